@@ -530,6 +530,9 @@ exaCloseScreen(int i, ScreenPtr pScreen)
     }
 #endif
 
+    if (pExaScr->info->offScreenAreas)
+	exaOffscreenReportStats (pScreen);
+    xfree (pExaScr->offScreenHeap);
     xfree (pExaScr);
 
     return (*pScreen->CloseScreen) (i, pScreen);
@@ -64,6 +64,14 @@ struct _ExaOffscreenArea {
     ExaOffscreenState   state;
 
     ExaOffscreenArea    *next;
+
+    /* private */
+    ExaOffscreenArea    *prev;
+    ExaOffscreenArea    *free_next;	/* free list links, if available */
+    ExaOffscreenArea    *free_prev;
+    int                 bin;		/* free list index */
+    int                 heap_index;	/* eviction index slot, if removable */
+    unsigned int        epoch;		/* decay period score was last read */
 };
 
 /**
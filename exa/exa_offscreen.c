@@ -24,8 +24,17 @@
  * This allocator allocates blocks of memory by maintaining a list of areas
  * and a score for each area.  As an area is marked used, its score is
  * incremented, and periodically all of the areas have their scores decayed by
- * a fraction.  When allocating, the contiguous block of areas with the minimum
- * score is found and evicted in order to make room for the new allocation.
+ * a fraction.  The decay is applied lazily: a screen-wide epoch counts the
+ * decay periods, and each area catches up on the periods it missed when its
+ * score is next read.
+ *
+ * Free areas are kept on segregated free lists, binned by the highest set
+ * bit of their size, so that a fitting area is usually found by looking at
+ * the head of a single list.  Removable areas are kept in a binary min-heap
+ * keyed by score.  When no free area fits, the run with the lowest total
+ * score is evicted, as before, but the search for it starts from the
+ * lowest scored areas and stops as soon as no other run can cost less,
+ * instead of scoring the runs from every area.
  */
 
 #include "exa_priv.h"
@@ -33,6 +42,8 @@
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #if DEBUG_OFFSCREEN
 #define DBG_OFFSCREEN(a) ErrorF a
@@ -40,12 +51,28 @@
 #define DBG_OFFSCREEN(a)
 #endif
 
+/**
+ * Returns the score of an area, after applying the decay periods that
+ * have passed since it was last read.
+ */
+static int
+ExaOffscreenScore (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
+{
+    unsigned int age = pExaScr->offScreenEpoch - area->epoch;
+
+    while (age-- && area->score > 0)
+	area->score = (area->score * 7) / 8;
+    area->epoch = pExaScr->offScreenEpoch;
+    return area->score;
+}
+
 #if DEBUG_OFFSCREEN
 static void
 ExaOffscreenValidate (ScreenPtr pScreen)
 {
     ExaScreenPriv (pScreen);
     ExaOffscreenArea *prev = 0, *area;
+    int i;
 
     assert (pExaScr->info->offScreenAreas->base_offset == 
 	    pExaScr->info->offScreenBase);
@@ -53,24 +80,297 @@ ExaOffscreenValidate (ScreenPtr pScreen)
     {
 	assert (area->offset >= area->base_offset &&
 		area->offset < (area->base_offset + area->size));
+	assert (area->prev == prev);
 	if (prev)
 	    assert (prev->base_offset + prev->size == area->base_offset);
+	if (area->state == ExaOffscreenRemovable)
+	    assert (pExaScr->offScreenHeap[area->heap_index] == area);
 	prev = area;
     }
     assert (prev->base_offset + prev->size == pExaScr->info->memorySize);
+    for (i = 1; i < pExaScr->offScreenHeapSize; i++)
+	assert (ExaOffscreenScore (pExaScr,
+				   pExaScr->offScreenHeap[(i - 1) >> 1]) <=
+		ExaOffscreenScore (pExaScr, pExaScr->offScreenHeap[i]));
 }
 #else
 #define ExaOffscreenValidate(s)
 #endif
 
+static int
+ExaOffscreenBin (int size)
+{
+    int bin = 0;
+
+    while ((size >>= 1) != 0)
+	bin++;
+    return bin;
+}
+
+static void
+ExaOffscreenFreeInsert (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
+{
+    int bin = ExaOffscreenBin (area->size);
+
+    area->bin = bin;
+    area->free_prev = NULL;
+    area->free_next = pExaScr->offScreenBins[bin];
+    if (area->free_next)
+	area->free_next->free_prev = area;
+    pExaScr->offScreenBins[bin] = area;
+    pExaScr->offScreenBinMask |= (1U << bin);
+}
+
+static void
+ExaOffscreenFreeRemove (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
+{
+    if (area->free_prev)
+	area->free_prev->free_next = area->free_next;
+    else
+	pExaScr->offScreenBins[area->bin] = area->free_next;
+    if (area->free_next)
+	area->free_next->free_prev = area->free_prev;
+    if (!pExaScr->offScreenBins[area->bin])
+	pExaScr->offScreenBinMask &= ~(1U << area->bin);
+    area->free_next = area->free_prev = NULL;
+}
+
+static void
+ExaOffscreenHeapSet (ExaScreenPrivPtr pExaScr, int i, ExaOffscreenArea *area)
+{
+    pExaScr->offScreenHeap[i] = area;
+    area->heap_index = i;
+}
+
+static void
+ExaOffscreenHeapUp (ExaScreenPrivPtr pExaScr, int i)
+{
+    ExaOffscreenArea **heap = pExaScr->offScreenHeap;
+    ExaOffscreenArea *area = heap[i];
+    int parent;
+
+    while (i > 0) {
+	parent = (i - 1) >> 1;
+	if (ExaOffscreenScore (pExaScr, heap[parent]) <=
+	    ExaOffscreenScore (pExaScr, area))
+	    break;
+	ExaOffscreenHeapSet (pExaScr, i, heap[parent]);
+	i = parent;
+    }
+    ExaOffscreenHeapSet (pExaScr, i, area);
+}
+
+static void
+ExaOffscreenHeapDown (ExaScreenPrivPtr pExaScr, int i)
+{
+    ExaOffscreenArea **heap = pExaScr->offScreenHeap;
+    ExaOffscreenArea *area = heap[i];
+    int n = pExaScr->offScreenHeapSize;
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+	if (child + 1 < n && ExaOffscreenScore (pExaScr, heap[child + 1]) <
+	    ExaOffscreenScore (pExaScr, heap[child]))
+	    child++;
+	if (ExaOffscreenScore (pExaScr, area) <=
+	    ExaOffscreenScore (pExaScr, heap[child]))
+	    break;
+	ExaOffscreenHeapSet (pExaScr, i, heap[child]);
+	i = child;
+    }
+    ExaOffscreenHeapSet (pExaScr, i, area);
+}
+
+static Bool
+ExaOffscreenHeapInsert (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
+{
+    if (pExaScr->offScreenHeapSize == pExaScr->offScreenHeapMax) {
+	int max = pExaScr->offScreenHeapMax ? pExaScr->offScreenHeapMax * 2 : 64;
+	ExaOffscreenArea **heap;
+
+	heap = xrealloc (pExaScr->offScreenHeap, max * sizeof (*heap));
+	if (!heap)
+	    return FALSE;
+	pExaScr->offScreenHeap = heap;
+	pExaScr->offScreenHeapMax = max;
+    }
+
+    pExaScr->offScreenHeap[pExaScr->offScreenHeapSize] = area;
+    ExaOffscreenHeapUp (pExaScr, pExaScr->offScreenHeapSize++);
+    return TRUE;
+}
+
+static void
+ExaOffscreenHeapRemove (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
+{
+    int i = area->heap_index;
+    ExaOffscreenArea *last;
+
+    area->heap_index = -1;
+    last = pExaScr->offScreenHeap[--pExaScr->offScreenHeapSize];
+    if (last == area)
+	return;
+
+    ExaOffscreenHeapSet (pExaScr, i, last);
+    ExaOffscreenHeapUp (pExaScr, i);
+    ExaOffscreenHeapDown (pExaScr, last->heap_index);
+}
+
+/* size needed for an allocation of size bytes starting in area */
+static int
+ExaOffscreenRealSize (ExaOffscreenArea *area, int size, int align)
+{
+    int tmp = area->base_offset % align;
+
+    return tmp ? size + (align - tmp) : size;
+}
+
 static ExaOffscreenArea *
 ExaOffscreenKickOut (ScreenPtr pScreen, ExaOffscreenArea *area)
 {
+    ExaScreenPriv (pScreen);
+
+    pExaScr->offScreenStats.evictions++;
+    pExaScr->offScreenStats.evictedBytes += area->size;
     if (area->save)
 	(*area->save) (pScreen, area);
     return exaOffscreenFree (pScreen, area);
 }
 
+/**
+ * Finds a free area that can hold size bytes at the given alignment.
+ */
+static ExaOffscreenArea *
+ExaOffscreenFindFree (ExaScreenPrivPtr pExaScr, int size, int align)
+{
+    ExaOffscreenArea *area;
+    CARD32 mask;
+    int bin = ExaOffscreenBin (size);
+
+    /* Areas in the first bin may be smaller than size. */
+    mask = pExaScr->offScreenBinMask & ~((1U << bin) - 1);
+    while (mask) {
+	bin = ffs (mask) - 1;
+	for (area = pExaScr->offScreenBins[bin]; area; area = area->free_next)
+	    if (ExaOffscreenRealSize (area, size, align) <= area->size)
+		return area;
+	mask &= ~(1U << bin);
+    }
+    return NULL;
+}
+
+/**
+ * Finds the run of available and removable areas with the lowest total
+ * score that can hold size bytes.  Removable areas are taken from the
+ * heap, lowest score first, and the runs through each are scored until
+ * no run through a later one can beat the best found.  Returns the first
+ * area of the run.
+ */
+static ExaOffscreenArea *
+ExaOffscreenFindRun (ScreenPtr pScreen, int size, int align)
+{
+    ExaScreenPriv (pScreen);
+    ExaOffscreenArea *best = NULL, *begin, *end, *cand, *popped = NULL;
+    int best_score = INT_MAX, score, avail, before;
+
+    while (pExaScr->offScreenHeapSize) {
+	cand = pExaScr->offScreenHeap[0];
+
+	/*
+	 * Candidates come in score order, and every run through one costs
+	 * at least its score, so no later one can do better.
+	 */
+	if (best_score <= ExaOffscreenScore (pExaScr, cand))
+	    break;
+
+	ExaOffscreenHeapRemove (pExaScr, cand);
+	cand->free_next = popped;
+	popped = cand;
+
+	/*
+	 * Try each run through cand, moving its start back from cand.
+	 * Score should only be non-zero for ExaOffscreenRemovable.
+	 */
+	begin = end = cand;
+	avail = cand->size;
+	score = ExaOffscreenScore (pExaScr, cand);
+	before = 0;
+	for (;;) {
+	    while (avail < ExaOffscreenRealSize (begin, size, align) &&
+		   end->next && end->next->state != ExaOffscreenLocked) {
+		end = end->next;
+		avail += end->size;
+		score += ExaOffscreenScore (pExaScr, end);
+	    }
+	    if (avail >= ExaOffscreenRealSize (begin, size, align) &&
+		score < best_score) {
+		best = begin;
+		best_score = score;
+	    }
+
+	    if (!begin->prev || begin->prev->state == ExaOffscreenLocked)
+		break;
+	    begin = begin->prev;
+	    avail += begin->size;
+	    score += ExaOffscreenScore (pExaScr, begin);
+	    before += begin->size;
+
+	    /* Runs starting here end before cand. */
+	    if (before >= ExaOffscreenRealSize (begin, size, align))
+		break;
+
+	    /* Drop the areas at the end that are no longer needed. */
+	    while (end != cand &&
+		   avail - end->size >= ExaOffscreenRealSize (begin, size,
+							      align)) {
+		avail -= end->size;
+		score -= ExaOffscreenScore (pExaScr, end);
+		end = end->prev;
+	    }
+	}
+    }
+
+    while (popped) {
+	cand = popped;
+	popped = cand->free_next;
+	cand->free_next = NULL;
+	/* Can't fail, these were in the heap a moment ago. */
+	(void) ExaOffscreenHeapInsert (pExaScr, cand);
+    }
+
+    return best;
+}
+
+/**
+ * Kicks out the run of removable areas found by ExaOffscreenFindRun, so
+ * that a free area can hold size bytes.
+ */
+static ExaOffscreenArea *
+ExaOffscreenEvict (ScreenPtr pScreen, int size, int align)
+{
+    ExaOffscreenArea *area;
+
+    area = ExaOffscreenFindRun (pScreen, size, align);
+    if (!area)
+	return NULL;
+
+    /*
+     * Kick out first area if in use
+     */
+    if (area->state != ExaOffscreenAvail)
+	area = ExaOffscreenKickOut (pScreen, area);
+    /*
+     * Now get the system to merge the other needed areas together
+     */
+    while (area->size < ExaOffscreenRealSize (area, size, align))
+    {
+	if (!area->next || area->next->state != ExaOffscreenRemovable)
+	    return NULL;
+	(void) ExaOffscreenKickOut (pScreen, area->next);
+    }
+    return area;
+}
+
 /**
  * exaOffscreenAlloc allocates offscreen memory
  *
@@ -96,9 +396,9 @@ exaOffscreenAlloc (ScreenPtr pScreen, int size, int align,
                    ExaOffscreenSaveProc save,
                    pointer privData)
 {
-    ExaOffscreenArea *area, *begin, *best;
+    ExaOffscreenArea *area;
     ExaScreenPriv (pScreen);
-    int tmp, real_size = 0, best_score;
+    int real_size;
 #if DEBUG_OFFSCREEN
     static int number = 0;
     ErrorF("================= ============ allocating a new pixmap %d\n", ++number);
@@ -120,105 +420,28 @@ exaOffscreenAlloc (ScreenPtr pScreen, int size, int align,
 	DBG_OFFSCREEN (("Alloc 0x%x vs (0x%lx) -> TOBIG\n", size,
 			pExaScr->info->memorySize -
 			pExaScr->info->offScreenBase));
+	pExaScr->offScreenStats.allocFailures++;
 	return NULL;
     }
 
     /* Try to find a free space that'll fit. */
-    for (area = pExaScr->info->offScreenAreas; area; area = area->next)
-    {
-	/* skip allocated areas */
-	if (area->state != ExaOffscreenAvail)
-	    continue;
-
-	/* adjust size to match alignment requirement */
-	real_size = size;
-	tmp = area->base_offset % align;
-	if (tmp)
-	    real_size += (align - tmp);
+    area = ExaOffscreenFindFree (pExaScr, size, align);
 
-	/* does it fit? */
-	if (real_size <= area->size)
-	    break;
-    }
+    /* Kick out existing users to make space. */
+    if (!area)
+	area = ExaOffscreenEvict (pScreen, size, align);
 
     if (!area)
     {
-	/*
-	 * Kick out existing users to make space.
-	 *
-	 * First, locate a region which can hold the desired object.
-	 */
-
-	/* prev points at the first object to boot */
-	best = NULL;
-	best_score = INT_MAX;
-	for (begin = pExaScr->info->offScreenAreas; begin != NULL;
-	     begin = begin->next)
-	{
-	    int avail, score;
-	    ExaOffscreenArea *scan;
-
-	    if (begin->state == ExaOffscreenLocked)
-		continue;
-
-	    /* adjust size needed to account for alignment loss for this area */
-	    real_size = size;
-	    tmp = begin->base_offset % align;
-	    if (tmp)
-		real_size += (align - tmp);
-
-	    avail = 0;
-	    score = 0;
-	    /* now see if we can make room here, and how "costly" it'll be. */
-	    for (scan = begin; scan != NULL; scan = scan->next)
-	    {
-		if (scan->state == ExaOffscreenLocked) {
-		    /* Can't make room here, start after this locked area. */
-		    begin = scan;
-		    break;
-		}
-		/* Score should only be non-zero for ExaOffscreenRemovable */
-		score += scan->score;
-		avail += scan->size;
-		if (avail >= real_size)
-		    break;
-	    }
-	    /* Is it the best option we've found so far? */
-	    if (avail >= real_size && score < best_score) {
-		best = begin;
-		best_score = score;
-	    }
-	}
-	area = best;
-	if (!area)
-	{
-	    DBG_OFFSCREEN (("Alloc 0x%x -> NOSPACE\n", size));
-	    /* Could not allocate memory */
-	    ExaOffscreenValidate (pScreen);
-	    return NULL;
-	}
-
-	/* adjust size needed to account for alignment loss for this area */
-	real_size = size;
-	tmp = area->base_offset % align;
-	if (tmp)
-	    real_size += (align - tmp);
-
-	/*
-	 * Kick out first area if in use
-	 */
-	if (area->state != ExaOffscreenAvail)
-	    area = ExaOffscreenKickOut (pScreen, area);
-	/*
-	 * Now get the system to merge the other needed areas together
-	 */
-	while (area->size < real_size)
-	{
-	    assert (area->next && area->next->state == ExaOffscreenRemovable);
-	    (void) ExaOffscreenKickOut (pScreen, area->next);
-	}
+	DBG_OFFSCREEN (("Alloc 0x%x -> NOSPACE\n", size));
+	/* Could not allocate memory */
+	pExaScr->offScreenStats.allocFailures++;
+	ExaOffscreenValidate (pScreen);
+	return NULL;
     }
 
+    real_size = ExaOffscreenRealSize (area, size, align);
+
     /* save extra space in new area */
     if (real_size < area->size)
     {
@@ -231,23 +454,37 @@ exaOffscreenAlloc (ScreenPtr pScreen, int size, int align,
 	new_area->state = ExaOffscreenAvail;
 	new_area->save = NULL;
 	new_area->score = 0;
+	new_area->epoch = pExaScr->offScreenEpoch;
+	new_area->heap_index = -1;
 	new_area->next = area->next;
+	new_area->prev = area;
+	if (area->next)
+	    area->next->prev = new_area;
 	area->next = new_area;
 	area->size = real_size;
+	ExaOffscreenFreeInsert (pExaScr, new_area);
     }
+    ExaOffscreenFreeRemove (pExaScr, area);
     /*
      * Mark this area as in use
      */
-    if (locked)
-	area->state = ExaOffscreenLocked;
-    else
-	area->state = ExaOffscreenRemovable;
     area->privData = privData;
     area->save = save;
     area->score = 0;
+    area->epoch = pExaScr->offScreenEpoch;
     area->offset = (area->base_offset + align - 1);
     area->offset -= area->offset % align;
+    area->state = ExaOffscreenLocked;
+    if (!locked) {
+	/* an area missing from the heap could never be evicted */
+	if (!ExaOffscreenHeapInsert (pExaScr, area)) {
+	    exaOffscreenFree (pScreen, area);
+	    return NULL;
+	}
+	area->state = ExaOffscreenRemovable;
+    }
 
+    pExaScr->offScreenStats.allocs++;
     ExaOffscreenValidate (pScreen);
 
     DBG_OFFSCREEN (("Alloc 0x%x -> 0x%x (0x%x)\n", size,
@@ -290,26 +527,19 @@ static void
 ExaOffscreenEjectPixmaps (ScreenPtr pScreen)
 {
     ExaScreenPriv (pScreen);
+    ExaOffscreenArea *area;
 
     ExaOffscreenValidate (pScreen);
-    /* loop until a single free area spans the space */
-    for (;;)
+    for (area = pExaScr->info->offScreenAreas; area != NULL;
+	 area = area->next)
     {
-	ExaOffscreenArea *area;
-
-	for (area = pExaScr->info->offScreenAreas; area != NULL;
-	     area = area->next)
+	/* The freed area is merged with its neighbours and stays valid. */
+	if (area->state == ExaOffscreenRemovable &&
+	    area->save == exaPixmapSave)
 	{
-	    if (area->state == ExaOffscreenRemovable &&
-		area->save == exaPixmapSave)
-	    {
-		(void) ExaOffscreenKickOut (pScreen, area);
-		ExaOffscreenValidate (pScreen);
-		break;
-	    }
+	    area = ExaOffscreenKickOut (pScreen, area);
+	    ExaOffscreenValidate (pScreen);
 	}
-	if (area == NULL)
-	    break;
     }
     ExaOffscreenValidate (pScreen);
 }
@@ -358,14 +588,17 @@ exaEnableDisableFBAccess (int index, Bool enable)
 
 /* merge the next free area into this one */
 static void
-ExaOffscreenMerge (ExaOffscreenArea *area)
+ExaOffscreenMerge (ExaScreenPrivPtr pExaScr, ExaOffscreenArea *area)
 {
     ExaOffscreenArea	*next = area->next;
 
+    ExaOffscreenFreeRemove (pExaScr, next);
     /* account for space */
     area->size += next->size;
     /* frob pointer */
     area->next = next->next;
+    if (area->next)
+	area->next->prev = area;
     xfree (next);
 }
 
@@ -387,34 +620,30 @@ exaOffscreenFree (ScreenPtr pScreen, ExaOffscreenArea *area)
 {
     ExaScreenPriv(pScreen);
     ExaOffscreenArea	*next = area->next;
-    ExaOffscreenArea	*prev;
+    ExaOffscreenArea	*prev = area->prev;
 
     DBG_OFFSCREEN (("Free 0x%x -> 0x%x (0x%x)\n", area->size,
 		    area->base_offset, area->offset));
     ExaOffscreenValidate (pScreen);
 
+    if (area->state == ExaOffscreenRemovable)
+	ExaOffscreenHeapRemove (pExaScr, area);
     area->state = ExaOffscreenAvail;
     area->save = NULL;
     area->score = 0;
-    /*
-     * Find previous area
-     */
-    if (area == pExaScr->info->offScreenAreas)
-	prev = NULL;
-    else
-	for (prev = pExaScr->info->offScreenAreas; prev; prev = prev->next)
-	    if (prev->next == area)
-		break;
 
     /* link with next area if free */
     if (next && next->state == ExaOffscreenAvail)
-	ExaOffscreenMerge (area);
+	ExaOffscreenMerge (pExaScr, area);
+    ExaOffscreenFreeInsert (pExaScr, area);
 
     /* link with prev area if free */
     if (prev && prev->state == ExaOffscreenAvail)
     {
+	ExaOffscreenFreeRemove (pExaScr, prev);
 	area = prev;
-	ExaOffscreenMerge (area);
+	ExaOffscreenMerge (pExaScr, area);
+	ExaOffscreenFreeInsert (pExaScr, area);
     }
 
     ExaOffscreenValidate (pScreen);
@@ -427,23 +656,60 @@ ExaOffscreenMarkUsed (PixmapPtr pPixmap)
 {
     ExaPixmapPriv (pPixmap);
     ExaScreenPriv (pPixmap->drawable.pScreen);
-    static int iter = 0;
+    ExaOffscreenArea *area;
 
     if (!pExaPixmap || !pExaPixmap->area)
 	return;
 
+    area = pExaPixmap->area;
+
     /* The numbers here are arbitrary.  We may want to tune these. */
-    pExaPixmap->area->score += 100;
-    if (++iter == 10) {
-	ExaOffscreenArea *area;
-	for (area = pExaScr->info->offScreenAreas; area != NULL;
-	     area = area->next)
-	{
-	    if (area->state == ExaOffscreenRemovable)
-		area->score = (area->score * 7) / 8;
+    area->score = ExaOffscreenScore (pExaScr, area) + 100;
+    if (area->state == ExaOffscreenRemovable)
+	ExaOffscreenHeapDown (pExaScr, area->heap_index);
+    if (++pExaScr->offScreenMarks == 10) {
+	/*
+	 * Start a new decay period.  Decaying all scores by the same
+	 * factor keeps the heap order.
+	 */
+	pExaScr->offScreenEpoch++;
+	pExaScr->offScreenMarks = 0;
+    }
+}
+
+/**
+ * Logs fragmentation and eviction statistics of the offscreen memory manager.
+ */
+void
+exaOffscreenReportStats (ScreenPtr pScreen)
+{
+    ExaScreenPriv (pScreen);
+    ExaOffscreenArea *area;
+    unsigned long total = 0, largest = 0;
+    int numFree = 0, numUsed = 0;
+
+    for (area = pExaScr->info->offScreenAreas; area; area = area->next)
+    {
+	if (area->state != ExaOffscreenAvail) {
+	    numUsed++;
+	    continue;
 	}
-	iter = 0;
+	numFree++;
+	total += area->size;
+	if (area->size > largest)
+	    largest = area->size;
     }
+
+    LogMessageVerb(X_INFO, 3, "EXA(%d): Offscreen: %d areas in use, "
+		   "%d free areas of %lu bytes, largest %lu bytes "
+		   "(%lu%% fragmented)\n", pScreen->myNum, numUsed, numFree,
+		   total, largest, total ? 100 - (largest * 100) / total : 0);
+    LogMessageVerb(X_INFO, 3, "EXA(%d): Offscreen: %lu allocations, "
+		   "%lu failed, %lu evictions of %lu bytes\n", pScreen->myNum,
+		   pExaScr->offScreenStats.allocs,
+		   pExaScr->offScreenStats.allocFailures,
+		   pExaScr->offScreenStats.evictions,
+		   pExaScr->offScreenStats.evictedBytes);
 }
 
 /**
@@ -472,10 +738,17 @@ exaOffscreenInit (ScreenPtr pScreen)
     area->size = pExaScr->info->memorySize - area->base_offset;
     area->save = NULL;
     area->next = NULL;
+    area->prev = NULL;
     area->score = 0;
+    area->epoch = pExaScr->offScreenEpoch;
+    area->heap_index = -1;
 
     /* Add it to the free areas */
     pExaScr->info->offScreenAreas = area;
+    memset (pExaScr->offScreenBins, 0, sizeof (pExaScr->offScreenBins));
+    pExaScr->offScreenBinMask = 0;
+    pExaScr->offScreenHeapSize = 0;
+    ExaOffscreenFreeInsert (pExaScr, area);
 
     ExaOffscreenValidate (pScreen);
 
@@ -494,4 +767,7 @@ ExaOffscreenFini (ScreenPtr pScreen)
 	pExaScr->info->offScreenAreas = area->next;
 	xfree (area);
     }
+    memset (pExaScr->offScreenBins, 0, sizeof (pExaScr->offScreenBins));
+    pExaScr->offScreenBinMask = 0;
+    pExaScr->offScreenHeapSize = 0;
 }
@@ -92,6 +92,19 @@ enum ExaMigrationHeuristic {
 };
 
 typedef void (*EnableDisableFBAccessProcPtr)(int, Bool);
+/**
+ * Free areas are binned by the position of the highest set bit of their
+ * size.
+ */
+#define EXA_OFFSCREEN_BINS 32
+
+typedef struct {
+    unsigned long allocs;
+    unsigned long allocFailures;
+    unsigned long evictions;
+    unsigned long evictedBytes;
+} ExaOffscreenStatsRec;
+
 typedef struct {
     ExaDriverPtr info;
     CreateGCProcPtr 		 SavedCreateGC;
@@ -115,6 +128,16 @@ typedef struct {
     Bool			 hideOffscreenPixmapData;
     Bool			 checkDirtyCorrectness;
     unsigned			 disableFbCount;
+
+    /* Offscreen allocator: segregated free lists and eviction index */
+    ExaOffscreenArea		*offScreenBins[EXA_OFFSCREEN_BINS];
+    CARD32			 offScreenBinMask;
+    ExaOffscreenArea		**offScreenHeap;
+    int				 offScreenHeapSize;
+    int				 offScreenHeapMax;
+    unsigned int		 offScreenEpoch;
+    int				 offScreenMarks;
+    ExaOffscreenStatsRec	 offScreenStats;
 } ExaScreenPrivRec, *ExaScreenPrivPtr;
 
 /*
@@ -335,6 +358,9 @@ exaOffscreenInit(ScreenPtr pScreen);
 void
 ExaOffscreenFini (ScreenPtr pScreen);
 
+void
+exaOffscreenReportStats (ScreenPtr pScreen);
+
 /* exa.c */
 void
 exaPrepareAccess(DrawablePtr pDrawable, int index);
@@ -45,20 +45,26 @@
 #include "psb_accel.h"
 #include "psb_driver.h"
 
-#define PSB_EXA_MIN_COMPOSITE 512      /* Needs tuning */
-#define PSB_EXA_MIN_COPY 256	       /* Needs tuning */
-#define PSB_EXA_MIN_DOWNLOAD 256       /* Needs tuning */
+#define PSB_EXA_STAT_INTERVAL 10000    /* msecs */
 #define PSB_FMT_HASH_SIZE 256
 #define PSB_NUM_COMP_FORMATS 9
 
 #undef PSB_FIX_BUG_W8
 #define PSB_FIX_BUG_OVERLAP
 
+/*
+ * Largest pattern the 2D engine fills with. Pattern sides must
+ * also be powers of two.
+ */
+
+#define PSB_PAT_MAX 16
+
 #define PSB_FMT_HASH(arg) (((((arg) >> 1) + (arg)) >> 8) & 0xFF)
 
 typedef struct _PsbFormat
 {
     unsigned pictFormat;
+    int index;
     Bool dstSupported;
     Bool patSupported;
     Bool srcSupported;
@@ -69,6 +75,8 @@ typedef struct _PsbFormat
 
 static PsbFormatRec psbCompFormats[PSB_FMT_HASH_SIZE];
 
+static void psbAccelPatternFlush(Psb2DBufferPtr cb, PsbTwodContextPtr tdc);
+
 static const unsigned psbFormats[PSB_NUM_COMP_FORMATS][7] = {
     {PICT_a8, 0x00, PSB_2D_PAT_8_ALPHA, PSB_2D_SRC_8_ALPHA, 0, 0, 1},
     {PICT_a4, 0x00, PSB_2D_PAT_4_ALPHA, PSB_2D_SRC_4_ALPHA, 0, 0, 1},
@@ -88,6 +96,27 @@ static const unsigned psbFormats[PSB_NUM_COMP_FORMATS][7] = {
      PSB_2D_SRC_8888ARGB, 1, 1, 1}
 };
 
+/*
+ * Source to destination format conversions done by plain blits,
+ * indexed as psbFormats. Alpha-only sources have no color to convert,
+ * and the blitter doesn't set alpha bits when the source has none, so
+ * those pairs are left out.
+ */
+
+static const unsigned char psbBlitConvert[PSB_NUM_COMP_FORMATS]
+    [PSB_NUM_COMP_FORMATS] = {
+    /* a8 a4 332 4444 x555 1555 565 x888 8888 */
+    {0, 0, 0, 0, 0, 0, 0, 0, 0},       /* a8 */
+    {0, 0, 0, 0, 0, 0, 0, 0, 0},       /* a4 */
+    {0, 0, 1, 0, 1, 0, 1, 1, 0},       /* r3g3b2 */
+    {0, 0, 1, 1, 1, 1, 1, 1, 1},       /* a4r4g4b4 */
+    {0, 0, 1, 0, 1, 0, 1, 1, 0},       /* x1r5g5b5 */
+    {0, 0, 1, 1, 1, 1, 1, 1, 1},       /* a1r5g5b5 */
+    {0, 0, 1, 0, 1, 0, 1, 1, 0},       /* r5g6b5 */
+    {0, 0, 1, 0, 1, 0, 1, 1, 0},       /* x8r8g8b8 */
+    {0, 0, 1, 1, 1, 1, 1, 1, 1}        /* a8r8g8b8 */
+};
+
 static const int psbCopyROP[] =
     { 0x00, 0x88, 0x44, 0xCC, 0x22, 0xAA, 0x66, 0xEE, 0x11,
     0x99, 0x55, 0xDD, 0x33, 0xBB, 0x77, 0xFF
@@ -226,18 +255,23 @@ psbAccelSetMode(PsbTwodContextPtr tdc, int sdepth, int ddepth, Pixel pix)
     switch (sdepth) {
     case 8:
 	tdc->sMode = PSB_2D_SRC_332RGB;
+	tdc->pMode = PSB_2D_PAT_332RGB;
 	break;
     case 15:
 	tdc->sMode = PSB_2D_SRC_555RGB;
+	tdc->pMode = PSB_2D_PAT_555RGB;
 	break;
     case 16:
 	tdc->sMode = PSB_2D_SRC_565RGB;
+	tdc->pMode = PSB_2D_PAT_565RGB;
 	break;
     case 24:
 	tdc->sMode = PSB_2D_SRC_0888ARGB;
+	tdc->pMode = PSB_2D_PAT_0888ARGB;
 	break;
     default:
 	tdc->sMode = PSB_2D_SRC_8888ARGB;
+	tdc->pMode = PSB_2D_PAT_8888ARGB;
 	break;
     }
     switch (ddepth) {
@@ -308,44 +342,33 @@ psbAccelCompositeBugDelta1(unsigned rotation, int *xDelta, int *yDelta)
 }
 #endif
 
-static void*
-psbExaCreatePixmap(ScreenPtr pScreen, int w, int h, int depth, int usage_hint, int bpp, int* new_pitch  )
-{
-	return NULL;
-}
-static void
-psbExaDestroyPixmap(ScreenPtr pScreen, void* driverPriv ){
-}
-static Bool
-psbExaPixmapIsOffscreen(PixmapPtr p)
-{
-    ScreenPtr pScreen = p->drawable.pScreen;
-    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-    PsbPtr pPsb = psbPTR(pScrn);
-
-    return ((unsigned long)p->devPrivate.ptr 
-		- (unsigned long)mmBufVirtual(pPsb->pPsbExa->exaBuf.buf)) 
-			< mmBufSize(pPsb->pPsbExa->exaBuf.buf);
-}
-
 void
 psbExaClose(PsbExaPtr pPsbExa, ScreenPtr pScreen)
 {
+    int i;
+
     PSB_DEBUG(pScreen->myNum, 3, "psbExaClose\n");
 
     if (!pPsbExa)
 	return;
 
+    if (pPsbExa->blockHandler) {
+	pScreen->BlockHandler = pPsbExa->blockHandler;
+	pPsbExa->blockHandler = NULL;
+    }
+    psbUploadClose(pPsbExa);
     if (pPsbExa->exaUp) {
 	exaDriverFini(pScreen);
 	pPsbExa->exaUp = FALSE;
     }
+    psbPixmapClose(xf86Screens[pScreen->myNum], pPsbExa);
     if (pPsbExa->pExa) {
 	xfree(pPsbExa->pExa);
 	pPsbExa->pExa = NULL;
     }
     psbClearBufItem(&pPsbExa->exaBuf);
-    psbClearBufItem(&pPsbExa->scratchBuf);
+    for (i = 0; i < PSB_EXA_NUM_SCRATCH; ++i)
+	psbClearBufItem(&pPsbExa->scratchBuf[i]);
     psbClearBufItem(&pPsbExa->tmpBuf);
 
     xfree(pPsbExa);
@@ -356,17 +379,27 @@ psbExaAllocBuffers(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
 {
     PsbPtr pPsb = psbPTR(pScrn);
     PsbDevicePtr pDevice = psbDevicePTR(pPsb);
+    unsigned long scratchSize = pPsb->exaScratchSize / PSB_EXA_NUM_SCRATCH;
+    unsigned long exaSize = PSB_EXA_BASE_SIZE;
+    struct _MMBuffer *buf;
+    int i;
 
 #ifdef XF86DRI
     PsbDRIPtr pPsbDRI;
 #endif
 
     mmInitListHead(&pPsbExa->exaBuf.head);
-    mmInitListHead(&pPsbExa->scratchBuf.head);
+    for (i = 0; i < PSB_EXA_NUM_SCRATCH; ++i)
+	mmInitListHead(&pPsbExa->scratchBuf[i].head);
     mmInitListHead(&pPsbExa->tmpBuf.head);
 
+#ifdef XF86DRI
+    if (pPsb->pDRIInfo)
+	exaSize += PSB_EXA_DRI_SIZE;
+#endif
+
     psbAddBufItem(&pPsb->buffers, &pPsbExa->exaBuf,
-		  pDevice->man->createBuf(pDevice->man, pPsb->exaSize, 0,
+		  pDevice->man->createBuf(pDevice->man, exaSize, 0,
 					  MM_FLAG_READ |
 					  MM_FLAG_WRITE |
 					  MM_FLAG_MEM_TT |
@@ -385,15 +418,36 @@ psbExaAllocBuffers(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
     }
 #endif
 
-    psbAddBufItem(&pPsb->buffers, &pPsbExa->scratchBuf,
-		  pDevice->man->createBuf(pDevice->man, pPsb->exaScratchSize,
-					  0,
+    /*
+     * The scratch buffers are read back by the CPU, so try to make
+     * them cached.
+     */
+
+    pPsbExa->scratchCached = TRUE;
+    for (i = 0; i < PSB_EXA_NUM_SCRATCH; ++i) {
+	buf = NULL;
+	if (pPsbExa->scratchCached)
+	    buf = pDevice->man->createBuf(pDevice->man, scratchSize, 0,
+					  MM_FLAG_READ | MM_FLAG_WRITE |
+					  MM_FLAG_MEM_TT | MM_FLAG_CACHED,
+					  MM_HINT_DONT_FENCE);
+	if (!buf) {
+	    pPsbExa->scratchCached = FALSE;
+	    buf = pDevice->man->createBuf(pDevice->man, scratchSize, 0,
 					  MM_FLAG_READ | MM_FLAG_WRITE |
 					  MM_FLAG_MEM_TT,
-					  MM_HINT_DONT_FENCE));
+					  MM_HINT_DONT_FENCE);
+	}
+	psbAddBufItem(&pPsb->buffers, &pPsbExa->scratchBuf[i], buf);
 
-    if (!pPsbExa->scratchBuf.buf)
-	return FALSE;
+	if (!pPsbExa->scratchBuf[i].buf)
+	    return FALSE;
+    }
+
+    if (!pPsbExa->scratchCached)
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "[EXA] No cached scratch memory. "
+		   "Not accelerating downloads.\n");
 
     pPsbExa->tmpBuf.buf = NULL;
 
@@ -504,30 +558,47 @@ psbCompFormat(unsigned format)
     return &psbCompFormats[PSB_FMT_HASH(format)];
 }
 
+static Bool
+psbBlitConvertible(unsigned srcFormat, unsigned dstFormat)
+{
+    PsbFormatPointer src = psbCompFormat(srcFormat);
+    PsbFormatPointer dst = psbCompFormat(dstFormat);
+
+    if (src->pictFormat != srcFormat || dst->pictFormat != dstFormat)
+	return FALSE;
+
+    return psbBlitConvert[src->index][dst->index];
+}
+
 static Bool
 psbExaCheckComposite(int op,
 		     PicturePtr pSrcPicture, PicturePtr pMaskPicture,
 		     PicturePtr pDstPicture)
 {
-    int w, h;
+    unsigned long area;
     DrawablePtr pDraw = pSrcPicture->pDrawable;
+    PsbExaPtr pPsbExa;
 
     if (!pDraw)
         return FALSE;
 
-    w = pDraw->width;
-    h = pDraw->height;
+    pPsbExa = psbPTR(xf86Screens[pDraw->pScreen->myNum])->pPsbExa;
+    area = pDraw->width * pDraw->height;
 
     if (op > PictOpAdd)
 	return FALSE;
 
-    if (!pSrcPicture->repeat && w * h < PSB_EXA_MIN_COMPOSITE)
+    if (!pSrcPicture->repeat &&
+	!psbCalibrateUseBlitter(pPsbExa, PSB_CAL_COMPOSITE,
+				pDraw->bitsPerPixel, area))
 	return FALSE;
 
     if (pMaskPicture == NULL)
 	return TRUE;
 
-    if (!pMaskPicture->repeat && w * h < PSB_EXA_MIN_COMPOSITE)
+    if (!pMaskPicture->repeat &&
+	!psbCalibrateUseBlitter(pPsbExa, PSB_CAL_COMPOSITE,
+				pDraw->bitsPerPixel, area))
 	return FALSE;
 
     if (pMaskPicture->componentAlpha)
@@ -647,6 +718,7 @@ psbInitComposite(void)
 	    FatalError("Bad composite format hash function.\n");
 
 	format->pictFormat = tmp;
+	format->index = i;
 	format->dstSupported = (psbFormats[i][4] != 0);
 	format->patSupported = (psbFormats[i][5] != 0);
 	format->srcSupported = (psbFormats[i][6] != 0);
@@ -662,71 +734,101 @@ psbExaPrepareAccess(PixmapPtr pPix, int index)
     ScreenPtr pScreen = pPix->drawable.pScreen;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     PsbPtr pPsb = psbPTR(pScrn);
-    void *ptr;
-    PsbBufListPtr b;
+    struct _MMBuffer *buf;
+    unsigned long offset;
     unsigned flags;
 
-    ptr = (void *)(exaGetPixmapOffset(pPix) +
-		   (unsigned long)mmBufVirtual(pPsb->pPsbExa->exaBuf.buf));
-    b = psbInBuffer(&pPsb->buffers, ptr);
-    if (b) {
-	flags = (index == EXA_PREPARE_DEST) ?
-	    DRM_BO_FLAG_WRITE : DRM_BO_FLAG_READ;
+    if (!psbExaGetSuperOffset(pPix, &offset, &buf))
+	return TRUE;
 
-	/*
-	 * We already have a virtual address of the pixmap.
-	 * Use mapBuf as a syncing operation only.
-	 * This makes sure the hardware has finished rendering to this
-	 * buffer.
-	 */
+    if (!psbPixmapCPUAccess(pPix, index))
+	return FALSE;
 
-	if (b->buf->man->mapBuf(b->buf, flags, 0))
-	    return FALSE;
-    }
+    flags = (index == EXA_PREPARE_DEST) ?
+	DRM_BO_FLAG_WRITE : DRM_BO_FLAG_READ;
+#ifdef EXA_SUPPORTS_PREPARE_AUX
+    if (index == EXA_PREPARE_AUX_DEST)
+	flags = DRM_BO_FLAG_WRITE;
+#endif
+
+    /*
+     * Commands touching this buffer may still be pending.
+     */
+
+    if (psb2DBufferReferences(&pPsb->superC, mmKernelBuf(buf)))
+	psbAccelFlush(pScrn);
+
+    /*
+     * We already have a virtual address of the pixmap.
+     * Use mapBuf as a syncing operation only.
+     * This makes sure the hardware has finished rendering to this
+     * buffer.
+     */
+
+    if (buf->man->mapBuf(buf, flags, 0))
+	return FALSE;
+
+    psbPixmapPriv(pPix)->mapped |= (1 << index);
+    pPix->devPrivate.ptr = (CARD8 *) mmBufVirtual(buf) + offset;
     return TRUE;
 }
 
 void
 psbExaFinishAccess(PixmapPtr pPix, int index)
 {
-    ScreenPtr pScreen = pPix->drawable.pScreen;
-    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-    PsbPtr pPsb = psbPTR(pScrn);
-    PsbBufListPtr b;
-    void *ptr;
+    struct _MMBuffer *buf;
+    unsigned long offset;
+
+    if (!psbExaGetSuperOffset(pPix, &offset, &buf))
+	return;
 
-    ptr = (void *)(exaGetPixmapOffset(pPix) +
-		   (unsigned long)mmBufVirtual(pPsb->pPsbExa->exaBuf.buf));
-    b = psbInBuffer(&pPsb->buffers, ptr);
-    if (b)
-	(void)b->buf->man->unMapBuf(b->buf);
+    /*
+     * Accesses we refused have nothing to unmap.
+     */
+
+    if (psbPixmapPriv(pPix)->mapped & (1 << index)) {
+	psbPixmapPriv(pPix)->mapped &= ~(1 << index);
+	(void)buf->man->unMapBuf(buf);
+    }
 }
 
+/*
+ * Look up the buffer and offset of a pixmap's storage.
+ */
+
 Bool
 psbExaGetSuperOffset(PixmapPtr p, unsigned long *offset,
 		     struct _MMBuffer **buffer)
 {
-    ScreenPtr pScreen = p->drawable.pScreen;
-    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
-    PsbPtr pPsb = psbPTR(pScrn);
-    PsbBufListPtr b;
-    void *ptr;
-
-    ptr = (void *)(exaGetPixmapOffset(p) +
-		   (unsigned long)mmBufVirtual(pPsb->pPsbExa->exaBuf.buf));
+    PsbPixmapPtr priv = psbPixmapPriv(p);
 
-    b = psbInBuffer(&pPsb->buffers, ptr);
-
-    if (!b) {
+    if (!priv || !priv->buf)
 	return FALSE;
-    }
 
-    *offset = (unsigned long)ptr - (unsigned long)mmBufVirtual(b->buf);
-    *buffer = b->buf;
+    *offset = priv->offset;
+    *buffer = priv->buf;
 
     return TRUE;
 }
 
+/*
+ * Submit 2D commands that have been deferred across EXA operations.
+ */
+
+void
+psbAccelFlush(ScrnInfoPtr pScrn)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    Psb2DBufferPtr cb = &pPsb->superC;
+
+    if (!pPsb->has2DBuffer || !PSB_2D_PENDING(cb))
+	return;
+
+    psbDRILock(pScrn, 0);
+    psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
+    psbDRIUnlock(pScrn);
+}
+
 static void
 psbExaDoneSuper(PixmapPtr pPixmap)
 {
@@ -734,10 +836,25 @@ psbExaDoneSuper(PixmapPtr pPixmap)
     PsbPtr pPsb = psbPTR(pScrn);
     Psb2DBufferPtr cb = &pPsb->superC;
 
-    psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
+    if (!pPsb->exaLazyFlush)
+	psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
     psbDRIUnlock(pScrn);
 }
 
+static void
+psbExaDoneSuperCopy(PixmapPtr pPixmap)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPixmap->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+
+    if (tdc->patCopy) {
+	psbAccelPatternFlush(&pPsb->superC, tdc);
+	tdc->patCopy = FALSE;
+    }
+    psbExaDoneSuper(pPixmap);
+}
+
 static void
 psbExaDoneComposite(PixmapPtr pPixmap)
 {
@@ -748,51 +865,376 @@ psbExaDoneComposite(PixmapPtr pPixmap)
 
     if (!tdc->comp2D)
 	psbExaDoneComposite3D(pPixmap);
-    else
+    else if (!pPsb->exaLazyFlush)
 	psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
 
     psbDRIUnlock(pScrn);
 }
 
+static void
+psbExaReportStats(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, Psb2DBufferPtr cb,
+		  PsbTwodContextPtr tdc)
+{
+    CARD32 now = GetTimeInMillis();
+    CARD32 elapsed = now - pPsbExa->statTime;
+    unsigned long batches;
+
+    if (elapsed < PSB_EXA_STAT_INTERVAL)
+	return;
+
+    batches = cb->numSubmits - pPsbExa->statSubmits;
+    if (batches)
+	PSB_DEBUG(pScrn->scrnIndex, 4,
+		  "[EXA] %lu 2D batches/s, %llu dwords per batch, "
+		  "%llu dwords saved per batch.\n",
+		  batches * 1000 / elapsed,
+		  (cb->numDwords - pPsbExa->statDwords) / batches,
+		  (tdc->dwordsSaved - pPsbExa->statSaved) / batches);
+
+    pPsbExa->statTime = now;
+    pPsbExa->statSubmits = cb->numSubmits;
+    pPsbExa->statDwords = cb->numDwords;
+    pPsbExa->statSaved = tdc->dwordsSaved;
+}
+
+/*
+ * Flush deferred 2D commands before the server goes to sleep,
+ * so that they reach the hardware before clients see any replies.
+ */
+
+static void
+psbExaBlockHandler(int i, pointer blockData, pointer pTimeout,
+		   pointer pReadmask)
+{
+    ScreenPtr pScreen = screenInfo.screens[i];
+    ScrnInfoPtr pScrn = xf86Screens[i];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbExaPtr pPsbExa = pPsb->pPsbExa;
+
+    pScreen->BlockHandler = pPsbExa->blockHandler;
+    (*pScreen->BlockHandler) (i, blockData, pTimeout, pReadmask);
+    pScreen->BlockHandler = psbExaBlockHandler;
+
+    psbAccelFlush(pScrn);
+    psbUploadExpire(pPsbExa);
+    psbPixmapExpire(pScrn, pPsbExa);
+    psbExaReportStats(pScrn, pPsbExa, &pPsb->superC, &pPsb->td);
+
+    /*
+     * Calibrate once the hardware is fully up and we own the VT.
+     */
+
+    if (pPsbExa->calPending && pScrn->vtSema) {
+	pPsbExa->calPending = FALSE;
+	if (psbCalibrateRun(pScrn, pPsbExa) && !pPsb->secondary)
+	    psbCalibrateSave(pScrn, pPsbExa, pPsb->exaCalibrationFile);
+    }
+}
+
+static Bool
+psbAccelSurfMatch(PsbTwodSurfStatePtr shadow, struct _MMBuffer *buffer,
+		  CARD32 offset, CARD32 stride, CARD32 mode)
+{
+    return (shadow->valid && shadow->buffer == buffer &&
+	    shadow->offset == offset && shadow->stride == stride &&
+	    shadow->mode == mode);
+}
+
+static void
+psbAccelSurfSet(PsbTwodSurfStatePtr shadow, struct _MMBuffer *buffer,
+		CARD32 offset, CARD32 stride, CARD32 mode)
+{
+    shadow->valid = TRUE;
+    shadow->buffer = buffer;
+    shadow->offset = offset;
+    shadow->stride = stride;
+    shadow->mode = mode;
+}
+
+/*
+ * Emit a fence before the first surface state change, so that blits
+ * still running don't see their surfaces change. Nothing is dirty
+ * after it.
+ */
+
+static void
+psbAccelStateFence(Psb2DBufferPtr cb, PsbTwodContextPtr tdc, Bool *fenced)
+{
+    if (*fenced)
+	return;
+
+    PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
+    tdc->dirty = FALSE;
+    *fenced = TRUE;
+}
+
+/*
+ * Forget the surface state emitted so far, so that it is emitted again
+ * before the next blit.
+ */
+
+void
+psbAccelInvalidateState(PsbTwodContextPtr tdc)
+{
+    tdc->shadowSrc.valid = FALSE;
+    tdc->shadowDst.valid = FALSE;
+    tdc->shadowPat.valid = FALSE;
+}
+
+/*
+ * Emit source and destination surface state, unless the same state
+ * has already been emitted to the current batch.
+ */
+
 static void
 psbAccelVolatileStateCallback(Psb2DBufferPtr ptrCb, void *arg)
 {
     PsbTwodContextPtr tdc = (PsbTwodContextPtr) arg;
+    CARD32 sMode = tdc->sMode & PSB_2D_SRC_FORMAT_MASK;
+    CARD32 dMode = tdc->dMode & PSB_2D_DST_FORMAT_MASK;
+    CARD32 pMode = tdc->pMode & PSB_2D_PAT_FORMAT_MASK;
+    Bool fenced = FALSE;
     int ret;
 
     PSB_SUPER_2D_VARS(ptrCb);
-    if (tdc->srcState || tdc->dstState) {
-        PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
-	tdc->bhFence = FALSE;
+    if (tdc->shadowBatch != cb->numSubmits) {
+	psbAccelInvalidateState(tdc);
+	tdc->shadowBatch = cb->numSubmits;
+    }
+
+    if (tdc->patCopy) {
+	if (psbAccelSurfMatch(&tdc->shadowPat, tdc->pBuffer, tdc->pOffset,
+			      tdc->pStride, pMode)) {
+	    tdc->dwordsSaved += 2;
+	} else {
+	    psbAccelStateFence(ptrCb, tdc, &fenced);
+	    PSB_SUPER_2D_OUT(PSB_2D_PAT_SURF_BH | pMode |
+			     ((tdc->pStride << PSB_2D_PAT_STRIDE_SHIFT) &
+			      PSB_2D_PAT_STRIDE_MASK));
+	    PSB_SUPER_2D_RELOC_OFFSET(tdc->pOffset, mmKernelBuf(tdc->pBuffer),
+				      0, 0);
+	    psbAccelSurfSet(&tdc->shadowPat, tdc->pBuffer, tdc->pOffset,
+			    tdc->pStride, pMode);
+	}
     }
 
     if (tdc->srcState) {
-	PSB_SUPER_2D_OUT(PSB_2D_SRC_SURF_BH |
-			 (tdc->sMode & PSB_2D_SRC_FORMAT_MASK) |
-			 ((tdc->sStride << PSB_2D_SRC_STRIDE_SHIFT) &
-			  PSB_2D_SRC_STRIDE_MASK));
-	PSB_SUPER_2D_RELOC_OFFSET(tdc->sOffset, mmKernelBuf(tdc->sBuffer), 
-				  0, 0);
+	if (psbAccelSurfMatch(&tdc->shadowSrc, tdc->sBuffer, tdc->sOffset,
+			      tdc->sStride, sMode)) {
+	    tdc->dwordsSaved += 2;
+	} else {
+	    psbAccelStateFence(ptrCb, tdc, &fenced);
+	    PSB_SUPER_2D_OUT(PSB_2D_SRC_SURF_BH | sMode |
+			     ((tdc->sStride << PSB_2D_SRC_STRIDE_SHIFT) &
+			      PSB_2D_SRC_STRIDE_MASK));
+	    PSB_SUPER_2D_RELOC_OFFSET(tdc->sOffset, mmKernelBuf(tdc->sBuffer),
+				      0, 0);
+	    psbAccelSurfSet(&tdc->shadowSrc, tdc->sBuffer, tdc->sOffset,
+			    tdc->sStride, sMode);
+	}
     }
 
     if (tdc->dstState) {
-	PSB_SUPER_2D_OUT(PSB_2D_DST_SURF_BH |
-			 (tdc->dMode & PSB_2D_DST_FORMAT_MASK) |
-			 ((tdc->dStride << PSB_2D_DST_STRIDE_SHIFT) &
-			  PSB_2D_DST_STRIDE_MASK));
-	PSB_SUPER_2D_RELOC_OFFSET(tdc->dOffset, mmKernelBuf(tdc->dBuffer), 
-				  0, 0);
+	if (psbAccelSurfMatch(&tdc->shadowDst, tdc->dBuffer, tdc->dOffset,
+			      tdc->dStride, dMode)) {
+	    tdc->dwordsSaved += 2;
+	} else {
+	    psbAccelStateFence(ptrCb, tdc, &fenced);
+	    PSB_SUPER_2D_OUT(PSB_2D_DST_SURF_BH | dMode |
+			     ((tdc->dStride << PSB_2D_DST_STRIDE_SHIFT) &
+			      PSB_2D_DST_STRIDE_MASK));
+	    PSB_SUPER_2D_RELOC_OFFSET(tdc->dOffset, mmKernelBuf(tdc->dBuffer),
+				      0, 0);
+	    psbAccelSurfSet(&tdc->shadowDst, tdc->dBuffer, tdc->dOffset,
+			    tdc->dStride, dMode);
+	}
     }
     PSB_SUPER_2D_DONE(ret);
 }
-	
+
+/*
+ * Whether a ROP3 code depends on the source or the destination.
+ */
+
+static inline Bool
+psbRopReadsSrc(CARD32 rop)
+{
+    return (((rop >> 2) ^ rop) & 0x33) != 0;
+}
+
+static inline Bool
+psbRopReadsDst(CARD32 rop)
+{
+    return (((rop >> 1) ^ rop) & 0x55) != 0;
+}
+
+static inline Bool
+psbRopReadsPat(CARD32 rop)
+{
+    return (((rop >> 4) ^ rop) & 0x0F) != 0;
+}
+
+/*
+ * The area touched by a blit starting at x, y. With a reversed
+ * copy order, x and / or y is the far corner.
+ */
+
+static void
+psbAccelBlitBox(CARD32 cmd, int x, int y, int w, int h, BoxPtr box)
+{
+    CARD32 order = cmd & ~PSB_2D_COPYORDER_CLRMASK;
+
+    if ((cmd & PSB_2D_ROT_MASK) != PSB_2D_ROT_NONE) {
+
+	/*
+	 * Don't bother with rotated coordinates.
+	 */
+
+	box->x1 = box->y1 = 0;
+	box->x2 = box->y2 = MAXSHORT;
+	return;
+    }
+
+    box->x1 = (order == PSB_2D_COPYORDER_BR2TL ||
+	       order == PSB_2D_COPYORDER_TR2BL) ? x - w + 1 : x;
+    box->y1 = (order == PSB_2D_COPYORDER_BR2TL ||
+	       order == PSB_2D_COPYORDER_BL2TR) ? y - h + 1 : y;
+    box->x2 = box->x1 + w;
+    box->y2 = box->y1 + h;
+}
+
+/*
+ * The bytes of a surface a box covers, whole rows in between.
+ */
+
+static void
+psbAccelBoxBytes(CARD32 offset, CARD32 stride, CARD32 mode, BoxPtr box,
+		 unsigned long *start, unsigned long *end)
+{
+    unsigned cpp;
+
+    switch (mode & PSB_2D_DST_FORMAT_MASK) {
+    case PSB_2D_DST_332RGB:
+	cpp = 1;
+	break;
+    case PSB_2D_DST_555RGB:
+    case PSB_2D_DST_565RGB:
+	cpp = 2;
+	break;
+    default:
+	cpp = 4;
+	break;
+    }
+
+    *start = offset + (unsigned long)max(box->y1, 0) * stride +
+	(unsigned long)max(box->x1, 0) * cpp;
+    *end = offset + (unsigned long)max(box->y2 - 1, 0) * stride +
+	(unsigned long)max(box->x2, 0) * cpp;
+}
+
+/*
+ * Surfaces may overlap in their buffer without having the same offset,
+ * so areas are compared as boxes only on the same surface, and as byte
+ * ranges otherwise.
+ */
+
+static Bool
+psbAccelDirtyOverlap(PsbTwodContextPtr tdc, struct _MMBuffer *buffer,
+		     CARD32 offset, CARD32 stride, CARD32 mode, BoxPtr box)
+{
+    unsigned long start, end;
+
+    if (tdc->dirtyMulti)
+	return TRUE;
+
+    if (tdc->dirtyBuffer != buffer)
+	return FALSE;
+
+    if (tdc->dirtyBoxValid && tdc->dirtyOffset == offset &&
+	tdc->dirtyStride == stride)
+	return (box->x1 < tdc->dirtyBox.x2 && tdc->dirtyBox.x1 < box->x2 &&
+		box->y1 < tdc->dirtyBox.y2 && tdc->dirtyBox.y1 < box->y2);
+
+    psbAccelBoxBytes(offset, stride, mode, box, &start, &end);
+    return (start < tdc->dirtyEnd && tdc->dirtyStart < end);
+}
+
+/*
+ * Check whether a blit reads anything that blits issued since the
+ * last fence may still be writing. If so, the caller needs to emit a
+ * fence, and the dirty area is cleared. The blit's own destination
+ * area is then recorded as dirty. For pattern copies, srcBox is the
+ * area read from the pattern surface.
+ */
+
+static Bool
+psbAccelBlitFence(PsbTwodContextPtr tdc, CARD32 cmd, BoxPtr srcBox,
+		  BoxPtr dstBox)
+{
+    CARD32 rop = (cmd & PSB_2D_ROP3A_MASK) >> PSB_2D_ROP3A_SHIFT;
+    Bool fence = FALSE;
+    unsigned long start, end;
+
+    if (tdc->dirty) {
+	if (srcBox && psbRopReadsSrc(rop) &&
+	    psbAccelDirtyOverlap(tdc, tdc->sBuffer, tdc->sOffset,
+				 tdc->sStride, tdc->sMode, srcBox))
+	    fence = TRUE;
+	else if (srcBox && tdc->patCopy && psbRopReadsPat(rop) &&
+		 psbAccelDirtyOverlap(tdc, tdc->pBuffer, tdc->pOffset,
+				      tdc->pStride, tdc->pMode, srcBox))
+	    fence = TRUE;
+	else if ((psbRopReadsDst(rop) || (cmd & PSB_2D_ALPHA_ENABLE)) &&
+		 psbAccelDirtyOverlap(tdc, tdc->dBuffer, tdc->dOffset,
+				      tdc->dStride, tdc->dMode, dstBox))
+	    fence = TRUE;
+
+	/*
+	 * Blits used to be fenced one by one.
+	 */
+
+	if (!fence)
+	    tdc->dwordsSaved++;
+    }
+
+    psbAccelBoxBytes(tdc->dOffset, tdc->dStride, tdc->dMode, dstBox,
+		     &start, &end);
+
+    if (fence || !tdc->dirty) {
+	tdc->dirty = TRUE;
+	tdc->dirtyMulti = FALSE;
+	tdc->dirtyBuffer = tdc->dBuffer;
+	tdc->dirtyStart = start;
+	tdc->dirtyEnd = end;
+	tdc->dirtyBoxValid = TRUE;
+	tdc->dirtyOffset = tdc->dOffset;
+	tdc->dirtyStride = tdc->dStride;
+	tdc->dirtyBox = *dstBox;
+    } else if (!tdc->dirtyMulti) {
+	if (tdc->dirtyBuffer == tdc->dBuffer) {
+	    tdc->dirtyStart = min(tdc->dirtyStart, start);
+	    tdc->dirtyEnd = max(tdc->dirtyEnd, end);
+	    if (tdc->dirtyOffset != tdc->dOffset ||
+		tdc->dirtyStride != tdc->dStride)
+		tdc->dirtyBoxValid = FALSE;
+	    tdc->dirtyBox.x1 = min(tdc->dirtyBox.x1, dstBox->x1);
+	    tdc->dirtyBox.y1 = min(tdc->dirtyBox.y1, dstBox->y1);
+	    tdc->dirtyBox.x2 = max(tdc->dirtyBox.x2, dstBox->x2);
+	    tdc->dirtyBox.y2 = max(tdc->dirtyBox.y2, dstBox->y2);
+	} else
+	    tdc->dirtyMulti = TRUE;
+    }
+
+    return fence;
+}
+
 static int
 psbAccelSuperEmitState(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc)
 {
     int ret;
 
     PSB_SUPER_2D_VARS(ptrCb);
-    PSB_SUPER_2D_SIZE(5, 2, 0, 0);
+    PSB_SUPER_2D_SIZE(7, 3, 0, 0);
     psbAccelVolatileStateCallback(ptrCb, tdc);
     PSB_SUPER_2D_DONE(ret);
     
@@ -807,10 +1249,13 @@ psbAccelSuperSolidHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 {
     int ret;
 
+    BoxRec dstBox;
+
     PSB_SUPER_2D_VARS(ptrCb);
     PSB_SUPER_2D_SIZE(5, 0, 0, 0);
 
-    if (tdc->bhFence)
+    psbAccelBlitBox(cmd, x, y, w, h, &dstBox);
+    if (psbAccelBlitFence(tdc, cmd, NULL, &dstBox))
 	PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
     PSB_SUPER_2D_OUT(cmd);
     PSB_SUPER_2D_OUT(fg);
@@ -821,7 +1266,6 @@ psbAccelSuperSolidHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 		     ((h << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK));
 
     PSB_SUPER_2D_DONE(ret);
-    tdc->bhFence = TRUE;
 
     if (ret) {
 	PSB_DEBUG(0, 3, "Error = %i\n", ret);
@@ -844,9 +1288,14 @@ psbExaPrepareSuperSolid(PixmapPtr pPixmap, int alu, Pixel planeMask, Pixel fg)
 	return FALSE;
 
     /*
-     * Do solid fills in software. Much faster;
+     * Plain solid fills are usually faster in software, unless
+     * calibration found otherwise for this size.
      */
-    if (alu == GXcopy)
+    if (alu == GXcopy &&
+	!psbCalibrateUseBlitter(pPsb->pPsbExa, PSB_CAL_SOLID,
+				pPixmap->drawable.bitsPerPixel,
+				pPixmap->drawable.width *
+				pPixmap->drawable.height))
 	return FALSE;
 
     psbDRILock(pScrn, 0);
@@ -885,6 +1334,8 @@ psbExaSuperSolid(PixmapPtr pPixmap, int x1, int y1, int x2, int y2)
     int w = x2 - x1;
     int h = y2 - y1;
 
+    psbPixmapGPUAccess(pPixmap, w, h);
+
 #ifdef PSB_FIX_BUG_W8
     if (w == 8) {
 	w = 4;
@@ -908,10 +1359,14 @@ psbAccelSuperCopyHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 {
     int ret;
 
+    BoxRec srcBox, dstBox;
+
     PSB_SUPER_2D_VARS(ptrCb);
     PSB_SUPER_2D_SIZE(8, 0, 0, 0);
-    
-    if (tdc->bhFence)
+
+    psbAccelBlitBox(cmd, xs, ys, w, h, &srcBox);
+    psbAccelBlitBox(cmd, xd, yd, w, h, &dstBox);
+    if (psbAccelBlitFence(tdc, cmd, &srcBox, &dstBox))
 	PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
     PSB_SUPER_2D_OUT(PSB_2D_SRC_OFF_BH |
 		     ((xs << PSB_2D_SRCOFF_XSTART_SHIFT) &
@@ -929,34 +1384,265 @@ psbAccelSuperCopyHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 		     ((h << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK));
 
     PSB_SUPER_2D_DONE(ret);
-    tdc->bhFence = TRUE;
 
     if (ret) {
 	PSB_DEBUG(0, 3, "Error = %i\n", ret);
     }
 }
 
-static Bool
-psbExaPrepareSuperCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int xdir,
-		       int ydir, int alu, Pixel planeMask)
+/*
+ * Pattern copies. EXA fills with a tile by copying it to the
+ * destination once per tile instance. If the tile is small enough to
+ * be a pattern, adjacent copies that continue the same tiling are
+ * merged and each merged rectangle that repeats the tile is filled
+ * with it as pattern, so that a box usually takes a single blit.
+ * Rectangles within one tile instance, such as any copy that isn't
+ * part of a tiling, stay plain copies.
+ */
+
+static void
+psbAccelSuperPatternHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
+			   int x, int y, int w, int h, int xp, int yp,
+			   unsigned cmd)
 {
-    int rop;
-    ScrnInfoPtr pScrn = xf86Screens[pDstPixmap->drawable.pScreen->myNum];
-    PsbPtr pPsb = psbPTR(pScrn);
-    PsbTwodContextPtr tdc = &pPsb->td;
+    int ret;
 
-    /* can't do depth 4 */
-    if (pSrcPixmap->drawable.depth == 4 || pDstPixmap->drawable.depth == 4)
-	return FALSE;
+    BoxRec patBox, dstBox;
 
-    if (pSrcPixmap->drawable.width * pSrcPixmap->drawable.height <
-	PSB_EXA_MIN_COPY
-	|| pDstPixmap->drawable.width * pDstPixmap->drawable.height <
-	PSB_EXA_MIN_COPY)
-	return FALSE;
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_SIZE(5, 0, 0, 0);
 
-    psbDRILock(pScrn, 0);
-    tdc->direction = psbAccelCopyDirection(xdir, ydir);
+    patBox.x1 = 0;
+    patBox.y1 = 0;
+    patBox.x2 = tdc->patWidth;
+    patBox.y2 = tdc->patHeight;
+    psbAccelBlitBox(cmd, x, y, w, h, &dstBox);
+    if (psbAccelBlitFence(tdc, cmd, &patBox, &dstBox))
+	PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
+    PSB_SUPER_2D_OUT(PSB_2D_PAT_BH |
+		     ((tdc->patWidth << PSB_2D_PAT_WIDTH_SHIFT) &
+		      PSB_2D_PAT_WIDTH_MASK) |
+		     ((tdc->patHeight << PSB_2D_PAT_HEIGHT_SHIFT) &
+		      PSB_2D_PAT_HEIGHT_MASK) |
+		     ((xp << PSB_2D_PAT_XSTART_SHIFT) &
+		      PSB_2D_PAT_XSTART_MASK) |
+		     ((yp << PSB_2D_PAT_YSTART_SHIFT) &
+		      PSB_2D_PAT_YSTART_MASK));
+    PSB_SUPER_2D_OUT(cmd);
+    PSB_SUPER_2D_OUT(((x << PSB_2D_DST_XSTART_SHIFT) & PSB_2D_DST_XSTART_MASK)
+		     | ((y << PSB_2D_DST_YSTART_SHIFT) &
+			PSB_2D_DST_YSTART_MASK));
+    PSB_SUPER_2D_OUT(((w << PSB_2D_DST_XSIZE_SHIFT) & PSB_2D_DST_XSIZE_MASK) |
+		     ((h << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK));
+
+    PSB_SUPER_2D_DONE(ret);
+
+    if (ret) {
+	PSB_DEBUG(0, 3, "Error = %i\n", ret);
+    }
+}
+
+static void
+psbAccelPatternBox(Psb2DBufferPtr cb, PsbTwodContextPtr tdc,
+		   int x, int y, int w, int h, int xp, int yp)
+{
+    if (xp + w <= tdc->patWidth && yp + h <= tdc->patHeight)
+	psbAccelSuperCopyHelper(cb, tdc, xp, yp, x, y, w, h, tdc->sMode,
+				tdc->dMode, tdc->fixPat, tdc->copyCmd);
+    else
+	psbAccelSuperPatternHelper(cb, tdc, x, y, w, h, xp, yp, tdc->cmd);
+}
+
+static void
+psbAccelPatternEmit(Psb2DBufferPtr cb, PsbTwodContextPtr tdc, BoxPtr box,
+		    int phaseX, int phaseY)
+{
+    int x = box->x1;
+    int w = box->x2 - box->x1;
+    int xp = (x + phaseX) & (tdc->patWidth - 1);
+    int yp = (box->y1 + phaseY) & (tdc->patHeight - 1);
+
+    if (w <= 0)
+	return;
+
+#ifdef PSB_FIX_BUG_W8
+    if (w == 8) {
+	w = 4;
+
+	psbAccelPatternBox(cb, tdc, x, box->y1, w, box->y2 - box->y1,
+			   xp, yp);
+
+	x += 4;
+	xp = (xp + 4) & (tdc->patWidth - 1);
+    }
+#endif
+    psbAccelPatternBox(cb, tdc, x, box->y1, w, box->y2 - box->y1, xp, yp);
+}
+
+/*
+ * Finish the current band, merging it with the rectangle above it if
+ * they line up.
+ */
+
+static void
+psbAccelPatternEndRow(Psb2DBufferPtr cb, PsbTwodContextPtr tdc)
+{
+    BoxPtr row = &tdc->patRow;
+    BoxPtr rect = &tdc->patRect;
+
+    if (row->x2 <= row->x1)
+	return;
+
+    if (rect->x2 > rect->x1 && rect->x1 == row->x1 && rect->x2 == row->x2 &&
+	rect->y2 == row->y1 && tdc->patRectX == tdc->patRowX &&
+	tdc->patRectY == tdc->patRowY) {
+	rect->y2 = row->y2;
+    } else {
+	psbAccelPatternEmit(cb, tdc, rect, tdc->patRectX, tdc->patRectY);
+	*rect = *row;
+	tdc->patRectX = tdc->patRowX;
+	tdc->patRectY = tdc->patRowY;
+    }
+    row->x2 = row->x1;
+}
+
+static void
+psbAccelPatternFlush(Psb2DBufferPtr cb, PsbTwodContextPtr tdc)
+{
+    psbAccelPatternEndRow(cb, tdc);
+    psbAccelPatternEmit(cb, tdc, &tdc->patRect, tdc->patRectX,
+			tdc->patRectY);
+    tdc->patRect.x2 = tdc->patRect.x1;
+}
+
+static void
+psbAccelPatternCopy(Psb2DBufferPtr cb, PsbTwodContextPtr tdc,
+		    int srcX, int srcY, int dstX, int dstY, int w, int h)
+{
+    BoxPtr row = &tdc->patRow;
+    int phaseX = (srcX - dstX) & (tdc->patWidth - 1);
+    int phaseY = (srcY - dstY) & (tdc->patHeight - 1);
+
+    if (w <= 0 || h <= 0)
+	return;
+
+    if (row->x2 > row->x1 && row->x2 == dstX && row->y1 == dstY &&
+	row->y2 == dstY + h && tdc->patRowX == phaseX &&
+	tdc->patRowY == phaseY) {
+	row->x2 += w;
+	return;
+    }
+
+    psbAccelPatternEndRow(cb, tdc);
+    row->x1 = dstX;
+    row->y1 = dstY;
+    row->x2 = dstX + w;
+    row->y2 = dstY + h;
+    tdc->patRowX = phaseX;
+    tdc->patRowY = phaseY;
+}
+
+static Bool
+psbAccelPatternSize(int w, int h)
+{
+    return (w <= PSB_PAT_MAX && h <= PSB_PAT_MAX &&
+	    (w & (w - 1)) == 0 && (h & (h - 1)) == 0);
+}
+
+static Bool
+psbExaPreparePatternCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int alu)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDstPixmap->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+    int rop = psbPatternROP[alu];
+    int copyRop = psbCopyROP[alu];
+    unsigned long offset;
+
+    /*
+     * Like solid fills, plain pattern fills of small pixmaps are
+     * faster in software.
+     */
+    if (alu == GXcopy &&
+	!psbCalibrateUseBlitter(pPsb->pPsbExa, PSB_CAL_SOLID,
+				pDstPixmap->drawable.bitsPerPixel,
+				pDstPixmap->drawable.width *
+				pDstPixmap->drawable.height))
+	return FALSE;
+
+    psbDRILock(pScrn, 0);
+    psbAccelSetMode(tdc, pSrcPixmap->drawable.depth,
+		    pDstPixmap->drawable.depth, 0);
+    tdc->cmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_PAT |
+	((rop << PSB_2D_ROP3B_SHIFT) & PSB_2D_ROP3B_MASK) |
+	((rop << PSB_2D_ROP3A_SHIFT) & PSB_2D_ROP3A_MASK);
+    tdc->copyCmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+	((copyRop << PSB_2D_ROP3B_SHIFT) & PSB_2D_ROP3B_MASK) |
+	((copyRop << PSB_2D_ROP3A_SHIFT) & PSB_2D_ROP3A_MASK);
+
+    if (!psbExaGetSuperOffset(pSrcPixmap, &offset, &tdc->pBuffer))
+	goto out_err;
+    tdc->pOffset = offset;
+    tdc->sBuffer = tdc->pBuffer;
+    tdc->sOffset = offset;
+
+    if (!psbExaGetSuperOffset(pDstPixmap, &offset, &tdc->dBuffer))
+	goto out_err;
+    tdc->dOffset = offset;
+
+    tdc->pStride = exaGetPixmapPitch(pSrcPixmap);
+    tdc->sStride = tdc->pStride;
+    tdc->dStride = exaGetPixmapPitch(pDstPixmap);
+    tdc->sBPP = pSrcPixmap->drawable.bitsPerPixel >> 3;
+    tdc->patWidth = pSrcPixmap->drawable.width;
+    tdc->patHeight = pSrcPixmap->drawable.height;
+    tdc->patRow.x2 = tdc->patRow.x1;
+    tdc->patRect.x2 = tdc->patRect.x1;
+    tdc->patCopy = TRUE;
+    tdc->srcState = TRUE;
+    tdc->dstState = TRUE;
+    psbAccelSuperEmitState(&pPsb->superC, tdc);
+
+    return TRUE;
+  out_err:
+    psbDRIUnlock(pScrn);
+    return FALSE;
+}
+
+static Bool
+psbExaPrepareSuperCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int xdir,
+		       int ydir, int alu, Pixel planeMask)
+{
+    int rop;
+    ScrnInfoPtr pScrn = xf86Screens[pDstPixmap->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+
+    /* can't do depth 4 */
+    if (pSrcPixmap->drawable.depth == 4 || pDstPixmap->drawable.depth == 4)
+	return FALSE;
+
+    if (pSrcPixmap != pDstPixmap &&
+	pSrcPixmap->drawable.depth == pDstPixmap->drawable.depth &&
+	EXA_PM_IS_SOLID(&pDstPixmap->drawable, planeMask) &&
+	psbAccelPatternSize(pSrcPixmap->drawable.width,
+			    pSrcPixmap->drawable.height))
+	return psbExaPreparePatternCopy(pSrcPixmap, pDstPixmap, alu);
+
+    if (!psbCalibrateUseBlitter(pPsb->pPsbExa, PSB_CAL_COPY,
+				pSrcPixmap->drawable.bitsPerPixel,
+				pSrcPixmap->drawable.width *
+				pSrcPixmap->drawable.height)
+	|| !psbCalibrateUseBlitter(pPsb->pPsbExa, PSB_CAL_COPY,
+				   pDstPixmap->drawable.bitsPerPixel,
+				   pDstPixmap->drawable.width *
+				   pDstPixmap->drawable.height))
+	return FALSE;
+
+    psbDRILock(pScrn, 0);
+    tdc->direction = psbAccelCopyDirection(xdir, ydir);
 
     rop = (EXA_PM_IS_SOLID(&pDstPixmap->drawable, planeMask)) ?
 	psbCopyROP[alu] : psbCopyROP_PM(alu);
@@ -991,6 +1677,48 @@ psbExaPrepareSuperCopy(PixmapPtr pSrcPixmap, PixmapPtr pDstPixmap, int xdir,
     return FALSE;
 }
 
+/*
+ * Emit a single GXcopy fill or blit of a w x h rectangle within buf.
+ * Used by the calibration code to time the blitter.
+ */
+
+void
+psbAccelCalibrateBlit(ScrnInfoPtr pScrn, PsbCalOp op, struct _MMBuffer *buf,
+		      unsigned long srcOffset, unsigned long dstOffset,
+		      unsigned stride, int bpp, int w, int h)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+    Psb2DBufferPtr cb2 = &pPsb->superC;
+    int depth = (bpp == 32) ? 24 : bpp;
+    int rop = (op == PSB_CAL_SOLID) ?
+	psbPatternROP[GXcopy] : psbCopyROP[GXcopy];
+
+    psbAccelSetMode(tdc, depth, depth, 0);
+    tdc->cmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+	((rop << PSB_2D_ROP3B_SHIFT) & PSB_2D_ROP3B_MASK) |
+	((rop << PSB_2D_ROP3A_SHIFT) & PSB_2D_ROP3A_MASK);
+
+    tdc->dBuffer = buf;
+    tdc->dOffset = dstOffset;
+    tdc->dStride = stride;
+    tdc->sBuffer = buf;
+    tdc->sOffset = srcOffset;
+    tdc->sStride = stride;
+    tdc->sBPP = bpp >> 3;
+    tdc->srcState = (op != PSB_CAL_SOLID);
+    tdc->dstState = TRUE;
+    psbAccelSuperEmitState(cb2, tdc);
+
+    if (op == PSB_CAL_SOLID)
+	psbAccelSuperSolidHelper(cb2, tdc, 0, 0, w, h, tdc->dMode,
+				 tdc->fixPat, tdc->cmd);
+    else
+	psbAccelSuperCopyHelper(cb2, tdc, 0, 0, 0, 0, w, h, tdc->sMode,
+				tdc->dMode, tdc->fixPat, tdc->cmd);
+}
+
 static void
 psbExaSuperCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
 		int width, int height)
@@ -1000,6 +1728,13 @@ psbExaSuperCopy(PixmapPtr pDstPixmap, int srcX, int srcY, int dstX, int dstY,
     PsbTwodContextPtr tdc = &pPsb->td;
     Psb2DBufferPtr cb2 = &pPsb->superC;
 
+    psbPixmapGPUAccess(pDstPixmap, width, height);
+
+    if (tdc->patCopy) {
+	psbAccelPatternCopy(cb2, tdc, srcX, srcY, dstX, dstY, width, height);
+	return;
+    }
+
 #ifdef PSB_FIX_BUG_OVERLAP
     tdc->cmd &= PSB_2D_COPYORDER_CLRMASK;
     tdc->direction = (tdc->sOffset != tdc->dOffset) ?
@@ -1053,10 +1788,14 @@ psbAccelSuperCompositeHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 {
     int ret;
 
+    BoxRec srcBox, dstBox;
+
     PSB_SUPER_2D_VARS(ptrCb);
     PSB_SUPER_2D_SIZE(12, 0, 0, 0);
 
-    if (tdc->bhFence)
+    psbAccelBlitBox(cmd, xs, ys, w, h, &srcBox);
+    psbAccelBlitBox(cmd, xd, yd, w, h, &dstBox);
+    if (psbAccelBlitFence(tdc, cmd, &srcBox, &dstBox))
 	PSB_SUPER_2D_OUT(PSB_2D_FENCE_BH);
     PSB_SUPER_2D_OUT(PSB_2D_SRC_OFF_BH |
 		     ((xs << PSB_2D_SRCOFF_XSTART_SHIFT) &
@@ -1084,14 +1823,143 @@ psbAccelSuperCompositeHelper(Psb2DBufferPtr ptrCb, PsbTwodContextPtr tdc,
 
     PSB_SUPER_2D_DONE(ret);
 
-    tdc->bhFence = TRUE;
-
     if (ret) {
 	PSB_DEBUG(0, 3, "Error = %i\n", ret);
     }
 
 }
 
+/*
+ * Read a pixel of a pixmap the blitter may be writing to. Fails
+ * rather than waits if the pixmap is busy.
+ */
+
+static Bool
+psbAccelReadPixel(ScrnInfoPtr pScrn, PixmapPtr pPix, unsigned format,
+		  CARD32 * argb8888)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    struct _MMBuffer *buf;
+    unsigned long offset;
+
+    if (!psbExaGetSuperOffset(pPix, &offset, &buf)) {
+	if (!pPix->devPrivate.ptr)
+	    return FALSE;
+	psbPixelARGB8888(format, pPix->devPrivate.ptr, argb8888);
+	return TRUE;
+    }
+
+    /*
+     * Don't wait for the engine to write the pixel. Masks are often
+     * rendered right before they are used, and waiting for them on
+     * every Composite costs more than the 2D path saves.
+     */
+    if (psb2DBufferReferences(&pPsb->superC, mmKernelBuf(buf)))
+	return FALSE;
+
+    if (buf->man->mapBuf(buf, DRM_BO_FLAG_READ, DRM_BO_HINT_DONT_BLOCK))
+	return FALSE;
+    psbPixelARGB8888(format, (CARD8 *) mmBufVirtual(buf) + offset, argb8888);
+    (void)buf->man->unMapBuf(buf);
+
+    return TRUE;
+}
+
+/*
+ * PictOpOver and PictOpAdd with no mask or a constant one are done
+ * with the 2D engine's alpha blending. The global alpha holds the
+ * mask alpha m:
+ *
+ *   Over: dst = src * m + dst * (1 - srcA * m)
+ *   Add:  dst = src * m + dst
+ *
+ * Sources without alpha have srcA = 1.
+ */
+
+static Bool
+psbAccelPrepareBlend2D(ScrnInfoPtr pScrn, int op, PicturePtr pSrcPicture,
+		       PicturePtr pMaskPicture, PicturePtr pDstPicture,
+		       PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+    PsbFormatPointer format;
+    CARD32 maskPixel = 0xFF000000;
+    CARD32 gbl;
+    unsigned long offset;
+
+    if (pSrcPicture->repeat || pSrcPicture->transform ||
+	pSrcPicture->alphaMap || pDstPicture->alphaMap)
+	return FALSE;
+
+    if (PICT_FORMAT_RGB(pSrcPicture->format) == 0 ||
+	!psbSrcSupported(pSrcPicture->format, FALSE) ||
+	!psbDstSupported(pDstPicture->format))
+	return FALSE;
+
+    /*
+     * A source without alpha is opaque, but the engine would write its
+     * undefined alpha bits to the destination alpha.
+     */
+    if (PICT_FORMAT_A(pSrcPicture->format) == 0 &&
+	PICT_FORMAT_A(pDstPicture->format) != 0)
+	return FALSE;
+
+    if (pMaskPicture) {
+	if (!pMaskPicture->repeat || pMaskPicture->alphaMap ||
+	    pMask->drawable.width != 1 || pMask->drawable.height != 1 ||
+	    !psbExpandablePixel(pMaskPicture->format))
+	    return FALSE;
+
+	if (PICT_FORMAT_A(pMaskPicture->format) != 0 &&
+	    !psbAccelReadPixel(pScrn, pMask, pMaskPicture->format,
+			       &maskPixel))
+	    return FALSE;
+    }
+
+    gbl = maskPixel >> 24;
+    tdc->alpha1 = PSB_2D_SRCALPHA_OP_GBL |
+	((gbl << PSB_2D_GBLALPHA_SHIFT) & PSB_2D_GBLALPHA_MASK);
+    if (op == PictOpOver)
+	tdc->alpha1 |= PSB_2D_DSTALPHA_INVERT |
+	    ((PICT_FORMAT_A(pSrcPicture->format) != 0) ?
+	     PSB_2D_DSTALPHA_OP_SG : PSB_2D_DSTALPHA_OP_GBL);
+    else
+	tdc->alpha1 |= PSB_2D_DSTALPHA_OP_ONE;
+    tdc->alpha2 = 0;
+
+    format = psbCompFormat(pSrcPicture->format);
+    tdc->sMode = format->srcFormat;
+    format = psbCompFormat(pDstPicture->format);
+    tdc->dMode = format->dstFormat;
+
+    tdc->cmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+	PSB_2D_ROP3_SRCCOPY | PSB_2D_ALPHA_ENABLE;
+
+    if (!psbExaGetSuperOffset(pSrc, &offset, &tdc->sBuffer))
+	return FALSE;
+    tdc->sOffset = offset;
+
+    if (!psbExaGetSuperOffset(pDst, &offset, &tdc->dBuffer))
+	return FALSE;
+    tdc->dOffset = offset;
+
+    tdc->sStride = exaGetPixmapPitch(pSrc);
+    tdc->dStride = exaGetPixmapPitch(pDst);
+    tdc->sBPP = pSrc->drawable.bitsPerPixel >> 3;
+    tdc->srcTransform = NULL;
+    tdc->srcRot = PSB_2D_ROT_NONE;
+    tdc->srcWidth = pSrc->drawable.width;
+    tdc->srcHeight = pSrc->drawable.height;
+    tdc->comp2D = TRUE;
+    tdc->srcState = TRUE;
+    tdc->dstState = TRUE;
+    psbAccelSuperEmitState(&pPsb->superC, tdc);
+
+    return TRUE;
+}
+
 static Bool
 psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
 			    PicturePtr pMaskPicture, PicturePtr pDstPicture,
@@ -1106,11 +1974,11 @@ psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
     psbDRILock(pScrn, 0);
 
     tdc->cmd = 0;
-    if (op == PictOpSrc && pMaskPicture == NULL &&
-	pSrcPicture->format == pDstPicture->format && !pSrcPicture->repeat) {
+    if (op == PictOpSrc && pMaskPicture == NULL && !pSrcPicture->repeat &&
+	psbBlitConvertible(pSrcPicture->format, pDstPicture->format)) {
 
 	/*
-	 * Try 2D compositing. Pure blits and rotation.
+	 * Try 2D compositing. Pure blits, format conversion and rotation.
 	 */
 
 	if (!psbDstSupported(pDstPicture->format))
@@ -1136,6 +2004,8 @@ psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
 	    PSB_2D_COPYORDER_TL2BR |
 	    PSB_2D_DSTCK_DISABLE |
 	    PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL | PSB_2D_ROP3_SRCCOPY;
+	tdc->alpha1 = 0;
+	tdc->alpha2 = 0;
 
 	if (!psbExaGetSuperOffset(pSrc, &tdc->sOffset, &tdc->sBuffer))
 	    goto out_err;
@@ -1156,6 +2026,16 @@ psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
 
 	return TRUE;
     }
+
+    /*
+     * Blends the 2D engine can do are cheaper to set up than 3D.
+     */
+
+    if ((op == PictOpOver || op == PictOpAdd) &&
+	psbAccelPrepareBlend2D(pScrn, op, pSrcPicture, pMaskPicture,
+			       pDstPicture, pSrc, pMask, pDst))
+	return TRUE;
+
   composite3D:
     if (!pPsb->hasXpsb)
 	goto out_err;
@@ -1163,6 +2043,12 @@ psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
     if (pSrcPicture->transform)
 	goto out_err;
 
+    /*
+     * Keep 2D and 3D commands in order.
+     */
+
+    psbAccelFlush(pScrn);
+
     if (psbExaPrepareComposite3D(op, pSrcPicture, pMaskPicture,
 				 pDstPicture, pSrc, pMask, pDst)) {
 	tdc->comp2D = FALSE;
@@ -1174,10 +2060,10 @@ psbExaPrepareSuperComposite(int op, PicturePtr pSrcPicture,
 }
 
 /*
- * In the absence of copy-on-write user buffers, this is currently
- * the fastest way to do UploadToScreen on Poulsbo, provided that the
- * destination buffer is write-combined. We should see a throughput
- * in excess of 600MiB / s.
+ * Large uploads are blitted straight from client memory, wrapped as a
+ * user buffer. Otherwise, CPU memcpy is the fastest way to do
+ * UploadToScreen on Poulsbo, provided that the destination buffer is
+ * write-combined. We should see a throughput in excess of 600MiB / s.
  */
 
 static Bool
@@ -1187,8 +2073,9 @@ psbExaUploadToScreen(PixmapPtr pDst, int x, int y, int w, int h, char *src,
     ScreenPtr pScreen = pDst->drawable.pScreen;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
     PsbPtr pPsb = psbPTR(pScrn);
+    struct _MMBuffer *buf;
+    unsigned long offset;
     CARD8 *ptr;
-    PsbBufListPtr b;
     unsigned dstPitch = exaGetPixmapPitch(pDst);
     unsigned int bitsPerPixel = pDst->drawable.bitsPerPixel;
     unsigned wBytes = (w * bitsPerPixel) >> 3;
@@ -1196,25 +2083,190 @@ psbExaUploadToScreen(PixmapPtr pDst, int x, int y, int w, int h, char *src,
     if (bitsPerPixel != 8 && bitsPerPixel != 16 && bitsPerPixel != 32)
 	return FALSE;
 
-    ptr = (CARD8 *) (exaGetPixmapOffset(pDst) +
-		     (unsigned long)mmBufVirtual(pPsb->pPsbExa->exaBuf.buf));
-    b = psbInBuffer(&pPsb->buffers, ptr);
-    if (!b)
+    if (psbUploadUserBuf(pDst, x, y, w, h, src, src_pitch))
+	return TRUE;
+
+    if (!psbExaGetSuperOffset(pDst, &offset, &buf))
+	return FALSE;
+
+    ptr = (CARD8 *) mmBufVirtual(buf) + offset +
+	y * dstPitch + ((x * bitsPerPixel) >> 3);
+
+    if (psb2DBufferReferences(&pPsb->superC, mmKernelBuf(buf)))
+	psbAccelFlush(pScrn);
+
+    if (buf->man->mapBuf(buf, MM_FLAG_WRITE, 0))
+	return FALSE;
+
+    psbCopyRectWCAsync(ptr, dstPitch, src, src_pitch, wBytes, h);
+    psbCopyWait();
+
+    buf->man->unMapBuf(buf);
+    return TRUE;
+}
+
+/*
+ * Blit a w x h rectangle from a wrapped client buffer into a pixmap,
+ * and submit it right away.
+ */
+
+Bool
+psbAccelUploadBlit(PixmapPtr pDst, int x, int y, int w, int h,
+		   struct _MMBuffer *buf, unsigned long srcOffset, int srcX,
+		   unsigned long srcPitch)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbTwodContextPtr tdc = &pPsb->td;
+    Psb2DBufferPtr cb2 = &pPsb->superC;
+    int rop = psbCopyROP[GXcopy];
+
+    psbDRILock(pScrn, 0);
+
+    if (!psbExaGetSuperOffset(pDst, &tdc->dOffset, &tdc->dBuffer)) {
+	psbDRIUnlock(pScrn);
+	return FALSE;
+    }
+
+    psbAccelSetMode(tdc, pDst->drawable.depth, pDst->drawable.depth, 0);
+    tdc->cmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+	((rop << PSB_2D_ROP3B_SHIFT) & PSB_2D_ROP3B_MASK) |
+	((rop << PSB_2D_ROP3A_SHIFT) & PSB_2D_ROP3A_MASK);
+
+    tdc->dStride = exaGetPixmapPitch(pDst);
+    tdc->sBuffer = buf;
+    tdc->sOffset = srcOffset;
+    tdc->sStride = srcPitch;
+    tdc->sBPP = pDst->drawable.bitsPerPixel >> 3;
+    tdc->srcState = TRUE;
+    tdc->dstState = TRUE;
+    psbAccelSuperEmitState(cb2, tdc);
+    psbAccelSuperCopyHelper(cb2, tdc, srcX, 0, x, y, w, h, tdc->sMode,
+			    tdc->dMode, tdc->fixPat, tdc->cmd);
+    psbFlush2D(cb2, DRM_FENCE_FLAG_NO_USER, NULL);
+
+    psbDRIUnlock(pScrn);
+    return TRUE;
+}
+
+/*
+ * Read back a rectangle by blitting it into the cached scratch buffers,
+ * a chunk of rows at a time, and copying it out with the CPU. While the
+ * CPU copies one chunk, the blitter fills the next.
+ */
+
+static Bool
+psbExaDownloadFromScreen(PixmapPtr pSrc, int x, int y, int w, int h,
+			 char *dst, int dst_pitch)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pSrc->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbExaPtr pPsbExa = pPsb->pPsbExa;
+    PsbTwodContextPtr tdc = &pPsb->td;
+    Psb2DBufferPtr cb2 = &pPsb->superC;
+    int bitsPerPixel = pSrc->drawable.bitsPerPixel;
+    unsigned wBytes = (w * bitsPerPixel) >> 3;
+    unsigned stride = ALIGN_TO(wBytes, 32 * 4);
+    int chunkRows[PSB_EXA_NUM_SCRATCH];
+    char *chunkDst[PSB_EXA_NUM_SCRATCH];
+    struct _MMBuffer *buf;
+    CARD8 *src;
+    int maxRows, rows, cur, i;
+    int rop = psbCopyROP[GXcopy];
+
+    if (!pPsbExa->scratchCached)
+	return FALSE;
+
+    if (bitsPerPixel != 8 && bitsPerPixel != 16 && bitsPerPixel != 32)
+	return FALSE;
+
+    if (pSrc->drawable.depth == 4)
 	return FALSE;
 
-    ptr += y * dstPitch + ((x * bitsPerPixel) >> 3);
+    if (!psbCalibrateUseBlitter(pPsbExa, PSB_CAL_DOWNLOAD, bitsPerPixel,
+				w * h))
+	return FALSE;
 
-    if (b->buf->man->mapBuf(b->buf, MM_FLAG_WRITE, 0))
+    maxRows = mmBufSize(pPsbExa->scratchBuf[0].buf) / stride;
+    if (maxRows == 0)
 	return FALSE;
 
-    while (h--) {
-	memcpy(ptr, src, wBytes);
-	ptr += dstPitch;
-	src += src_pitch;
+    psbDRILock(pScrn, 0);
+
+    psbAccelSetMode(tdc, pSrc->drawable.depth, pSrc->drawable.depth, 0);
+    tdc->cmd = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE | PSB_2D_COPYORDER_TL2BR |
+	PSB_2D_DSTCK_DISABLE | PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+	((rop << PSB_2D_ROP3B_SHIFT) & PSB_2D_ROP3B_MASK) |
+	((rop << PSB_2D_ROP3A_SHIFT) & PSB_2D_ROP3A_MASK);
+
+    if (!psbExaGetSuperOffset(pSrc, &tdc->sOffset, &tdc->sBuffer))
+	goto out_err;
+
+    tdc->sStride = exaGetPixmapPitch(pSrc);
+    tdc->sBPP = bitsPerPixel >> 3;
+    tdc->dOffset = 0;
+    tdc->dStride = stride;
+
+    for (i = 0; i < PSB_EXA_NUM_SCRATCH; ++i)
+	chunkRows[i] = 0;
+
+    cur = 0;
+    for (;;) {
+	if (h) {
+	    rows = (h < maxRows) ? h : maxRows;
+
+	    tdc->dBuffer = pPsbExa->scratchBuf[cur].buf;
+	    tdc->srcState = TRUE;
+	    tdc->dstState = TRUE;
+	    psbAccelSuperEmitState(cb2, tdc);
+	    psbAccelSuperCopyHelper(cb2, tdc, x, y, 0, 0, w, rows,
+				    tdc->sMode, tdc->dMode, tdc->fixPat,
+				    tdc->cmd);
+	    psbFlush2D(cb2, DRM_FENCE_FLAG_NO_USER, NULL);
+
+	    chunkRows[cur] = rows;
+	    chunkDst[cur] = dst;
+	    y += rows;
+	    h -= rows;
+	    dst += rows * dst_pitch;
+	}
+
+	cur = (cur + 1) % PSB_EXA_NUM_SCRATCH;
+	if (!chunkRows[cur]) {
+	    for (i = 0; i < PSB_EXA_NUM_SCRATCH; ++i)
+		if (chunkRows[i])
+		    break;
+	    if (!h && i == PSB_EXA_NUM_SCRATCH)
+		break;
+	    continue;
+	}
+
+	/*
+	 * mapBuf waits for the blit into this buffer only.
+	 */
+
+	buf = pPsbExa->scratchBuf[cur].buf;
+	if (buf->man->mapBuf(buf, MM_FLAG_READ, 0))
+	    goto out_err;
+
+	src = mmBufVirtual(buf);
+	for (rows = chunkRows[cur]; rows; --rows) {
+	    memcpy(chunkDst[cur], src, wBytes);
+	    chunkDst[cur] += dst_pitch;
+	    src += stride;
+	}
+
+	buf->man->unMapBuf(buf);
+	chunkRows[cur] = 0;
     }
 
-    b->buf->man->unMapBuf(b->buf);
+    psbDRIUnlock(pScrn);
     return TRUE;
+
+  out_err:
+    psbDRIUnlock(pScrn);
+    return FALSE;
 }
 
 static void
@@ -1231,6 +2283,8 @@ psbExaSuperComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
     int xDelta, yDelta;
     unsigned rot = tdc->cmd & PSB_2D_ROT_MASK;
 #endif
+    psbPixmapGPUAccess(pDst, width, height);
+
     if (!tdc->comp2D) {
 	psbExaComposite3D(pDst, srcX, srcY, maskX, maskY,
 			  dstX, dstY, width, height);
@@ -1261,7 +2315,7 @@ psbExaSuperComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 	psbAccelSuperCompositeHelper(cb2, tdc, srcX, srcY, 0, 0, dstX, dstY,
 				     1, 1, width, height, tdc->sMode,
 				     tdc->mMode, tdc->dMode, tdc->fixPat,
-				     tdc->cmd, 0, 0, FALSE);
+				     tdc->cmd, tdc->alpha1, tdc->alpha2, FALSE);
 
 	srcX += xDelta;
 	srcY += yDelta;
@@ -1269,7 +2323,7 @@ psbExaSuperComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 	psbAccelSuperCompositeHelper(cb2, tdc, srcX, srcY, 0, 0, dstX, dstY,
 				     1, 1, width, height, tdc->sMode,
 				     tdc->mMode, tdc->dMode, tdc->fixPat,
-				     tdc->cmd, 0, 0, FALSE);
+				     tdc->cmd, tdc->alpha1, tdc->alpha2, FALSE);
 
     } else if (height == 8
 	       && (rot == PSB_2D_ROT_90DEGS || rot == PSB_2D_ROT_270DEGS)) {
@@ -1279,21 +2333,21 @@ psbExaSuperComposite(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
 	psbAccelSuperCompositeHelper(cb2, tdc, srcX, srcY, 0, 0, dstX, dstY,
 				     1, 1, width, height, tdc->sMode,
 				     tdc->mMode, tdc->dMode, tdc->fixPat,
-				     tdc->cmd, 0, 0, FALSE);
+				     tdc->cmd, tdc->alpha1, tdc->alpha2, FALSE);
 
 	srcX += xDelta;
 	dstY += 4;
 	psbAccelSuperCompositeHelper(cb2, tdc, srcX, srcY, 0, 0, dstX, dstY,
 				     1, 1, width, height, tdc->sMode,
 				     tdc->mMode, tdc->dMode, tdc->fixPat,
-				     tdc->cmd, 0, 0, FALSE);
+				     tdc->cmd, tdc->alpha1, tdc->alpha2, FALSE);
 
     } else
 #endif
 	psbAccelSuperCompositeHelper(cb2, tdc, srcX, srcY, 0, 0, dstX, dstY,
 				     1, 1, width, height, tdc->sMode,
 				     tdc->mMode, tdc->dMode, tdc->fixPat,
-				     tdc->cmd, 0, 0, FALSE);
+				     tdc->cmd, tdc->alpha1, tdc->alpha2, FALSE);
 }
 
 PsbExaPtr
@@ -1320,6 +2374,8 @@ psbExaInit(ScrnInfoPtr pScrn)
     memset(pExa, 0, sizeof(*pExa));
     pExa->exa_major = 2;
     pExa->exa_minor = 2;
+    psbPixmapInit(pScrn, pPsbExa);
+
     pExa->memoryBase = mmBufVirtual(pPsbExa->exaBuf.buf);
     pExa->offScreenBase = 0;
     pExa->memorySize = mmBufSize(pPsbExa->exaBuf.buf);
@@ -1327,6 +2383,9 @@ psbExaInit(ScrnInfoPtr pScrn)
     pExa->pixmapPitchAlign = 32 * 4;
     pExa->flags = EXA_OFFSCREEN_PIXMAPS;
     pExa->flags |= EXA_HANDLES_PIXMAPS | EXA_MIXED_PIXMAPS;
+#ifdef EXA_SUPPORTS_PREPARE_AUX
+    pExa->flags |= EXA_SUPPORTS_PREPARE_AUX;
+#endif
     pExa->maxX = 2047;
     pExa->maxY = 2047;
     pExa->WaitMarker = psbExaWaitMarker;
@@ -1336,18 +2395,20 @@ psbExaInit(ScrnInfoPtr pScrn)
     pExa->DoneSolid = psbExaDoneSuper;
     pExa->PrepareCopy = psbExaPrepareSuperCopy;
     pExa->Copy = psbExaSuperCopy;
-    pExa->DoneCopy = psbExaDoneSuper;
+    pExa->DoneCopy = psbExaDoneSuperCopy;
     pExa->CheckComposite = psbExaCheckComposite;
     pExa->PrepareComposite = psbExaPrepareSuperComposite;
     pExa->Composite = psbExaSuperComposite;
     pExa->DoneComposite = psbExaDoneComposite;
     pExa->PixmapIsOffscreen = psbExaPixmapIsOffscreen;
-	pExa->CreatePixmap = NULL;
-	pExa->CreatePixmap2 = psbExaCreatePixmap;
-	pExa->DestroyPixmap = psbExaDestroyPixmap;
+    pExa->CreatePixmap = NULL;
+    pExa->CreatePixmap2 = psbExaCreatePixmap;
+    pExa->DestroyPixmap = psbExaDestroyPixmap;
+    pExa->ModifyPixmapHeader = psbExaModifyPixmapHeader;
     pExa->PrepareAccess = psbExaPrepareAccess;
     pExa->FinishAccess = psbExaFinishAccess;
     pExa->UploadToScreen = psbExaUploadToScreen;
+    pExa->DownloadFromScreen = psbExaDownloadFromScreen;
 
     if (!exaDriverInit(pScrn->pScreen, pExa)) {
 	goto out_err;
@@ -1358,10 +2419,26 @@ psbExaInit(ScrnInfoPtr pScrn)
 
     pPsb->td.srcState = FALSE;
     pPsb->td.dstState = FALSE;
-    pPsb->td.bhFence = TRUE;
+    pPsb->td.shadowSrc.valid = FALSE;
+    pPsb->td.shadowDst.valid = FALSE;
+    pPsb->td.shadowPat.valid = FALSE;
+    pPsb->td.patCopy = FALSE;
+    pPsb->td.dirty = TRUE;
+    pPsb->td.dirtyMulti = TRUE;
+    pPsb->td.dwordsSaved = 0;
     psbSetStateCallback(&pPsb->superC, &psbAccelVolatileStateCallback,
 			&pPsb->td);
 
+    pPsbExa->statTime = GetTimeInMillis();
+    psbUploadInit(pScrn, pPsbExa);
+
+    pPsbExa->calPending =
+	psbCalibrateInit(pScrn, pPsbExa, pPsb->exaCalibrate,
+			 pPsb->exaCalibrationFile, !pPsb->secondary);
+
+    pPsbExa->blockHandler = pScrn->pScreen->BlockHandler;
+    pScrn->pScreen->BlockHandler = psbExaBlockHandler;
+
     return pPsbExa;
 
   out_err:
@@ -1385,14 +2462,23 @@ psbTexOffsetStart(PixmapPtr pPix)
 {
     ScreenPtr pScreen = pPix->drawable.pScreen;
     ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    unsigned long offset;
 
     exaMoveInPixmap(pPix);
     ExaOffscreenMarkUsed(pPix);
+    psbAccelFlush(pScrn);
 
     if (!exaPixmapIsOffscreen(pPix))
         return ~0ULL;
 
-    return exaGetPixmapOffset(pPix);
+    /*
+     * DRI clients can only reach pixmaps in the shared EXA buffer.
+     */
+
+    if (!psbPixmapShare(pScrn, pPix, &offset))
+	return ~0ULL;
+
+    return offset;
 }
 
 #endif
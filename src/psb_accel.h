@@ -41,6 +41,139 @@
 
 struct _PsbDevice;
 
+/*
+ * Operations whose CPU / blitter crossover is calibrated.
+ */
+
+typedef enum
+{
+    PSB_CAL_SOLID = 0,
+    PSB_CAL_COPY,
+    PSB_CAL_COMPOSITE,
+    PSB_CAL_DOWNLOAD,
+    PSB_CAL_NUM_OPS
+} PsbCalOp;
+
+typedef enum
+{
+    PSB_CAL_MODE_OFF = 0,
+    PSB_CAL_MODE_AUTO,
+    PSB_CAL_MODE_FORCE
+} PsbCalMode;
+
+#define PSB_CAL_NUM_BPP 2
+#define PSB_CAL_BPP_INDEX(_bpp) (((_bpp) > 16) ? 1 : 0)
+#define PSB_CAL_DEFAULT_FILE "/var/lib/xorg/psb_exa_calibration"
+
+/*
+ * The scratch area is split in buffers that are used in turn, so that
+ * the blitter can fill one while the CPU reads from another.
+ */
+
+#define PSB_EXA_NUM_SCRATCH 2
+
+/*
+ * Pixmaps have buffers of their own. The first page of the EXA buffer
+ * only provides the memory base EXA wants. With DRI, it is followed by
+ * an area that pixmaps DRI clients texture from are moved into, since
+ * the EXA buffer is the only one they can reach.
+ */
+
+#define PSB_EXA_BASE_SIZE 4096
+#define PSB_EXA_DRI_SIZE (8 * 1024 * 1024)
+
+/*
+ * Client memory wrapped as a buffer object for uploads. Wrapped MIT-SHM
+ * segments are kept for reuse.
+ */
+
+#define PSB_UPLOAD_CACHE_SIZE 8
+
+typedef struct _PsbUploadSeg
+{
+    struct _MMBuffer *buf;
+    XID shmseg;
+    unsigned long start;
+    unsigned long end;
+    unsigned long generation;
+    unsigned long lastUse;
+} PsbUploadSegRec, *PsbUploadSegPtr;
+
+/*
+ * Pixmap storage. Pixmaps up to the largest chunk size are sub-allocated
+ * from slabs, larger ones get a buffer of their own.
+ */
+
+#define PSB_PIXMAP_SLAB_SIZE (256 * 1024)
+#define PSB_PIXMAP_CHUNK_MIN 512
+#define PSB_PIXMAP_SLAB_CLASSES 7
+#define PSB_PIXMAP_SLAB_WORDS \
+    (PSB_PIXMAP_SLAB_SIZE / PSB_PIXMAP_CHUNK_MIN / 32)
+
+typedef struct _PsbPixmapBuf
+{
+    PsbBufListRec entry;
+    MMListHead allHead;
+    MMListHead cacheHead;
+    unsigned long size;
+    unsigned flags;
+    CARD32 lastUse;
+} PsbPixmapBufRec, *PsbPixmapBufPtr;
+
+typedef struct _PsbPixmapSlab
+{
+    MMListHead head;
+    PsbPixmapBufPtr pBuf;
+    unsigned chunkSize;
+    unsigned numFree;
+    CARD32 freeMask[PSB_PIXMAP_SLAB_WORDS];
+    CARD32 lastUse;
+} PsbPixmapSlabRec, *PsbPixmapSlabPtr;
+
+typedef struct _PsbPixmapRange
+{
+    MMListHead head;
+    unsigned long offset;
+    unsigned long size;
+} PsbPixmapRangeRec, *PsbPixmapRangePtr;
+
+/*
+ * EXA driver private of a pixmap. buf is NULL if the pixmap has no
+ * storage the hardware can reach. The storage is owned by the pixmap
+ * if slab or pBuf is set, or if driSize is, in which case it is in the
+ * DRI area of the EXA buffer. cpuBytes and gpuBytes are the access
+ * history psbPixmapCPUAccess decides on, and sysCopy is its decision.
+ * mapped has a bit set for each EXA access index the storage is mapped
+ * for.
+ */
+
+typedef struct _PsbPixmap
+{
+    struct _MMBuffer *buf;
+    unsigned long offset;
+    PsbPixmapBufPtr pBuf;
+    PsbPixmapSlabPtr slab;
+    unsigned chunk;
+    unsigned long driSize;
+    unsigned long cpuBytes;
+    unsigned long gpuBytes;
+    Bool sysCopy;
+    unsigned mapped;
+} PsbPixmapRec, *PsbPixmapPtr;
+
+/*
+ * Surface state last emitted to the 2D command stream.
+ */
+
+typedef struct _PsbTwodSurfState
+{
+    Bool valid;
+    struct _MMBuffer *buffer;
+    CARD32 offset;
+    CARD32 stride;
+    CARD32 mode;
+} PsbTwodSurfStateRec, *PsbTwodSurfStatePtr;
+
 typedef struct _PsbTwodContext
 {
     CARD32 sMode;
@@ -62,18 +195,110 @@ typedef struct _PsbTwodContext
     int srcHeight;
     Bool twoPassComp;
     Bool comp2D;
+    CARD32 alpha1;
+    CARD32 alpha2;
     Bool srcState;
     Bool dstState;
-    Bool bhFence;
+
+    /*
+     * Copies from a pattern sized pixmap are merged and done as pattern
+     * fills where they repeat it, and as plain copies with copyCmd
+     * otherwise. patRow is the band of merged copies being built, and
+     * patRect the bands merged below each other before it. The phases
+     * give the pattern position at destination coordinate 0.
+     */
+
+    Bool patCopy;
+    CARD32 copyCmd;
+    struct _MMBuffer *pBuffer;
+    CARD32 pOffset;
+    CARD32 pStride;
+    CARD32 pMode;
+    int patWidth;
+    int patHeight;
+    BoxRec patRow;
+    int patRowX;
+    int patRowY;
+    BoxRec patRect;
+    int patRectX;
+    int patRectY;
+
+    /*
+     * Shadow state, valid for the batch numbered shadowBatch.
+     */
+
+    unsigned long shadowBatch;
+    PsbTwodSurfStateRec shadowSrc;
+    PsbTwodSurfStateRec shadowDst;
+    PsbTwodSurfStateRec shadowPat;
+
+    /*
+     * Area written by blits since the last fence: the byte range
+     * [dirtyStart, dirtyEnd) of dirtyBuffer and, while all of it went
+     * to one surface, that surface's box. If blits have written to
+     * more than one buffer, dirtyMulti is set.
+     */
+
+    Bool dirty;
+    Bool dirtyMulti;
+    struct _MMBuffer *dirtyBuffer;
+    unsigned long dirtyStart;
+    unsigned long dirtyEnd;
+    Bool dirtyBoxValid;
+    CARD32 dirtyOffset;
+    CARD32 dirtyStride;
+    BoxRec dirtyBox;
+
+    unsigned long long dwordsSaved;
 } PsbTwodContextRec, *PsbTwodContextPtr;
 
 typedef struct _PsbExa
 {
     PsbBufListRec tmpBuf;
-    PsbBufListRec scratchBuf;
+    PsbBufListRec scratchBuf[PSB_EXA_NUM_SCRATCH];
+    Bool scratchCached;
     PsbBufListRec exaBuf;
     ExaDriverPtr pExa;
     Bool exaUp;
+    ScreenBlockHandlerProcPtr blockHandler;
+
+    /*
+     * 2D submission statistics.
+     */
+
+    CARD32 statTime;
+    unsigned long statSubmits;
+    unsigned long long statDwords;
+    unsigned long long statSaved;
+
+    /*
+     * Smallest pixmap area, in pixels, for which the blitter is used
+     * rather than the CPU. Indexed by PsbCalOp and PSB_CAL_BPP_INDEX.
+     */
+
+    unsigned minPixels[PSB_CAL_NUM_OPS][PSB_CAL_NUM_BPP];
+    Bool calPending;
+
+    PsbUploadSegRec uploadCache[PSB_UPLOAD_CACHE_SIZE];
+    unsigned long uploadTick;
+    Bool uploadUp;
+    Bool uploadShm;
+    Bool uploadShmProbed;
+
+    /*
+     * Pixmap storage. pixBytes counts all pixmap buffers, pixCached
+     * the unused ones kept for reuse. driFree holds the free ranges of
+     * the DRI area of the EXA buffer.
+     */
+
+    MMListHead pixSlabs[PSB_PIXMAP_SLAB_CLASSES];
+    MMListHead pixCache;
+    MMListHead pixBufs;
+    unsigned long pixBytes;
+    unsigned long pixCached;
+    unsigned long pixBudget;
+    CARD32 pixExpireTime;
+    MMListHead driFree;
 
     /*
      * Composite stuff.
@@ -99,8 +324,86 @@ typedef struct _PsbExa
 
 extern void psbExaClose(PsbExaPtr pPsbExa, ScreenPtr pScreen);
 extern PsbExaPtr psbExaInit(ScrnInfoPtr pScrn);
+extern void psbAccelFlush(ScrnInfoPtr pScrn);
 extern void psbPixelARGB8888(unsigned format, void *pixelP,
 			     CARD32 * argb8888);
 extern Bool psbExpandablePixel(int format);
 extern unsigned long long psbTexOffsetStart(PixmapPtr pPix);
+extern void psbAccelCalibrateBlit(ScrnInfoPtr pScrn, PsbCalOp op,
+				  struct _MMBuffer *buf,
+				  unsigned long srcOffset,
+				  unsigned long dstOffset, unsigned stride,
+				  int bpp, int w, int h);
+extern void psbAccelInvalidateState(PsbTwodContextPtr tdc);
+extern Bool psbAccelUploadBlit(PixmapPtr pDst, int x, int y, int w, int h,
+			       struct _MMBuffer *buf, unsigned long srcOffset,
+			       int srcX, unsigned long srcPitch);
+
+/*
+ * psb_calibrate.c
+ */
+
+extern void psbCalibrateDefaults(PsbExaPtr pPsbExa);
+extern Bool psbCalibrateLoad(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa,
+			     const char *name);
+extern Bool psbCalibrateSave(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa,
+			     const char *name);
+extern Bool psbCalibrateRun(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa);
+extern Bool psbCalibrateInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa,
+			     PsbCalMode mode, const char *name,
+			     Bool canSave);
+
+/*
+ * psb_upload.c
+ */
+
+extern void psbUploadInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa);
+extern void psbUploadClose(PsbExaPtr pPsbExa);
+extern void psbUploadExpire(PsbExaPtr pPsbExa);
+extern Bool psbUploadUserBuf(PixmapPtr pDst, int x, int y, int w, int h,
+			     char *src, int src_pitch);
+
+/*
+ * psb_pixmap.c
+ */
+
+extern void psbPixmapInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa);
+extern void psbPixmapClose(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa);
+extern void psbPixmapExpire(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa);
+extern void *psbExaCreatePixmap(ScreenPtr pScreen, int w, int h, int depth,
+				int usage_hint, int bpp, int *new_pitch);
+extern void psbExaDestroyPixmap(ScreenPtr pScreen, void *driverPriv);
+extern Bool psbExaModifyPixmapHeader(PixmapPtr pPix, int w, int h, int depth,
+				     int bpp, int devKind, pointer pPixData);
+extern Bool psbExaPixmapIsOffscreen(PixmapPtr p);
+extern Bool psbPixmapShare(ScrnInfoPtr pScrn, PixmapPtr pPix,
+			   unsigned long *offset);
+extern Bool psbPixmapCPUAccess(PixmapPtr pPix, int index);
+
+static inline PsbPixmapPtr
+psbPixmapPriv(PixmapPtr pPix)
+{
+    return (PsbPixmapPtr) exaGetPixmapDriverPrivate(pPix);
+}
+
+/*
+ * Count a w x h rectangle the 2D engine draws into a pixmap.
+ */
+
+static inline void
+psbPixmapGPUAccess(PixmapPtr pPix, int w, int h)
+{
+    PsbPixmapPtr priv = psbPixmapPriv(pPix);
+
+    if (priv)
+	priv->gpuBytes += (unsigned long)w * h *
+	    (pPix->drawable.bitsPerPixel >> 3);
+}
+
+static inline Bool
+psbCalibrateUseBlitter(PsbExaPtr pPsbExa, PsbCalOp op, int bpp,
+		       unsigned long pixels)
+{
+    return (pixels >= pPsbExa->minPixels[op][PSB_CAL_BPP_INDEX(bpp)]);
+}
 #endif
@@ -58,7 +58,7 @@ psbScanoutDestroy(PsbScanoutPtr scanout)
     psbDRIUpdateScanouts(scanout->pScrn);
 #endif
 
-    mmListDel(&scanout->entry.head);
+    psbBufIndexRemove(&scanout->entry);
     if (scanout->entry.buf) {
 
 	/*
@@ -160,7 +160,7 @@ psbScanoutCreate(ScrnInfoPtr pScrn, unsigned cpp, unsigned depth,
     tmp->offset = mmBufOffset(tmp->entry.buf) & 0x0FFFFFFF;
     man->unMapBuf(tmp->entry.buf);
     tmp->entry.validated = FALSE;
-    mmListAddTail(&tmp->entry.head, &pPsb->buffers);
+    psbBufIndexInsert(&pPsb->buffers, &tmp->entry);
 
 #ifdef XF86DRI
     if (front)
@@ -180,20 +180,124 @@ psbScanoutCreate(ScrnInfoPtr pScrn, unsigned cpp, unsigned depth,
     return NULL;
 }
 
+void
+psbBufIndexInit(PsbBufIndexPtr index)
+{
+    mmInitListHead(&index->list);
+    index->entries = NULL;
+    index->numEntries = 0;
+    index->maxEntries = 0;
+    index->linear = FALSE;
+}
+
+/*
+ * Return the position of the first entry starting above addr.
+ */
+
+static int
+psbBufIndexUpper(PsbBufIndexPtr index, unsigned long addr)
+{
+    int lo = 0;
+    int hi = index->numEntries;
+    int mid;
+
+    while (lo < hi) {
+	mid = (lo + hi) >> 1;
+	if (index->entries[mid]->start <= addr)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+void
+psbBufIndexInsert(PsbBufIndexPtr index, PsbBufListPtr b)
+{
+    PsbBufListPtr *entries;
+    int pos;
+
+    b->start = (unsigned long)mmBufVirtual(b->buf);
+    b->end = b->start + mmBufSize(b->buf);
+    b->index = index;
+    mmListAddTail(&b->head, &index->list);
+
+    if (index->linear)
+	return;
+
+    if (index->numEntries == index->maxEntries) {
+	entries = xrealloc(index->entries, (index->maxEntries + 16) *
+			   sizeof(*entries));
+	if (!entries) {
+	    xfree(index->entries);
+	    index->entries = NULL;
+	    index->numEntries = 0;
+	    index->maxEntries = 0;
+	    index->linear = TRUE;
+	    return;
+	}
+	index->entries = entries;
+	index->maxEntries += 16;
+    }
+
+    pos = psbBufIndexUpper(index, b->start);
+    memmove(&index->entries[pos + 1], &index->entries[pos],
+	    (index->numEntries - pos) * sizeof(*index->entries));
+    index->entries[pos] = b;
+    index->numEntries++;
+}
+
+void
+psbBufIndexRemove(PsbBufListPtr b)
+{
+    PsbBufIndexPtr index = b->index;
+    int pos;
+
+    mmListDelInit(&b->head);
+    if (!index)
+	return;
+
+    b->index = NULL;
+    if (index->linear)
+	return;
+
+    pos = psbBufIndexUpper(index, b->start);
+    while (--pos >= 0 && index->entries[pos] != b) ;
+    if (pos < 0)
+	return;
+
+    index->numEntries--;
+    memmove(&index->entries[pos], &index->entries[pos + 1],
+	    (index->numEntries - pos) * sizeof(*index->entries));
+
+    if (!index->numEntries) {
+	xfree(index->entries);
+	index->entries = NULL;
+	index->maxEntries = 0;
+    }
+}
+
 PsbBufListPtr
-psbInBuffer(MMListHead * head, void *ptr)
+psbInBuffer(PsbBufIndexPtr index, void *ptr)
 {
+    unsigned long addr = (unsigned long)ptr;
     PsbBufListPtr entry;
-    struct _MMBuffer *buf;
     MMListHead *list;
-    unsigned long offset;
-
-    mmListForEach(list, head) {
-	entry = mmListEntry(list, PsbBufListRec, head);
-	buf = entry->buf;
-	offset = (unsigned long)ptr - (unsigned long)mmBufVirtual(buf);
-	if (offset < mmBufSize(buf))
-	    return entry;
+    int pos;
+
+    if (index->linear) {
+	mmListForEach(list, &index->list) {
+	    entry = mmListEntry(list, PsbBufListRec, head);
+	    if (addr - entry->start < entry->end - entry->start)
+		return entry;
+	}
+	return NULL;
     }
-    return NULL;
+
+    pos = psbBufIndexUpper(index, addr);
+    if (pos == 0)
+	return NULL;
+
+    entry = index->entries[pos - 1];
+    return (addr < entry->end) ? entry : NULL;
 }
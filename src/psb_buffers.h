@@ -36,13 +36,39 @@
 #include "libmm/mm_defines.h"
 #include "libmm/mm_interface.h"
 
+struct _PsbBufIndex;
+
 typedef struct _PsbBufList
 {
     MMListHead head;
     struct _MMBuffer *buf;
     Bool validated;
+
+    /*
+     * Virtual range of buf, if the entry is in an index.
+     */
+
+    struct _PsbBufIndex *index;
+    unsigned long start;
+    unsigned long end;
 } PsbBufListRec, *PsbBufListPtr;
 
+/*
+ * Buffers the CPU may reach pixmap data in. Besides the list, entries are
+ * kept in an array sorted by virtual start address, so that the buffer
+ * holding an address can be found with a binary search. If the array
+ * can't be grown, lookups fall back to walking the list.
+ */
+
+typedef struct _PsbBufIndex
+{
+    MMListHead list;
+    PsbBufListPtr *entries;
+    int numEntries;
+    int maxEntries;
+    Bool linear;
+} PsbBufIndexRec, *PsbBufIndexPtr;
+
 typedef struct _PsbScanoutRec
 {
     PsbBufListRec entry;
@@ -117,13 +143,17 @@ psbScanoutRotation(PsbScanoutPtr psbScanout)
     return psbScanout->rotation;
 }
 
+extern void psbBufIndexInit(PsbBufIndexPtr index);
+extern void psbBufIndexInsert(PsbBufIndexPtr index, PsbBufListPtr b);
+extern void psbBufIndexRemove(PsbBufListPtr b);
+
 static inline void
 psbClearBufItem(PsbBufListPtr b)
 {
     if (!b)
 	return;
 
-    mmListDelInit(&b->head);
+    psbBufIndexRemove(b);
     if (b->buf) {
 	mmBufDestroy(b->buf);
 	b->buf = NULL;
@@ -132,7 +162,7 @@ psbClearBufItem(PsbBufListPtr b)
 }
 
 static inline void
-psbAddBufItem(MMListHead * list, PsbBufListPtr b, struct _MMBuffer *buf)
+psbAddBufItem(PsbBufIndexPtr index, PsbBufListPtr b, struct _MMBuffer *buf)
 {
 
     if (!buf)
@@ -141,7 +171,7 @@ psbAddBufItem(MMListHead * list, PsbBufListPtr b, struct _MMBuffer *buf)
     b->validated = FALSE;
     buf->man->mapBuf(buf, MM_FLAG_READ | MM_FLAG_WRITE, 0);
     buf->man->unMapBuf(buf);
-    mmListAddTail(&b->head, list);
+    psbBufIndexInsert(index, b);
 }
 
 extern PsbScanoutPtr
@@ -153,5 +183,5 @@ extern void *psbScanoutMap(PsbScanoutPtr scanout);
 void psbScanoutUnMap(PsbScanoutPtr scanout);
 extern void psbScanoutDestroy(PsbScanoutPtr scanout);
 
-extern PsbBufListPtr psbInBuffer(MMListHead * head, void *ptr);
+extern PsbBufListPtr psbInBuffer(PsbBufIndexPtr index, void *ptr);
 #endif
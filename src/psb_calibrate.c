@@ -0,0 +1,464 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Calibration of the pixmap sizes from which the blitter is faster
+ * than the CPU.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "psb_accel.h"
+#include "psb_driver.h"
+
+#define PSB_CAL_VERSION 1
+#define PSB_CAL_NUM_SIZES 6
+#define PSB_CAL_MAX_SIDE 256
+#define PSB_CAL_STRIDE (PSB_CAL_MAX_SIDE * 4)
+#define PSB_CAL_AREA_SIZE (PSB_CAL_MAX_SIDE * PSB_CAL_STRIDE)
+#define PSB_CAL_PIXELS (1 << 20)      /* Pixels per measurement */
+#define PSB_CAL_MAX_REPS 4096
+#define PSB_CAL_LINE_SIZE 128
+
+/*
+ * Built-in thresholds, used until calibrated or when calibration is off.
+ * ~0 means always use the CPU.
+ */
+
+static const unsigned psbCalDefaults[PSB_CAL_NUM_OPS] = {
+    ~0U,			       /* solid */
+    256,			       /* copy */
+    512,			       /* composite */
+    256				       /* download */
+};
+
+static const char *psbCalOpNames[PSB_CAL_NUM_OPS] = {
+    "solid",
+    "copy",
+    "composite",
+    "download"
+};
+
+static const int psbCalBpp[PSB_CAL_NUM_BPP] = { 16, 32 };
+
+static const int psbCalSides[PSB_CAL_NUM_SIZES] = {
+    8, 16, 32, 64, 128, PSB_CAL_MAX_SIDE
+};
+
+void
+psbCalibrateDefaults(PsbExaPtr pPsbExa)
+{
+    int op, i;
+
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	for (i = 0; i < PSB_CAL_NUM_BPP; ++i)
+	    pPsbExa->minPixels[op][i] = psbCalDefaults[op];
+}
+
+static int
+psbCalOpByName(const char *name)
+{
+    int op;
+
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	if (!strcmp(name, psbCalOpNames[op]))
+	    return op;
+
+    return -1;
+}
+
+/*
+ * Read a profile saved by psbCalibrateSave. The profile is only used if
+ * it has the right version and contains an entry for every operation.
+ */
+
+Bool
+psbCalibrateLoad(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, const char *name)
+{
+    unsigned minPixels[PSB_CAL_NUM_OPS][PSB_CAL_NUM_BPP];
+    unsigned found = 0;
+    char line[PSB_CAL_LINE_SIZE];
+    char opName[PSB_CAL_LINE_SIZE];
+    unsigned pixels;
+    int version, op, bpp;
+    FILE *f;
+
+    f = fopen(name, "r");
+    if (!f)
+	return FALSE;
+
+    if (!fgets(line, sizeof(line), f) ||
+	sscanf(line, "psb-exa-calibration %d", &version) != 1 ||
+	version != PSB_CAL_VERSION)
+	goto out_bad;
+
+    while (fgets(line, sizeof(line), f)) {
+	if (line[0] == '#' || line[0] == '\n')
+	    continue;
+	if (sscanf(line, "%s %d %u", opName, &bpp, &pixels) != 3)
+	    goto out_bad;
+	op = psbCalOpByName(opName);
+	if (op < 0 || (bpp != 16 && bpp != 32))
+	    goto out_bad;
+	minPixels[op][PSB_CAL_BPP_INDEX(bpp)] = pixels;
+	found |= 1 << (op * PSB_CAL_NUM_BPP + PSB_CAL_BPP_INDEX(bpp));
+    }
+    fclose(f);
+
+    if (found != (1 << (PSB_CAL_NUM_OPS * PSB_CAL_NUM_BPP)) - 1) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "[EXA] Incomplete calibration profile \"%s\".\n", name);
+	return FALSE;
+    }
+
+    memcpy(pPsbExa->minPixels, minPixels, sizeof(minPixels));
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+	       "[EXA] Using calibration profile \"%s\".\n", name);
+    return TRUE;
+
+  out_bad:
+    fclose(f);
+    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+	       "[EXA] Ignoring invalid calibration profile \"%s\".\n", name);
+    return FALSE;
+}
+
+Bool
+psbCalibrateSave(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, const char *name)
+{
+    char *tmpName;
+    FILE *f;
+    int op, i;
+    Bool ret = FALSE;
+
+    tmpName = xalloc(strlen(name) + 5);
+    if (!tmpName)
+	return FALSE;
+    sprintf(tmpName, "%s.tmp", name);
+
+    f = fopen(tmpName, "w");
+    if (!f)
+	goto out;
+
+    fprintf(f, "psb-exa-calibration %d\n", PSB_CAL_VERSION);
+    fprintf(f, "# operation bpp min-pixels\n");
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	for (i = 0; i < PSB_CAL_NUM_BPP; ++i)
+	    fprintf(f, "%s %d %u\n", psbCalOpNames[op], psbCalBpp[i],
+		    pPsbExa->minPixels[op][i]);
+
+    if (fclose(f) == 0 && rename(tmpName, name) == 0)
+	ret = TRUE;
+    else
+	unlink(tmpName);
+
+  out:
+    if (!ret)
+	xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+		       "[EXA] Could not save calibration profile \"%s\".\n",
+		       name);
+    xfree(tmpName);
+    return ret;
+}
+
+/*
+ * Return whether the directory of a profile can take a new file.
+ */
+
+static Bool
+psbCalDirWritable(const char *name)
+{
+    const char *slash = strrchr(name, '/');
+    char *dir;
+    Bool ret;
+
+    if (!slash)
+	return access(".", W_OK | X_OK) == 0;
+    if (slash == name)
+	return access("/", W_OK | X_OK) == 0;
+
+    dir = xalloc(slash - name + 1);
+    if (!dir)
+	return FALSE;
+    memcpy(dir, name, slash - name);
+    dir[slash - name] = 0;
+    ret = (access(dir, W_OK | X_OK) == 0);
+    xfree(dir);
+
+    return ret;
+}
+
+/*
+ * Set up the thresholds for the given calibration mode and return
+ * whether a calibration run should follow. In auto mode, an existing
+ * profile is used even if it turns out to be invalid, and a calibration
+ * is only run when there is no profile yet and one can be saved, so
+ * that it is done once rather than on every server start.
+ */
+
+Bool
+psbCalibrateInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, PsbCalMode mode,
+		 const char *name, Bool canSave)
+{
+    psbCalibrateDefaults(pPsbExa);
+
+    switch (mode) {
+    case PSB_CAL_MODE_FORCE:
+	return TRUE;
+    case PSB_CAL_MODE_AUTO:
+	if (access(name, F_OK) == 0) {
+	    psbCalibrateLoad(pScrn, pPsbExa, name);
+	    return FALSE;
+	}
+	if (!canSave || !psbCalDirWritable(name)) {
+	    xf86DrvMsgVerb(pScrn->scrnIndex, X_INFO, 3,
+			   "[EXA] No calibration profile \"%s\" and none "
+			   "can be saved. Using built-in thresholds.\n", name);
+	    return FALSE;
+	}
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+static unsigned long long
+psbCalTimeDiff(struct timeval *then, struct timeval *now)
+{
+    return (unsigned long long)(now->tv_sec - then->tv_sec) * 1000000ULL +
+	now->tv_usec - then->tv_usec;
+}
+
+/*
+ * Time reps software fills or copies, including the buffer
+ * map / unmap that the EXA software fallbacks pay for each operation.
+ * The source is the first area of the buffer, the destination the second.
+ * Fails if the buffer can't be mapped.
+ */
+
+static Bool
+psbCalTimeCPU(PsbCalOp op, struct _MMBuffer *buf, CARD8 *virtual,
+	      int cpp, int side, int reps, unsigned long long *usec)
+{
+    struct timeval then, now;
+    CARD8 *src = virtual;
+    CARD8 *dst = virtual + PSB_CAL_AREA_SIZE;
+    int i, y;
+
+    gettimeofday(&then, NULL);
+    for (i = 0; i < reps; ++i) {
+	if (buf->man->mapBuf(buf, MM_FLAG_READ | MM_FLAG_WRITE, 0))
+	    return FALSE;
+	for (y = 0; y < side; ++y) {
+	    if (op == PSB_CAL_SOLID)
+		memset(dst + y * PSB_CAL_STRIDE, i & 0xFF, side * cpp);
+	    else
+		memcpy(dst + y * PSB_CAL_STRIDE, src + y * PSB_CAL_STRIDE,
+		       side * cpp);
+	}
+	buf->man->unMapBuf(buf);
+    }
+    gettimeofday(&now, NULL);
+
+    *usec = psbCalTimeDiff(&then, &now);
+    return TRUE;
+}
+
+/*
+ * Time reps blitter fills or copies, submitted the way EXA would
+ * submit them, up to the point where the CPU can access the result.
+ * The DRI lock must be held. Fails if the buffer can't be mapped.
+ */
+
+static Bool
+psbCalTimeBlit(ScrnInfoPtr pScrn, PsbCalOp op, struct _MMBuffer *buf,
+	       int bpp, int side, int reps, unsigned long long *usec)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    Psb2DBufferPtr cb = &pPsb->superC;
+    struct timeval then, now;
+    int i;
+
+    gettimeofday(&then, NULL);
+    for (i = 0; i < reps; ++i) {
+	psbAccelCalibrateBlit(pScrn, op, buf, 0, PSB_CAL_AREA_SIZE,
+			      PSB_CAL_STRIDE, bpp, side, side);
+	if (!pPsb->exaLazyFlush)
+	    psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
+    }
+    psbFlush2D(cb, DRM_FENCE_FLAG_NO_USER, NULL);
+    if (buf->man->mapBuf(buf, MM_FLAG_READ | MM_FLAG_WRITE, 0))
+	return FALSE;
+    buf->man->unMapBuf(buf);
+    gettimeofday(&now, NULL);
+
+    *usec = psbCalTimeDiff(&then, &now);
+    return TRUE;
+}
+
+/*
+ * Return the smallest measured area from which the blitter is at least
+ * as fast as the CPU for all larger sizes. If the CPU wins even at the
+ * largest size, the threshold is put just beyond the measured range.
+ */
+
+static unsigned
+psbCalCrossover(const unsigned long long *cpu,
+		const unsigned long long *blit)
+{
+    unsigned side = PSB_CAL_MAX_SIDE * 2;
+    int i;
+
+    for (i = PSB_CAL_NUM_SIZES - 1; i >= 0; --i) {
+	if (blit[i] > cpu[i])
+	    break;
+	side = psbCalSides[i];
+    }
+
+    return side * side;
+}
+
+/*
+ * Measure CPU and blitter fills and copies at a range of sizes and
+ * derive the solid, copy and composite thresholds from the crossover
+ * points. Uploads and downloads are not measured. If a measurement
+ * fails, the thresholds are left as they were.
+ */
+
+Bool
+psbCalibrateRun(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbDevicePtr pDevice = psbDevicePTR(pPsb);
+    unsigned long long cpu[PSB_CAL_NUM_SIZES];
+    unsigned long long blit[PSB_CAL_NUM_SIZES];
+    unsigned minPixels[PSB_CAL_NUM_OPS][PSB_CAL_NUM_BPP];
+    struct _MMBuffer *buf;
+    CARD8 *virtual;
+    Bool ret = TRUE;
+    int b, i, op, reps;
+
+    if (!pPsb->has2DBuffer)
+	return FALSE;
+
+    buf = pDevice->man->createBuf(pDevice->man, 2 * PSB_CAL_AREA_SIZE, 0,
+				  MM_FLAG_READ | MM_FLAG_WRITE |
+				  MM_FLAG_MEM_TT, MM_HINT_DONT_FENCE);
+    if (!buf)
+	return FALSE;
+
+    if (buf->man->mapBuf(buf, MM_FLAG_READ | MM_FLAG_WRITE, 0)) {
+	mmBufDestroy(buf);
+	return FALSE;
+    }
+    buf->man->unMapBuf(buf);
+    virtual = mmBufVirtual(buf);
+    if (!virtual) {
+	mmBufDestroy(buf);
+	return FALSE;
+    }
+    memset(virtual, 0, 2 * PSB_CAL_AREA_SIZE);
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+	       "[EXA] Calibrating CPU / blitter thresholds.\n");
+
+    psbDRILock(pScrn, 0);
+    psbFlush2D(&pPsb->superC, DRM_FENCE_FLAG_NO_USER, NULL);
+
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b) {
+	for (op = PSB_CAL_SOLID; op <= PSB_CAL_COPY; ++op) {
+	    for (i = 0; i < PSB_CAL_NUM_SIZES; ++i) {
+		reps = PSB_CAL_PIXELS / (psbCalSides[i] * psbCalSides[i]);
+		if (reps > PSB_CAL_MAX_REPS)
+		    reps = PSB_CAL_MAX_REPS;
+
+		if (!psbCalTimeCPU(op, buf, virtual, psbCalBpp[b] >> 3,
+				   psbCalSides[i], reps, &cpu[i]) ||
+		    !psbCalTimeBlit(pScrn, op, buf, psbCalBpp[b],
+				    psbCalSides[i], reps, &blit[i])) {
+		    ret = FALSE;
+		    goto out;
+		}
+		PSB_DEBUG(pScrn->scrnIndex, 3,
+			  "[EXA] %s %dbpp %dx%d: cpu %llu us, blit %llu us "
+			  "for %d ops.\n", psbCalOpNames[op], psbCalBpp[b],
+			  psbCalSides[i], psbCalSides[i], cpu[i], blit[i],
+			  reps);
+	    }
+	    minPixels[op][b] = psbCalCrossover(cpu, blit);
+	}
+
+	/*
+	 * 2D composites are copies with a format conversion, but the
+	 * 3D fallback has a higher setup cost. Keep the default ratio
+	 * between the copy and composite thresholds.
+	 */
+
+	minPixels[PSB_CAL_COMPOSITE][b] = minPixels[PSB_CAL_COPY][b] *
+	    psbCalDefaults[PSB_CAL_COMPOSITE] / psbCalDefaults[PSB_CAL_COPY];
+    }
+
+  out:
+
+    /*
+     * The calibration buffer is going away. Make sure no shadow or
+     * dirty state refers to it.
+     */
+
+    psbAccelInvalidateState(&pPsb->td);
+    pPsb->td.dirty = TRUE;
+    pPsb->td.dirtyMulti = TRUE;
+    psbDRIUnlock(pScrn);
+
+    mmBufDestroy(buf);
+
+    if (!ret) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "[EXA] Calibration could not map its buffer. "
+		   "Keeping the current thresholds.\n");
+	return FALSE;
+    }
+    memcpy(pPsbExa->minPixels, minPixels, sizeof(minPixels));
+
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b)
+	for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		       "[EXA] %dbpp %s: blitter from %u pixels.\n",
+		       psbCalBpp[b], psbCalOpNames[op],
+		       pPsbExa->minPixels[op][b]);
+
+    return TRUE;
+}
@@ -0,0 +1,665 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Row copy kernels for write-combined destinations, selected at startup
+ * from the CPU features. The SSE kernels align the destination and use
+ * non-temporal stores, so that uploads don't pull the destination into
+ * the cache or stall on partial write-combining buffers.
+ *
+ * Planar chroma is interleaved the same way, so that all planar video
+ * formats are uploaded as NV12.
+ *
+ * Large copies can also be split in row bands and shared with a small
+ * pool of worker threads.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "xf86.h"
+#include "psb_copy.h"
+
+/*
+ * The SIMD kernels are built with per-function target attributes, so that
+ * the rest of the driver needn't be built with -msse2 on i386. The
+ * intrinsics headers only support that from gcc 4.9 on.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define PSB_COPY_X86
+#include <emmintrin.h>
+#include <pmmintrin.h>
+#define PSB_COPY_TARGET(_isa) __attribute__((target(_isa)))
+#endif
+
+/*
+ * Rows shorter than this are not worth the alignment overhead.
+ */
+
+#define PSB_COPY_MIN_STREAM 64
+
+/*
+ * Copies smaller than this are done by the calling thread alone.
+ */
+
+#define PSB_COPY_MIN_PARALLEL (64 * 1024)
+#define PSB_COPY_MAX_BANDS 32
+
+typedef struct _PsbCopyBand
+{
+    CARD8 *dst;
+    const CARD8 *src;
+    const CARD8 *srcV;
+    unsigned long dstPitch;
+    unsigned long srcPitch;
+    unsigned long wBytes;
+    unsigned long h;
+} PsbCopyBandRec, *PsbCopyBandPtr;
+
+/*
+ * Bands are handed out in queue order. pending counts the bands queued
+ * or being copied, and the queue is reset when it drops to zero.
+ */
+
+typedef struct _PsbCopyPool
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int numThreads;
+    int numBands;
+    int next;
+    int pending;
+    PsbCopyBandRec bands[PSB_COPY_MAX_BANDS];
+} PsbCopyPoolRec;
+
+static PsbCopyPoolRec psbCopyPool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+    0, 0, 0, 0
+};
+
+typedef void PsbCopyRowFunc(CARD8 *dst, const CARD8 *src,
+			    unsigned long size);
+
+static void
+psbCopyRowMemcpy(CARD8 *dst, const CARD8 *src, unsigned long size)
+{
+    memcpy(dst, src, size);
+}
+
+typedef void PsbInterleaveRowFunc(CARD8 *dst, const CARD8 *u,
+				  const CARD8 *v, unsigned long n);
+
+/*
+ * Write n byte pairs, u first. This is the reference the SIMD kernel
+ * must match byte for byte.
+ */
+
+static void
+psbInterleaveRowC(CARD8 *dst, const CARD8 *u, const CARD8 *v,
+		  unsigned long n)
+{
+    while (n--) {
+	*dst++ = *u++;
+	*dst++ = *v++;
+    }
+}
+
+static PsbCopyRowFunc *psbCopyRowUnaligned = psbCopyRowMemcpy;
+static PsbCopyRowFunc *psbCopyRowAligned = psbCopyRowMemcpy;
+static PsbInterleaveRowFunc *psbInterleaveRow = psbInterleaveRowC;
+static Bool psbCopyStreaming = FALSE;
+
+#ifdef PSB_COPY_X86
+
+#define PSB_CPUID_EDX_SSE2 (1 << 26)
+#define PSB_CPUID_ECX_SSE3 (1 << 0)
+
+static void
+psbCpuid(unsigned op, unsigned *ecx, unsigned *edx)
+{
+    unsigned eax = op;
+
+    /*
+     * Preserve ebx, which holds the GOT pointer in i386 PIC code.
+     */
+
+#ifdef __i386__
+    __asm__ __volatile__("pushl %%ebx\n\t"
+			 "cpuid\n\t"
+			 "popl %%ebx\n\t"
+			 :"+a"(eax), "=c"(*ecx), "=d"(*edx));
+#else
+    unsigned ebx;
+
+    __asm__ __volatile__("cpuid"
+			 :"+a"(eax), "=b"(ebx), "=c"(*ecx), "=d"(*edx));
+#endif
+}
+
+static Bool
+psbHasCpuid(void)
+{
+#ifdef __i386__
+    unsigned long a, b;
+
+    /*
+     * CPUID is available if the ID flag in EFLAGS can be toggled.
+     */
+
+    __asm__ __volatile__("pushfl\n\t"
+			 "pushfl\n\t"
+			 "popl %0\n\t"
+			 "movl %0, %1\n\t"
+			 "xorl $0x200000, %0\n\t"
+			 "pushl %0\n\t"
+			 "popfl\n\t"
+			 "pushfl\n\t"
+			 "popl %0\n\t"
+			 "popfl\n\t"
+			 :"=&r"(a), "=&r"(b));
+    return ((a ^ b) & 0x200000) != 0;
+#else
+    return TRUE;
+#endif
+}
+
+/*
+ * Copy the unaligned head with memcpy, so that the destination is
+ * 16-byte aligned for the streaming stores. Returns the number of
+ * bytes copied.
+ */
+
+static inline unsigned long
+psbCopyHead(CARD8 *dst, const CARD8 *src)
+{
+    unsigned long head = (-(unsigned long)dst) & 15;
+
+    if (head)
+	memcpy(dst, src, head);
+    return head;
+}
+
+#define PSB_COPY_ROW_SSE(_name, _isa, _load)				\
+static PSB_COPY_TARGET(_isa) void					\
+_name(CARD8 *dst, const CARD8 *src, unsigned long size)		\
+{									\
+    unsigned long head = psbCopyHead(dst, src);				\
+    __m128i x0, x1, x2, x3;						\
+									\
+    dst += head;							\
+    src += head;							\
+    size -= head;							\
+									\
+    while (size >= 64) {						\
+	x0 = _load((const __m128i *)src);				\
+	x1 = _load((const __m128i *)(src + 16));			\
+	x2 = _load((const __m128i *)(src + 32));			\
+	x3 = _load((const __m128i *)(src + 48));			\
+	_mm_stream_si128((__m128i *) dst, x0);				\
+	_mm_stream_si128((__m128i *) (dst + 16), x1);			\
+	_mm_stream_si128((__m128i *) (dst + 32), x2);			\
+	_mm_stream_si128((__m128i *) (dst + 48), x3);			\
+	dst += 64;							\
+	src += 64;							\
+	size -= 64;							\
+    }									\
+									\
+    while (size >= 16) {						\
+	_mm_stream_si128((__m128i *) dst, _load((const __m128i *)src));	\
+	dst += 16;							\
+	src += 16;							\
+	size -= 16;							\
+    }									\
+									\
+    if (size)								\
+	memcpy(dst, src, size);						\
+}
+
+/*
+ * Source and destination equally aligned: aligned loads.
+ */
+
+PSB_COPY_ROW_SSE(psbCopyRowSSE2Aligned, "sse2", _mm_load_si128)
+
+/*
+ * Unaligned source: lddqu on SSE3 CPUs, which avoids cache line split
+ * penalties, movdqu otherwise.
+ */
+
+PSB_COPY_ROW_SSE(psbCopyRowSSE2, "sse2", _mm_loadu_si128)
+PSB_COPY_ROW_SSE(psbCopyRowSSE3, "sse3", _mm_lddqu_si128)
+
+/*
+ * Interleave 16 byte pairs at a time with punpck{l,h}bw. Destinations
+ * that can't be 16-byte aligned are left to the C loop.
+ */
+
+static PSB_COPY_TARGET("sse2") void
+psbInterleaveRowSSE2(CARD8 *dst, const CARD8 *u, const CARD8 *v,
+		     unsigned long n)
+{
+    __m128i x0, x1;
+
+    while (n && ((unsigned long)dst & 15)) {
+	*dst++ = *u++;
+	*dst++ = *v++;
+	n--;
+    }
+
+    if (((unsigned long)dst & 15) == 0) {
+	while (n >= 16) {
+	    x0 = _mm_loadu_si128((const __m128i *)u);
+	    x1 = _mm_loadu_si128((const __m128i *)v);
+	    _mm_stream_si128((__m128i *) dst, _mm_unpacklo_epi8(x0, x1));
+	    _mm_stream_si128((__m128i *) (dst + 16),
+			     _mm_unpackhi_epi8(x0, x1));
+	    dst += 32;
+	    u += 16;
+	    v += 16;
+	    n -= 16;
+	}
+    }
+
+    psbInterleaveRowC(dst, u, v, n);
+}
+
+/*
+ * Order the non-temporal stores before anything that follows, in
+ * particular before the hardware is told to read the data.
+ */
+
+static PSB_COPY_TARGET("sse2") void
+psbCopyFence(void)
+{
+    _mm_sfence();
+}
+
+#endif
+
+static void psbCopyPoolInit(int scrnIndex, int numThreads,
+			    MessageType from);
+
+/*
+ * Use the best kernels the CPU supports, but none above max.
+ */
+
+PsbCopyKernel
+psbCopySelect(PsbCopyKernel max)
+{
+    PsbCopyKernel kernel = PSB_COPY_MEMCPY;
+
+    psbCopyStreaming = FALSE;
+    psbCopyRowAligned = psbCopyRowMemcpy;
+    psbCopyRowUnaligned = psbCopyRowMemcpy;
+    psbInterleaveRow = psbInterleaveRowC;
+
+#ifdef PSB_COPY_X86
+    if (max >= PSB_COPY_SSE2 && psbHasCpuid()) {
+	unsigned ecx, edx;
+
+	psbCpuid(1, &ecx, &edx);
+	if (edx & PSB_CPUID_EDX_SSE2) {
+	    kernel = PSB_COPY_SSE2;
+	    psbCopyStreaming = TRUE;
+	    psbCopyRowAligned = psbCopyRowSSE2Aligned;
+	    psbCopyRowUnaligned = psbCopyRowSSE2;
+	    psbInterleaveRow = psbInterleaveRowSSE2;
+	    if (max >= PSB_COPY_SSE3 && (ecx & PSB_CPUID_ECX_SSE3)) {
+		kernel = PSB_COPY_SSE3;
+		psbCopyRowUnaligned = psbCopyRowSSE3;
+	    }
+	}
+    }
+#endif
+
+    return kernel;
+}
+
+void
+psbCopyInit(int scrnIndex, int numThreads, MessageType from)
+{
+    static Bool initialized = FALSE;
+    static const char *names[] = { "memcpy", "SSE2", "SSE3" };
+
+    if (initialized)
+	return;
+    initialized = TRUE;
+
+    xf86DrvMsg(scrnIndex, X_INFO, "Using %s upload copies.\n",
+	       names[psbCopySelect(PSB_COPY_SSE3)]);
+
+    psbCopyPoolInit(scrnIndex, numThreads, from);
+}
+
+/*
+ * Copy h rows of wBytes bytes into write-combined memory.
+ */
+
+void
+psbCopyRectWC(void *dst, unsigned long dstPitch,
+	      const void *src, unsigned long srcPitch,
+	      unsigned long wBytes, unsigned long h)
+{
+    CARD8 *d = (CARD8 *) dst;
+    const CARD8 *s = (const CARD8 *)src;
+
+    if (!psbCopyStreaming || wBytes < PSB_COPY_MIN_STREAM) {
+	while (h--) {
+	    memcpy(d, s, wBytes);
+	    d += dstPitch;
+	    s += srcPitch;
+	}
+	return;
+    }
+
+    while (h--) {
+	if ((((unsigned long)d ^ (unsigned long)s) & 15) == 0)
+	    psbCopyRowAligned(d, s, wBytes);
+	else
+	    psbCopyRowUnaligned(d, s, wBytes);
+	d += dstPitch;
+	s += srcPitch;
+    }
+
+#ifdef PSB_COPY_X86
+    psbCopyFence();
+#endif
+}
+
+/*
+ * Interleave h rows of n bytes from the u and v planes into
+ * write-combined memory.
+ */
+
+void
+psbInterleaveRectWC(void *dst, unsigned long dstPitch,
+		    const void *u, const void *v, unsigned long srcPitch,
+		    unsigned long n, unsigned long h)
+{
+    CARD8 *d = (CARD8 *) dst;
+    const CARD8 *su = (const CARD8 *)u;
+    const CARD8 *sv = (const CARD8 *)v;
+
+    while (h--) {
+	psbInterleaveRow(d, su, sv, n);
+	d += dstPitch;
+	su += srcPitch;
+	sv += srcPitch;
+    }
+
+#ifdef PSB_COPY_X86
+    if (psbCopyStreaming)
+	psbCopyFence();
+#endif
+}
+
+/*
+ * Bands with a second source interleave it with the first one, and
+ * wBytes counts byte pairs.
+ */
+
+static void
+psbCopyBandRun(PsbCopyBandPtr band)
+{
+    if (band->srcV)
+	psbInterleaveRectWC(band->dst, band->dstPitch, band->src, band->srcV,
+			    band->srcPitch, band->wBytes, band->h);
+    else
+	psbCopyRectWC(band->dst, band->dstPitch, band->src, band->srcPitch,
+		      band->wBytes, band->h);
+}
+
+/*
+ * Take the next queued band, with the pool mutex held.
+ */
+
+static Bool
+psbCopyTakeBand(PsbCopyBandPtr band)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+
+    if (pool->next == pool->numBands)
+	return FALSE;
+
+    *band = pool->bands[pool->next++];
+    return TRUE;
+}
+
+/*
+ * Account for a finished band, with the pool mutex held.
+ */
+
+static void
+psbCopyBandDone(void)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+
+    if (--pool->pending == 0) {
+	pool->numBands = 0;
+	pool->next = 0;
+	pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *
+psbCopyWorker(void *arg)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+    PsbCopyBandRec band;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+	while (!psbCopyTakeBand(&band))
+	    pthread_cond_wait(&pool->work, &pool->mutex);
+
+	pthread_mutex_unlock(&pool->mutex);
+	psbCopyBandRun(&band);
+	pthread_mutex_lock(&pool->mutex);
+
+	psbCopyBandDone();
+    }
+
+    return NULL;
+}
+
+/*
+ * Start the worker threads. They live as long as the server process.
+ * A negative thread count picks one thread less than there are CPUs,
+ * leaving a CPU for the server thread, which copies a band as well.
+ */
+
+static void
+psbCopyPoolInit(int scrnIndex, int numThreads, MessageType from)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+    sigset_t all, saved;
+    pthread_attr_t attr;
+    pthread_t thread;
+    long cpus;
+
+    if (numThreads < 0) {
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	numThreads = (cpus > 1) ? cpus - 1 : 0;
+    }
+    if (numThreads > PSB_COPY_MAX_THREADS)
+	numThreads = PSB_COPY_MAX_THREADS;
+
+    /*
+     * Signals are for the server thread only.
+     */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    while (pool->numThreads < numThreads) {
+	if (pthread_create(&thread, &attr, psbCopyWorker, NULL) != 0) {
+	    xf86DrvMsg(scrnIndex, X_WARNING,
+		       "Failed to start a copy thread.\n");
+	    break;
+	}
+	pool->numThreads++;
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    xf86DrvMsg(scrnIndex, from, "Using %d copy threads.\n",
+	       pool->numThreads);
+}
+
+/*
+ * Split a copy in row bands, one for each worker thread and one for
+ * the caller, and queue them. Small copies and copies that don't fit
+ * the queue are done right away.
+ */
+
+static void
+psbCopyQueue(const PsbCopyBandRec * rect, unsigned long bytes)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+    unsigned long numBands = pool->numThreads + 1;
+    unsigned long h = rect->h;
+    unsigned long bandH;
+    PsbCopyBandRec piece = *rect;
+
+    if (pool->numThreads == 0 || bytes < PSB_COPY_MIN_PARALLEL ||
+	h < numBands) {
+	psbCopyBandRun(&piece);
+	return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->numBands + numBands > PSB_COPY_MAX_BANDS) {
+	pthread_mutex_unlock(&pool->mutex);
+	psbCopyBandRun(&piece);
+	return;
+    }
+
+    bandH = (h + numBands - 1) / numBands;
+    while (h) {
+	if (bandH > h)
+	    bandH = h;
+
+	piece.h = bandH;
+	pool->bands[pool->numBands++] = piece;
+	pool->pending++;
+
+	piece.dst += bandH * piece.dstPitch;
+	piece.src += bandH * piece.srcPitch;
+	if (piece.srcV)
+	    piece.srcV += bandH * piece.srcPitch;
+	h -= bandH;
+    }
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/*
+ * Queue a copy. It may still be running on return; psbCopyWait()
+ * must be called before the destination is used.
+ */
+
+void
+psbCopyRectWCAsync(void *dst, unsigned long dstPitch,
+		   const void *src, unsigned long srcPitch,
+		   unsigned long wBytes, unsigned long h)
+{
+    PsbCopyBandRec rect;
+
+    rect.dst = (CARD8 *) dst;
+    rect.src = (const CARD8 *)src;
+    rect.srcV = NULL;
+    rect.dstPitch = dstPitch;
+    rect.srcPitch = srcPitch;
+    rect.wBytes = wBytes;
+    rect.h = h;
+    psbCopyQueue(&rect, wBytes * h);
+}
+
+/*
+ * Queue an interleave of two planes, as psbCopyRectWCAsync().
+ */
+
+void
+psbInterleaveRectWCAsync(void *dst, unsigned long dstPitch,
+			 const void *u, const void *v,
+			 unsigned long srcPitch, unsigned long n,
+			 unsigned long h)
+{
+    PsbCopyBandRec rect;
+
+    rect.dst = (CARD8 *) dst;
+    rect.src = (const CARD8 *)u;
+    rect.srcV = (const CARD8 *)v;
+    rect.dstPitch = dstPitch;
+    rect.srcPitch = srcPitch;
+    rect.wBytes = n;
+    rect.h = h;
+    psbCopyQueue(&rect, 2 * n * h);
+}
+
+/*
+ * Help copying the queued bands, and wait until all are done.
+ */
+
+void
+psbCopyWait(void)
+{
+    PsbCopyPoolRec *pool = &psbCopyPool;
+    PsbCopyBandRec band;
+
+    if (pool->numThreads == 0)
+	return;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (psbCopyTakeBand(&band)) {
+	pthread_mutex_unlock(&pool->mutex);
+	psbCopyBandRun(&band);
+	pthread_mutex_lock(&pool->mutex);
+
+	psbCopyBandDone();
+    }
+
+    while (pool->pending)
+	pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,71 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Copies into write-combined memory.
+ */
+
+#ifndef _PSB_COPY_H_
+#define _PSB_COPY_H_
+
+#define PSB_COPY_MAX_THREADS 4
+
+typedef enum
+{
+    PSB_COPY_MEMCPY = 0,
+    PSB_COPY_SSE2,
+    PSB_COPY_SSE3
+} PsbCopyKernel;
+
+extern PsbCopyKernel psbCopySelect(PsbCopyKernel max);
+extern void psbCopyInit(int scrnIndex, int numThreads, MessageType from);
+extern void psbCopyRectWC(void *dst, unsigned long dstPitch,
+			  const void *src, unsigned long srcPitch,
+			  unsigned long wBytes, unsigned long h);
+extern void psbCopyRectWCAsync(void *dst, unsigned long dstPitch,
+			       const void *src, unsigned long srcPitch,
+			       unsigned long wBytes, unsigned long h);
+extern void psbInterleaveRectWC(void *dst, unsigned long dstPitch,
+				const void *u, const void *v,
+				unsigned long srcPitch, unsigned long n,
+				unsigned long h);
+extern void psbInterleaveRectWCAsync(void *dst, unsigned long dstPitch,
+				     const void *u, const void *v,
+				     unsigned long srcPitch, unsigned long n,
+				     unsigned long h);
+extern void psbCopyWait(void);
+
+static inline void
+psbCopyWC(void *dst, const void *src, unsigned long size)
+{
+    psbCopyRectWC(dst, 0, src, 0, size, 1);
+}
+
+#endif
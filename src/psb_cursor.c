@@ -129,7 +129,7 @@ psb_crtc_load_cursor_image(xf86CrtcPtr crtc, unsigned char *src)
 	intel_crtc->cursor_offset;
 
     intel_crtc->cursor_is_argb = FALSE;
-    memcpy(pcurs, src, I810_CURSOR_X * I810_CURSOR_Y / 4);
+    psbCopyWC(pcurs, src, I810_CURSOR_X * I810_CURSOR_Y / 4);
 }
 
 void
@@ -144,7 +144,7 @@ psb_crtc_load_cursor_argb(xf86CrtcPtr crtc, CARD32 * image)
 			intel_crtc->cursor_argb_offset);
 
     intel_crtc->cursor_is_argb = TRUE;
-    memcpy(pcurs, image, I810_CURSOR_Y * I810_CURSOR_X * 4);
+    psbCopyWC(pcurs, image, I810_CURSOR_Y * I810_CURSOR_X * 4);
 }
 
 void
@@ -132,7 +132,19 @@ typedef enum
     OPTION_NOACCEL,
     OPTION_SWCURSOR,
     OPTION_EXAMEM,
+    OPTION_EXAMEMMAX,
     OPTION_EXASCRATCH,
+    OPTION_EXACMDBUFFERS,
+    OPTION_EXALAZYFLUSH,
+    OPTION_EXACALIBRATE,
+    OPTION_EXACALIBRATIONFILE,
+    OPTION_EXAUSERUPLOAD,
+    OPTION_EXASHMCACHE,
+    OPTION_EXA2DTRACE,
+    OPTION_COPYTHREADS,
+    OPTION_XVMEM,
+    OPTION_XVBUFFERS,
+    OPTION_XVSKIPREPEATS,
     OPTION_IGNORE_ACPI,
     OPTION_NOPANEL,
     OPTION_LIDTIMER,
@@ -146,7 +158,20 @@ static const OptionInfoRec psbOptions[] = {
     {OPTION_NOACCEL, "NoAccel", OPTV_BOOLEAN, {0}, FALSE},
     {OPTION_SWCURSOR, "SWcursor", OPTV_BOOLEAN, {0}, FALSE},
     {OPTION_EXAMEM, "ExaMem", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_EXAMEMMAX, "ExaMemMax", OPTV_INTEGER, {0}, FALSE},
     {OPTION_EXASCRATCH, "ExaScratch", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_EXACMDBUFFERS, "ExaCmdBuffers", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_EXALAZYFLUSH, "ExaLazyFlush", OPTV_BOOLEAN, {0}, FALSE},
+    {OPTION_EXACALIBRATE, "ExaCalibrate", OPTV_STRING, {0}, FALSE},
+    {OPTION_EXACALIBRATIONFILE, "ExaCalibrationFile", OPTV_STRING, {0},
+     FALSE},
+    {OPTION_EXAUSERUPLOAD, "ExaUserUpload", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_EXASHMCACHE, "ExaShmCache", OPTV_BOOLEAN, {0}, FALSE},
+    {OPTION_EXA2DTRACE, "Exa2DTrace", OPTV_STRING, {0}, FALSE},
+    {OPTION_COPYTHREADS, "CopyThreads", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_XVMEM, "XvMem", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_XVBUFFERS, "XvBuffers", OPTV_INTEGER, {0}, FALSE},
+    {OPTION_XVSKIPREPEATS, "XvSkipRepeats", OPTV_BOOLEAN, {0}, FALSE},
     {OPTION_IGNORE_ACPI, "IgnoreACPI", OPTV_BOOLEAN, {0}, FALSE},
     {OPTION_NOPANEL, "NoPanel", OPTV_BOOLEAN, {0}, FALSE},
     {OPTION_LIDTIMER, "LidTimer", OPTV_BOOLEAN, {0}, FALSE},
@@ -191,6 +216,7 @@ static const char *exaSymbols[] = {
     "exaOffscreenFree",
     "exaGetPixmapPitch",
     "exaGetPixmapOffset",
+    "exaGetPixmapDriverPrivate",
     "exaWaitSync",
     NULL
 };
@@ -671,6 +697,7 @@ psbPreInitAccel(ScrnInfoPtr pScrn)
     PsbPtr pPsb = psbPTR(pScrn);
     MessageType from;
     int tmp;
+    const char *s;
 
     pPsb->noAccel = FALSE;
     from = xf86GetOptValBool(pPsb->options, OPTION_NOACCEL, &pPsb->noAccel)
@@ -691,10 +718,21 @@ psbPreInitAccel(ScrnInfoPtr pScrn)
 
     if (!pPsb->noAccel)
 	xf86DrvMsg(pScrn->scrnIndex, from,
-		   "[EXA] Allocate %d kiB for EXA pixmap cache.\n", tmp);
+		   "[EXA] Initial pixmap memory budget %d kiB.\n", tmp);
     pPsb->exaSize = tmp * 1024;
 
-    tmp = 4;
+    tmp = 128 * 1024;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_EXAMEMMAX, &tmp)
+	? X_CONFIG : X_DEFAULT;
+
+    if (tmp * 1024 < pPsb->exaSize)
+	tmp = pPsb->exaSize / 1024;
+    if (!pPsb->noAccel)
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "[EXA] Pixmap memory budget may grow to %d kiB.\n", tmp);
+    pPsb->exaMaxSize = tmp * 1024;
+
+    tmp = 512;
     from = xf86GetOptValInteger(pPsb->options, OPTION_EXASCRATCH, &tmp)
 	? X_CONFIG : X_DEFAULT;
 
@@ -703,6 +741,88 @@ psbPreInitAccel(ScrnInfoPtr pScrn)
 		   "[EXA] Allocate %d kiB for scratch memory.\n", tmp);
     pPsb->exaScratchSize = tmp * 1024;
 
+    tmp = 3;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_EXACMDBUFFERS, &tmp)
+	? X_CONFIG : X_DEFAULT;
+
+    if (tmp < PSB_2D_MIN_SLOTS || tmp > PSB_2D_MAX_SLOTS) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "[EXA] ExaCmdBuffers must be between %d and %d.\n",
+		   PSB_2D_MIN_SLOTS, PSB_2D_MAX_SLOTS);
+	tmp = (tmp < PSB_2D_MIN_SLOTS) ? PSB_2D_MIN_SLOTS : PSB_2D_MAX_SLOTS;
+    }
+
+    if (!pPsb->noAccel)
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "[EXA] Use %d 2D command buffers.\n", tmp);
+    pPsb->exaCmdBuffers = tmp;
+
+    pPsb->exaLazyFlush = TRUE;
+    from = xf86GetOptValBool(pPsb->options, OPTION_EXALAZYFLUSH,
+			     &pPsb->exaLazyFlush) ? X_CONFIG : X_DEFAULT;
+
+    if (!pPsb->noAccel)
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "[EXA] Deferred 2D command submission %sabled.\n",
+		   pPsb->exaLazyFlush ? "en" : "dis");
+
+    tmp = 128;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_EXAUSERUPLOAD, &tmp)
+	? X_CONFIG : X_DEFAULT;
+
+    if (tmp < 0)
+	tmp = 0;
+    if (!pPsb->noAccel) {
+	if (tmp)
+	    xf86DrvMsg(pScrn->scrnIndex, from,
+		       "[EXA] Blit uploads of %d kiB or more "
+		       "from client memory.\n", tmp);
+	else
+	    xf86DrvMsg(pScrn->scrnIndex, from,
+		       "[EXA] Uploads from client memory disabled.\n");
+    }
+    pPsb->exaUserUpload = tmp * 1024;
+
+    pPsb->exaShmCache = FALSE;
+    from = xf86GetOptValBool(pPsb->options, OPTION_EXASHMCACHE,
+			     &pPsb->exaShmCache) ? X_CONFIG : X_DEFAULT;
+
+    if (!pPsb->noAccel && pPsb->exaUserUpload)
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "[EXA] Caching of MIT-SHM segments for uploads %sabled.\n",
+		   pPsb->exaShmCache ? "en" : "dis");
+
+    pPsb->exa2DTrace = xf86GetOptValString(pPsb->options, OPTION_EXA2DTRACE);
+
+    pPsb->exaCalibrate = PSB_CAL_MODE_OFF;
+    from = X_DEFAULT;
+    if ((s = xf86GetOptValString(pPsb->options, OPTION_EXACALIBRATE))) {
+	from = X_CONFIG;
+	if (!xf86NameCmp(s, "auto"))
+	    pPsb->exaCalibrate = PSB_CAL_MODE_AUTO;
+	else if (!xf86NameCmp(s, "force"))
+	    pPsb->exaCalibrate = PSB_CAL_MODE_FORCE;
+	else if (!xf86NameCmp(s, "off"))
+	    pPsb->exaCalibrate = PSB_CAL_MODE_OFF;
+	else {
+	    xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		       "[EXA] Unknown ExaCalibrate value \"%s\".\n", s);
+	    from = X_DEFAULT;
+	}
+    }
+
+    pPsb->exaCalibrationFile =
+	xf86GetOptValString(pPsb->options, OPTION_EXACALIBRATIONFILE);
+    if (!pPsb->exaCalibrationFile)
+	pPsb->exaCalibrationFile = PSB_CAL_DEFAULT_FILE;
+
+    if (!pPsb->noAccel)
+	xf86DrvMsg(pScrn->scrnIndex, from,
+		   "[EXA] Blitter threshold calibration: %s.\n",
+		   (pPsb->exaCalibrate == PSB_CAL_MODE_OFF) ? "off" :
+		   (pPsb->exaCalibrate == PSB_CAL_MODE_FORCE) ? "forced" :
+		   "auto");
+
     return TRUE;
 }
 
@@ -816,6 +936,9 @@ psbPreInit(ScrnInfoPtr pScrn, int flags)
     DevUnion *pPriv;
     PsbDevicePtr pDevice;
     MessageType from;
+    int copyThreads;
+    int xvMem;
+    int xvBuffers;
 
     if (flags & PROBE_DETECT) {
 	return FALSE;
@@ -943,6 +1066,41 @@ psbPreInit(ScrnInfoPtr pScrn, int flags)
     if (!psbPreInitShadowFB(pScrn))
 	return (FALSE);
 
+    copyThreads = -1;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_COPYTHREADS,
+				&copyThreads) ? X_CONFIG : X_DEFAULT;
+    psbCopyInit(pScrn->scrnIndex, copyThreads, from);
+
+    xvMem = 16 * 1024;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_XVMEM, &xvMem)
+	? X_CONFIG : X_DEFAULT;
+    if (xvMem < 0)
+	xvMem = 0;
+    xf86DrvMsg(pScrn->scrnIndex, from,
+	       "Keep up to %d kiB of Xv frame buffers.\n", xvMem);
+    pPsb->xvMemMax = (unsigned long)xvMem * 1024;
+
+    xvBuffers = 3;
+    from = xf86GetOptValInteger(pPsb->options, OPTION_XVBUFFERS, &xvBuffers)
+	? X_CONFIG : X_DEFAULT;
+    if (xvBuffers < PSB_VIDEO_MIN_BUFS || xvBuffers > PSB_VIDEO_MAX_BUFS) {
+	xf86DrvMsg(pScrn->scrnIndex, X_WARNING,
+		   "XvBuffers must be between %d and %d.\n",
+		   PSB_VIDEO_MIN_BUFS, PSB_VIDEO_MAX_BUFS);
+	xvBuffers = (xvBuffers < PSB_VIDEO_MIN_BUFS) ?
+	    PSB_VIDEO_MIN_BUFS : PSB_VIDEO_MAX_BUFS;
+    }
+    xf86DrvMsg(pScrn->scrnIndex, from,
+	       "Use %d frame buffers for each Xv port.\n", xvBuffers);
+    pPsb->xvBuffers = xvBuffers;
+
+    pPsb->xvSkipRepeats = FALSE;
+    from = xf86GetOptValBool(pPsb->options, OPTION_XVSKIPREPEATS,
+			     &pPsb->xvSkipRepeats) ? X_CONFIG : X_DEFAULT;
+    xf86DrvMsg(pScrn->scrnIndex, from,
+	       "Skipping the upload of repeated Xv frames %sabled.\n",
+	       pPsb->xvSkipRepeats ? "en" : "dis");
+
     if (!pPsb->shadowFB && !psbPreInitAccel(pScrn))
 	return (FALSE);
 
@@ -997,7 +1155,7 @@ psbPreInit(ScrnInfoPtr pScrn, int flags)
     xf86SetGamma(pScrn, gzeros);
     xf86SetDpi(pScrn, 0, 0);
 
-    mmInitListHead(&pPsb->buffers);
+    psbBufIndexInit(&pPsb->buffers);
     pPsb->serverGeneration = 1;
     return TRUE;
 }
@@ -1508,7 +1666,18 @@ psbScreenInit(int scrnIndex, ScreenPtr pScreen, int argc, char **argv)
 
 #ifdef XF86DRI
     if (!pPsb->shadowFB && !pPsb->noAccel && pDevice->hasDRM) {
-	pPsb->has2DBuffer = psbInit2DBuffer(pDevice->drmFD, &pPsb->superC);
+	pPsb->has2DBuffer = psbInit2DBuffer(pDevice->drmFD, &pPsb->superC,
+					     pPsb->exaCmdBuffers);
+	if (pPsb->has2DBuffer && pPsb->exa2DTrace) {
+	    if (psbTrace2DOpen(&pPsb->superC, pPsb->exa2DTrace))
+		xf86DrvMsg(scrnIndex, X_CONFIG,
+			   "[EXA] Capturing 2D command stream to \"%s\".\n",
+			   pPsb->exa2DTrace);
+	    else
+		xf86DrvMsg(scrnIndex, X_WARNING,
+			   "[EXA] Could not open 2D trace file \"%s\".\n",
+			   pPsb->exa2DTrace);
+	}
 	if (pPsb->has2DBuffer) {
 	    pPsb->pPsbExa = psbExaInit(pScrn);
 	    if (!pPsb->pPsbExa) {
@@ -1757,6 +1926,7 @@ psbLeaveVT(int scrnIndex, int flags)
     PSB_DEBUG(scrnIndex, 3, "psbLeaveVT\n");
 
     psbDRILock(pScrn, 0);
+    psbAccelFlush(pScrn);
     xf86DPMSSet(pScrn, DPMSModeStandby, 0);
 
     xf86_hide_cursors(pScrn);
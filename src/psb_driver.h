@@ -59,6 +59,7 @@
 
 #include "psb_buffers.h"
 #include "psb_accel.h"
+#include "psb_copy.h"
 
 #include "i830_bios.h"
 
@@ -82,6 +83,8 @@
 #define PSB_MAX_CRTCS 2
 #define PSB_MAX_SCREENS 2
 #define PSB_SAVESWF_NUM 17
+#define PSB_VIDEO_MIN_BUFS 2
+#define PSB_VIDEO_MAX_BUFS 8
 
 #define PSB_VERSION      4000
 #define PSB_NAME         "PSB"
@@ -221,6 +224,8 @@ typedef struct _PsbDevice
     Bool mmLocked;
     int vtRefCount;
 
+    struct _PsbVideoPool *videoPool;
+
     char sdvoBName[60];
 
     CARD32 *OpRegion;
@@ -283,7 +288,7 @@ typedef struct _PsbRec
     Bool ignoreACPI;
     unsigned long serverGeneration;
 
-    struct _MMListHead buffers;
+    PsbBufIndexRec buffers;
 
     PsbScanoutPtr front;
 
@@ -356,7 +361,15 @@ typedef struct _PsbRec
 
     PsbExaPtr pPsbExa;
     unsigned long exaSize;
+    unsigned long exaMaxSize;
     unsigned long exaScratchSize;
+    unsigned exaCmdBuffers;
+    Bool exaLazyFlush;
+    PsbCalMode exaCalibrate;
+    const char *exaCalibrationFile;
+    unsigned long exaUserUpload;
+    Bool exaShmCache;
+    const char *exa2DTrace;
     PsbTwodContextRec td;
     Bool exaSuperIoctl;
 /*
@@ -396,6 +409,9 @@ typedef struct _PsbRec
  */
     int colorKey;
     XF86VideoAdaptorPtr adaptor;
+    unsigned long xvMemMax;
+    int xvBuffers;
+    Bool xvSkipRepeats;
 
 /*
  * DRI
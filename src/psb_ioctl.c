@@ -47,6 +47,8 @@
 
 #define PSB_2D_RELOC_BUFFER_SIZE (4096*16)
 #define PSB_2D_RELOC_OFFS (4096*4)
+#define PSB_BO_ARENA_NODES 32
+#define PSB_BO_HASH_MIN 64
 
 typedef struct _drmBONode
 {
@@ -55,14 +57,23 @@ typedef struct _drmBONode
     struct drm_bo_op_arg bo_arg;
     uint64_t arg0;
     uint64_t arg1;
+    int index;
+    unsigned hashSlot;
 } drmBONode;
 
+typedef struct _drmBOArena
+{
+    struct _drmBOArena *next;
+    unsigned used;
+    drmBONode nodes[PSB_BO_ARENA_NODES];
+} drmBOArena;
+
 static int
 psbAddValidateItem(drmBOList * list, drmBO * buf, uint64_t flags,
 		   uint64_t mask, int *itemLoc, struct _drmBONode **pNode);
 
 
-static unsigned
+unsigned
 psbTimeDiff(struct timeval *now, struct timeval *then)
 {
     long long val;
@@ -77,90 +88,91 @@ psbTimeDiff(struct timeval *now, struct timeval *then)
     return (unsigned)val;
 }
 
-static int
-drmAdjustListNodes(drmBOList * list)
+static inline unsigned
+drmBOHash(const drmBO * buf)
 {
-    drmBONode *node;
-    drmMMListHead *l;
-    int ret = 0;
+    unsigned long key = (unsigned long)buf >> 4;
 
-    while (list->numCurrent < list->numTarget) {
-	node = (drmBONode *) malloc(sizeof(*node));
-	if (!node) {
-	    ret = -ENOMEM;
-	    break;
-	}
-	list->numCurrent++;
-	DRMLISTADD(&node->head, &list->free);
-    }
+    key ^= key >> 11;
+    return (unsigned)(key * 2654435761UL);
+}
 
-    while (list->numCurrent > list->numTarget) {
-	l = list->free.next;
-	if (l == &list->free)
-	    break;
-	DRMLISTDEL(l);
-	node = DRMLISTENTRY(drmBONode, l, head);
-	free(node);
-	list->numCurrent--;
-    }
-    return ret;
+static drmBOArena *
+drmBOArenaAlloc(void)
+{
+    drmBOArena *arena = (drmBOArena *) malloc(sizeof(*arena));
+
+    if (!arena)
+	return NULL;
+
+    arena->next = NULL;
+    arena->used = 0;
+    return arena;
 }
 
 static int
 drmBOCreateList(int numTarget, drmBOList * list)
 {
+    unsigned size = PSB_BO_HASH_MIN;
+
+    while (size < 2 * (unsigned)numTarget)
+	size <<= 1;
+
     DRMINITLISTHEAD(&list->list);
-    DRMINITLISTHEAD(&list->free);
-    list->numTarget = numTarget;
-    list->numCurrent = 0;
     list->numOnList = 0;
-    return drmAdjustListNodes(list);
+    list->lastNode = NULL;
+    list->hashMask = size - 1;
+    list->hash = (drmBONode **) calloc(size, sizeof(*list->hash));
+    list->arena = drmBOArenaAlloc();
+    list->curArena = list->arena;
+
+    return (list->hash && list->arena) ? 0 : -ENOMEM;
 }
 
+/*
+ * Return all nodes to the arena. Only the hash slots actually in use
+ * are cleared, and no memory is freed.
+ */
+
 static int
 drmBOResetList(drmBOList * list)
 {
     drmMMListHead *l;
-    int ret;
-
-    ret = drmAdjustListNodes(list);
-    if (ret)
-	return ret;
+    drmBONode *node;
+    drmBOArena *arena;
 
-    l = list->list.next;
-    while (l != &list->list) {
-	DRMLISTDEL(l);
-	DRMLISTADD(l, &list->free);
-	list->numOnList--;
-	l = list->list.next;
+    for (l = list->list.next; l != &list->list; l = l->next) {
+	node = DRMLISTENTRY(drmBONode, l, head);
+	list->hash[node->hashSlot] = NULL;
     }
-    return drmAdjustListNodes(list);
+
+    for (arena = list->arena; arena && arena->used; arena = arena->next)
+	arena->used = 0;
+
+    DRMINITLISTHEAD(&list->list);
+    list->curArena = list->arena;
+    list->numOnList = 0;
+    list->lastNode = NULL;
+    return 0;
 }
 
 static void
 drmBOFreeList(drmBOList * list)
 {
-    drmBONode *node;
-    drmMMListHead *l;
+    drmBOArena *arena, *next;
 
-    l = list->list.next;
-    while (l != &list->list) {
-	DRMLISTDEL(l);
-	node = DRMLISTENTRY(drmBONode, l, head);
-	free(node);
-	l = list->list.next;
-	list->numCurrent--;
-	list->numOnList--;
+    for (arena = list->arena; arena; arena = next) {
+	next = arena->next;
+	free(arena);
     }
+    free(list->hash);
 
-    l = list->free.next;
-    while (l != &list->free) {
-	DRMLISTDEL(l);
-	node = DRMLISTENTRY(drmBONode, l, head);
-	free(node);
-	l = list->free.next;
-	list->numCurrent--;
-    }
+    DRMINITLISTHEAD(&list->list);
+    list->arena = NULL;
+    list->curArena = NULL;
+    list->hash = NULL;
+    list->numOnList = 0;
+    list->lastNode = NULL;
 }
 
 static void
@@ -289,79 +301,218 @@ psbDRMCmdBuf(int fd, drmBOList * list, unsigned cmdBufHandle,
     return 0;
 }
 
-Bool
-psbInit2DBuffer(int fd, Psb2DBufferPtr buf)
+/*
+ * Put the current ring slot first on the validate list, so that
+ * relocations can refer to it.
+ */
+
+static int
+psbValidate2DSlot(Psb2DBufferPtr buf)
 {
-    int ret;
-    void *addr;
     struct _drmBONode *node;
     struct drm_bo_info_req *req;
+    int ret;
 
-    ret = drmBOCreate(fd, PSB_2D_RELOC_BUFFER_SIZE, 0, NULL,
-		      DRM_BO_FLAG_MEM_LOCAL | DRM_BO_FLAG_EXE |
-		      DRM_BO_FLAG_READ, DRM_BO_HINT_DONT_FENCE, &buf->buffer);
+    ret = psbAddValidateItem(&buf->bufferList, buf->buffer, 0, 0,
+			     &buf->myValidateIndex, &node);
     if (ret)
-	return FALSE;
+	return ret;
 
-    ret = drmBOMap(fd, &buf->buffer, DRM_BO_FLAG_WRITE, 0, &addr);
-    buf->startCmd = addr;
-    drmBOUnmap(fd, &buf->buffer);
+    req = &node->bo_arg.d.req.bo_req;
+    req->hint = DRM_BO_HINT_PRESUMED_OFFSET;
+    req->presumed_offset = 0; /* Local memory */
 
-    ret = drmBOCreateList(10, &buf->bufferList);
+    return 0;
+}
 
-    if (ret)
-	return FALSE;
+static void
+psbSelect2DSlot(Psb2DBufferPtr buf, unsigned slot)
+{
+    Psb2DSlotPtr cur = &buf->slots[slot];
 
-    buf->fd = fd;
+    buf->curSlot = slot;
+    buf->buffer = &cur->buffer;
+    buf->startCmd = cur->startCmd;
     buf->curCmd = buf->startCmd;
     buf->startReloc = (struct drm_psb_reloc *)
 	((unsigned long)buf->startCmd + PSB_2D_RELOC_OFFS);
     buf->curReloc = buf->startReloc;
+}
+
+/*
+ * Advance to the next ring slot. If the hardware is still busy with
+ * the commands last submitted from that slot, we need to wait.
+ */
+
+static void
+psbNext2DSlot(Psb2DBufferPtr buf)
+{
+    unsigned slot = (buf->curSlot + 1) % buf->numSlots;
+    drmBO *bo = &buf->slots[slot].buffer;
+    struct timeval then, now;
+    int busy = 0;
+
+    if (buf->numSlots > 1 && !drmBOBusy(buf->fd, bo, &busy) && busy) {
+	buf->numStalls++;
+	if (gettimeofday(&then, NULL))
+	    FatalError("Gettimeofday error.\n");
+	(void)drmBOWaitIdle(buf->fd, bo, 0);
+	if (gettimeofday(&now, NULL))
+	    FatalError("Gettimeofday error.\n");
+	buf->stallUsec += psbTimeDiff(&now, &then);
+    }
+
+    psbSelect2DSlot(buf, slot);
+}
+
+Bool
+psbInit2DBuffer(int fd, Psb2DBufferPtr buf, unsigned numSlots)
+{
+    int ret;
+    void *addr;
+    unsigned i;
+    Psb2DSlotPtr slot;
+
+    if (numSlots < PSB_2D_MIN_SLOTS)
+	numSlots = PSB_2D_MIN_SLOTS;
+    if (numSlots > PSB_2D_MAX_SLOTS)
+	numSlots = PSB_2D_MAX_SLOTS;
+
+    buf->slots = xcalloc(numSlots, sizeof(*buf->slots));
+    if (!buf->slots)
+	return FALSE;
+
+    buf->fd = fd;
+    buf->numSlots = 0;
+    buf->numSubmits = 0;
+    buf->numDwords = 0;
+    buf->numStalls = 0;
+    buf->stallUsec = 0;
+    buf->trace = NULL;
+
+    ret = drmBOCreateList(10, &buf->bufferList);
+    if (ret)
+	goto out_err;
+
+    for (i = 0; i < numSlots; ++i) {
+	slot = &buf->slots[i];
+	ret = drmBOCreate(fd, PSB_2D_RELOC_BUFFER_SIZE, 0, NULL,
+			  DRM_BO_FLAG_MEM_LOCAL | DRM_BO_FLAG_EXE |
+			  DRM_BO_FLAG_READ, DRM_BO_HINT_DONT_FENCE,
+			  &slot->buffer);
+	if (ret)
+	    goto out_err;
+
+	buf->numSlots++;
+	ret = drmBOMap(fd, &slot->buffer, DRM_BO_FLAG_WRITE, 0, &addr);
+	if (ret)
+	    goto out_err;
+
+	slot->startCmd = addr;
+	drmBOUnmap(fd, &slot->buffer);
+    }
+
     buf->maxRelocs = (PSB_2D_RELOC_BUFFER_SIZE - PSB_2D_RELOC_OFFS) /
 	sizeof(struct drm_psb_reloc);
 
-    ret = psbAddValidateItem(&buf->bufferList, &buf->buffer, 0, 0,
-			     &buf->myValidateIndex, &node);
+    psbSelect2DSlot(buf, 0);
+    ret = psbValidate2DSlot(buf);
     if (ret)
-	return FALSE;
-
-    req = &node->bo_arg.d.req.bo_req;
-    req->hint = DRM_BO_HINT_PRESUMED_OFFSET;
-    req->presumed_offset = 0; /* Local memory */
+	goto out_err;
 
     return TRUE;
+
+  out_err:
+    psbTakedown2DBuffer(fd, buf);
+    return FALSE;
 }
 
 void
 psbTakedown2DBuffer(int fd, Psb2DBufferPtr buf)
 {
+    unsigned i;
+
+    if (buf->numSubmits)
+	PSB_DEBUG(-1, 3, "2D ring: %u slots, %lu submissions, "
+		  "%llu dwords per submission, "
+		  "%lu stalls, %llu usec stalled.\n", buf->numSlots,
+		  buf->numSubmits, buf->numDwords / buf->numSubmits,
+		  buf->numStalls, buf->stallUsec);
+
+    if (buf->trace) {
+	fclose(buf->trace);
+	buf->trace = NULL;
+    }
+
     drmBOFreeList(&buf->bufferList);
-    (void)drmBOUnreference(fd, &buf->buffer);
+    for (i = 0; i < buf->numSlots; ++i)
+	(void)drmBOUnreference(fd, &buf->slots[i].buffer);
+
+    xfree(buf->slots);
+    buf->slots = NULL;
+    buf->numSlots = 0;
+    buf->buffer = NULL;
 }
 
-static drmBONode *
-psbAddListItem(drmBOList * list, drmBO * item, uint64_t arg0, uint64_t arg1)
+/*
+ * Double the hash table. Happens only when a single submission
+ * references more buffers than ever before.
+ */
+
+static int
+psbGrowListHash(drmBOList * list)
 {
+    unsigned size = (list->hashMask + 1) << 1;
+    drmBONode **hash;
     drmBONode *node;
     drmMMListHead *l;
+    unsigned slot;
 
-    l = list->free.next;
-    if (l == &list->free) {
-	node = (drmBONode *) malloc(sizeof(*node));
-	if (!node) {
-	    return NULL;
-	}
-	list->numCurrent++;
-    } else {
-	DRMLISTDEL(l);
+    hash = (drmBONode **) calloc(size, sizeof(*hash));
+    if (!hash)
+	return -ENOMEM;
+
+    free(list->hash);
+    list->hash = hash;
+    list->hashMask = size - 1;
+
+    for (l = list->list.next; l != &list->list; l = l->next) {
 	node = DRMLISTENTRY(drmBONode, l, head);
+	slot = drmBOHash(node->buf) & list->hashMask;
+	while (hash[slot])
+	    slot = (slot + 1) & list->hashMask;
+	hash[slot] = node;
+	node->hashSlot = slot;
+    }
+    return 0;
+}
+
+static drmBONode *
+psbAddListItem(drmBOList * list, drmBO * item, uint64_t arg0, uint64_t arg1,
+	       unsigned slot)
+{
+    drmBONode *node;
+    drmBOArena *arena = list->curArena;
+
+    if (arena->used == PSB_BO_ARENA_NODES) {
+	if (!arena->next) {
+	    arena->next = drmBOArenaAlloc();
+	    if (!arena->next)
+		return NULL;
+	}
+	arena = arena->next;
+	list->curArena = arena;
     }
+    node = &arena->nodes[arena->used++];
+
     memset(&node->bo_arg, 0, sizeof(node->bo_arg));
     node->buf = item;
     node->arg0 = arg0;
     node->arg1 = arg1;
+    node->index = list->numOnList++;
+    node->hashSlot = slot;
+    list->hash[slot] = node;
     DRMLISTADDTAIL(&node->head, &list->list);
-    list->numOnList++;
     return node;
 }
 
@@ -374,27 +525,26 @@ static int
 psbAddValidateItem(drmBOList * list, drmBO * buf, uint64_t flags,
 		   uint64_t mask, int *itemLoc, struct _drmBONode **pNode)
 {
-    drmBONode *node, *cur;
-    drmMMListHead *l;
-    int count = 0;
+    drmBONode *cur;
+    unsigned slot;
 
-    cur = NULL;
+    cur = list->lastNode;
+    if (cur && cur->buf == buf && list->lastFlags == flags &&
+	list->lastMask == mask)
+	goto out;
+
+    if (2 * (list->numOnList + 1) > list->hashMask + 1 &&
+	psbGrowListHash(list))
+	return -ENOMEM;
+
+    slot = drmBOHash(buf) & list->hashMask;
+    while ((cur = list->hash[slot]) != NULL && cur->buf != buf)
+	slot = (slot + 1) & list->hashMask;
 
-    for (l = list->list.next; l != &list->list; l = l->next) {
-	node = DRMLISTENTRY(drmBONode, l, head);
-	if (node->buf == buf) {
-	    cur = node;
-	    break;
-	}
-	count++;
-    }
     if (!cur) {
-	cur = psbAddListItem(list, buf, flags, mask);
+	cur = psbAddListItem(list, buf, flags, mask, slot);
 	if (!cur)
 	    return -ENOMEM;
-
-	cur->arg0 = flags;
-	cur->arg1 = mask;
     } else {
 	uint64_t memMask = (cur->arg1 | mask) & DRM_BO_MASK_MEM;
 	uint64_t memFlags = cur->arg0 & flags & memMask;
@@ -409,11 +559,39 @@ psbAddValidateItem(drmBOList * list, drmBO * buf, uint64_t flags,
 	cur->arg0 = memFlags | ((cur->arg0 | flags) &
 				cur->arg1 & ~DRM_BO_MASK_MEM);
     }
-    *itemLoc = count;
+
+    list->lastNode = cur;
+    list->lastFlags = flags;
+    list->lastMask = mask;
+  out:
+    *itemLoc = cur->index;
     *pNode = cur;
     return 0;
 }
 
+/*
+ * Whether the unsubmitted commands reference a buffer object.
+ */
+
+Bool
+psb2DBufferReferences(Psb2DBufferPtr buf, drmBO * buffer)
+{
+    drmBOList *list = &buf->bufferList;
+    drmBONode *cur;
+    unsigned slot;
+
+    if (!PSB_2D_PENDING(buf))
+	return FALSE;
+
+    slot = drmBOHash(buffer) & list->hashMask;
+    while ((cur = list->hash[slot]) != NULL) {
+	if (cur->buf == buffer)
+	    return TRUE;
+	slot = (slot + 1) & list->hashMask;
+    }
+    return FALSE;
+}
+
 int
 psbRelocOffset2D(Psb2DBufferPtr buf, unsigned delta, drmBO * buffer,
 		 uint64_t flags, uint64_t mask)
@@ -452,43 +630,105 @@ psbRelocOffset2D(Psb2DBufferPtr buf, unsigned delta, drmBO * buffer,
     return 0;
 }
 
+/*
+ * Start capturing 2D submissions to a trace file.
+ */
+
+Bool
+psbTrace2DOpen(Psb2DBufferPtr buf, const char *name)
+{
+    PsbTraceHeaderRec header;
+
+    buf->trace = fopen(name, "w");
+    if (!buf->trace)
+	return FALSE;
+
+    header.magic = PSB_TRACE_MAGIC;
+    header.version = PSB_TRACE_VERSION;
+    header.relocSize = sizeof(struct drm_psb_reloc);
+    header.pad = 0;
+
+    if (fwrite(&header, sizeof(header), 1, buf->trace) != 1) {
+	fclose(buf->trace);
+	buf->trace = NULL;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+psbTrace2DSubmission(Psb2DBufferPtr buf, unsigned fence_flags)
+{
+    PsbTraceSubmissionRec sub;
+    PsbTraceBufferRec tb;
+    drmMMListHead *l;
+    drmBONode *node;
+    FILE *f = buf->trace;
+    int ok;
+
+    sub.numDwords = buf->curCmd - buf->startCmd;
+    sub.numRelocs = buf->curReloc - buf->startReloc;
+    sub.numBuffers = buf->bufferList.numOnList;
+    sub.numClipRects = 0;	       /* 2D submissions are not clipped */
+    sub.engine = PSB_ENGINE_2D;
+    sub.fenceFlags = fence_flags;
+
+    ok = (fwrite(&sub, sizeof(sub), 1, f) == 1 &&
+	  fwrite(buf->startCmd, sizeof(*buf->startCmd), sub.numDwords,
+		 f) == sub.numDwords &&
+	  fwrite(buf->startReloc, sizeof(*buf->startReloc), sub.numRelocs,
+		 f) == sub.numRelocs);
+
+    for (l = buf->bufferList.list.next; ok && l != &buf->bufferList.list;
+	 l = l->next) {
+	node = DRMLISTENTRY(drmBONode, l, head);
+	tb.handle = node->buf->handle;
+	tb.pad = 0;
+	tb.flags = node->arg0;
+	tb.mask = node->arg1;
+	ok = (fwrite(&tb, sizeof(tb), 1, f) == 1);
+    }
+
+    if (!ok) {
+	ErrorF("Failed writing 2D trace. Stopping capture.\n");
+	fclose(f);
+	buf->trace = NULL;
+    }
+}
+
 int
 psbFlush2D(Psb2DBufferPtr buf, unsigned fence_flags, unsigned *fence_handle)
 {
-    struct _drmBONode *node;
-    struct drm_bo_info_req *req;
     int ret;
 
     if (buf->curCmd == buf->startCmd)
 	return 0;
 
-    ret = psbDRMCmdBuf(buf->fd, &buf->bufferList, buf->buffer.handle,
+    if (buf->trace)
+	psbTrace2DSubmission(buf, fence_flags);
+
+    ret = psbDRMCmdBuf(buf->fd, &buf->bufferList, buf->buffer->handle,
 		       0, buf->curCmd - buf->startCmd,
 		       0, 0, 0,
-		       buf->buffer.handle, PSB_2D_RELOC_OFFS,
+		       buf->buffer->handle, PSB_2D_RELOC_OFFS,
 		       buf->curReloc - buf->startReloc, buf->clipRects, 0,
 		       PSB_ENGINE_2D, fence_flags, fence_handle);
 
     if (ret) {
 	ErrorF("Command submission ioctl failed: \"%s\".\n", strerror(-ret));
     }
+    buf->numSubmits++;
+    buf->numDwords += buf->curCmd - buf->startCmd;
 
     drmBOResetList(&buf->bufferList);
-    buf->curCmd = buf->startCmd;
-    buf->curReloc = buf->startReloc;
-    ret = psbAddValidateItem(&buf->bufferList, &buf->buffer, 0, 0,
-			     &buf->myValidateIndex, &node);
+    psbNext2DSlot(buf);
+    ret = psbValidate2DSlot(buf);
     if (ret) {
 	ErrorF("Failed adding command buffer to validate list:"
 	       " \"%s\".\n", strerror(-ret));
-	goto out;
     }
 
-    req = &node->bo_arg.d.req.bo_req;
-    req->hint = DRM_BO_HINT_PRESUMED_OFFSET;
-    req->presumed_offset = 0; /* Local memory */
-
-  out:
     return ret;
 }
 
@@ -33,13 +33,37 @@
 #ifndef _PSB_IOCTL_H_
 #define _PSB_IOCTL_H_
 
+#include <stdio.h>
+#include <sys/time.h>
+
+struct _drmBONode;
+struct _drmBOArena;
+
+/*
+ * Validate list. Nodes are carved out of an arena that is only grown,
+ * never shrunk, and looked up through an open-addressed hash on the
+ * drmBO pointer.
+ */
+
 typedef struct _drmBOList
 {
-    unsigned numTarget;
-    unsigned numCurrent;
     unsigned numOnList;
     drmMMListHead list;
-    drmMMListHead free;
+
+    struct _drmBOArena *arena;
+    struct _drmBOArena *curArena;
+
+    struct _drmBONode **hash;
+    unsigned hashMask;
+
+    /*
+     * Last relocation target, to skip lookup and flag merging
+     * for repeated relocations.
+     */
+
+    struct _drmBONode *lastNode;
+    uint64_t lastFlags;
+    uint64_t lastMask;
 } drmBOList;
 
 struct _Psb2DBuffer;
@@ -47,15 +71,72 @@ struct _Psb2DBuffer;
 typedef void (PsbVolatileStateFunc) (struct _Psb2DBuffer *, void *);
 
 /*
- * 2D command buffer. A drm buffer object that lives in system memory only.
+ * One slot of the 2D command ring. A drm buffer object that lives in
+ * system memory only, holding commands followed by relocations.
+ * The kernel fences the buffer object on submission, so a slot
+ * may be refilled once the buffer object is idle.
+ */
+
+typedef struct _Psb2DSlot
+{
+    drmBO buffer;
+    unsigned *startCmd;
+} Psb2DSlotRec, *Psb2DSlotPtr;
+
+#define PSB_2D_MIN_SLOTS 1
+#define PSB_2D_MAX_SLOTS 16
+
+/*
+ * 2D command stream trace file. A PsbTraceHeaderRec, followed by one
+ * record per submission: a PsbTraceSubmissionRec, then numDwords command
+ * dwords, numRelocs struct drm_psb_reloc, numBuffers PsbTraceBufferRec
+ * and numClipRects drm_clip_rect_t. Everything is in host byte order.
+ */
+
+#define PSB_TRACE_MAGIC 0x54443250     /* "P2DT" */
+#define PSB_TRACE_VERSION 1
+
+typedef struct _PsbTraceHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t relocSize;
+    uint32_t pad;
+} PsbTraceHeaderRec;
+
+typedef struct _PsbTraceSubmission
+{
+    uint32_t numDwords;
+    uint32_t numRelocs;
+    uint32_t numBuffers;
+    uint32_t numClipRects;
+    uint32_t engine;
+    uint32_t fenceFlags;
+} PsbTraceSubmissionRec;
+
+typedef struct _PsbTraceBuffer
+{
+    uint32_t handle;
+    uint32_t pad;
+    uint64_t flags;
+    uint64_t mask;
+} PsbTraceBufferRec;
+
+/*
+ * 2D command buffer. A ring of slots, where the current slot is being
+ * filled while previously submitted slots may still be processed.
  */
 
 typedef struct _Psb2DBuffer
 {
     int fd;
-    drmBO buffer;
+    drmBO *buffer;
     drmBOList bufferList;
 
+    Psb2DSlotPtr slots;
+    unsigned numSlots;
+    unsigned curSlot;
+
     unsigned *startCmd;
     unsigned *curCmd;
     int myValidateIndex;
@@ -66,8 +147,21 @@ typedef struct _Psb2DBuffer
     drm_clip_rect_t *clipRects;
     PsbVolatileStateFunc *emitVolatileState;
     void *volatileStateArg;
+
+    /*
+     * Statistics.
+     */
+
+    unsigned long numSubmits;
+    unsigned long long numDwords;
+    unsigned long numStalls;
+    unsigned long long stallUsec;
+
+    FILE *trace;
 } Psb2DBufferRec, *Psb2DBufferPtr;
 
+#define PSB_2D_PENDING(_cb) ((_cb)->curCmd != (_cb)->startCmd)
+
 #define PSB_SUPER_2D_VARS(_cb)		        \
     Psb2DBufferPtr cb = (_cb);			\
     int __ret2D = 0
@@ -100,8 +194,11 @@ extern int psbFlush2D(Psb2DBufferPtr buf, unsigned fence_flags,
 		      unsigned *fence_handle);
 extern int psbRelocOffset2D(Psb2DBufferPtr buf, unsigned delta,
 			    drmBO * buffer, uint64_t flags, uint64_t mask);
-extern Bool psbInit2DBuffer(int fd, Psb2DBufferPtr buf);
+extern Bool psb2DBufferReferences(Psb2DBufferPtr buf, drmBO * buffer);
+extern Bool psbInit2DBuffer(int fd, Psb2DBufferPtr buf, unsigned numSlots);
+extern unsigned psbTimeDiff(struct timeval *now, struct timeval *then);
 extern void psbTakedown2DBuffer(int fd, Psb2DBufferPtr buf);
+extern Bool psbTrace2DOpen(Psb2DBufferPtr buf, const char *name);
 extern void psbSetStateCallback(Psb2DBufferPtr buf, PsbVolatileStateFunc *func,
 				void *arg);
 
@@ -0,0 +1,750 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Pixmap storage for EXA mixed pixmaps.
+ *
+ * Each offscreen pixmap gets storage of its own rather than a piece of
+ * one big, fragmentable pixmap area. Small pixmaps are sub-allocated in
+ * fixed size chunks from slab buffers, one set of slabs per chunk size.
+ * Larger pixmaps get a buffer object each. Buffers that are no longer used
+ * are kept in a cache, keyed by rounded size and creation flags, so that
+ * the frequent create / destroy cycles of temporary pixmaps don't go to
+ * the kernel every time.
+ *
+ * All buffers, cached or not, count against a budget. The budget starts
+ * out at ExaMem and grows, up to ExaMemMax, when the pixmaps in use
+ * don't fit. Cached buffers and empty slabs are freed when they have been
+ * idle for a while, and the budget shrinks back when usage drops.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "psb_driver.h"
+
+#define PSB_PIXMAP_PAGE_SIZE 4096
+#define PSB_PIXMAP_PITCH_ALIGN (32 * 4)
+#define PSB_PIXMAP_BUF_FLAGS (MM_FLAG_READ | MM_FLAG_WRITE | MM_FLAG_MEM_TT)
+
+/*
+ * Cached buffers and empty slabs idle for this long are freed.
+ */
+
+#define PSB_PIXMAP_IDLE_MS 2000
+#define PSB_PIXMAP_EXPIRE_MS 500
+
+static void
+psbPixmapBufDestroy(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa,
+		    PsbPixmapBufPtr pBuf)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+
+    /*
+     * Deferred 2D commands may still refer to the buffer.
+     */
+
+    if (psb2DBufferReferences(&pPsb->superC, mmKernelBuf(pBuf->entry.buf)))
+	psbAccelFlush(pScrn);
+
+    mmListDel(&pBuf->allHead);
+    pPsbExa->pixBytes -= pBuf->size;
+    psbClearBufItem(&pBuf->entry);
+    xfree(pBuf);
+}
+
+static void
+psbPixmapUncache(PsbExaPtr pPsbExa, PsbPixmapBufPtr pBuf)
+{
+    mmListDelInit(&pBuf->cacheHead);
+    pPsbExa->pixCached -= pBuf->size;
+}
+
+/*
+ * Round a buffer size up to its size class. Classes are a quarter to an
+ * eighth of an octave apart, so that buffers of slightly different size
+ * can be reused for each other.
+ */
+
+static unsigned long
+psbPixmapRound(unsigned long size)
+{
+    unsigned long step = PSB_PIXMAP_PAGE_SIZE;
+
+    size = ALIGN_TO(size, PSB_PIXMAP_PAGE_SIZE);
+    while ((step << 3) < size)
+	step <<= 1;
+
+    return ALIGN_TO(size, step);
+}
+
+/*
+ * Make room for size more bytes, first by dropping cached buffers,
+ * oldest first, then by growing the budget.
+ */
+
+static Bool
+psbPixmapReserve(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, unsigned long size)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbPixmapBufPtr pBuf;
+    unsigned long budget;
+
+    while (pPsbExa->pixBytes + size > pPsbExa->pixBudget &&
+	   pPsbExa->pixCache.prev != &pPsbExa->pixCache) {
+	pBuf = mmListEntry(pPsbExa->pixCache.prev, PsbPixmapBufRec,
+			   cacheHead);
+	psbPixmapUncache(pPsbExa, pBuf);
+	psbPixmapBufDestroy(pScrn, pPsbExa, pBuf);
+    }
+
+    if (pPsbExa->pixBytes + size <= pPsbExa->pixBudget)
+	return TRUE;
+
+    if (pPsbExa->pixBytes + size > pPsb->exaMaxSize)
+	return FALSE;
+
+    budget = pPsbExa->pixBudget + (pPsbExa->pixBudget >> 1);
+    if (budget < pPsbExa->pixBytes + size)
+	budget = pPsbExa->pixBytes + size;
+    if (budget > pPsb->exaMaxSize)
+	budget = pPsb->exaMaxSize;
+
+    PSB_DEBUG(pScrn->scrnIndex, 3, "Pixmap budget grows to %lu kiB.\n",
+	      budget >> 10);
+    pPsbExa->pixBudget = budget;
+
+    return TRUE;
+}
+
+static PsbPixmapBufPtr
+psbPixmapBufGet(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, unsigned long size,
+		unsigned flags)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbDevicePtr pDevice = psbDevicePTR(pPsb);
+    PsbPixmapBufPtr pBuf;
+    MMListHead *list;
+
+    size = psbPixmapRound(size);
+
+    mmListForEach(list, &pPsbExa->pixCache) {
+	pBuf = mmListEntry(list, PsbPixmapBufRec, cacheHead);
+	if (pBuf->size == size && pBuf->flags == flags) {
+	    psbPixmapUncache(pPsbExa, pBuf);
+	    return pBuf;
+	}
+    }
+
+    if (!psbPixmapReserve(pScrn, pPsbExa, size))
+	return NULL;
+
+    pBuf = xcalloc(1, sizeof(*pBuf));
+    if (!pBuf)
+	return NULL;
+
+    mmInitListHead(&pBuf->entry.head);
+    mmInitListHead(&pBuf->cacheHead);
+    psbAddBufItem(&pPsb->buffers, &pBuf->entry,
+		  pDevice->man->createBuf(pDevice->man, size, 0, flags,
+					  MM_HINT_DONT_FENCE));
+    if (!pBuf->entry.buf) {
+	xfree(pBuf);
+	return NULL;
+    }
+
+    pBuf->size = size;
+    pBuf->flags = flags;
+    mmListAddTail(&pBuf->allHead, &pPsbExa->pixBufs);
+    pPsbExa->pixBytes += size;
+
+    return pBuf;
+}
+
+/*
+ * Put a buffer in the cache, unless the budget is already exceeded.
+ */
+
+static void
+psbPixmapBufPut(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, PsbPixmapBufPtr pBuf)
+{
+    if (pPsbExa->pixBytes > pPsbExa->pixBudget) {
+	psbPixmapBufDestroy(pScrn, pPsbExa, pBuf);
+	return;
+    }
+
+    pBuf->lastUse = GetTimeInMillis();
+    mmListAdd(&pBuf->cacheHead, &pPsbExa->pixCache);
+    pPsbExa->pixCached += pBuf->size;
+}
+
+static int
+psbPixmapSlabClass(unsigned long size)
+{
+    int class;
+
+    for (class = 0; class < PSB_PIXMAP_SLAB_CLASSES; ++class)
+	if (size <= (PSB_PIXMAP_CHUNK_MIN << class))
+	    return class;
+
+    return -1;
+}
+
+static PsbPixmapSlabPtr
+psbPixmapSlabCreate(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, int class)
+{
+    PsbPixmapSlabPtr slab;
+    unsigned numChunks;
+    unsigned i;
+
+    slab = xcalloc(1, sizeof(*slab));
+    if (!slab)
+	return NULL;
+
+    slab->pBuf = psbPixmapBufGet(pScrn, pPsbExa, PSB_PIXMAP_SLAB_SIZE,
+				 PSB_PIXMAP_BUF_FLAGS);
+    if (!slab->pBuf) {
+	xfree(slab);
+	return NULL;
+    }
+
+    slab->chunkSize = PSB_PIXMAP_CHUNK_MIN << class;
+    numChunks = PSB_PIXMAP_SLAB_SIZE / slab->chunkSize;
+    for (i = 0; i < numChunks; ++i)
+	slab->freeMask[i >> 5] |= (1 << (i & 31));
+    slab->numFree = numChunks;
+    slab->lastUse = GetTimeInMillis();
+    mmListAdd(&slab->head, &pPsbExa->pixSlabs[class]);
+
+    return slab;
+}
+
+static void
+psbPixmapSlabDestroy(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa,
+		     PsbPixmapSlabPtr slab)
+{
+    mmListDel(&slab->head);
+    psbPixmapBufPut(pScrn, pPsbExa, slab->pBuf);
+    xfree(slab);
+}
+
+static Bool
+psbPixmapSlabAlloc(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, int class,
+		   PsbPixmapPtr priv)
+{
+    PsbPixmapSlabPtr slab = NULL;
+    MMListHead *list;
+    unsigned i;
+    int bit;
+
+    /*
+     * Slabs with free chunks are kept at the head of the list.
+     */
+
+    mmListForEach(list, &pPsbExa->pixSlabs[class]) {
+	slab = mmListEntry(list, PsbPixmapSlabRec, head);
+	if (slab->numFree)
+	    break;
+	slab = NULL;
+    }
+
+    if (!slab) {
+	slab = psbPixmapSlabCreate(pScrn, pPsbExa, class);
+	if (!slab)
+	    return FALSE;
+    }
+
+    for (i = 0; !slab->freeMask[i]; ++i) ;
+    bit = ffs(slab->freeMask[i]) - 1;
+    slab->freeMask[i] &= ~(1 << bit);
+    if (--slab->numFree == 0) {
+	mmListDel(&slab->head);
+	mmListAddTail(&slab->head, &pPsbExa->pixSlabs[class]);
+    }
+
+    priv->slab = slab;
+    priv->chunk = (i << 5) + bit;
+    priv->buf = slab->pBuf->entry.buf;
+    priv->offset = priv->chunk * slab->chunkSize;
+
+    return TRUE;
+}
+
+static void
+psbPixmapSlabFree(PsbExaPtr pPsbExa, PsbPixmapPtr priv)
+{
+    PsbPixmapSlabPtr slab = priv->slab;
+    int class = psbPixmapSlabClass(slab->chunkSize);
+
+    slab->freeMask[priv->chunk >> 5] |= (1 << (priv->chunk & 31));
+    if (slab->numFree++ == 0) {
+	mmListDel(&slab->head);
+	mmListAdd(&slab->head, &pPsbExa->pixSlabs[class]);
+    }
+    slab->lastUse = GetTimeInMillis();
+}
+
+/*
+ * DRI clients can only texture from the EXA buffer, so pixmaps handed to
+ * them are moved into the area behind its first page. The area is
+ * allocated first fit from a list of free ranges sorted by offset.
+ */
+
+static Bool
+psbPixmapDRIAlloc(PsbExaPtr pPsbExa, unsigned long size,
+		  unsigned long *offset)
+{
+    PsbPixmapRangePtr range;
+    MMListHead *list;
+
+    mmListForEach(list, &pPsbExa->driFree) {
+	range = mmListEntry(list, PsbPixmapRangeRec, head);
+	if (range->size < size)
+	    continue;
+
+	*offset = range->offset;
+	range->offset += size;
+	range->size -= size;
+	if (!range->size) {
+	    mmListDel(&range->head);
+	    xfree(range);
+	}
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+psbPixmapDRIFree(PsbExaPtr pPsbExa, unsigned long offset, unsigned long size)
+{
+    PsbPixmapRangePtr range, prev = NULL, next = NULL;
+    MMListHead *list;
+
+    mmListForEach(list, &pPsbExa->driFree) {
+	range = mmListEntry(list, PsbPixmapRangeRec, head);
+	if (range->offset > offset) {
+	    next = range;
+	    break;
+	}
+	prev = range;
+    }
+
+    if (prev && prev->offset + prev->size == offset) {
+	prev->size += size;
+	if (next && offset + size == next->offset) {
+	    prev->size += next->size;
+	    mmListDel(&next->head);
+	    xfree(next);
+	}
+	return;
+    }
+
+    if (next && offset + size == next->offset) {
+	next->offset = offset;
+	next->size += size;
+	return;
+    }
+
+    /*
+     * If this fails, the range is lost until the server regenerates.
+     */
+
+    range = xcalloc(1, sizeof(*range));
+    if (!range)
+	return;
+
+    range->offset = offset;
+    range->size = size;
+    mmListAddTail(&range->head, list);
+}
+
+/*
+ * Drop the storage of a pixmap.
+ */
+
+static void
+psbPixmapRelease(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa, PsbPixmapPtr priv)
+{
+    if (pPsbExa) {
+	if (priv->slab)
+	    psbPixmapSlabFree(pPsbExa, priv);
+	else if (priv->pBuf)
+	    psbPixmapBufPut(pScrn, pPsbExa, priv->pBuf);
+	else if (priv->driSize)
+	    psbPixmapDRIFree(pPsbExa, priv->offset, priv->driSize);
+    }
+
+    priv->slab = NULL;
+    priv->pBuf = NULL;
+    priv->driSize = 0;
+    priv->buf = NULL;
+    priv->offset = 0;
+}
+
+/*
+ * Move a pixmap into the DRI area of the EXA buffer, unless it is there
+ * already, and return its offset in the EXA buffer. Storage we don't own,
+ * like the scanout, can't be moved.
+ */
+
+Bool
+psbPixmapShare(ScrnInfoPtr pScrn, PixmapPtr pPix, unsigned long *offset)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbExaPtr pPsbExa = pPsb->pPsbExa;
+    PsbPixmapPtr priv = psbPixmapPriv(pPix);
+    struct _MMBuffer *exaBuf = pPsbExa->exaBuf.buf;
+    unsigned long bytes, size, driOffset;
+
+    if (!priv || !priv->buf)
+	return FALSE;
+
+    if (priv->driSize) {
+	*offset = priv->offset;
+	return TRUE;
+    }
+
+    if (!priv->slab && !priv->pBuf)
+	return FALSE;
+
+    bytes = exaGetPixmapPitch(pPix) * pPix->drawable.height;
+    size = ALIGN_TO(bytes, PSB_PIXMAP_PAGE_SIZE);
+    if (!psbPixmapDRIAlloc(pPsbExa, size, &driOffset))
+	return FALSE;
+
+    /*
+     * Commands still pending may read the old storage or, for a range
+     * that was freed recently, write the new one. Mapping waits for them.
+     */
+
+    if (psb2DBufferReferences(&pPsb->superC, mmKernelBuf(priv->buf)) ||
+	psb2DBufferReferences(&pPsb->superC, mmKernelBuf(exaBuf)))
+	psbAccelFlush(pScrn);
+
+    if (priv->buf->man->mapBuf(priv->buf, MM_FLAG_READ, 0))
+	goto out_err;
+    if (exaBuf->man->mapBuf(exaBuf, MM_FLAG_WRITE, 0)) {
+	(void)priv->buf->man->unMapBuf(priv->buf);
+	goto out_err;
+    }
+
+    memcpy((CARD8 *) mmBufVirtual(exaBuf) + driOffset,
+	   (CARD8 *) mmBufVirtual(priv->buf) + priv->offset, bytes);
+
+    (void)exaBuf->man->unMapBuf(exaBuf);
+    (void)priv->buf->man->unMapBuf(priv->buf);
+
+    psbPixmapRelease(pScrn, pPsbExa, priv);
+    priv->buf = exaBuf;
+    priv->offset = driOffset;
+    priv->driSize = size;
+
+    *offset = driOffset;
+    return TRUE;
+
+  out_err:
+    psbPixmapDRIFree(pPsbExa, driOffset, size);
+    return FALSE;
+}
+
+void *
+psbExaCreatePixmap(ScreenPtr pScreen, int w, int h, int depth,
+		   int usage_hint, int bpp, int *new_pitch)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    PsbExaPtr pPsbExa = psbPTR(pScrn)->pPsbExa;
+    PsbPixmapPtr priv;
+    unsigned long pitch, size;
+    int class;
+
+    priv = xcalloc(1, sizeof(*priv));
+    if (!priv)
+	return NULL;
+
+    /*
+     * Pixmap headers get their storage through ModifyPixmapHeader.
+     */
+
+    if (!w || !h || !pPsbExa)
+	return priv;
+
+    pitch = ALIGN_TO((((unsigned long)w * bpp) + 7) >> 3,
+		     PSB_PIXMAP_PITCH_ALIGN);
+    size = pitch * h;
+
+    class = psbPixmapSlabClass(size);
+    if (class >= 0) {
+	if (!psbPixmapSlabAlloc(pScrn, pPsbExa, class, priv))
+	    goto out_err;
+    } else {
+	priv->pBuf = psbPixmapBufGet(pScrn, pPsbExa, size,
+				     PSB_PIXMAP_BUF_FLAGS);
+	if (!priv->pBuf)
+	    goto out_err;
+	priv->buf = priv->pBuf->entry.buf;
+	priv->offset = 0;
+    }
+
+    *new_pitch = pitch;
+    return priv;
+
+  out_err:
+    xfree(priv);
+    return NULL;
+}
+
+void
+psbExaDestroyPixmap(ScreenPtr pScreen, void *driverPriv)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pScreen->myNum];
+    PsbPixmapPtr priv = (PsbPixmapPtr) driverPriv;
+
+    if (!priv)
+	return;
+
+    psbPixmapRelease(pScrn, psbPTR(pScrn)->pPsbExa, priv);
+    xfree(priv);
+}
+
+/*
+ * A pixmap header pointed at memory we know, like the scanout, is
+ * wrapped without owning the storage. We always return FALSE so that
+ * the rest of the header is set up as usual.
+ */
+
+Bool
+psbExaModifyPixmapHeader(PixmapPtr pPix, int w, int h, int depth, int bpp,
+			 int devKind, pointer pPixData)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbPixmapPtr priv = psbPixmapPriv(pPix);
+    PsbBufListPtr b;
+
+    if (!priv || !pPixData)
+	return FALSE;
+
+    psbPixmapRelease(pScrn, pPsb->pPsbExa, priv);
+    b = psbInBuffer(&pPsb->buffers, pPixData);
+    if (b) {
+	priv->buf = b->buf;
+	priv->offset = (unsigned long)pPixData -
+	    (unsigned long)mmBufVirtual(b->buf);
+    }
+
+    return FALSE;
+}
+
+Bool
+psbExaPixmapIsOffscreen(PixmapPtr p)
+{
+    PsbPixmapPtr priv = psbPixmapPriv(p);
+
+    return (priv && priv->buf);
+}
+
+/*
+ * Decide whether the CPU may access a pixmap's storage directly. Our
+ * storage is write-combined, which makes CPU reads of it very slow. If
+ * we refuse, EXA keeps a copy of the pixmap in system memory for the
+ * CPU, fills it with DownloadFromScreen where the 2D engine has drawn
+ * since, and uploads what the CPU changed before the engine uses it.
+ * That pays off when the CPU reads more than the engine draws. Where
+ * DownloadFromScreen or UploadToScreen decline, EXA maps the pixmap
+ * with the auxiliary indices and copies itself, which it only does for
+ * drivers with EXA_SUPPORTS_PREPARE_AUX. Without that, a refusal would
+ * leave the copy stale, so we only refuse with it.
+ *
+ * Every access counts the whole pixmap, as we aren't told the region,
+ * and counts as a read, as fb reads most destinations too. Both counts
+ * decay by an eighth at each access. A copy is started when the CPU
+ * count exceeds PSB_PIXMAP_SYS_ENTER times the engine count and
+ * PSB_PIXMAP_SYS_MIN times the pixmap size, that is from the third
+ * access without engine work in between. It is dropped when the engine
+ * count exceeds PSB_PIXMAP_SYS_LEAVE times the CPU count, so that a
+ * pixmap doesn't switch back and forth.
+ */
+
+#define PSB_PIXMAP_SYS_ENTER 2
+#define PSB_PIXMAP_SYS_LEAVE 2
+#define PSB_PIXMAP_SYS_MIN 2
+
+Bool
+psbPixmapCPUAccess(PixmapPtr pPix, int index)
+{
+#ifdef EXA_SUPPORTS_PREPARE_AUX
+    PsbPixmapPtr priv = psbPixmapPriv(pPix);
+    unsigned long size;
+
+    /*
+     * The auxiliary indices are EXA filling or writing back its copy.
+     * Storage we don't own, like the scanout or pixmaps DRI clients
+     * use, must always be current.
+     */
+
+    if (index > EXA_PREPARE_MASK || !priv || (!priv->slab && !priv->pBuf))
+	return TRUE;
+
+    priv->cpuBytes -= priv->cpuBytes >> 3;
+    priv->gpuBytes -= priv->gpuBytes >> 3;
+    size = exaGetPixmapPitch(pPix) * pPix->drawable.height;
+    priv->cpuBytes += size;
+
+    if (priv->sysCopy)
+	priv->sysCopy =
+	    (priv->gpuBytes <= PSB_PIXMAP_SYS_LEAVE * priv->cpuBytes);
+    else
+	priv->sysCopy =
+	    (priv->cpuBytes > PSB_PIXMAP_SYS_ENTER * priv->gpuBytes &&
+	     priv->cpuBytes > PSB_PIXMAP_SYS_MIN * size);
+
+    return !priv->sysCopy;
+#else
+    return TRUE;
+#endif
+}
+
+/*
+ * Free idle cached buffers and empty slabs, and let the budget
+ * shrink back towards ExaMem when usage has dropped.
+ */
+
+void
+psbPixmapExpire(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    CARD32 now = GetTimeInMillis();
+    PsbPixmapSlabPtr slab;
+    PsbPixmapBufPtr pBuf;
+    MMListHead *list, *next;
+    unsigned long budget;
+    int class;
+
+    if ((CARD32) (now - pPsbExa->pixExpireTime) < PSB_PIXMAP_EXPIRE_MS)
+	return;
+    pPsbExa->pixExpireTime = now;
+
+    for (class = 0; class < PSB_PIXMAP_SLAB_CLASSES; ++class) {
+	mmListForEachSafe(list, next, &pPsbExa->pixSlabs[class]) {
+	    slab = mmListEntry(list, PsbPixmapSlabRec, head);
+	    if (slab->numFree == PSB_PIXMAP_SLAB_SIZE / slab->chunkSize &&
+		(CARD32) (now - slab->lastUse) >= PSB_PIXMAP_IDLE_MS)
+		psbPixmapSlabDestroy(pScrn, pPsbExa, slab);
+	}
+    }
+
+    mmListForEachPrevSafe(list, next, &pPsbExa->pixCache) {
+	pBuf = mmListEntry(list, PsbPixmapBufRec, cacheHead);
+	if ((CARD32) (now - pBuf->lastUse) < PSB_PIXMAP_IDLE_MS)
+	    break;
+	psbPixmapUncache(pPsbExa, pBuf);
+	psbPixmapBufDestroy(pScrn, pPsbExa, pBuf);
+    }
+
+    if (pPsbExa->pixBudget > pPsb->exaSize &&
+	pPsbExa->pixBytes < (pPsbExa->pixBudget >> 2)) {
+	budget = pPsbExa->pixBudget >> 1;
+	if (budget < pPsb->exaSize)
+	    budget = pPsb->exaSize;
+
+	PSB_DEBUG(pScrn->scrnIndex, 3,
+		  "Pixmap budget shrinks to %lu kiB.\n", budget >> 10);
+	pPsbExa->pixBudget = budget;
+    }
+}
+
+void
+psbPixmapInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbPixmapRangePtr range;
+    unsigned long exaSize = mmBufSize(pPsbExa->exaBuf.buf);
+    int class;
+
+    for (class = 0; class < PSB_PIXMAP_SLAB_CLASSES; ++class)
+	mmInitListHead(&pPsbExa->pixSlabs[class]);
+    mmInitListHead(&pPsbExa->pixCache);
+    mmInitListHead(&pPsbExa->pixBufs);
+    pPsbExa->pixBytes = 0;
+    pPsbExa->pixCached = 0;
+    pPsbExa->pixBudget = pPsb->exaSize;
+    pPsbExa->pixExpireTime = GetTimeInMillis();
+
+    mmInitListHead(&pPsbExa->driFree);
+    if (exaSize > PSB_EXA_BASE_SIZE) {
+	range = xcalloc(1, sizeof(*range));
+	if (range) {
+	    range->offset = PSB_EXA_BASE_SIZE;
+	    range->size = exaSize - PSB_EXA_BASE_SIZE;
+	    mmListAdd(&range->head, &pPsbExa->driFree);
+	}
+    }
+}
+
+/*
+ * Free all pixmap storage. Pixmaps destroyed after this only free
+ * their private.
+ */
+
+void
+psbPixmapClose(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
+{
+    PsbPixmapSlabPtr slab;
+    PsbPixmapBufPtr pBuf;
+    PsbPixmapRangePtr range;
+    MMListHead *list, *next;
+    int class;
+
+    if (!pPsbExa->pixBufs.next)
+	return;
+
+    for (class = 0; class < PSB_PIXMAP_SLAB_CLASSES; ++class) {
+	mmListForEachSafe(list, next, &pPsbExa->pixSlabs[class]) {
+	    slab = mmListEntry(list, PsbPixmapSlabRec, head);
+	    mmListDel(&slab->head);
+	    xfree(slab);
+	}
+    }
+
+    mmListForEachSafe(list, next, &pPsbExa->pixBufs) {
+	pBuf = mmListEntry(list, PsbPixmapBufRec, allHead);
+	psbPixmapBufDestroy(pScrn, pPsbExa, pBuf);
+    }
+    mmInitListHead(&pPsbExa->pixCache);
+    pPsbExa->pixCached = 0;
+
+    mmListForEachSafe(list, next, &pPsbExa->driFree) {
+	range = mmListEntry(list, PsbPixmapRangeRec, head);
+	mmListDel(&range->head);
+	xfree(range);
+    }
+}
@@ -0,0 +1,386 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Zero-copy uploads. Large PutImage and ShmPutImage sources are wrapped
+ * as user buffer objects and blitted into the destination pixmap.
+ *
+ * Wrapping a buffer pins its pages, so with ExaShmCache a wrapped
+ * MIT-SHM segment can be reused for later uploads from the same
+ * segment, as long as the segment stays attached. The MIT-SHM dispatch
+ * function is wrapped to learn which segment a ShmPutImage comes from,
+ * and to drop all cached segments whenever segments are attached or
+ * detached. Extensions are initialized after the screens, so the
+ * wrapping is done from the first block handler.
+ *
+ * Other modules may wrap the same dispatch entries after us. We can
+ * then no longer unwrap at CloseScreen, and leave our function in the
+ * chain, still forwarding to what it wrapped, until the server resets
+ * the dispatch tables for the next generation. That case has not been
+ * tried against a real extension, so the cache is off by default.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include "psb_driver.h"
+#include "dixstruct.h"
+#include "extnsionst.h"
+#define _XSHM_SERVER_
+#include <X11/extensions/shmstr.h>
+
+#define PSB_UPLOAD_PAGE_SIZE 4096
+#define PSB_UPLOAD_OFFSET_ALIGN 8
+
+static int psbUploadScreens = 0;
+static int psbShmMajor = -1;
+static int (*psbShmProc) (ClientPtr) = NULL;
+static int (*psbShmSwappedProc) (ClientPtr) = NULL;
+static unsigned long psbShmGeneration = 1;
+static XID psbShmCurSeg = None;
+
+static int
+psbShmDispatchCommon(ClientPtr client, int (*proc) (ClientPtr))
+{
+    REQUEST(xReq);
+    xShmPutImageReq *req;
+    int ret;
+
+    switch (stuff->data) {
+    case X_ShmPutImage:
+	if (client->req_len < (sizeof(xShmPutImageReq) >> 2))
+	    break;
+	req = (xShmPutImageReq *) stuff;
+	psbShmCurSeg = req->shmseg;
+	if (client->swapped)
+	    psbShmCurSeg = lswapl(psbShmCurSeg);
+	ret = (*proc) (client);
+	psbShmCurSeg = None;
+	return ret;
+    case X_ShmAttach:
+    case X_ShmDetach:
+	psbShmGeneration++;
+	break;
+    default:
+	break;
+    }
+
+    return (*proc) (client);
+}
+
+static int
+psbShmDispatch(ClientPtr client)
+{
+    return psbShmDispatchCommon(client, psbShmProc);
+}
+
+static int
+psbShmSwappedDispatch(ClientPtr client)
+{
+    return psbShmDispatchCommon(client, psbShmSwappedProc);
+}
+
+/*
+ * Segments of a client that goes away are detached without any
+ * ShmDetach request.
+ */
+
+static void
+psbUploadClientState(CallbackListPtr *list, pointer closure, pointer data)
+{
+    NewClientInfoRec *clientinfo = (NewClientInfoRec *) data;
+
+    if (clientinfo->client->clientState == ClientStateGone)
+	psbShmGeneration++;
+}
+
+void
+psbUploadInit(ScrnInfoPtr pScrn, PsbExaPtr pPsbExa)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+
+    if (!pPsb->exaUserUpload)
+	return;
+
+    pPsbExa->uploadUp = TRUE;
+    pPsbExa->uploadShm = FALSE;
+    pPsbExa->uploadShmProbed = !pPsb->exaShmCache;
+}
+
+/*
+ * Wrap the MIT-SHM dispatch functions, or share the wrapping another
+ * screen already did. Screens are counted only once they are hooked.
+ */
+
+static Bool
+psbUploadHookShm(void)
+{
+    ExtensionEntry *ext;
+
+    if (psbUploadScreens) {
+	psbUploadScreens++;
+	return TRUE;
+    }
+
+    ext = CheckExtension(SHMNAME);
+    if (!ext)
+	return FALSE;
+
+    if (!AddCallback(&ClientStateCallback, psbUploadClientState, NULL))
+	return FALSE;
+
+    psbShmMajor = ext->base;
+    psbShmProc = ProcVector[psbShmMajor];
+    psbShmSwappedProc = SwappedProcVector[psbShmMajor];
+    ProcVector[psbShmMajor] = psbShmDispatch;
+    SwappedProcVector[psbShmMajor] = psbShmSwappedDispatch;
+    psbUploadScreens = 1;
+
+    return TRUE;
+}
+
+static void
+psbUploadDropSeg(PsbUploadSegPtr seg)
+{
+    if (seg->buf) {
+	mmBufDestroy(seg->buf);
+	seg->buf = NULL;
+    }
+}
+
+void
+psbUploadClose(PsbExaPtr pPsbExa)
+{
+    int i;
+
+    if (!pPsbExa->uploadUp)
+	return;
+
+    for (i = 0; i < PSB_UPLOAD_CACHE_SIZE; ++i)
+	psbUploadDropSeg(&pPsbExa->uploadCache[i]);
+
+    pPsbExa->uploadUp = FALSE;
+    if (!pPsbExa->uploadShm)
+	return;
+
+    pPsbExa->uploadShm = FALSE;
+    if (--psbUploadScreens)
+	return;
+
+    /*
+     * Only unwrap what nobody wrapped on top of us. Otherwise the
+     * saved functions stay in use by our dispatch functions.
+     */
+
+    if (ProcVector[psbShmMajor] == psbShmDispatch)
+	ProcVector[psbShmMajor] = psbShmProc;
+    if (SwappedProcVector[psbShmMajor] == psbShmSwappedDispatch)
+	SwappedProcVector[psbShmMajor] = psbShmSwappedProc;
+    DeleteCallback(&ClientStateCallback, psbUploadClientState, NULL);
+    psbShmMajor = -1;
+}
+
+/*
+ * Called from the block handler. Hook MIT-SHM the first time through,
+ * and unpin segments that may have been detached.
+ */
+
+void
+psbUploadExpire(PsbExaPtr pPsbExa)
+{
+    PsbUploadSegPtr seg;
+    int i;
+
+    if (!pPsbExa->uploadUp)
+	return;
+
+    if (!pPsbExa->uploadShmProbed) {
+	pPsbExa->uploadShmProbed = TRUE;
+	pPsbExa->uploadShm = psbUploadHookShm();
+    }
+
+    for (i = 0; i < PSB_UPLOAD_CACHE_SIZE; ++i) {
+	seg = &pPsbExa->uploadCache[i];
+	if (seg->buf && seg->generation != psbShmGeneration)
+	    psbUploadDropSeg(seg);
+    }
+}
+
+/*
+ * Whether [start, end) lies within a single System V shared memory
+ * mapping of the server. During a ShmPutImage, uploads from other
+ * memory, like EXA's system copies of pixmaps it migrates, may come
+ * through as well, and must not be cached under the segment.
+ */
+
+static Bool
+psbUploadInShm(unsigned long start, unsigned long end)
+{
+    unsigned long lo, hi;
+    char line[256], path[64];
+    Bool ret = FALSE;
+    FILE *maps;
+
+    maps = fopen("/proc/self/maps", "r");
+    if (!maps)
+	return FALSE;
+
+    while (fgets(line, sizeof(line), maps)) {
+	path[0] = 0;
+	if (sscanf(line, "%lx-%lx %*s %*s %*s %*s %63s", &lo, &hi, path) < 2)
+	    continue;
+	if (lo <= start && start < hi) {
+	    ret = (end <= hi && !strncmp(path, "/SYSV", 5));
+	    break;
+	}
+    }
+
+    fclose(maps);
+    return ret;
+}
+
+/*
+ * Find a wrapped segment covering [start, end), or a slot to put a new
+ * one in: a free slot, a stale one, or the least recently used one.
+ */
+
+static PsbUploadSegPtr
+psbUploadLookup(PsbExaPtr pPsbExa, XID shmseg, unsigned long start,
+		unsigned long end, Bool *found)
+{
+    PsbUploadSegPtr seg, victim = NULL;
+    int i;
+
+    for (i = 0; i < PSB_UPLOAD_CACHE_SIZE; ++i) {
+	seg = &pPsbExa->uploadCache[i];
+	if (seg->buf && seg->generation != psbShmGeneration)
+	    psbUploadDropSeg(seg);
+
+	if (seg->buf && seg->shmseg == shmseg &&
+	    seg->start <= start && end <= seg->end) {
+	    *found = TRUE;
+	    return seg;
+	}
+
+	if (!victim || (victim->buf && (!seg->buf ||
+					seg->lastUse < victim->lastUse)))
+	    victim = seg;
+    }
+
+    *found = FALSE;
+    return victim;
+}
+
+static Bool
+psbUploadWaitIdle(PsbPtr pPsb, struct _MMBuffer *buf)
+{
+#ifdef XF86DRI
+    return drmBOWaitIdle(pPsb->drmFD, mmKernelBuf(buf), 0) == 0;
+#else
+    return FALSE;
+#endif
+}
+
+Bool
+psbUploadUserBuf(PixmapPtr pDst, int x, int y, int w, int h, char *src,
+		 int src_pitch)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pDst->drawable.pScreen->myNum];
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbDevicePtr pDevice = psbDevicePTR(pPsb);
+    PsbExaPtr pPsbExa = pPsb->pPsbExa;
+    unsigned long wBytes = (w * pDst->drawable.bitsPerPixel) >> 3;
+    unsigned long start, end, offset;
+    PsbUploadSegPtr seg = NULL;
+    struct _MMBuffer *buf;
+    Bool found = FALSE;
+    Bool ret;
+
+    if (!pPsbExa->uploadUp || h * wBytes < pPsb->exaUserUpload)
+	return FALSE;
+
+    if (pDst->drawable.depth == 4 || (((unsigned long)src | src_pitch) & 3))
+	return FALSE;
+
+    start = (unsigned long)src & ~(PSB_UPLOAD_PAGE_SIZE - 1);
+    end = ALIGN_TO((unsigned long)src + (h - 1) * src_pitch + wBytes,
+		   PSB_UPLOAD_PAGE_SIZE);
+
+    if (psbShmCurSeg != None) {
+	seg = psbUploadLookup(pPsbExa, psbShmCurSeg, start, end, &found);
+	if (!found && !psbUploadInShm(start, end))
+	    seg = NULL;
+    }
+
+    if (found)
+	buf = seg->buf;
+    else {
+	buf = pDevice->man->createUserBuf(pDevice->man, (void *)start,
+					  end - start,
+					  MM_FLAG_READ | MM_FLAG_MEM_TT |
+					  MM_FLAG_CACHED,
+					  MM_HINT_DONT_FENCE);
+	if (!buf)
+	    return FALSE;
+    }
+
+    offset = (unsigned long)src - start;
+    ret = psbAccelUploadBlit(pDst, x, y, w, h, buf,
+			     offset & ~(PSB_UPLOAD_OFFSET_ALIGN - 1),
+			     (offset & (PSB_UPLOAD_OFFSET_ALIGN - 1)) * 8 /
+			     pDst->drawable.bitsPerPixel, src_pitch);
+
+    /*
+     * The caller may reuse the source as soon as we return, so wait
+     * until the blitter is done reading it. If we can't, let the CPU
+     * copy the image instead. Mapping the destination for that waits
+     * for the blit too.
+     */
+
+    if (ret && !psbUploadWaitIdle(pPsb, buf))
+	ret = FALSE;
+
+    if (found) {
+	seg->lastUse = ++pPsbExa->uploadTick;
+    } else if (seg && ret) {
+	psbUploadDropSeg(seg);
+	seg->buf = buf;
+	seg->shmseg = psbShmCurSeg;
+	seg->start = start;
+	seg->end = end;
+	seg->generation = psbShmGeneration;
+	seg->lastUse = ++pPsbExa->uploadTick;
+    } else
+	mmBufDestroy(buf);
+
+    return ret;
+}
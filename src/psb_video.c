@@ -243,16 +243,69 @@ typedef struct _psb_coeffs_
     signed short bConst;
 } psb_coeffs_s, *psb_coeffs_p;
 
+/*
+ * Video frame buffers are leased to the ports from a pool shared by all
+ * ports of the device. Returned buffers are kept, most recently used
+ * first, for leases of the same size class. They are freed oldest first
+ * when the pool holds more than its cap, and by a timer once they have
+ * been idle for PSB_VIDEO_IDLE_MS, so that a stopped player doesn't leave
+ * them resident. Leases past the cap are still served, so that video
+ * keeps playing.
+ */
+
+#define PSB_VIDEO_PAGE_SIZE 4096
+#define PSB_VIDEO_IDLE_MS 5000
+
+typedef struct _PsbVideoBuf
+{
+    MMListHead head;
+    struct _MMBuffer *buf;
+    unsigned long size;
+    CARD32 lastUse;
+    unsigned long seq;		/* of the last frame displayed from it */
+} PsbVideoBufRec, *PsbVideoBufPtr;
+
+typedef struct _PsbVideoPool
+{
+    struct _MMManager *man;
+    MMListHead free;
+    unsigned long cap;
+    unsigned long resident;
+    unsigned long peak;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long seq;
+    OsTimerPtr timer;
+    int refCount;
+} PsbVideoPoolRec, *PsbVideoPoolPtr;
+
 typedef struct _PsbPortPrivRec
 {
     RegionRec clip;
     struct _MMManager *man;
-    struct _MMBuffer *videoBuf[2];
+    PsbVideoPoolPtr pool;
+    PsbVideoBufPtr videoLease[PSB_VIDEO_MAX_BUFS];
+    struct _MMBuffer *videoBuf[PSB_VIDEO_MAX_BUFS];
+    int numBufs;
     int curBuf;
     int videoBufSize;
+    unsigned long numStalls;
+    unsigned long long stallUsec;
+
+    /* the frame in videoBuf[curBuf], for ReputImage and repeat detection */
+    Bool haveFrame;
+    int frameId;
+    int frameDestId;
+    CARD32 frameHash;
+    short frameWidth, frameHeight;
+    int framePitch;
+    short src_x, src_y, src_w, src_h;
+    short drw_w, drw_h;
+    unsigned long numRepeats;
+
     float conversionData[11];
     Bool hdtv;
-    XpsbSurface srf[3][2];
+    XpsbSurface srf[3][PSB_VIDEO_MAX_BUFS];
     XpsbSurface dst;
     unsigned int bufPitch;
 
@@ -309,6 +362,190 @@ psbSetupPlanarConversionData(PsbPortPrivPtr pPriv, Bool hdtv)
     psb_pack_coeffs(pPriv, &pPriv->sgx_coeffs[0]);
 }
 
+/*
+ * Round a buffer size up to its size class, a quarter to an eighth of
+ * an octave wide.
+ */
+
+static unsigned long
+psbVideoRound(unsigned long size)
+{
+    unsigned long step = PSB_VIDEO_PAGE_SIZE;
+
+    size = ALIGN_TO(size, PSB_VIDEO_PAGE_SIZE);
+    while ((step << 3) < size)
+	step <<= 1;
+
+    return ALIGN_TO(size, step);
+}
+
+static void
+psbVideoBufDestroy(PsbVideoPoolPtr pool, PsbVideoBufPtr vBuf)
+{
+    mmBufDestroy(vBuf->buf);
+    pool->resident -= vBuf->size;
+    xfree(vBuf);
+}
+
+/*
+ * Free idle buffers, and the least recently used ones until no more
+ * than limit bytes are resident.
+ */
+
+static void
+psbVideoPoolTrim(PsbVideoPoolPtr pool, unsigned long limit)
+{
+    CARD32 now = GetTimeInMillis();
+    PsbVideoBufPtr vBuf;
+    MMListHead *list, *prev;
+
+    mmListForEachPrevSafe(list, prev, &pool->free) {
+	vBuf = mmListEntry(list, PsbVideoBufRec, head);
+	if (pool->resident <= limit &&
+	    now - vBuf->lastUse < PSB_VIDEO_IDLE_MS)
+	    break;
+
+	mmListDel(&vBuf->head);
+	psbVideoBufDestroy(pool, vBuf);
+    }
+}
+
+/*
+ * Runs while there are free buffers: frees the idle ones, and comes back
+ * when the next one will be.
+ */
+
+static CARD32
+psbVideoPoolTimer(OsTimerPtr timer, CARD32 now, pointer arg)
+{
+    PsbVideoPoolPtr pool = (PsbVideoPoolPtr) arg;
+    PsbVideoBufPtr vBuf;
+
+    psbVideoPoolTrim(pool, pool->cap);
+    if (pool->free.prev == &pool->free)
+	return 0;
+
+    vBuf = mmListEntry(pool->free.prev, PsbVideoBufRec, head);
+    return PSB_VIDEO_IDLE_MS - (now - vBuf->lastUse);
+}
+
+static PsbVideoBufPtr
+psbVideoBufLease(PsbVideoPoolPtr pool, unsigned long size)
+{
+    PsbVideoBufPtr vBuf;
+    MMListHead *list;
+
+    size = psbVideoRound(size);
+
+    mmListForEach(list, &pool->free) {
+	vBuf = mmListEntry(list, PsbVideoBufRec, head);
+	if (vBuf->size == size) {
+	    mmListDel(&vBuf->head);
+	    pool->hits++;
+	    return vBuf;
+	}
+    }
+
+    pool->misses++;
+    psbVideoPoolTrim(pool, (pool->cap > size) ? pool->cap - size : 0);
+
+    vBuf = xcalloc(1, sizeof(*vBuf));
+    if (!vBuf)
+	return NULL;
+
+    vBuf->buf = pool->man->createBuf(pool->man, size, 0,
+				     DRM_PSB_FLAG_MEM_MMU | DRM_BO_FLAG_READ,
+				     DRM_BO_HINT_DONT_FENCE);
+    if (!vBuf->buf) {
+	xfree(vBuf);
+	return NULL;
+    }
+
+    vBuf->size = size;
+    pool->resident += size;
+    if (pool->resident > pool->peak)
+	pool->peak = pool->resident;
+
+    return vBuf;
+}
+
+static void
+psbVideoBufRelease(PsbVideoPoolPtr pool, PsbVideoBufPtr vBuf)
+{
+    Bool wasEmpty = (pool->free.next == &pool->free);
+
+    vBuf->lastUse = GetTimeInMillis();
+    mmListAdd(&vBuf->head, &pool->free);
+    psbVideoPoolTrim(pool, pool->cap);
+
+    /*
+     * Otherwise the timer is already set for an older buffer.
+     */
+
+    if (wasEmpty)
+	pool->timer = TimerSet(pool->timer, 0, PSB_VIDEO_IDLE_MS,
+			       psbVideoPoolTimer, pool);
+}
+
+static PsbVideoPoolPtr
+psbVideoPoolRef(ScrnInfoPtr pScrn)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbDevicePtr pDevice = psbDevicePTR(pPsb);
+    PsbVideoPoolPtr pool = pDevice->videoPool;
+
+    if (!pool) {
+	pool = xcalloc(1, sizeof(*pool));
+	if (!pool)
+	    return NULL;
+
+	pool->man = pDevice->man;
+	pool->cap = pPsb->xvMemMax;
+	mmInitListHead(&pool->free);
+	pDevice->videoPool = pool;
+    }
+
+    pool->refCount++;
+    return pool;
+}
+
+static void
+psbVideoPoolUnref(ScrnInfoPtr pScrn, PsbVideoPoolPtr pool)
+{
+    PsbDevicePtr pDevice = psbDevicePTR(psbPTR(pScrn));
+
+    if (--pool->refCount > 0)
+	return;
+
+    xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+	       "Xv buffer pool: %lu hits, %lu misses, "
+	       "%lu kiB resident at most.\n",
+	       pool->hits, pool->misses, pool->peak >> 10);
+
+    TimerFree(pool->timer);
+    psbVideoPoolTrim(pool, 0);
+    pDevice->videoPool = NULL;
+    xfree(pool);
+}
+
+/*
+ * Give the frame buffers of a port back to the pool.
+ */
+
+static void
+psbReleaseVideoBuffers(PsbPortPrivPtr pPriv)
+{
+    int i;
+
+    for (i = 0; i < pPriv->numBufs; ++i) {
+	if (pPriv->videoLease[i])
+	    psbVideoBufRelease(pPriv->pool, pPriv->videoLease[i]);
+	pPriv->videoLease[i] = NULL;
+	pPriv->videoBuf[i] = NULL;
+    }
+    pPriv->haveFrame = FALSE;
+}
+
 static void psbStopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown);
 
 static PsbPortPrivPtr
@@ -320,7 +557,13 @@ psbPortPrivCreate(ScrnInfoPtr pScrn)
     pPriv = xcalloc(1, sizeof(*pPriv));
     if (!pPriv)
 	return NULL;
+    pPriv->pool = psbVideoPoolRef(pScrn);
+    if (!pPriv->pool) {
+	xfree(pPriv);
+	return NULL;
+    }
     pPriv->man = pDevice->man;
+    pPriv->numBufs = psbPTR(pScrn)->xvBuffers;
     REGION_NULL(pScreen, &pPriv->clip);
     pPriv->hdtv = TRUE;
     psbSetupConversionData(pPriv, FALSE);
@@ -348,56 +591,90 @@ psbPortPrivDestroy(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv)
 	return;
 
     psbStopVideo(pScrn, pPriv, TRUE);
-
-    if (pPriv->videoBuf[0]) {
-	mmBufDestroy(pPriv->videoBuf[0]);
-	mmBufDestroy(pPriv->videoBuf[1]);
-    }
+    psbVideoPoolUnref(pScrn, pPriv->pool);
+
+    if (pPriv->numStalls)
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Xv port: %lu buffer stalls, %llu usec stalled.\n",
+		   pPriv->numStalls, pPriv->stallUsec);
+    if (pPriv->numRepeats)
+	xf86DrvMsg(pScrn->scrnIndex, X_INFO,
+		   "Xv port: %lu repeated frames not uploaded.\n",
+		   pPriv->numRepeats);
     xfree(pPriv);
 }
 
 static int
 psbCheckVideoBuffer(PsbPortPrivPtr pPriv, unsigned int size)
 {
+    int i;
+
     size = ALIGN_TO(size, 4096);
 
-    if (pPriv->videoBuf[0] && pPriv->videoBufSize != size) {
-	mmBufDestroy(pPriv->videoBuf[0]);
-	mmBufDestroy(pPriv->videoBuf[1]);
-	pPriv->videoBuf[0] = NULL;
-	pPriv->videoBuf[1] = NULL;
-    }
-    if (!pPriv->videoBuf[0]) {
-	pPriv->videoBuf[0] = pPriv->man->createBuf(pPriv->man,
-						   size,
-						   0,
-						   DRM_PSB_FLAG_MEM_MMU |
-						   DRM_BO_FLAG_READ,
-						   DRM_BO_HINT_DONT_FENCE);
-	if (!pPriv->videoBuf[0])
-	    return BadAlloc;
-
-	pPriv->videoBuf[1] = pPriv->man->createBuf(pPriv->man,
-						   size,
-						   0,
-						   DRM_PSB_FLAG_MEM_MMU |
-						   DRM_BO_FLAG_READ,
-						   DRM_BO_HINT_DONT_FENCE);
-	if (!pPriv->videoBuf[1]) {
-	    mmBufDestroy(pPriv->videoBuf[0]);
-	    pPriv->videoBuf[0] = NULL;
-	    return BadAlloc;
+    if (pPriv->videoLease[0] &&
+	pPriv->videoLease[0]->size != psbVideoRound(size))
+	psbReleaseVideoBuffers(pPriv);
+
+    if (!pPriv->videoLease[0]) {
+	for (i = 0; i < pPriv->numBufs; ++i) {
+	    pPriv->videoLease[i] = psbVideoBufLease(pPriv->pool, size);
+	    if (!pPriv->videoLease[i]) {
+		psbReleaseVideoBuffers(pPriv);
+		return BadAlloc;
+	    }
+	    pPriv->videoBuf[i] = pPriv->videoLease[i]->buf;
+	    pPriv->srf[0][i].buffer = mmKernelBuf(pPriv->videoBuf[i]);
+	    pPriv->srf[0][i].offset = 0;
 	}
 
 	pPriv->videoBufSize = size;
-	pPriv->srf[0][0].buffer = mmKernelBuf(pPriv->videoBuf[0]);
-	pPriv->srf[0][0].offset = 0;
-	pPriv->srf[0][1].buffer = mmKernelBuf(pPriv->videoBuf[1]);
-	pPriv->srf[0][1].offset = 0;
     }
     return Success;
 }
 
+/*
+ * Pick the buffer to upload the next frame into: the first one, in ring
+ * order, that the hardware is done with. Only if all of them are busy do
+ * we wait, for the one displayed from longest ago, which the hardware
+ * gets done with first. Ring order alone doesn't tell which one that is,
+ * once idle buffers have been picked out of turn or the buffers were
+ * last displayed by another port.
+ */
+
+static void
+psbSelectVideoBuffer(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv)
+{
+    int fd = psbPTR(pScrn)->drmFD;
+    struct timeval then, now;
+    drmBO *bo;
+    int busy;
+    int i, slot, oldest = -1;
+
+    for (i = 1; i <= pPriv->numBufs; ++i) {
+	slot = (pPriv->curBuf + i) % pPriv->numBufs;
+	bo = mmKernelBuf(pPriv->videoBuf[slot]);
+	busy = 0;
+	if (drmBOBusy(fd, bo, &busy) || !busy) {
+	    pPriv->curBuf = slot;
+	    return;
+	}
+	if (oldest < 0 || (long)(pPriv->videoLease[slot]->seq -
+				 pPriv->videoLease[oldest]->seq) < 0)
+	    oldest = slot;
+    }
+
+    slot = oldest;
+    pPriv->numStalls++;
+    if (gettimeofday(&then, NULL))
+	FatalError("Gettimeofday error.\n");
+    (void)drmBOWaitIdle(fd, mmKernelBuf(pPriv->videoBuf[slot]), 0);
+    if (gettimeofday(&now, NULL))
+	FatalError("Gettimeofday error.\n");
+    pPriv->stallUsec += psbTimeDiff(&now, &then);
+
+    pPriv->curBuf = slot;
+}
+
 static int
 psbSetPortAttribute(ScrnInfoPtr pScrn,
 		    Atom attribute, INT32 value, pointer data)
@@ -473,7 +750,6 @@ psbCopyPackedData(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
 		  int srcPitch, int dstPitch, int top, int left, int h, int w)
 {
     unsigned char *src, *dst;
-    int i;
     struct _MMBuffer *dstBuf = pPriv->videoBuf[pPriv->curBuf];
 
     src = buf + (top * srcPitch) + (left << 1);
@@ -484,23 +760,23 @@ psbCopyPackedData(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
 
     dstBuf->man->mapBuf(dstBuf, MM_FLAG_WRITE, 0);
     dst = mmBufVirtual(dstBuf);
-    w <<= 1;
-    for (i = 0; i < h; i++) {
-	memcpy(dst, src, w);
-	src += srcPitch;
-	dst += dstPitch;
-    }
+    psbCopyRectWCAsync(dst, dstPitch, src, srcPitch, w << 1, h);
+    psbCopyWait();
     dstBuf->man->unMapBuf(dstBuf);
 }
 
+/*
+ * Planar YUV is uploaded as NV12, with the U and V planes interleaved
+ * into one chroma plane, so that it needs one texture less.
+ */
+
 static void
 psbCopyPlanarYUVData(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
 		     unsigned char *buf,
-		     int srcPitch, int dstPitch, int dstPitch2,
+		     int srcPitch, int dstPitch,
 		     int top, int left, int h, int w, int id)
 {
-    unsigned char *src_y, *src_u, *src_v, *dst_y, *dst_u, *dst_v;
-    int i;
+    unsigned char *src_y, *src_u, *src_v, *dst_y, *dst_uv;
     struct _MMBuffer *dstBuf = pPriv->videoBuf[pPriv->curBuf];
 
     src_y = buf + (top * srcPitch) + left;
@@ -520,36 +796,17 @@ psbCopyPlanarYUVData(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
 
     dstBuf->man->mapBuf(dstBuf, MM_FLAG_WRITE, 0);
 
-    /* dst always YUV, not YVU for I420 */
     dst_y = mmBufVirtual(dstBuf);
-    dst_u = dst_y + dstPitch * h;
-    dst_v = dst_u + dstPitch2 * (h >> 1);
+    dst_uv = dst_y + dstPitch * h;
 
     /* copy Y data */
-    for (i = 0; i < h; i++) {
-	memcpy(dst_y, src_y, w);
-	src_y += srcPitch;
-	dst_y += dstPitch;
-    }
+    psbCopyRectWCAsync(dst_y, dstPitch, src_y, srcPitch, w, h);
 
-    /* copy UV data */
-    srcPitch >>= 1;
-    w >>= 1;
-    h >>= 1;
-
-    for (i = 0; i < h; i++) {
-	memcpy(dst_u, src_u, w);
-	src_u += srcPitch;
-	dst_u += dstPitch2;
-    }
-
-    /* copy V data */
-    for (i = 0; i < h; i++) {
-	memcpy(dst_v, src_v, w);
-	src_v += srcPitch;
-	dst_v += dstPitch2;
-    }
+    /* interleave U and V data */
+    psbInterleaveRectWCAsync(dst_uv, dstPitch, src_u, src_v, srcPitch >> 1,
+			     w >> 1, h >> 1);
 
+    psbCopyWait();
     dstBuf->man->unMapBuf(dstBuf);
 }
 
@@ -560,7 +817,6 @@ psbCopyPlanarNV12Data(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
 		      int top, int left, int h, int w)
 {
     unsigned char *src_y, *src_uv, *dst_y, *dst_uv;
-    int i;
     struct _MMBuffer *dstBuf = pPriv->videoBuf[pPriv->curBuf];
 
     src_y = buf + (top * srcPitch) + left;
@@ -576,20 +832,12 @@ psbCopyPlanarNV12Data(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
     dst_uv = dst_y + dstPitch * h;
 
     /* copy Y data */
-    for (i = 0; i < h; i++) {
-	memcpy(dst_y, src_y, w);
-	src_y += srcPitch;
-	dst_y += dstPitch;
-    }
+    psbCopyRectWCAsync(dst_y, dstPitch, src_y, srcPitch, w, h);
 
     /* copy UV data */
-    h >>= 1;
-    for (i = 0; i < h; i++) {
-	memcpy(dst_uv, src_uv, w);
-	src_uv += srcPitch;
-	dst_uv += dstPitch;
-    }
+    psbCopyRectWCAsync(dst_uv, dstPitch, src_uv, srcPitch, w, h >> 1);
 
+    psbCopyWait();
     dstBuf->man->unMapBuf(dstBuf);
 }
 
@@ -650,9 +898,10 @@ psbDisplayVideo(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv, int id,
 	memcpy(src[1], src[0], sizeof(XpsbSurface));
 	src[1]->h /= 2;
 	src[1]->w /= 2;		       /* width will be used as stride in Xpsb */
-	src[1]->stride = ALIGN_TO(src[1]->w, 32);
+	/* the chroma plane follows the frame's luma rows, at the same pitch */
+	src[1]->stride = video_pitch;
 	src[1]->texCoordIndex = 1;
-	src[1]->offset = src[0]->offset + video_pitch * src_h;
+	src[1]->offset = src[0]->offset + video_pitch * height;
 	src[1]->isYUVPacked = 2;
 
 	conversion_data = (float *)(&pPriv->sgx_coeffs[0]);
@@ -722,6 +971,12 @@ psbDisplayVideo(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv, int id,
     pbox = REGION_RECTS(dstRegion);
     nbox = REGION_NUM_RECTS(dstRegion);
 
+    /*
+     * Deferred 2D rendering to the destination must land first.
+     */
+
+    psbAccelFlush(pScrn);
+
 #ifdef PSB_DETEAR
     /* we don't support multiple box render detearing with temp buffer
        very well, have to fall back to original rendering */
@@ -782,6 +1037,78 @@ psbDisplayVideo(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv, int id,
     return TRUE;
 }
 
+/*
+ * A cheap hash of a client frame, used with the XvSkipRepeats option to
+ * spot a client putting the same frame again (paused or low frame rate
+ * video). It samples about PSB_VIDEO_HASH_SAMPLES words spread over the
+ * whole frame; the odd stride makes consecutive samples walk across
+ * columns rather than hitting the same column of every row. A frame that
+ * differs from the last one only between the samples is taken for a
+ * repeat, which is why this is off by default.
+ */
+
+#define PSB_VIDEO_HASH_SAMPLES 8192
+
+static CARD32
+psbVideoFrameHash(const unsigned char *buf, unsigned int size)
+{
+    const CARD32 *words = (const CARD32 *)buf;
+    unsigned int num = size >> 2;
+    unsigned int step = (num / PSB_VIDEO_HASH_SAMPLES) | 1;
+    CARD32 hash = 2166136261U;
+    unsigned int i;
+
+    for (i = 0; i < num; i += step)
+	hash = (hash ^ words[i]) * 16777619U;
+    if (num)
+	hash = (hash ^ words[num - 1]) * 16777619U;
+
+    return hash;
+}
+
+/*
+ * Display the retained frame at the given destination geometry.
+ */
+
+static int
+psbPutFrame(ScrnInfoPtr pScrn, PsbPortPrivPtr pPriv,
+	    short drw_x, short drw_y, short drw_w, short drw_h,
+	    RegionPtr clipBoxes, DrawablePtr pDraw)
+{
+    ScreenPtr pScreen = screenInfo.screens[pScrn->scrnIndex];
+    PixmapPtr pPixmap;
+    INT32 x1, x2, y1, y2;
+    BoxRec dstBox;
+
+    x1 = pPriv->src_x;
+    x2 = pPriv->src_x + pPriv->src_w;
+    y1 = pPriv->src_y;
+    y2 = pPriv->src_y + pPriv->src_h;
+
+    dstBox.x1 = drw_x;
+    dstBox.x2 = drw_x + drw_w;
+    dstBox.y1 = drw_y;
+    dstBox.y2 = drw_y + drw_h;
+
+    if (!xf86XVClipVideoHelper(&dstBox, &x1, &x2, &y1, &y2, clipBoxes,
+			       pPriv->frameWidth, pPriv->frameHeight))
+	return Success;
+
+    if (pDraw->type == DRAWABLE_WINDOW) {
+	pPixmap = (*pScreen->GetWindowPixmap) ((WindowPtr) pDraw);
+    } else {
+	pPixmap = (PixmapPtr) pDraw;
+    }
+
+    psbDisplayVideo(pScrn, pPriv, pPriv->frameDestId, clipBoxes,
+		    pPriv->frameWidth, pPriv->frameHeight, pPriv->framePitch,
+		    x1, y1, x2, y2, pPriv->src_w, pPriv->src_h,
+		    drw_w, drw_h, pPixmap);
+    pPriv->videoLease[pPriv->curBuf]->seq = ++pPriv->pool->seq;
+
+    return Success;
+}
+
 /*
  * The source rectangle of the video is defined by (src_x, src_y, src_w, src_h).
  * The dest rectangle of the video is defined by (drw_x, drw_y, drw_w, drw_h).
@@ -807,12 +1134,12 @@ psbPutImage(ScrnInfoPtr pScrn,
 	    Bool sync, RegionPtr clipBoxes, pointer data, DrawablePtr pDraw)
 {
     PsbPortPrivPtr pPriv = (PsbPortPrivPtr) data;
-    ScreenPtr pScreen = screenInfo.screens[pScrn->scrnIndex];
-    PixmapPtr pPixmap;
     INT32 x1, x2, y1, y2;
-    int srcPitch, dstPitch, dstPitch2 = 0, destId;
-    int size = 0;
+    int srcPitch, dstPitch, destId;
+    int size = 0, srcSize = 0;
     BoxRec dstBox;
+    Bool skipRepeats = psbPTR(pScrn)->xvSkipRepeats;
+    CARD32 hash;
     int ret;
 
     /* Clip */
@@ -827,8 +1154,10 @@ psbPutImage(ScrnInfoPtr pScrn,
     dstBox.y2 = drw_y + drw_h;
 
     if (!xf86XVClipVideoHelper(&dstBox, &x1, &x2, &y1, &y2, clipBoxes,
-			       width, height))
+			       width, height)) {
+	pPriv->haveFrame = FALSE;
 	return Success;
+    }
 
     destId = id;
 
@@ -841,19 +1170,21 @@ psbPutImage(ScrnInfoPtr pScrn,
 	 */
 	dstPitch = ALIGN_TO(width, 32) << 1;
 	size = dstPitch * height;
+	srcSize = srcPitch * height;
 	break;
     case FOURCC_YV12:
     case FOURCC_I420:
+	destId = FOURCC_NV12;
 	srcPitch = width;
 	dstPitch = ALIGN_TO(width, 32);
-	dstPitch2 = ALIGN_TO(width >> 1, 32);
-	size = dstPitch * height + /* UV */ 2 * dstPitch2 * (height >> 1);
+	size = dstPitch * height + /* UV */ dstPitch * ((height + 1) >> 1);
+	srcSize = srcPitch * height + 2 * (srcPitch >> 1) * (height >> 1);
 	break;
     case FOURCC_NV12:
 	srcPitch = width;
 	dstPitch = ALIGN_TO(width, 32);
-	dstPitch2 = ALIGN_TO(width >> 1, 32);
-	size = dstPitch * height + /* UV */ 2 * dstPitch2 * (height >> 1);
+	size = dstPitch * height + /* UV */ dstPitch * ((height + 1) >> 1);
+	srcSize = srcPitch * height + 2 * (srcPitch >> 1) * (height >> 1);
 	break;
     default:
 	xf86DrvMsg(pScrn->scrnIndex, X_ERROR,
@@ -861,11 +1192,27 @@ psbPutImage(ScrnInfoPtr pScrn,
 	return BadValue;
     }
 
+    /*
+     * The same frame again: display the copy we still have.
+     */
+
+    hash = skipRepeats ? psbVideoFrameHash(buf, srcSize) : 0;
+    if (skipRepeats && pPriv->haveFrame &&
+	pPriv->frameHash == hash && pPriv->frameId == id &&
+	pPriv->frameWidth == width && pPriv->frameHeight == height &&
+	pPriv->src_x == src_x && pPriv->src_y == src_y &&
+	pPriv->src_w == src_w && pPriv->src_h == src_h) {
+	pPriv->numRepeats++;
+	goto out_display;
+    }
+
     ret = psbCheckVideoBuffer(pPriv, size);
 
     if (ret)
 	return ret;
 
+    psbSelectVideoBuffer(pScrn, pPriv);
+
     switch (id) {
     case FOURCC_UYVY:
     case FOURCC_YUY2:
@@ -875,7 +1222,7 @@ psbPutImage(ScrnInfoPtr pScrn,
 
     case FOURCC_YV12:
     case FOURCC_I420:
-	psbCopyPlanarYUVData(pScrn, pPriv, buf, srcPitch, dstPitch, dstPitch2,
+	psbCopyPlanarYUVData(pScrn, pPriv, buf, srcPitch, dstPitch,
 			     src_y, src_x, height, width, id);
 	break;
     case FOURCC_NV12:
@@ -886,20 +1233,70 @@ psbPutImage(ScrnInfoPtr pScrn,
 	break;
     }
 
-    if (pDraw->type == DRAWABLE_WINDOW) {
-	pPixmap = (*pScreen->GetWindowPixmap) ((WindowPtr) pDraw);
-    } else {
-	pPixmap = (PixmapPtr) pDraw;
-    }
+    pPriv->haveFrame = TRUE;
+    pPriv->frameId = id;
+    pPriv->frameDestId = destId;
+    pPriv->frameHash = hash;
+    pPriv->frameWidth = width;
+    pPriv->frameHeight = height;
+    pPriv->framePitch = dstPitch;
+    pPriv->src_x = src_x;
+    pPriv->src_y = src_y;
+    pPriv->src_w = src_w;
+    pPriv->src_h = src_h;
+
+  out_display:
+    pPriv->drw_w = drw_w;
+    pPriv->drw_h = drw_h;
+
+    return psbPutFrame(pScrn, pPriv, drw_x, drw_y, drw_w, drw_h,
+		       clipBoxes, pDraw);
+}
+
+/*
+ * Redisplay the last frame put on the port, for exposes and window moves,
+ * without the client sending it again.
+ */
 
+#if GET_ABI_MAJOR(ABI_VIDEODRV_VERSION) < 6
+static int
+psbReputImage(ScrnInfoPtr pScrn,
+	      short drw_x, short drw_y,
+	      RegionPtr clipBoxes, pointer data, DrawablePtr pDraw)
+{
+    PsbPortPrivPtr pPriv = (PsbPortPrivPtr) data;
 
-    psbDisplayVideo(pScrn, pPriv, destId, clipBoxes, width, height,
-		    dstPitch, x1, y1, x2, y2,
-		    src_w, src_h, drw_w, drw_h, pPixmap);
+    if (!pPriv->haveFrame)
+	return Success;
 
-    pPriv->curBuf = (pPriv->curBuf + 1) & 1;
-    return Success;
+    return psbPutFrame(pScrn, pPriv, drw_x, drw_y, pPriv->drw_w,
+		       pPriv->drw_h, clipBoxes, pDraw);
+}
+#else
+static int
+psbReputImage(ScrnInfoPtr pScrn,
+	      short src_x, short src_y,
+	      short drw_x, short drw_y,
+	      short src_w, short src_h,
+	      short drw_w, short drw_h,
+	      RegionPtr clipBoxes, pointer data, DrawablePtr pDraw)
+{
+    PsbPortPrivPtr pPriv = (PsbPortPrivPtr) data;
+
+    if (!pPriv->haveFrame)
+	return Success;
+
+    pPriv->src_x = src_x;
+    pPriv->src_y = src_y;
+    pPriv->src_w = src_w;
+    pPriv->src_h = src_h;
+    pPriv->drw_w = drw_w;
+    pPriv->drw_h = drw_h;
+
+    return psbPutFrame(pScrn, pPriv, drw_x, drw_y, drw_w, drw_h,
+		       clipBoxes, pDraw);
 }
+#endif
 
 static void
 psbStopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown)
@@ -907,6 +1304,13 @@ psbStopVideo(ScrnInfoPtr pScrn, pointer data, Bool shutdown)
     PsbPortPrivPtr pPriv = (PsbPortPrivPtr) data;
 
     REGION_EMPTY(pScrn->pScreen, &pPriv->clip);
+
+    /*
+     * Stopped ports don't hold on to frame buffers.
+     */
+
+    if (shutdown)
+	psbReleaseVideoBuffers(pPriv);
 }
 
 static int
@@ -1039,7 +1443,7 @@ psbSetupImageVideo(ScreenPtr pScreen)
     adapt->GetPortAttribute = psbGetPortAttribute;
     adapt->QueryBestSize = psbQueryBestSize;
     adapt->PutImage = psbPutImage;
-    adapt->ReputImage = NULL;
+    adapt->ReputImage = psbReputImage;
     adapt->QueryImageAttributes = psbQueryImageAttributes;
 
     adapt->pPortPrivates = (DevUnion *)
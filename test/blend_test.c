@@ -0,0 +1,390 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * 2D blends: PictOpOver and PictOpAdd go to the 2D engine only when it
+ * gets the destination alpha right. A source without alpha must not be
+ * blended into a destination with alpha, since the engine would write
+ * the source's undefined alpha bits there. The blends must match what
+ * Render defines, with and without a constant mask, and a mask the
+ * engine may still be writing must not be waited for.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+typedef Bool (*TestPrepareCompositeProc) (int, PicturePtr, PicturePtr,
+					  PicturePtr, PixmapPtr, PixmapPtr,
+					  PixmapPtr);
+typedef void (*TestCompositeProc) (PixmapPtr, int, int, int, int, int, int,
+				   int, int);
+typedef Bool (*TestPrepareSolidProc) (PixmapPtr, int, Pixel, Pixel);
+typedef void (*TestSolidProc) (PixmapPtr, int, int, int, int);
+typedef void (*TestDoneProc) (PixmapPtr);
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static Bool
+testBlend(ScrnInfoPtr pScrn, int op, CARD32 srcFormat, int srcDepth,
+	  int srcBpp, CARD32 dstFormat, int dstDepth, int dstBpp)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCompositeProc prepareComposite = pExa->PrepareComposite;
+    TestDoneProc doneComposite = pExa->DoneComposite;
+    PictureRec srcPict, dstPict;
+    PixmapPtr pSrc, pDst;
+    Bool ret;
+
+    pSrc = stubPixmapCreate(pScrn, 64, 64, srcDepth, srcBpp);
+    pDst = stubPixmapCreate(pScrn, 64, 64, dstDepth, dstBpp);
+    CHECK(pSrc && pDst);
+    if (!pSrc || !pDst)
+	return FALSE;
+
+    memset(&srcPict, 0, sizeof(srcPict));
+    srcPict.pDrawable = &pSrc->drawable;
+    srcPict.format = srcFormat;
+    memset(&dstPict, 0, sizeof(dstPict));
+    dstPict.pDrawable = &pDst->drawable;
+    dstPict.format = dstFormat;
+
+    ret = prepareComposite(op, &srcPict, NULL, &dstPict, pSrc, NULL, pDst);
+    if (ret)
+	doneComposite(pDst);
+
+    stubPixmapDestroy(pSrc);
+    stubPixmapDestroy(pDst);
+    return ret;
+}
+
+/*
+ * Premultiplied source pixels, with alpha 0 and 0xFF among them.
+ */
+
+static CARD32
+testSrcPixel(int x, int y)
+{
+    CARD32 a = (y == 0) ? 0xFF : (x == 0) ? 0 : (x * 37 + y * 11) & 0xFF;
+    CARD32 r = (a * ((x * 5 + y) & 0xF)) >> 4;
+    CARD32 g = (a * ((x + y * 3) & 0xF)) >> 4;
+    CARD32 b = (a * ((x * 7 + y * 9) & 0xF)) >> 4;
+
+    return (a << 24) | (r << 16) | (g << 8) | b;
+}
+
+static CARD32
+testDstPixel(int x, int y)
+{
+    return 0x30000000 + (x << 20) + (y << 12) + (x * y);
+}
+
+static CARD32
+testMul(CARD32 a, CARD32 b)
+{
+    CARD32 t = a * b + 0x80;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+/*
+ * Render's Over and Add with a mask of alpha m.
+ */
+
+static CARD32
+testReference(int op, CARD32 src, CARD32 dst, CARD32 m)
+{
+    CARD32 srcA = testMul(src >> 24, m);
+    CARD32 result = 0, c, s, d;
+    int shift;
+
+    for (shift = 0; shift < 32; shift += 8) {
+	s = testMul((src >> shift) & 0xFF, m);
+	d = (dst >> shift) & 0xFF;
+	if (op == PictOpOver)
+	    c = s + testMul(d, 0xFF - srcA);
+	else
+	    c = s + d;
+	result |= ((c > 0xFF) ? 0xFF : c) << shift;
+    }
+
+    return result;
+}
+
+static Bool
+testClose(CARD32 a, CARD32 b, CARD32 mask)
+{
+    int shift, diff;
+
+    for (shift = 0; shift < 32; shift += 8) {
+	if (!((mask >> shift) & 0xFF))
+	    continue;
+	diff = (int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF);
+	if (diff < -2 || diff > 2)
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+testFill(PixmapPtr pPix, CARD32(*pixel) (int, int))
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_DEST);
+    int x, y;
+
+    CHECK(base != NULL);
+    if (!base)
+	return;
+
+    for (y = 0; y < pPix->drawable.height; ++y)
+	for (x = 0; x < pPix->drawable.width; ++x)
+	    ((CARD32 *) (base + y * pPix->devKind))[x] = pixel(x, y);
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_DEST);
+}
+
+/*
+ * Blend a 16x16 a8r8g8b8 or x8r8g8b8 source into a 32 bpp destination
+ * with a 1x1 a8r8g8b8 mask of alpha maskA, or no mask if maskA is 0,
+ * and compare with Render's result.
+ */
+
+static void
+testPixels(ScrnInfoPtr pScrn, int op, Bool srcAlpha, Bool dstAlpha,
+	   CARD32 maskA)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCompositeProc prepareComposite = pExa->PrepareComposite;
+    TestCompositeProc composite = pExa->Composite;
+    TestDoneProc doneComposite = pExa->DoneComposite;
+    PictureRec srcPict, maskPict, dstPict;
+    PixmapPtr pSrc, pMask = NULL, pDst;
+    CARD32 dstMask = dstAlpha ? 0xFFFFFFFF : 0x00FFFFFF;
+    CARD32 src, expect;
+    CARD8 *base;
+    int x, y, bad = 0;
+
+    pSrc = stubPixmapCreate(pScrn, 16, 16, srcAlpha ? 32 : 24, 32);
+    pDst = stubPixmapCreate(pScrn, 16, 16, dstAlpha ? 32 : 24, 32);
+    if (maskA)
+	pMask = stubPixmapCreate(pScrn, 1, 1, 32, 32);
+    CHECK(pSrc && pDst && (pMask || !maskA));
+    if (!pSrc || !pDst || (!pMask && maskA))
+	return;
+
+    testFill(pSrc, testSrcPixel);
+    testFill(pDst, testDstPixel);
+
+    memset(&srcPict, 0, sizeof(srcPict));
+    srcPict.pDrawable = &pSrc->drawable;
+    srcPict.format = srcAlpha ? PICT_a8r8g8b8 : PICT_x8r8g8b8;
+    memset(&dstPict, 0, sizeof(dstPict));
+    dstPict.pDrawable = &pDst->drawable;
+    dstPict.format = dstAlpha ? PICT_a8r8g8b8 : PICT_x8r8g8b8;
+    if (pMask) {
+	base = stubPixmapMap(pMask, EXA_PREPARE_DEST);
+	CHECK(base != NULL);
+	if (base) {
+	    *(CARD32 *) base = (maskA << 24) | 0x00123456;
+	    stubPixmapUnmap(pMask, EXA_PREPARE_DEST);
+	}
+	memset(&maskPict, 0, sizeof(maskPict));
+	maskPict.pDrawable = &pMask->drawable;
+	maskPict.format = PICT_a8r8g8b8;
+	maskPict.repeat = 1;
+    }
+
+    stubDrmResetStats();
+    CHECK(prepareComposite(op, &srcPict, pMask ? &maskPict : NULL,
+			   &dstPict, pSrc, pMask, pDst));
+    composite(pDst, 0, 0, 0, 0, 0, 0, 16, 16);
+    doneComposite(pDst);
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+
+    base = stubPixmapMap(pDst, EXA_PREPARE_SRC);
+    CHECK(base != NULL);
+    if (!base)
+	goto out;
+
+    for (y = 0; y < 16; ++y) {
+	for (x = 0; x < 16; ++x) {
+	    src = testSrcPixel(x, y);
+	    if (!srcAlpha)
+		src |= 0xFF000000;
+	    expect = testReference(op, src, testDstPixel(x, y),
+				   maskA ? maskA : 0xFF);
+	    if (!testClose(((CARD32 *) (base + y * pDst->devKind))[x],
+			   expect, dstMask))
+		bad++;
+	}
+    }
+    stubPixmapUnmap(pDst, EXA_PREPARE_SRC);
+
+    if (bad)
+	fprintf(stderr, "Op %d, mask alpha 0x%02x: %d wrong pixels.\n", op,
+		(unsigned)maskA, bad);
+    CHECK(bad == 0);
+  out:
+    stubPixmapDestroy(pSrc);
+    stubPixmapDestroy(pDst);
+    if (pMask)
+	stubPixmapDestroy(pMask);
+}
+
+/*
+ * A mask the blitter has yet to write, or is busy otherwise, sends
+ * Composite off the 2D path instead of waiting for it.
+ */
+
+static void
+testBusyMask(ScrnInfoPtr pScrn)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCompositeProc prepareComposite = pExa->PrepareComposite;
+    TestPrepareSolidProc prepareSolid = pExa->PrepareSolid;
+    TestSolidProc solid = pExa->Solid;
+    TestDoneProc doneComposite = pExa->DoneComposite;
+    TestDoneProc doneSolid = pExa->DoneSolid;
+    PictureRec srcPict, maskPict, dstPict;
+    PixmapPtr pSrc, pMask, pDst;
+    drmBO *bo;
+    uint64_t busy;
+
+    pSrc = stubPixmapCreate(pScrn, 16, 16, 32, 32);
+    pMask = stubPixmapCreate(pScrn, 1, 1, 32, 32);
+    pDst = stubPixmapCreate(pScrn, 16, 16, 32, 32);
+    CHECK(pSrc && pMask && pDst);
+    if (!pSrc || !pMask || !pDst)
+	return;
+
+    memset(&srcPict, 0, sizeof(srcPict));
+    srcPict.pDrawable = &pSrc->drawable;
+    srcPict.format = PICT_a8r8g8b8;
+    memset(&maskPict, 0, sizeof(maskPict));
+    maskPict.pDrawable = &pMask->drawable;
+    maskPict.format = PICT_a8r8g8b8;
+    maskPict.repeat = 1;
+    memset(&dstPict, 0, sizeof(dstPict));
+    dstPict.pDrawable = &pDst->drawable;
+    dstPict.format = PICT_a8r8g8b8;
+
+    psbAccelFlush(pScrn);
+    stubDrmResetStats();
+    CHECK(prepareSolid(pMask, GXcopy, ~0, 0x80000000));
+    solid(pMask, 0, 0, 1, 1);
+    doneSolid(pMask);
+    CHECK(!prepareComposite(PictOpOver, &srcPict, &maskPict, &dstPict,
+			    pSrc, pMask, pDst));
+    CHECK(stubDrmStats.submits == 0);
+
+    psbAccelFlush(pScrn);
+    bo = mmKernelBuf(psbPixmapPriv(pMask)->buf);
+    busy = stubUsec() + 20000;
+    stubDrmBusyUntil(bo->handle, busy);
+    CHECK(!prepareComposite(PictOpOver, &srcPict, &maskPict, &dstPict,
+			    pSrc, pMask, pDst));
+    CHECK(stubUsec() < busy);
+
+    while (stubUsec() < busy) ;
+    CHECK(prepareComposite(PictOpOver, &srcPict, &maskPict, &dstPict,
+			   pSrc, pMask, pDst));
+    doneComposite(pDst);
+
+    stubPixmapDestroy(pSrc);
+    stubPixmapDestroy(pMask);
+    stubPixmapDestroy(pDst);
+}
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoPtr pScrn;
+    PsbExaPtr pPsbExa;
+    int b;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    CHECK(testBlend(pScrn, PictOpOver, PICT_a8r8g8b8, 32, 32,
+		    PICT_a8r8g8b8, 32, 32));
+    CHECK(testBlend(pScrn, PictOpOver, PICT_a8r8g8b8, 32, 32,
+		    PICT_x8r8g8b8, 24, 32));
+    CHECK(testBlend(pScrn, PictOpOver, PICT_x8r8g8b8, 24, 32,
+		    PICT_x8r8g8b8, 24, 32));
+    CHECK(testBlend(pScrn, PictOpAdd, PICT_r5g6b5, 16, 16,
+		    PICT_r5g6b5, 16, 16));
+
+    CHECK(!testBlend(pScrn, PictOpOver, PICT_x8r8g8b8, 24, 32,
+		     PICT_a8r8g8b8, 32, 32));
+    CHECK(!testBlend(pScrn, PictOpAdd, PICT_x8r8g8b8, 24, 32,
+		     PICT_a8r8g8b8, 32, 32));
+    CHECK(!testBlend(pScrn, PictOpOver, PICT_r5g6b5, 16, 16,
+		     PICT_a8r8g8b8, 32, 32));
+
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.validateErrors == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+
+    pPsbExa = psbPTR(pScrn)->pPsbExa;
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b)
+	pPsbExa->minPixels[PSB_CAL_SOLID][b] = 0;
+
+    testPixels(pScrn, PictOpOver, TRUE, TRUE, 0);
+    testPixels(pScrn, PictOpOver, TRUE, FALSE, 0x80);
+    testPixels(pScrn, PictOpOver, FALSE, FALSE, 0xC0);
+    testPixels(pScrn, PictOpAdd, TRUE, TRUE, 0);
+    testPixels(pScrn, PictOpAdd, TRUE, TRUE, 0x40);
+    testBusyMask(pScrn);
+
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}
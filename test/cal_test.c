@@ -0,0 +1,218 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Calibration profile handling: a saved profile must load back unchanged,
+ * damaged profiles must be ignored, and in auto mode a calibration run
+ * must only be requested when there is no profile yet and one can be
+ * saved. A calibration run that can't map its buffer must leave the
+ * thresholds alone, and no run may leave surface state behind that
+ * refers to its buffer.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "psb_driver.h"
+#include "psb_accel.h"
+#include "stub.h"
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static void
+writeFile(const char *name, const char *contents)
+{
+    FILE *f = fopen(name, "w");
+
+    if (!f || fputs(contents, f) < 0 || fclose(f)) {
+	perror(name);
+	exit(1);
+    }
+}
+
+static void
+testRun(void)
+{
+    static const int failAfter[] = { 0, 5, 4097 };
+    ScrnInfoPtr pScrn;
+    PsbExaPtr pPsbExa;
+    PsbTwodContextPtr tdc;
+    unsigned sentinel[PSB_CAL_NUM_OPS][PSB_CAL_NUM_BPP];
+    unsigned long numBuffers;
+    int f, op, i;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	failures++;
+	return;
+    }
+    pPsbExa = psbPTR(pScrn)->pPsbExa;
+    tdc = &psbPTR(pScrn)->td;
+
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	for (i = 0; i < PSB_CAL_NUM_BPP; ++i)
+	    sentinel[op][i] = 12345 + op * 2 + i;
+    memcpy(pPsbExa->minPixels, sentinel, sizeof(sentinel));
+    numBuffers = stubDrmStats.numBuffers;
+
+    /*
+     * Fail the first map, one while timing the CPU, and the one after
+     * the first blitter timing.
+     */
+
+    for (f = 0; f < sizeof(failAfter) / sizeof(failAfter[0]); ++f) {
+	tdc->shadowPat.valid = TRUE;
+	stubDrmFailMap(failAfter[f]);
+	CHECK(!psbCalibrateRun(pScrn, pPsbExa));
+	stubDrmFailMap(-1);
+	CHECK(!memcmp(pPsbExa->minPixels, sentinel, sizeof(sentinel)));
+	CHECK(stubDRILocked == 0);
+	CHECK(stubDrmStats.numBuffers == numBuffers);
+
+	/*
+	 * Without its first map, a run doesn't get to touch any state.
+	 */
+
+	CHECK(failAfter[f] == 0 ||
+	      (!tdc->shadowSrc.valid && !tdc->shadowDst.valid &&
+	       !tdc->shadowPat.valid));
+    }
+
+    tdc->shadowPat.valid = TRUE;
+    CHECK(psbCalibrateRun(pScrn, pPsbExa));
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	for (i = 0; i < PSB_CAL_NUM_BPP; ++i)
+	    CHECK(pPsbExa->minPixels[op][i] != sentinel[op][i]);
+    CHECK(stubDRILocked == 0);
+    CHECK(stubDrmStats.numBuffers == numBuffers);
+    CHECK(!tdc->shadowSrc.valid && !tdc->shadowDst.valid &&
+	  !tdc->shadowPat.valid);
+
+    stubScreenDestroy(pScrn);
+}
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoRec scrn;
+    PsbExaRec defaults, saved, exa;
+    char dir[] = "/tmp/cal_testXXXXXX";
+    char name[sizeof(dir) + 16];
+    char missing[sizeof(dir) + 32];
+    int op, i;
+
+    memset(&scrn, 0, sizeof(scrn));
+    if (!mkdtemp(dir)) {
+	perror("mkdtemp");
+	return 1;
+    }
+    sprintf(name, "%s/profile", dir);
+    sprintf(missing, "%s/no-such-dir/profile", dir);
+
+    memset(&defaults, 0, sizeof(defaults));
+    psbCalibrateDefaults(&defaults);
+
+    /*
+     * No profile: only auto mode with a writable directory calibrates.
+     */
+
+    memset(&exa, 0, sizeof(exa));
+    CHECK(psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_AUTO, name, TRUE));
+    CHECK(!memcmp(exa.minPixels, defaults.minPixels,
+		  sizeof(exa.minPixels)));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_AUTO, name, FALSE));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_AUTO, missing, TRUE));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_OFF, name, TRUE));
+    CHECK(psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_FORCE, name, TRUE));
+    CHECK(!psbCalibrateSave(&scrn, &exa, missing));
+
+    /*
+     * Round trip.
+     */
+
+    memset(&saved, 0, sizeof(saved));
+    for (op = 0; op < PSB_CAL_NUM_OPS; ++op)
+	for (i = 0; i < PSB_CAL_NUM_BPP; ++i)
+	    saved.minPixels[op][i] = (op + 1) * 1000 + i * 16 + 7;
+    saved.minPixels[PSB_CAL_SOLID][0] = ~0U;
+    CHECK(psbCalibrateSave(&scrn, &saved, name));
+    CHECK(access(name, F_OK) == 0);
+
+    memset(&exa, 0, sizeof(exa));
+    CHECK(psbCalibrateLoad(&scrn, &exa, name));
+    CHECK(!memcmp(exa.minPixels, saved.minPixels, sizeof(exa.minPixels)));
+
+    memset(&exa, 0, sizeof(exa));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_AUTO, name, TRUE));
+    CHECK(!memcmp(exa.minPixels, saved.minPixels, sizeof(exa.minPixels)));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_OFF, name, TRUE));
+    CHECK(!memcmp(exa.minPixels, defaults.minPixels,
+		  sizeof(exa.minPixels)));
+
+    /*
+     * Damaged profiles are ignored, but do not trigger a new run in auto
+     * mode either.
+     */
+
+    writeFile(name, "psb-exa-calibration 1\nsolid 16 100\ncopy 32 200\n");
+    memset(&exa, 0, sizeof(exa));
+    CHECK(!psbCalibrateLoad(&scrn, &exa, name));
+    CHECK(!psbCalibrateInit(&scrn, &exa, PSB_CAL_MODE_AUTO, name, TRUE));
+    CHECK(!memcmp(exa.minPixels, defaults.minPixels,
+		  sizeof(exa.minPixels)));
+
+    writeFile(name, "psb-exa-calibration 99\n");
+    CHECK(!psbCalibrateLoad(&scrn, &exa, name));
+
+    writeFile(name, "psb-exa-calibration 1\nblend 16 100\n");
+    CHECK(!psbCalibrateLoad(&scrn, &exa, name));
+
+    unlink(name);
+    rmdir(dir);
+
+    testRun();
+
+    return failures ? 1 : 0;
+}
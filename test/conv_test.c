@@ -0,0 +1,326 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Format conversion in 2D PictOpSrc composites: every source and
+ * destination format pair the 2D engine takes must give what Render
+ * asks for, which is checked against a CPU reference. Channels are
+ * widened by replicating their bits and narrowed by truncation, and a
+ * source without alpha is opaque.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+#define TEST_W 40
+#define TEST_H 24
+
+typedef Bool (*TestPrepareCompositeProc) (int, PicturePtr, PicturePtr,
+					  PicturePtr, PixmapPtr, PixmapPtr,
+					  PixmapPtr);
+typedef void (*TestCompositeProc) (PixmapPtr, int, int, int, int, int, int,
+				   int, int);
+typedef void (*TestDoneProc) (PixmapPtr);
+
+typedef struct _TestFormat
+{
+    CARD32 format;
+    int depth;
+} TestFormatRec;
+
+static const TestFormatRec testFormats[] = {
+    {PICT_r3g3b2, 8},
+    {PICT_a4r4g4b4, 16},
+    {PICT_x1r5g5b5, 15},
+    {PICT_a1r5g5b5, 16},
+    {PICT_r5g6b5, 16},
+    {PICT_x8r8g8b8, 24},
+    {PICT_a8r8g8b8, 32}
+};
+
+#define TEST_NUM_FORMATS (sizeof(testFormats) / sizeof(testFormats[0]))
+
+/*
+ * A composite: source position, destination position and size.
+ */
+
+static const int testRects[][6] = {
+    {3, 2, 5, 4, 29, 17},
+    {0, 0, 30, 1, 8, 20},
+    {11, 9, 0, 0, 1, 1}
+};
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static CARD32
+testGet(CARD8 * line, int bpp, int x)
+{
+    switch (bpp) {
+    case 8:
+	return line[x];
+    case 16:
+	return ((CARD16 *) line)[x];
+    default:
+	return ((CARD32 *) line)[x];
+    }
+}
+
+static void
+testPut(CARD8 * line, int bpp, int x, CARD32 value)
+{
+    switch (bpp) {
+    case 8:
+	line[x] = value;
+	break;
+    case 16:
+	((CARD16 *) line)[x] = value;
+	break;
+    default:
+	((CARD32 *) line)[x] = value;
+	break;
+    }
+}
+
+static CARD32
+testWiden(CARD32 value, int shift, int bits)
+{
+    CARD32 c = (value >> shift) & ((1 << bits) - 1);
+    CARD32 wide = 0;
+    int have;
+
+    for (have = 0; have < 8; have += bits)
+	wide = (wide << bits) | c;
+
+    return wide >> (have - 8);
+}
+
+/*
+ * Convert a pixel the way Render defines it, going through 8 bits per
+ * channel.
+ */
+
+static CARD32
+testReference(CARD32 from, CARD32 to, CARD32 value)
+{
+    int bits[4] = { PICT_FORMAT_A(from), PICT_FORMAT_R(from),
+	PICT_FORMAT_G(from), PICT_FORMAT_B(from)
+    };
+    int toBits[4] = { PICT_FORMAT_A(to), PICT_FORMAT_R(to),
+	PICT_FORMAT_G(to), PICT_FORMAT_B(to)
+    };
+    int shift = 0, toShift = 0, c;
+    CARD32 channel, result = 0;
+
+    for (c = 3; c >= 0; --c) {
+	if (bits[c])
+	    channel = testWiden(value, shift, bits[c]);
+	else
+	    channel = (c == 0) ? 0xFF : 0;
+	if (toBits[c])
+	    result |= (channel >> (8 - toBits[c])) << toShift;
+	shift += bits[c];
+	toShift += toBits[c];
+    }
+
+    return result;
+}
+
+static CARD32
+testMask(CARD32 format)
+{
+    int bits = PICT_FORMAT_A(format) + PICT_FORMAT_R(format) +
+	PICT_FORMAT_G(format) + PICT_FORMAT_B(format);
+
+    return (bits == 32) ? ~0U : (1U << bits) - 1;
+}
+
+static void
+testFill(PixmapPtr pPix, unsigned seed)
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_DEST);
+    int x, y;
+
+    CHECK(base != NULL);
+    if (!base)
+	return;
+
+    srand(seed);
+    for (y = 0; y < TEST_H; ++y)
+	for (x = 0; x < TEST_W; ++x)
+	    testPut(base + y * pPix->devKind, pPix->drawable.bitsPerPixel, x,
+		    (rand() << 16) ^ rand());
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_DEST);
+}
+
+/*
+ * Composite the test rectangles from a source in one format to a
+ * destination in another. Returns FALSE if the 2D engine doesn't take
+ * the pair.
+ */
+
+static Bool
+testConvert(ScrnInfoPtr pScrn, const TestFormatRec * src,
+	    const TestFormatRec * dst)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCompositeProc prepareComposite = pExa->PrepareComposite;
+    TestCompositeProc composite = pExa->Composite;
+    TestDoneProc doneComposite = pExa->DoneComposite;
+    int srcBpp = PICT_FORMAT_BPP(src->format);
+    int dstBpp = PICT_FORMAT_BPP(dst->format);
+    PictureRec srcPict, dstPict;
+    PixmapPtr pSrc, pDst;
+    CARD8 *srcBase, *dstBase, *srcLine, *dstLine;
+    CARD32 expect, got, mask = testMask(dst->format);
+    int r, x, y, sx, sy, bad = 0;
+    Bool ret;
+
+    pSrc = stubPixmapCreate(pScrn, TEST_W, TEST_H, src->depth, srcBpp);
+    pDst = stubPixmapCreate(pScrn, TEST_W, TEST_H, dst->depth, dstBpp);
+    CHECK(pSrc && pDst);
+    if (!pSrc || !pDst)
+	return FALSE;
+
+    testFill(pSrc, 1);
+    testFill(pDst, 2);
+
+    memset(&srcPict, 0, sizeof(srcPict));
+    srcPict.pDrawable = &pSrc->drawable;
+    srcPict.format = src->format;
+    memset(&dstPict, 0, sizeof(dstPict));
+    dstPict.pDrawable = &pDst->drawable;
+    dstPict.format = dst->format;
+
+    stubDrmResetStats();
+    ret = prepareComposite(PictOpSrc, &srcPict, NULL, &dstPict, pSrc, NULL,
+			   pDst);
+    if (!ret)
+	goto out;
+
+    for (r = 0; r < sizeof(testRects) / sizeof(testRects[0]); ++r)
+	composite(pDst, testRects[r][0], testRects[r][1], 0, 0,
+		  testRects[r][2], testRects[r][3], testRects[r][4],
+		  testRects[r][5]);
+    doneComposite(pDst);
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+    CHECK(stubDrmStats.hazards == 0);
+
+    /*
+     * Rebuild what the destination should hold: its own pixels, with
+     * the rectangles converted from the source on top.
+     */
+
+    srcBase = stubPixmapMap(pSrc, EXA_PREPARE_SRC);
+    dstBase = stubPixmapMap(pDst, EXA_PREPARE_SRC);
+    CHECK(srcBase && dstBase);
+    if (!srcBase || !dstBase)
+	goto out;
+
+    srand(2);
+    for (y = 0; y < TEST_H; ++y) {
+	dstLine = dstBase + y * pDst->devKind;
+	for (x = 0; x < TEST_W; ++x) {
+	    expect = (rand() << 16) ^ rand();
+	    for (r = 0; r < sizeof(testRects) / sizeof(testRects[0]); ++r) {
+		if (x < testRects[r][2] ||
+		    x >= testRects[r][2] + testRects[r][4] ||
+		    y < testRects[r][3] ||
+		    y >= testRects[r][3] + testRects[r][5])
+		    continue;
+		sx = testRects[r][0] + x - testRects[r][2];
+		sy = testRects[r][1] + y - testRects[r][3];
+		srcLine = srcBase + sy * pSrc->devKind;
+		expect = testReference(src->format, dst->format,
+				       testGet(srcLine, srcBpp, sx));
+	    }
+	    got = testGet(dstLine, dstBpp, x);
+	    if ((got & mask) != (expect & mask))
+		bad++;
+	}
+    }
+
+    stubPixmapUnmap(pSrc, EXA_PREPARE_SRC);
+    stubPixmapUnmap(pDst, EXA_PREPARE_SRC);
+
+    if (bad)
+	fprintf(stderr, "0x%08x to 0x%08x: %d wrong pixels.\n",
+		(unsigned)src->format, (unsigned)dst->format, bad);
+    CHECK(bad == 0);
+  out:
+    stubPixmapDestroy(pSrc);
+    stubPixmapDestroy(pDst);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoPtr pScrn;
+    int s, d, converted = 0;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    for (s = 0; s < TEST_NUM_FORMATS; ++s) {
+	for (d = 0; d < TEST_NUM_FORMATS; ++d) {
+	    if (testConvert(pScrn, &testFormats[s], &testFormats[d]))
+		converted += (s != d);
+	    else
+		CHECK(s != d);
+	}
+    }
+    CHECK(converted > 0);
+
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Throughput of the upload copy kernels, per kernel, row width and
+ * alignment. Each copy is checked byte for byte, including the bytes
+ * around the destination rectangle, which must be left alone.
+ *
+ * The destination is ordinary memory here rather than write-combined,
+ * so the numbers say little about how the kernels compare on hardware.
+ *
+ * Usage: copy_bench [MiB-per-measurement]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xf86.h"
+#include "psb_copy.h"
+#include "stub.h"
+
+#define BENCH_ROWS 64
+#define BENCH_GUARD 64
+
+static const char *benchKernelNames[] = { "memcpy", "SSE2", "SSE3" };
+
+static int
+benchRun(PsbCopyKernel kernel, unsigned long wBytes, unsigned dstAlign,
+	 unsigned srcAlign, unsigned long total)
+{
+    unsigned long pitch = wBytes + 2 * BENCH_GUARD;
+    unsigned long size = pitch * BENCH_ROWS + 32;
+    CARD8 *srcMem = malloc(size);
+    CARD8 *dstMem = malloc(size);
+    CARD8 *src, *dst;
+    unsigned long reps = total / (wBytes * BENCH_ROWS) + 1;
+    unsigned long i, y;
+    uint64_t start, usec;
+    int ret = 0;
+
+    if (!srcMem || !dstMem) {
+	free(srcMem);
+	free(dstMem);
+	return 1;
+    }
+
+    src = (CARD8 *) (((unsigned long)srcMem + 15) & ~15UL) + srcAlign;
+    dst = (CARD8 *) (((unsigned long)dstMem + 15) & ~15UL) + dstAlign;
+    for (i = 0; i < size; ++i)
+	srcMem[i] = (CARD8) (i * 37 + 11);
+    memset(dstMem, 0xA5, size);
+
+    psbCopyRectWC(dst + BENCH_GUARD, pitch, src + BENCH_GUARD, pitch,
+		  wBytes, BENCH_ROWS);
+
+    for (y = 0; y < BENCH_ROWS; ++y) {
+	CARD8 *d = dst + y * pitch;
+	CARD8 *s = src + y * pitch;
+
+	for (i = 0; i < pitch; ++i) {
+	    if (i >= BENCH_GUARD && i < BENCH_GUARD + wBytes) {
+		if (d[i] != s[i])
+		    ret = 1;
+	    } else if (d[i] != 0xA5) {
+		ret = 1;
+	    }
+	}
+    }
+
+    start = stubUsec();
+    for (i = 0; i < reps; ++i)
+	psbCopyRectWC(dst + BENCH_GUARD, pitch, src + BENCH_GUARD, pitch,
+		      wBytes, BENCH_ROWS);
+    usec = stubUsec() - start;
+
+    printf("%-6s %5lu bytes, dst +%u, src +%u: %8.1f MiB/s%s\n",
+	   benchKernelNames[kernel], wBytes, dstAlign, srcAlign,
+	   usec ? (double)reps * wBytes * BENCH_ROWS / usec * 1e6 /
+	   (1024. * 1024.) : 0., ret ? "  FAILED" : "");
+
+    free(srcMem);
+    free(dstMem);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const unsigned long widths[] = { 48, 64, 200, 1024, 4096 };
+    static const unsigned aligns[][2] = { {0, 0}, {0, 4}, {4, 0}, {7, 3} };
+    unsigned long total = ((argc > 1) ? strtoul(argv[1], NULL, 0) : 16) *
+	1024 * 1024;
+    PsbCopyKernel max, kernel;
+    unsigned i, j;
+    int ret = 0;
+
+    for (max = PSB_COPY_MEMCPY; max <= PSB_COPY_SSE3; ++max) {
+	kernel = psbCopySelect(max);
+	if (kernel != max)
+	    continue;
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i)
+	    for (j = 0; j < sizeof(aligns) / sizeof(aligns[0]); ++j)
+		ret |= benchRun(kernel, widths[i], aligns[j][0],
+				aligns[j][1], total);
+    }
+
+    return ret;
+}
@@ -0,0 +1,225 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Readback throughput of DownloadFromScreen against the stub DRM.
+ *
+ * A pixmap is filled with a known pattern, then read back with the
+ * driver's DownloadFromScreen, which blits into the cached scratch
+ * buffers and copies out of them, and with a plain copy out of the
+ * PrepareAccess mapping EXA falls back to, which the driver always
+ * grants for the auxiliary indices. The result must match byte for
+ * byte. The stub engine moves the given number of MB per second. The stub maps are ordinary memory, so on hardware the
+ * fallback, which reads write-combined memory, is far slower than here.
+ *
+ * Usage: download_bench [iterations [engine-MB-per-s]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+typedef Bool (*BenchDownloadProc) (PixmapPtr, int, int, int, int, char *,
+				   int);
+
+static CARD8
+benchPattern(int x, int y, int byte)
+{
+    return (CARD8) (x * 7 + y * 13 + byte * 101);
+}
+
+static Bool
+benchFill(PixmapPtr pPix)
+{
+    int cpp = pPix->drawable.bitsPerPixel >> 3;
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_DEST);
+    int x, y, b;
+
+    if (!base)
+	return FALSE;
+
+    for (y = 0; y < pPix->drawable.height; ++y)
+	for (x = 0; x < pPix->drawable.width; ++x)
+	    for (b = 0; b < cpp; ++b)
+		base[y * pPix->devKind + x * cpp + b] = benchPattern(x, y, b);
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_DEST);
+    return TRUE;
+}
+
+static int
+benchCheck(PixmapPtr pPix, int x0, int y0, int w, int h, const CARD8 * dst,
+	   int dstPitch)
+{
+    int cpp = pPix->drawable.bitsPerPixel >> 3;
+    int x, y, b;
+
+    for (y = 0; y < h; ++y)
+	for (x = 0; x < w; ++x)
+	    for (b = 0; b < cpp; ++b)
+		if (dst[y * dstPitch + x * cpp + b] !=
+		    benchPattern(x0 + x, y0 + y, b))
+		    return 1;
+
+    return 0;
+}
+
+static Bool
+benchMapped(PixmapPtr pPix, int x, int y, int w, int h, char *dst,
+	    int dstPitch)
+{
+    int cpp = pPix->drawable.bitsPerPixel >> 3;
+    CARD8 *src = stubPixmapMap(pPix, EXA_PREPARE_AUX_SRC);
+
+    if (!src)
+	return FALSE;
+
+    src += y * pPix->devKind + x * cpp;
+    while (h--) {
+	memcpy(dst, src, w * cpp);
+	dst += dstPitch;
+	src += pPix->devKind;
+    }
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_AUX_SRC);
+    return TRUE;
+}
+
+static double
+benchTime(BenchDownloadProc download, PixmapPtr pPix, int x, int y, int w,
+	  int h, char *dst, int dstPitch, unsigned iterations, int *ret)
+{
+    uint64_t start;
+    unsigned i;
+
+    memset(dst, 0, dstPitch * h);
+    start = stubUsec();
+    for (i = 0; i < iterations; ++i) {
+	if (!download(pPix, x, y, w, h, dst, dstPitch)) {
+	    *ret = 1;
+	    return 0.;
+	}
+    }
+
+    start = stubUsec() - start;
+    if (benchCheck(pPix, x, y, w, h, (CARD8 *) dst, dstPitch))
+	*ret = 1;
+
+    return (double)start / iterations;
+}
+
+static int
+benchRun(ScrnInfoPtr pScrn, int w, int h, int bpp, unsigned iterations)
+{
+    PsbExaPtr pPsbExa = psbPTR(pScrn)->pPsbExa;
+    BenchDownloadProc download = pPsbExa->pExa->DownloadFromScreen;
+    PixmapPtr pPix = stubPixmapCreate(pScrn, w + 16, h + 16,
+				      (bpp == 32) ? 24 : 16, bpp);
+    int dstPitch = (w * bpp / 8) + 12;
+    char *dst = malloc(dstPitch * h);
+    double mib = (double)w * h * (bpp / 8) / (1024. * 1024.);
+    double blitUsec, mapUsec;
+    int ret = 0;
+
+    if (!pPix || !dst || !benchFill(pPix)) {
+	printf("%4dx%-4d %2d bpp: setup failed.\n", w, h, bpp);
+	free(dst);
+	if (pPix)
+	    stubPixmapDestroy(pPix);
+	return 1;
+    }
+
+    stubDrmResetStats();
+    blitUsec = benchTime(download, pPix, 5, 3, w, h, dst, dstPitch,
+			 iterations, &ret);
+    if (stubDrmStats.submits == 0 || stubDrmStats.unhandled ||
+	stubDrmStats.boundsErrors || stubDrmStats.relocErrors)
+	ret = 1;
+    mapUsec = benchTime(benchMapped, pPix, 5, 3, w, h, dst, dstPitch,
+			iterations, &ret);
+
+    printf("%4dx%-4d %2d bpp: blit %8.1f MiB/s (%lu submissions), "
+	   "mapped %8.1f MiB/s%s\n", w, h, bpp,
+	   blitUsec ? mib * 1e6 / blitUsec : 0., stubDrmStats.submits,
+	   mapUsec ? mib * 1e6 / mapUsec : 0., ret ? "  FAILED" : "");
+
+    free(dst);
+    stubPixmapDestroy(pPix);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int sizes[][2] = {
+	{64, 64}, {256, 256}, {640, 480}, {1024, 768}, {2000, 1500}
+    };
+    unsigned iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 8;
+    unsigned bandwidth = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1000;
+    ScrnInfoPtr pScrn;
+    PsbExaPtr pPsbExa;
+    unsigned i, b;
+    int ret = 0;
+
+    stubDrmSetEngine(20, 10);
+    stubDrmSetBandwidth(bandwidth);
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	printf("EXA initialization failed.\n");
+	return 1;
+    }
+
+    /*
+     * Always take the blit path; the crossover is what calibration is
+     * for.
+     */
+
+    pPsbExa = psbPTR(pScrn)->pPsbExa;
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b)
+	pPsbExa->minPixels[PSB_CAL_DOWNLOAD][b] = 0;
+
+    printf("%u iterations, engine %u MB/s, %lu kiB scratch.\n",
+	   iterations, bandwidth, psbPTR(pScrn)->exaScratchSize / 1024);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+	ret |= benchRun(pScrn, sizes[i][0], sizes[i][1], 32, iterations);
+	ret |= benchRun(pScrn, sizes[i][0], sizes[i][1], 16, iterations);
+    }
+
+    stubScreenDestroy(pScrn);
+    return ret;
+}
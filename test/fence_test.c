@@ -0,0 +1,215 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * 2D fences: surface state must not change under blits that may still
+ * run, and a blit must be fenced from unfenced blits writing what it
+ * reads, also through another surface sharing the same bytes of a
+ * buffer. Blits that don't read such areas go without a fence.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+#define TEST_W 100
+#define TEST_H 200
+
+typedef Bool (*TestPrepareSolidProc) (PixmapPtr, int, Pixel, Pixel);
+typedef void (*TestSolidProc) (PixmapPtr, int, int, int, int);
+typedef Bool (*TestPrepareCopyProc) (PixmapPtr, PixmapPtr, int, int, int,
+				     Pixel);
+typedef void (*TestCopyProc) (PixmapPtr, int, int, int, int, int, int);
+typedef void (*TestDoneProc) (PixmapPtr);
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static void
+testSolid(ScrnInfoPtr pScrn, PixmapPtr pPix, Pixel fg)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareSolidProc prepareSolid = pExa->PrepareSolid;
+    TestSolidProc solid = pExa->Solid;
+    TestDoneProc doneSolid = pExa->DoneSolid;
+
+    CHECK(prepareSolid(pPix, GXcopy, ~0, fg));
+    solid(pPix, 0, 0, pPix->drawable.width, pPix->drawable.height);
+    doneSolid(pPix);
+}
+
+/*
+ * Fills of two pixmaps in one batch: the second one's destination
+ * state must be fenced from the first fill.
+ */
+
+static void
+testStateChange(ScrnInfoPtr pScrn)
+{
+    PixmapPtr pA = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+    PixmapPtr pB = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+
+    CHECK(pA && pB);
+    if (!pA || !pB)
+	return;
+
+    stubDrmResetStats();
+    testSolid(pScrn, pA, 0x00102030);
+    testSolid(pScrn, pB, 0x00405060);
+    testSolid(pScrn, pA, 0x00708090);
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.submits == 1);
+    CHECK(stubDrmStats.hazards == 0);
+
+    stubPixmapDestroy(pA);
+    stubPixmapDestroy(pB);
+}
+
+/*
+ * Copies from a surface starting 16 rows into the destination's
+ * storage. Copying rows just written through the destination needs a
+ * fence, copying others doesn't.
+ */
+
+static void
+testAlias(ScrnInfoPtr pScrn)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCopyProc prepareCopy = pExa->PrepareCopy;
+    TestCopyProc copy = pExa->Copy;
+    TestDoneProc doneCopy = pExa->DoneCopy;
+    PsbTwodContextPtr tdc = &psbPTR(pScrn)->td;
+    PixmapPtr pDst = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+    PixmapPtr pSrc = stubPixmapCreate(pScrn, TEST_W, TEST_H - 16, 24, 32);
+    PsbPixmapPtr dstPriv, srcPriv;
+    PsbPixmapRec saved;
+    unsigned long long saves;
+    CARD8 *base;
+    int y, bad = 0;
+
+    CHECK(pDst && pSrc);
+    if (!pDst || !pSrc)
+	return;
+
+    dstPriv = psbPixmapPriv(pDst);
+    srcPriv = psbPixmapPriv(pSrc);
+    CHECK(exaGetPixmapPitch(pSrc) == exaGetPixmapPitch(pDst));
+    saved = *srcPriv;
+    srcPriv->buf = dstPriv->buf;
+    srcPriv->offset = dstPriv->offset + 16 * exaGetPixmapPitch(pDst);
+
+    base = stubPixmapMap(pDst, EXA_PREPARE_DEST);
+    CHECK(base != NULL);
+    if (base) {
+	for (y = 0; y < TEST_H; ++y)
+	    ((CARD32 *) (base + y * pDst->devKind))[0] = y;
+	stubPixmapUnmap(pDst, EXA_PREPARE_DEST);
+    }
+    stubDrmResetStats();
+
+    CHECK(prepareCopy(pSrc, pDst, 1, 1, GXcopy, ~0));
+
+    /*
+     * Destination rows 16 to 31 from source rows 32 to 47, then rows
+     * 64 to 79 from source rows 48 to 63. Nothing wrote those yet.
+     */
+
+    copy(pDst, 0, 32, 0, 16, TEST_W, 16);
+    saves = tdc->dwordsSaved;
+    copy(pDst, 0, 48, 0, 64, TEST_W, 16);
+    CHECK(tdc->dwordsSaved == saves + 1);
+
+    /*
+     * Source rows 0 to 15 are destination rows 16 to 31.
+     */
+
+    copy(pDst, 0, 0, 0, 120, TEST_W, 16);
+    CHECK(tdc->dwordsSaved == saves + 1);
+    doneCopy(pDst);
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+    CHECK(stubDrmStats.hazards == 0);
+
+    base = stubPixmapMap(pDst, EXA_PREPARE_SRC);
+    CHECK(base != NULL);
+    if (base) {
+	for (y = 120; y < 136; ++y)
+	    if (((CARD32 *) (base + y * pDst->devKind))[0] != y - 72)
+		bad = 1;
+	stubPixmapUnmap(pDst, EXA_PREPARE_SRC);
+    }
+    CHECK(!bad);
+
+    *srcPriv = saved;
+    stubPixmapDestroy(pSrc);
+    stubPixmapDestroy(pDst);
+}
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoPtr pScrn;
+    PsbExaPtr pPsbExa;
+    int b;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    pPsbExa = psbPTR(pScrn)->pPsbExa;
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b) {
+	pPsbExa->minPixels[PSB_CAL_SOLID][b] = 0;
+	pPsbExa->minPixels[PSB_CAL_COPY][b] = 0;
+    }
+
+    testStateChange(pScrn);
+    testAlias(pScrn);
+
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,178 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Chroma interleaving for NV12 uploads. The scalar kernel and each SIMD
+ * kernel the CPU supports interleave the same planes, for row lengths
+ * around the vector width and every destination alignment, and must
+ * write exactly the reference result, leaving the bytes around the
+ * destination rectangle alone.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xf86.h"
+#include "psb_copy.h"
+#include "stub.h"
+
+#define TEST_ROWS 3
+#define TEST_MAX_N 1000
+#define TEST_GUARD 48
+#define TEST_SRC_PITCH (TEST_MAX_N + 32)
+#define TEST_DST_PITCH (2 * TEST_MAX_N + 2 * TEST_GUARD + 16)
+#define TEST_DST_SIZE ((TEST_ROWS + 2) * TEST_DST_PITCH)
+#define TEST_NUM(_a) (sizeof(_a) / sizeof((_a)[0]))
+
+static const char *testKernelNames[] = { "memcpy", "SSE2", "SSE3" };
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static CARD8 testU[TEST_ROWS * TEST_SRC_PITCH + 16];
+static CARD8 testV[TEST_ROWS * TEST_SRC_PITCH + 16];
+
+/*
+ * Interleave n bytes per row from the planes at the given offsets into
+ * dst, which is filled with 0xA5 first. The rectangle starts one row
+ * and TEST_GUARD + dstAlign bytes in.
+ */
+
+static void
+testInterleave(CARD8 *dst, unsigned dstAlign, unsigned uAlign,
+	       unsigned vAlign, unsigned long n, Bool reference)
+{
+    CARD8 *d = dst + TEST_DST_PITCH + TEST_GUARD + dstAlign;
+    const CARD8 *u = testU + uAlign;
+    const CARD8 *v = testV + vAlign;
+    unsigned long x, y;
+
+    memset(dst, 0xA5, TEST_DST_SIZE);
+    if (!reference) {
+	psbInterleaveRectWC(d, TEST_DST_PITCH, u, v, TEST_SRC_PITCH, n,
+			    TEST_ROWS);
+	return;
+    }
+
+    for (y = 0; y < TEST_ROWS; ++y) {
+	for (x = 0; x < n; ++x) {
+	    d[2 * x] = u[x];
+	    d[2 * x + 1] = v[x];
+	}
+	d += TEST_DST_PITCH;
+	u += TEST_SRC_PITCH;
+	v += TEST_SRC_PITCH;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static const unsigned srcAligns[][2] = { {0, 0}, {1, 5}, {7, 3} };
+    static const unsigned long sizes[] = {
+	47, 48, 63, 64, 65, 100, 333, 720, 960, TEST_MAX_N
+    };
+    CARD8 *ref = malloc(TEST_DST_SIZE + 16);
+    CARD8 *out = malloc(TEST_DST_SIZE + 16);
+    CARD8 *scalar = malloc(TEST_DST_SIZE + 16);
+    CARD8 *refBuf, *outBuf, *scalarBuf;
+    PsbCopyKernel max, kernel;
+    unsigned long n, i;
+    unsigned dstAlign, a, k, cases;
+
+    if (!ref || !out || !scalar) {
+	fprintf(stderr, "Out of memory.\n");
+	return 1;
+    }
+
+    refBuf = (CARD8 *) (((unsigned long)ref + 15) & ~15UL);
+    outBuf = (CARD8 *) (((unsigned long)out + 15) & ~15UL);
+    scalarBuf = (CARD8 *) (((unsigned long)scalar + 15) & ~15UL);
+
+    for (i = 0; i < sizeof(testU); ++i) {
+	testU[i] = (CARD8) ((i * 2654435761U) >> 24);
+	testV[i] = (CARD8) (((i + 0x10000) * 2654435761U) >> 24);
+    }
+
+    for (max = PSB_COPY_MEMCPY; max <= PSB_COPY_SSE3; ++max) {
+	kernel = psbCopySelect(max);
+	if (kernel != max) {
+	    printf("%-6s not supported\n", testKernelNames[max]);
+	    continue;
+	}
+
+	cases = 0;
+	for (dstAlign = 0; dstAlign < 16; ++dstAlign) {
+	    for (a = 0; a < TEST_NUM(srcAligns); ++a) {
+		for (k = 0; k <= 40 + TEST_NUM(sizes); ++k) {
+		    n = (k <= 40) ? k : sizes[k - 41];
+		    testInterleave(refBuf, dstAlign, srcAligns[a][0],
+				   srcAligns[a][1], n, TRUE);
+		    testInterleave(outBuf, dstAlign, srcAligns[a][0],
+				   srcAligns[a][1], n, FALSE);
+		    CHECK(memcmp(refBuf, outBuf, TEST_DST_SIZE) == 0);
+
+		    /*
+		     * And the same as the scalar kernel.
+		     */
+
+		    if (kernel != PSB_COPY_MEMCPY) {
+			psbCopySelect(PSB_COPY_MEMCPY);
+			testInterleave(scalarBuf, dstAlign, srcAligns[a][0],
+				       srcAligns[a][1], n, FALSE);
+			psbCopySelect(max);
+			CHECK(memcmp(scalarBuf, outBuf, TEST_DST_SIZE) == 0);
+		    }
+		    ++cases;
+		}
+	    }
+	}
+
+	printf("%-6s %u cases%s\n", testKernelNames[kernel], cases,
+	       failures ? "  FAILED" : "");
+    }
+
+    free(ref);
+    free(out);
+    free(scalar);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * The offscreen allocator of the EXA fork, on a random trace of pixmap
+ * allocations, frees and uses. Reports the time spent in the allocator
+ * and how the runs it evicts compare with the lowest scored run that an
+ * exhaustive search over all areas finds. Checks the area list, the
+ * eviction heap, and that lazily aged scores match scores aged every
+ * decay period, as the allocator used to do.
+ *
+ * Usage: offscreen_bench [ops [seed [MiB]]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "exa/exa_priv.h"
+#include "stub.h"
+
+#define BENCH_PIXMAPS 3000
+#define BENCH_BASE 4096
+#define BENCH_MEMORY 8
+#define BENCH_ALIGN 64
+#define BENCH_CHECK_OPS 1000
+
+typedef struct _BenchPixmap
+{
+    PixmapRec pixmap;
+    DevUnion priv;
+    ExaPixmapPrivRec exaPriv;
+    int score;			       /* score, aged every period */
+} BenchPixmapRec, *BenchPixmapPtr;
+
+int exaScreenPrivateIndex;
+int exaPixmapPrivateIndex;
+ScreenInfo screenInfo;
+
+static ScreenRec benchScreen;
+static DevUnion benchScreenPriv;
+static ExaScreenPrivRec benchExaScr;
+static ExaDriverRec benchDriver;
+static BenchPixmapRec benchPixmaps[BENCH_PIXMAPS];
+static int benchMarks;
+static unsigned long long benchEvictedScore;
+static int failures;
+
+/*
+ * The current score of an area, aged the way the allocator does it.
+ */
+
+static int
+benchScore(const ExaOffscreenArea * area)
+{
+    unsigned int age = benchExaScr.offScreenEpoch - area->epoch;
+    int score = area->score;
+
+    while (age-- && score > 0)
+	score = (score * 7) / 8;
+
+    return score;
+}
+
+void
+exaPixmapSave(ScreenPtr pScreen, ExaOffscreenArea * area)
+{
+    BenchPixmapPtr pBench = area->privData;
+
+    benchEvictedScore += benchScore(area);
+    pBench->exaPriv.area = NULL;
+}
+
+static int
+benchRealSize(const ExaOffscreenArea * area, int size, int align)
+{
+    int tmp = area->base_offset % align;
+
+    return tmp ? size + (align - tmp) : size;
+}
+
+/*
+ * The lowest total score of a run of areas that can hold size bytes,
+ * over all runs.
+ */
+
+static int
+benchBestScore(int size, int align)
+{
+    ExaOffscreenArea *begin, *scan;
+    int best = INT_MAX, avail, score;
+
+    for (begin = benchDriver.offScreenAreas; begin; begin = begin->next) {
+	avail = 0;
+	score = 0;
+	for (scan = begin; scan && scan->state != ExaOffscreenLocked;
+	     scan = scan->next) {
+	    score += benchScore(scan);
+	    avail += scan->size;
+	    if (avail >= benchRealSize(begin, size, align))
+		break;
+	}
+	if (scan && scan->state != ExaOffscreenLocked && score < best)
+	    best = score;
+    }
+
+    return best;
+}
+
+static void
+benchMarkUsed(BenchPixmapPtr pBench)
+{
+    int i;
+
+    ExaOffscreenMarkUsed(&pBench->pixmap);
+    pBench->score += 100;
+    if (++benchMarks < 10)
+	return;
+
+    benchMarks = 0;
+    for (i = 0; i < BENCH_PIXMAPS; ++i)
+	if (benchPixmaps[i].exaPriv.area)
+	    benchPixmaps[i].score = (benchPixmaps[i].score * 7) / 8;
+}
+
+static void
+benchCheck(void)
+{
+    ExaOffscreenArea *area, *prev = NULL;
+    BenchPixmapPtr pBench;
+    int i;
+
+    for (area = benchDriver.offScreenAreas; area; area = area->next) {
+	if (area->prev != prev ||
+	    (prev && prev->base_offset + prev->size != area->base_offset) ||
+	    (area->state == ExaOffscreenRemovable &&
+	     benchExaScr.offScreenHeap[area->heap_index] != area)) {
+	    fprintf(stderr, "Damaged area list at offset 0x%x.\n",
+		    area->base_offset);
+	    failures++;
+	    return;
+	}
+	prev = area;
+    }
+    if (!prev || prev->base_offset + prev->size != benchDriver.memorySize) {
+	fprintf(stderr, "Area list doesn't cover the memory.\n");
+	failures++;
+    }
+
+    for (i = 1; i < benchExaScr.offScreenHeapSize; ++i)
+	if (benchScore(benchExaScr.offScreenHeap[(i - 1) >> 1]) >
+	    benchScore(benchExaScr.offScreenHeap[i])) {
+	    fprintf(stderr, "Eviction heap out of order.\n");
+	    failures++;
+	    break;
+	}
+
+    for (i = 0; i < BENCH_PIXMAPS; ++i) {
+	pBench = &benchPixmaps[i];
+	area = pBench->exaPriv.area;
+	if (area && area->state == ExaOffscreenRemovable &&
+	    benchScore(area) != pBench->score) {
+	    fprintf(stderr, "Pixmap %d score %d, expected %d.\n", i,
+		    benchScore(area), pBench->score);
+	    failures++;
+	}
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned long ops = (argc > 1) ? strtoul(argv[1], NULL, 0) : 50000;
+    unsigned seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+    unsigned long memory = (argc > 3) ? strtoul(argv[3], NULL, 0) :
+	BENCH_MEMORY;
+    unsigned long decisions = 0, optimal = 0, op;
+    unsigned long long bestScore = 0, evictedScore = 0;
+    unsigned long evictions;
+    uint64_t start, usec = 0;
+    BenchPixmapPtr pBench;
+    int i, size, best;
+
+    benchDriver.offScreenBase = BENCH_BASE;
+    benchDriver.memorySize = memory << 20;
+    benchExaScr.info = &benchDriver;
+    benchScreenPriv.ptr = &benchExaScr;
+    benchScreen.devPrivates = &benchScreenPriv;
+    screenInfo.screens[0] = &benchScreen;
+    screenInfo.numScreens = 1;
+
+    for (i = 0; i < BENCH_PIXMAPS; ++i) {
+	pBench = &benchPixmaps[i];
+	pBench->priv.ptr = &pBench->exaPriv;
+	pBench->pixmap.devPrivates = &pBench->priv;
+	pBench->pixmap.drawable.pScreen = &benchScreen;
+    }
+
+    if (!exaOffscreenInit(&benchScreen))
+	return 1;
+
+    srand(seed);
+    for (op = 0; op < ops; ++op) {
+	pBench = &benchPixmaps[rand() % BENCH_PIXMAPS];
+
+	switch (rand() % 4) {
+	case 0:
+	    if (!pBench->exaPriv.area)
+		break;
+	    start = stubUsec();
+	    exaOffscreenFree(&benchScreen, pBench->exaPriv.area);
+	    usec += stubUsec() - start;
+	    pBench->exaPriv.area = NULL;
+	    continue;
+	default:
+	    if (!pBench->exaPriv.area)
+		break;
+	    for (i = rand() % 5; i > 0; --i) {
+		start = stubUsec();
+		benchMarkUsed(pBench);
+		usec += stubUsec() - start;
+	    }
+	    continue;
+	}
+
+	if (pBench->exaPriv.area)
+	    continue;
+
+	size = (rand() % 8 == 0) ? (rand() % (512 << 10)) + 1 :
+	    (rand() % 8192) + 64;
+	best = benchBestScore(size, BENCH_ALIGN);
+	evictions = benchExaScr.offScreenStats.evictions;
+	benchEvictedScore = 0;
+
+	start = stubUsec();
+	pBench->exaPriv.area = exaOffscreenAlloc(&benchScreen, size,
+						 BENCH_ALIGN,
+						 rand() % 50 == 0,
+						 exaPixmapSave, pBench);
+	usec += stubUsec() - start;
+	pBench->score = 0;
+
+	if (!pBench->exaPriv.area && best != INT_MAX) {
+	    fprintf(stderr, "Failed to allocate %d bytes.\n", size);
+	    failures++;
+	} else if (pBench->exaPriv.area &&
+		   pBench->exaPriv.area->offset % BENCH_ALIGN) {
+	    fprintf(stderr, "Misaligned area.\n");
+	    failures++;
+	}
+	if (benchExaScr.offScreenStats.evictions != evictions) {
+	    decisions++;
+	    bestScore += best;
+	    evictedScore += benchEvictedScore;
+	    if (benchEvictedScore == best)
+		optimal++;
+	}
+
+	if (op % BENCH_CHECK_OPS == 0)
+	    benchCheck();
+    }
+    benchCheck();
+
+    printf("%lu operations in %.2f ms, %.2f usec each.\n", ops,
+	   (double)usec / 1000., (double)usec / (double)ops);
+    printf("%lu allocations, %lu failed, %lu evictions of %lu kiB.\n",
+	   benchExaScr.offScreenStats.allocs,
+	   benchExaScr.offScreenStats.allocFailures,
+	   benchExaScr.offScreenStats.evictions,
+	   benchExaScr.offScreenStats.evictedBytes >> 10);
+    if (decisions)
+	printf("%lu evicting allocations, %.1f%% at the lowest score; "
+	       "evicted score %.2f times the lowest.\n", decisions,
+	       100. * optimal / decisions,
+	       bestScore ? (double)evictedScore / bestScore : 1.);
+
+    ExaOffscreenFini(&benchScreen);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,418 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Pixmap storage: destroying a pixmap whose buffer deferred 2D commands
+ * still refer to must not leave a freed buffer on the validate list, and
+ * pixmaps handed to DRI clients must be moved into the EXA buffer with
+ * their contents, and pixmaps the CPU mostly reads are kept out of the
+ * write-combined mapping.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+typedef Bool (*TestPrepareSolidProc) (PixmapPtr, int, Pixel, Pixel);
+typedef void (*TestSolidProc) (PixmapPtr, int, int, int, int);
+typedef void (*TestDoneProc) (PixmapPtr);
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static void
+testSolidRows(ScrnInfoPtr pScrn, PixmapPtr pPix, Pixel fg, int rows)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareSolidProc prepareSolid = pExa->PrepareSolid;
+    TestSolidProc solid = pExa->Solid;
+    TestDoneProc doneSolid = pExa->DoneSolid;
+
+    CHECK(prepareSolid(pPix, GXcopy, ~0, fg));
+    solid(pPix, 0, 0, pPix->drawable.width, rows);
+    doneSolid(pPix);
+}
+
+static void
+testSolid(ScrnInfoPtr pScrn, PixmapPtr pPix, Pixel fg)
+{
+    testSolidRows(pScrn, pPix, fg, pPix->drawable.height);
+}
+
+static void
+testFill(PixmapPtr pPix, CARD32 seed)
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_DEST);
+    int x, y;
+
+    CHECK(base != NULL);
+    if (!base)
+	return;
+
+    for (y = 0; y < pPix->drawable.height; ++y)
+	for (x = 0; x < pPix->drawable.width; ++x)
+	    ((CARD32 *) (base + y * pPix->devKind))[x] = seed + (y << 16) + x;
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_DEST);
+}
+
+static int
+testCheck(PixmapPtr pPix, CARD32 seed)
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_SRC);
+    int x, y, bad = 0;
+
+    if (!base)
+	return 1;
+
+    for (y = 0; y < pPix->drawable.height; ++y)
+	for (x = 0; x < pPix->drawable.width; ++x)
+	    if (((CARD32 *) (base + y * pPix->devKind))[x] !=
+		seed + (y << 16) + x)
+		bad = 1;
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_SRC);
+    return bad;
+}
+
+/*
+ * A pixmap buffer that is not cached on destruction is freed right
+ * away. Deferred commands referring to it must be submitted first.
+ */
+
+static void
+testDestroyPending(ScrnInfoPtr pScrn)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbExaPtr pPsbExa = pPsb->pPsbExa;
+    PixmapPtr pPix;
+    int b;
+
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b)
+	pPsbExa->minPixels[PSB_CAL_SOLID][b] = 0;
+
+    pPix = stubPixmapCreate(pScrn, 256, 256, 24, 32);
+    CHECK(pPix != NULL);
+    if (!pPix)
+	return;
+    CHECK(psbPixmapPriv(pPix)->pBuf != NULL);
+
+    stubDrmResetStats();
+    testSolid(pScrn, pPix, 0x00FF8000);
+    CHECK(PSB_2D_PENDING(&pPsb->superC));
+
+    pPsbExa->pixBudget = 0;
+    stubPixmapDestroy(pPix);
+    CHECK(!PSB_2D_PENDING(&pPsb->superC));
+    CHECK(pPsbExa->pixBytes == 0);
+
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.submits == 1);
+    CHECK(stubDrmStats.validateErrors == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+    pPsbExa->pixBudget = pPsb->exaSize;
+}
+
+/*
+ * Map a pixmap for reading and tell whether the driver granted the
+ * mapping, or EXA had to use a copy.
+ */
+
+static Bool
+testDirect(PixmapPtr pPix, int index)
+{
+    CARD8 *base = stubPixmapMap(pPix, index);
+    Bool direct = (psbPixmapPriv(pPix)->mapped & (1 << index)) != 0;
+
+    CHECK(base != NULL);
+    stubPixmapUnmap(pPix, index);
+    CHECK(psbPixmapPriv(pPix)->mapped == 0);
+    return direct;
+}
+
+/*
+ * A pixmap the CPU keeps reading without the engine drawing to it gets
+ * a system memory copy from the third access on. Enough engine work
+ * brings it back, and a mix in between stays where it is.
+ */
+
+static void
+testCPUAccess(ScrnInfoPtr pScrn)
+{
+    PixmapPtr pPix = stubPixmapCreate(pScrn, 256, 256, 24, 32);
+    int i;
+
+    CHECK(pPix != NULL);
+    if (!pPix)
+	return;
+
+    CHECK(testDirect(pPix, EXA_PREPARE_SRC));
+    CHECK(testDirect(pPix, EXA_PREPARE_SRC));
+    CHECK(!testDirect(pPix, EXA_PREPARE_SRC));
+    CHECK(psbPixmapPriv(pPix)->sysCopy);
+
+    /*
+     * EXA fills its copy through the auxiliary indices, and writes
+     * through the copy land in the pixmap.
+     */
+
+    CHECK(testDirect(pPix, EXA_PREPARE_AUX_SRC));
+    testFill(pPix, 0x5000000);
+    CHECK(psbPixmapPriv(pPix)->sysCopy);
+    CHECK(!testCheck(pPix, 0x5000000));
+
+    /*
+     * Engine work of one and a half pixmaps per read keeps the copy.
+     */
+
+    for (i = 0; i < 16; ++i) {
+	testSolid(pScrn, pPix, i);
+	testSolidRows(pScrn, pPix, i, 128);
+	CHECK(!testDirect(pPix, EXA_PREPARE_SRC));
+    }
+
+    for (i = 0; i < 12; ++i)
+	testSolid(pScrn, pPix, 0);
+    CHECK(testDirect(pPix, EXA_PREPARE_SRC));
+    CHECK(!psbPixmapPriv(pPix)->sysCopy);
+
+    /*
+     * Engine work of about half a pixmap per read doesn't bring the
+     * copy back.
+     */
+
+    for (i = 0; i < 16; ++i) {
+	testSolidRows(pScrn, pPix, i, 160);
+	CHECK(testDirect(pPix, EXA_PREPARE_SRC));
+    }
+
+    testFill(pPix, 0x6000000);
+    CHECK(!testCheck(pPix, 0x6000000));
+    stubPixmapDestroy(pPix);
+
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.validateErrors == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+}
+
+static Bool
+testDecline(PixmapPtr pPix, int x, int y, int w, int h, char *dst,
+	    int dst_pitch)
+{
+    return FALSE;
+}
+
+/*
+ * EXA fills a copy DownloadFromScreen declines through the auxiliary
+ * indices, which it only passes to drivers asking for them. The copy
+ * must then show what the engine drew.
+ */
+
+static void
+testCopyFill(ScrnInfoPtr pScrn)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    Bool (*download) (PixmapPtr, int, int, int, int, char *, int) =
+	pExa->DownloadFromScreen;
+    PixmapPtr pPix = stubPixmapCreate(pScrn, 64, 64, 24, 32);
+    CARD32 *base;
+    int x, y, bad = 0;
+
+    CHECK(pExa->flags & EXA_SUPPORTS_PREPARE_AUX);
+    CHECK(pPix != NULL);
+    if (!pPix)
+	return;
+
+    testDirect(pPix, EXA_PREPARE_SRC);
+    testDirect(pPix, EXA_PREPARE_SRC);
+    testDirect(pPix, EXA_PREPARE_SRC);
+    CHECK(psbPixmapPriv(pPix)->sysCopy);
+
+    pExa->DownloadFromScreen = testDecline;
+    stubExaAuxErrors = 0;
+    testSolid(pScrn, pPix, 0x00123456);
+    base = stubPixmapMap(pPix, EXA_PREPARE_SRC);
+    CHECK(base != NULL);
+    if (base) {
+	CHECK(!(psbPixmapPriv(pPix)->mapped & (1 << EXA_PREPARE_SRC)));
+	for (y = 0; y < pPix->drawable.height; ++y)
+	    for (x = 0; x < pPix->drawable.width; ++x)
+		if ((((CARD32 *) ((CARD8 *) base + y * pPix->devKind))[x] &
+		     0x00FFFFFF) != 0x00123456)
+		    bad = 1;
+	CHECK(!bad);
+	stubPixmapUnmap(pPix, EXA_PREPARE_SRC);
+    }
+    CHECK(stubExaAuxErrors == 0);
+    pExa->DownloadFromScreen = download;
+
+    stubPixmapDestroy(pPix);
+    psbAccelFlush(pScrn);
+}
+
+#ifdef XF86DRI
+
+static unsigned long
+testDRIFree(PsbExaPtr pPsbExa, unsigned *numRanges)
+{
+    PsbPixmapRangePtr range;
+    MMListHead *list;
+    unsigned long free = 0;
+
+    *numRanges = 0;
+    mmListForEach(list, &pPsbExa->driFree) {
+	range = mmListEntry(list, PsbPixmapRangeRec, head);
+	free += range->size;
+	(*numRanges)++;
+    }
+
+    return free;
+}
+
+/*
+ * DRI clients get offsets into the EXA buffer, so texOffsetStart must
+ * move pixmaps there, keeping their contents.
+ */
+
+static void
+testTexOffset(ScrnInfoPtr pScrn)
+{
+    PsbExaPtr pPsbExa = psbPTR(pScrn)->pPsbExa;
+    struct _MMBuffer *exaBuf = pPsbExa->exaBuf.buf;
+    unsigned long driSize = mmBufSize(exaBuf) - PSB_EXA_BASE_SIZE;
+    unsigned long long small, large, again;
+    PixmapPtr pSmall, pLarge, pHuge, pNext;
+    unsigned numRanges;
+
+    CHECK(driSize == PSB_EXA_DRI_SIZE);
+    CHECK(testDRIFree(pPsbExa, &numRanges) == driSize && numRanges == 1);
+
+    pSmall = stubPixmapCreate(pScrn, 64, 64, 24, 32);
+    pLarge = stubPixmapCreate(pScrn, 512, 300, 24, 32);
+    pHuge = stubPixmapCreate(pScrn, 2048, 1200, 24, 32);
+    CHECK(pSmall && pLarge && pHuge);
+    if (!pSmall || !pLarge || !pHuge)
+	return;
+
+    testFill(pSmall, 0x1000000);
+    testFill(pLarge, 0x2000000);
+    testFill(pHuge, 0x3000000);
+
+    /*
+     * Pending commands on the old storage land before the move.
+     */
+
+    small = psbTexOffsetStart(pSmall);
+    CHECK(small != ~0ULL);
+    CHECK(small >= PSB_EXA_BASE_SIZE && (small & 4095) == 0);
+    CHECK(psbPixmapPriv(pSmall)->buf == exaBuf);
+    CHECK(psbPixmapPriv(pSmall)->slab == NULL);
+    CHECK(!testCheck(pSmall, 0x1000000));
+
+    testSolid(pScrn, pLarge, 0);
+    testFill(pLarge, 0x2000000);
+    large = psbTexOffsetStart(pLarge);
+    CHECK(large != ~0ULL);
+    CHECK(large >= small + 64 * pSmall->devKind ||
+	  small >= large + 300 * pLarge->devKind);
+    CHECK(!testCheck(pLarge, 0x2000000));
+
+    again = psbTexOffsetStart(pSmall);
+    CHECK(again == small);
+
+    /*
+     * Too large for the DRI area: stays where it is.
+     */
+
+    CHECK(psbTexOffsetStart(pHuge) == ~0ULL);
+    CHECK(psbPixmapPriv(pHuge)->pBuf != NULL);
+    CHECK(!testCheck(pHuge, 0x3000000));
+
+    /*
+     * Freed ranges are reused and merged.
+     */
+
+    stubPixmapDestroy(pSmall);
+    pNext = stubPixmapCreate(pScrn, 64, 64, 24, 32);
+    CHECK(pNext != NULL);
+    if (pNext) {
+	testFill(pNext, 0x4000000);
+	CHECK(psbTexOffsetStart(pNext) == small);
+	CHECK(!testCheck(pNext, 0x4000000));
+	stubPixmapDestroy(pNext);
+    }
+    stubPixmapDestroy(pLarge);
+    stubPixmapDestroy(pHuge);
+
+    CHECK(testDRIFree(pPsbExa, &numRanges) == driSize && numRanges == 1);
+
+    psbAccelFlush(pScrn);
+    CHECK(stubDrmStats.validateErrors == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+}
+
+#endif
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoPtr pScrn;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    testDestroyPending(pScrn);
+    testCPUAccess(pScrn);
+    testCopyFill(pScrn);
+#ifdef XF86DRI
+    testTexOffset(pScrn);
+#endif
+
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Planar video uploads through the copy thread pool. Each frame queues
+ * the luma copy, the chroma interleave and a copy too small to be
+ * split, the way psbCopyPlanarYUVData does, and waits for them. The
+ * result is checked byte for byte, including the bytes around each
+ * destination rectangle, which must be left alone. Frames are timed
+ * first with the server thread copying alone, then with the pool
+ * started.
+ *
+ * The stub build may run on fewer CPUs than threads, in which case the
+ * pool can't be faster.
+ *
+ * Usage: pool_bench [threads [frames]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xf86.h"
+#include "psb_copy.h"
+#include "stub.h"
+
+#define BENCH_GUARD 64
+#define BENCH_SMALL 32
+
+typedef struct _BenchFrame
+{
+    int w;
+    int h;
+    unsigned long pitch;
+    CARD8 *y;
+    CARD8 *u;
+    CARD8 *v;
+    CARD8 *small;
+    CARD8 *dst;
+    unsigned long dstSize;
+} BenchFrame;
+
+static CARD8 *
+benchLuma(BenchFrame * f)
+{
+    return f->dst + BENCH_GUARD * f->pitch + BENCH_GUARD;
+}
+
+static CARD8 *
+benchChroma(BenchFrame * f)
+{
+    return benchLuma(f) + (f->h + BENCH_GUARD) * f->pitch;
+}
+
+static CARD8 *
+benchSmall(BenchFrame * f)
+{
+    return benchChroma(f) + (f->h / 2 + BENCH_GUARD) * f->pitch;
+}
+
+static Bool
+benchSetup(BenchFrame * f, int w, int h)
+{
+    f->w = w;
+    f->h = h;
+    f->pitch = ((w + 2 * BENCH_GUARD) + 63) & ~63UL;
+    f->dstSize = (h + h / 2 + BENCH_SMALL + 4 * BENCH_GUARD) * f->pitch;
+    f->y = malloc(w * h);
+    f->u = malloc(w / 2 * h / 2);
+    f->v = malloc(w / 2 * h / 2);
+    f->small = malloc(BENCH_SMALL * BENCH_SMALL);
+    f->dst = malloc(f->dstSize);
+
+    return (f->y && f->u && f->v && f->small && f->dst);
+}
+
+static void
+benchTeardown(BenchFrame * f)
+{
+    free(f->y);
+    free(f->u);
+    free(f->v);
+    free(f->small);
+    free(f->dst);
+}
+
+/*
+ * A pattern that doesn't repeat with any row or band offset.
+ */
+
+static CARD8
+benchByte(unsigned i, unsigned salt)
+{
+    return (CARD8) (((i ^ (salt << 24)) * 2654435761U) >> 24);
+}
+
+static void
+benchFill(BenchFrame * f, unsigned seed)
+{
+    int i;
+
+    for (i = 0; i < f->w * f->h; ++i)
+	f->y[i] = benchByte(i, 4 * seed);
+    for (i = 0; i < f->w / 2 * f->h / 2; ++i) {
+	f->u[i] = benchByte(i, 4 * seed + 1);
+	f->v[i] = benchByte(i, 4 * seed + 2);
+    }
+    for (i = 0; i < BENCH_SMALL * BENCH_SMALL; ++i)
+	f->small[i] = benchByte(i, 4 * seed + 3);
+    memset(f->dst, 0xA5, f->dstSize);
+}
+
+static void
+benchUpload(BenchFrame * f)
+{
+    psbCopyRectWCAsync(benchLuma(f), f->pitch, f->y, f->w, f->w, f->h);
+    psbInterleaveRectWCAsync(benchChroma(f), f->pitch, f->u, f->v,
+			     f->w / 2, f->w / 2, f->h / 2);
+    psbCopyRectWCAsync(benchSmall(f), f->pitch, f->small, BENCH_SMALL,
+		       BENCH_SMALL, BENCH_SMALL);
+    psbCopyWait();
+}
+
+/*
+ * Compare the destination with what the upload should have written,
+ * and with the fill pattern everywhere else.
+ */
+
+static int
+benchCheck(BenchFrame * f)
+{
+    CARD8 *ref = malloc(f->dstSize);
+    CARD8 *d;
+    int x, y, ret;
+
+    if (!ref)
+	return 1;
+
+    memset(ref, 0xA5, f->dstSize);
+    for (y = 0; y < f->h; ++y)
+	memcpy(benchLuma(f) - f->dst + ref + y * f->pitch,
+	       f->y + y * f->w, f->w);
+    for (y = 0; y < f->h / 2; ++y) {
+	d = benchChroma(f) - f->dst + ref + y * f->pitch;
+	for (x = 0; x < f->w / 2; ++x) {
+	    d[2 * x] = f->u[y * f->w / 2 + x];
+	    d[2 * x + 1] = f->v[y * f->w / 2 + x];
+	}
+    }
+    for (y = 0; y < BENCH_SMALL; ++y)
+	memcpy(benchSmall(f) - f->dst + ref + y * f->pitch,
+	       f->small + y * BENCH_SMALL, BENCH_SMALL);
+
+    ret = memcmp(ref, f->dst, f->dstSize) != 0;
+    free(ref);
+    return ret;
+}
+
+static int
+benchRun(int w, int h, unsigned frames, const char *what)
+{
+    BenchFrame f;
+    uint64_t usec = 0, start;
+    unsigned i;
+    int ret = 0;
+
+    if (!benchSetup(&f, w, h)) {
+	printf("%4dx%-4d: setup failed.\n", w, h);
+	benchTeardown(&f);
+	return 1;
+    }
+
+    for (i = 0; i < frames; ++i) {
+	benchFill(&f, i);
+	start = stubUsec();
+	benchUpload(&f);
+	usec += stubUsec() - start;
+	if (benchCheck(&f))
+	    ret = 1;
+    }
+
+    printf("%4dx%-4d %-10s %8.1f usec/frame, %8.1f MiB/s%s\n", w, h, what,
+	   (double)usec / frames,
+	   usec ? (double)frames * w * h * 3 / 2 / usec * 1e6 /
+	   (1024. * 1024.) : 0., ret ? "  FAILED" : "");
+
+    benchTeardown(&f);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int sizes[][2] = {
+	{176, 144}, {720, 576}, {1280, 720}, {1920, 1080}
+    };
+    int threads = (argc > 1) ? strtol(argv[1], NULL, 0) : 3;
+    unsigned frames = (argc > 2) ? strtoul(argv[2], NULL, 0) : 20;
+    char what[32];
+    unsigned i;
+    int ret = 0;
+
+    psbCopySelect(PSB_COPY_SSE3);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	ret |= benchRun(sizes[i][0], sizes[i][1], frames, "no pool");
+
+    psbCopyInit(0, threads, X_CONFIG);
+    snprintf(what, sizeof(what), "%d threads", threads);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+	ret |= benchRun(sizes[i][0], sizes[i][1], frames, what);
+
+    return ret;
+}
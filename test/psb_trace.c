@@ -0,0 +1,167 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Decode or replay a 2D command stream trace written with the
+ * Exa2DTrace option.
+ *
+ *   psb_trace stats FILE          totals and per-command counts
+ *   psb_trace dump FILE           every submission, one command per line
+ *   psb_trace replay FILE [N]     rebuild and submit every submission N
+ *                                 times against the stub DRM
+ *
+ * Replay goes through the driver's own relocation, validate list and
+ * submission code, so it can be used to time that code on a real
+ * command mix. Blits are not carried out, since the trace doesn't say
+ * what the buffers held.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "stub.h"
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: psb_trace stats FILE\n"
+	    "       psb_trace dump FILE\n"
+	    "       psb_trace replay FILE [repeat]\n");
+    exit(2);
+}
+
+static int
+traceDump(const char *name, int dump)
+{
+    TraceFileRec tf;
+    TraceSubmissionPtr sub;
+    TraceStatsRec stats;
+    int ret;
+
+    if (traceOpen(&tf, name))
+	return 1;
+
+    memset(&stats, 0, sizeof(stats));
+    while ((ret = traceNext(&tf, &sub)) > 0)
+	traceDecode(sub, &stats, dump ? stdout : NULL);
+    traceClose(&tf);
+
+    if (!dump)
+	tracePrintStats(&stats, stdout);
+
+    return (ret < 0 || stats.badStreams) ? 1 : 0;
+}
+
+static int
+traceReplayFile(const char *name, unsigned repeat)
+{
+    TraceFileRec tf;
+    TraceSubmissionPtr sub;
+    TraceReplayRec rp;
+    Psb2DBufferRec cb;
+    unsigned long submissions = 0;
+    unsigned long long dwords = 0;
+    uint64_t start, usec, build;
+    unsigned i;
+    int ret = 0;
+
+    memset(&cb, 0, sizeof(cb));
+    if (!psbInit2DBuffer(0, &cb, PSB_2D_MIN_SLOTS)) {
+	fprintf(stderr, "Failed to set up a command buffer.\n");
+	return 1;
+    }
+    traceReplayInit(&rp, 0);
+    stubDrmSetExecute(0);
+    stubDrmResetStats();
+
+    start = stubUsec();
+    for (i = 0; i < repeat && !ret; ++i) {
+	if (traceOpen(&tf, name)) {
+	    ret = 1;
+	    break;
+	}
+	while (!ret && (ret = traceNext(&tf, &sub)) > 0) {
+	    ret = traceReplay(&rp, &cb, sub);
+	    submissions++;
+	    dwords += sub->sub.numDwords;
+	}
+	traceClose(&tf);
+    }
+    stubDrmIdle();
+    usec = stubUsec() - start;
+    build = usec - stubDrmStats.ioctlUsec - stubDrmStats.waitUsec;
+
+    printf("%lu submissions, %llu dwords, %llu relocations in %.2f ms.\n",
+	   submissions, dwords, stubDrmStats.relocs, (double)usec / 1000.);
+    if (dwords)
+	printf("Reading and rebuilding: %.1f ns per dword, "
+	       "%.2f usec per submission.\n",
+	       (double)build * 1000. / (double)dwords,
+	       (double)build / (double)submissions);
+
+    if (ret || stubDrmStats.relocErrors || stubDrmStats.validateErrors ||
+	rp.mismatches || stubDrmStats.submits != submissions ||
+	stubDrmStats.dwords != dwords) {
+	fprintf(stderr, "Replay mismatch: ret %d, %lu reloc errors, "
+		"%lu validate errors, %lu validate list mismatches, "
+		"%lu / %lu submissions, %llu / %llu dwords.\n", ret,
+		stubDrmStats.relocErrors, stubDrmStats.validateErrors,
+		rp.mismatches, stubDrmStats.submits, submissions,
+		stubDrmStats.dwords, dwords);
+	ret = 1;
+    }
+
+    traceReplayFini(&rp);
+    psbTakedown2DBuffer(0, &cb);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc < 3)
+	usage();
+
+    if (!strcmp(argv[1], "stats") && argc == 3)
+	return traceDump(argv[2], 0);
+    if (!strcmp(argv[1], "dump") && argc == 3)
+	return traceDump(argv[2], 1);
+    if (!strcmp(argv[1], "replay") && argc <= 4)
+	return traceReplayFile(argv[2], (argc > 3) ?
+			       strtoul(argv[3], NULL, 0) : 1);
+
+    usage();
+    return 2;
+}
@@ -0,0 +1,171 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Cost of building 2D commands with relocations as the number of buffers
+ * referenced by a batch grows.
+ *
+ * Each operation is a blit with one relocation against a source and one
+ * against a destination buffer, both picked from a pool of the given
+ * size. Batches are flushed every BENCH_BATCH_OPS operations, so a batch
+ * references at most twice that many distinct buffers. The reported time
+ * is what the driver spends per operation and per relocation, with the
+ * time spent inside the stub ioctl taken out.
+ *
+ * Usage: reloc_bench [ops]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <psb_reg.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+#define BENCH_BATCH_OPS 64
+#define BENCH_MAX_BUFFERS 512
+
+static drmBO buffers[BENCH_MAX_BUFFERS];
+
+static void
+benchEmitState(Psb2DBufferPtr ptrCb, void *arg)
+{
+}
+
+static int
+benchCopy(Psb2DBufferPtr ptrCb, drmBO * src, drmBO * dst, int x, int y)
+{
+    int ret;
+
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_SIZE(9, 2, 0, 0);
+    PSB_SUPER_2D_OUT(PSB_2D_SRC_SURF_BH | PSB_2D_SRC_8888ARGB |
+		     ((4096 << PSB_2D_SRC_STRIDE_SHIFT) &
+		      PSB_2D_SRC_STRIDE_MASK));
+    PSB_SUPER_2D_RELOC_OFFSET(0, src, 0, 0);
+    PSB_SUPER_2D_OUT(PSB_2D_DST_SURF_BH | PSB_2D_DST_8888ARGB |
+		     ((4096 << PSB_2D_DST_STRIDE_SHIFT) &
+		      PSB_2D_DST_STRIDE_MASK));
+    PSB_SUPER_2D_RELOC_OFFSET(0, dst, 0, 0);
+    PSB_SUPER_2D_OUT(PSB_2D_SRC_OFF_BH |
+		     ((x << PSB_2D_SRCOFF_XSTART_SHIFT) &
+		      PSB_2D_SRCOFF_XSTART_MASK) |
+		     ((y << PSB_2D_SRCOFF_YSTART_SHIFT) &
+		      PSB_2D_SRCOFF_YSTART_MASK));
+    PSB_SUPER_2D_OUT(PSB_2D_BLIT_BH | PSB_2D_ROT_NONE |
+		     PSB_2D_COPYORDER_TL2BR | PSB_2D_DSTCK_DISABLE |
+		     PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+		     PSB_2D_ROP3_SRCCOPY);
+    PSB_SUPER_2D_OUT(0);
+    PSB_SUPER_2D_OUT(((x << PSB_2D_DST_XSTART_SHIFT) & PSB_2D_DST_XSTART_MASK)
+		     | ((y << PSB_2D_DST_YSTART_SHIFT) &
+			PSB_2D_DST_YSTART_MASK));
+    PSB_SUPER_2D_OUT(((16 << PSB_2D_DST_XSIZE_SHIFT) & PSB_2D_DST_XSIZE_MASK) |
+		     ((16 << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK));
+    PSB_SUPER_2D_DONE(ret);
+
+    return ret;
+}
+
+static int
+benchRun(unsigned numBuffers, unsigned ops)
+{
+    Psb2DBufferRec cb;
+    unsigned i;
+    uint64_t start, usec;
+    int ret = 0;
+
+    memset(&cb, 0, sizeof(cb));
+    if (!psbInit2DBuffer(0, &cb, 1))
+	return 1;
+    psbSetStateCallback(&cb, benchEmitState, NULL);
+    stubDrmResetStats();
+
+    start = stubUsec();
+    for (i = 0; i < ops && !ret; ++i) {
+	ret = benchCopy(&cb, &buffers[i % numBuffers],
+			&buffers[(i * 7 + 3) % numBuffers],
+			(i & 63) << 4, ((i >> 6) & 63) << 4);
+	if (!ret && i % BENCH_BATCH_OPS == BENCH_BATCH_OPS - 1)
+	    ret = psbFlush2D(&cb, 0, NULL);
+    }
+    if (!ret)
+	ret = psbFlush2D(&cb, 0, NULL);
+    stubDrmIdle();
+    usec = stubUsec() - start - stubDrmStats.ioctlUsec -
+	stubDrmStats.waitUsec;
+
+    printf("%3u buffers: %7.1f ns/op, %6.1f ns/reloc\n", numBuffers,
+	   (double)usec * 1e3 / (double)ops,
+	   (double)usec * 1e3 / (double)(2 * ops));
+
+    if (ret || stubDrmStats.relocErrors || stubDrmStats.validateErrors ||
+	stubDrmStats.relocs != 2ULL * ops) {
+	fprintf(stderr, "%u buffers: ret %d, %lu reloc errors, "
+		"%lu validate errors, %llu / %llu relocations.\n",
+		numBuffers, ret, stubDrmStats.relocErrors,
+		stubDrmStats.validateErrors, stubDrmStats.relocs,
+		2ULL * ops);
+	ret = 1;
+    }
+
+    psbTakedown2DBuffer(0, &cb);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned ops = (argc > 1) ? strtoul(argv[1], NULL, 0) : 65536;
+    unsigned i, n;
+    int ret = 0;
+
+    for (i = 0; i < BENCH_MAX_BUFFERS; ++i) {
+	if (drmBOCreate(0, 4096, 0, NULL, DRM_BO_FLAG_MEM_TT |
+			DRM_BO_FLAG_READ | DRM_BO_FLAG_WRITE, 0,
+			&buffers[i]))
+	    return 1;
+    }
+
+    printf("%u copies, two relocations each, %u per batch.\n", ops,
+	   BENCH_BATCH_OPS);
+
+    for (n = 1; n <= BENCH_MAX_BUFFERS; n <<= 1)
+	ret |= benchRun(n, ops);
+
+    for (i = 0; i < BENCH_MAX_BUFFERS; ++i)
+	drmBOUnreference(0, &buffers[i]);
+
+    return ret;
+}
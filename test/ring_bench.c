@@ -0,0 +1,189 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Throughput of the 2D command ring against the stub DRM.
+ *
+ * Operations are solid fills plus a fixed amount of simulated request
+ * processing on the CPU. Every BENCH_BATCH_OPS operations the batch is
+ * flushed, as the EXA Done hooks do, and every fourth batch keeps the
+ * engine busy much longer than the others. With one slot, the submission
+ * after a long batch has to wait for it; with more slots the CPU keeps
+ * building batches in the meantime.
+ *
+ * Usage: ring_bench [ops [cpu-usec-per-op [slow-batch-usec]]]
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <psb_reg.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+#define BENCH_BATCH_OPS 16
+#define BENCH_FAST_USEC 10
+
+static drmBO dstBuf;
+
+static void
+benchEmitState(Psb2DBufferPtr ptrCb, void *arg)
+{
+    int ret;
+
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_OUT(PSB_2D_DST_SURF_BH | PSB_2D_DST_8888ARGB |
+		     ((4096 << PSB_2D_DST_STRIDE_SHIFT) &
+		      PSB_2D_DST_STRIDE_MASK));
+    PSB_SUPER_2D_RELOC_OFFSET(0, &dstBuf, 0, 0);
+    PSB_SUPER_2D_DONE(ret);
+    (void)ret;
+}
+
+static int
+benchPrepare(Psb2DBufferPtr ptrCb)
+{
+    int ret;
+
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_SIZE(2, 1, 0, 0);
+    benchEmitState(ptrCb, NULL);
+    PSB_SUPER_2D_DONE(ret);
+
+    return ret;
+}
+
+static int
+benchSolid(Psb2DBufferPtr ptrCb, int x, int y, int w, int h)
+{
+    int ret;
+
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_SIZE(4, 0, 0, 0);
+    PSB_SUPER_2D_OUT(PSB_2D_BLIT_BH | PSB_2D_ROT_NONE |
+		     PSB_2D_COPYORDER_TL2BR | PSB_2D_DSTCK_DISABLE |
+		     PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL |
+		     PSB_2D_ROP3_PATCOPY);
+    PSB_SUPER_2D_OUT(0xFF00FF00);
+    PSB_SUPER_2D_OUT(((x << PSB_2D_DST_XSTART_SHIFT) & PSB_2D_DST_XSTART_MASK)
+		     | ((y << PSB_2D_DST_YSTART_SHIFT) &
+			PSB_2D_DST_YSTART_MASK));
+    PSB_SUPER_2D_OUT(((w << PSB_2D_DST_XSIZE_SHIFT) & PSB_2D_DST_XSIZE_MASK) |
+		     ((h << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK));
+    PSB_SUPER_2D_DONE(ret);
+
+    return ret;
+}
+
+static int
+benchRun(unsigned numSlots, unsigned ops, unsigned cpuUsec,
+	 unsigned slowUsec)
+{
+    Psb2DBufferRec cb;
+    unsigned i, batch = 0;
+    uint64_t start, usec;
+    int ret = 0;
+
+    memset(&cb, 0, sizeof(cb));
+    if (!psbInit2DBuffer(0, &cb, numSlots)) {
+	fprintf(stderr, "Failed to set up a %u slot ring.\n", numSlots);
+	return 1;
+    }
+    psbSetStateCallback(&cb, benchEmitState, NULL);
+    stubDrmResetStats();
+
+    start = stubUsec();
+    for (i = 0; i < ops && !ret; ++i) {
+	if (i % BENCH_BATCH_OPS == 0)
+	    ret = benchPrepare(&cb);
+	stubSpin(cpuUsec);
+	if (!ret)
+	    ret = benchSolid(&cb, i & 1023, (i >> 10) & 1023, 64, 64);
+	if (!ret && i % BENCH_BATCH_OPS == BENCH_BATCH_OPS - 1) {
+	    stubDrmSetEngine((++batch & 3) ? BENCH_FAST_USEC : slowUsec, 0);
+	    ret = psbFlush2D(&cb, 0, NULL);
+	}
+    }
+    if (!ret)
+	ret = psbFlush2D(&cb, 0, NULL);
+    stubDrmIdle();
+    usec = stubUsec() - start;
+
+    printf("%2u slot%s %9.0f ops/s, %5lu stalls, %8.2f ms stalled, "
+	   "%6.2f ms waiting in the ioctl\n", numSlots,
+	   (numSlots == 1) ? ": " : "s:",
+	   (double)ops * 1e6 / (double)usec, cb.numStalls,
+	   (double)cb.stallUsec / 1000.,
+	   (double)stubDrmStats.waitUsec / 1000.);
+
+    if (ret || stubDrmStats.relocErrors || stubDrmStats.validateErrors ||
+	stubDrmStats.submits != cb.numSubmits ||
+	stubDrmStats.dwords != cb.numDwords) {
+	fprintf(stderr, "%u slots: submission mismatch, ret %d, "
+		"%lu reloc errors, %lu validate errors, "
+		"%lu / %lu submissions, %llu / %llu dwords.\n", numSlots, ret,
+		stubDrmStats.relocErrors, stubDrmStats.validateErrors,
+		stubDrmStats.submits, cb.numSubmits, stubDrmStats.dwords,
+		cb.numDwords);
+	ret = 1;
+    }
+
+    psbTakedown2DBuffer(0, &cb);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const unsigned slots[] = { 1, 2, 3, 4, 8 };
+    unsigned ops = (argc > 1) ? strtoul(argv[1], NULL, 0) : 16384;
+    unsigned cpuUsec = (argc > 2) ? strtoul(argv[2], NULL, 0) : 3;
+    unsigned slowUsec = (argc > 3) ? strtoul(argv[3], NULL, 0) : 120;
+    unsigned i;
+    int ret = 0;
+
+    if (drmBOCreate(0, 4096 * 1024, 0, NULL, DRM_BO_FLAG_MEM_TT |
+		    DRM_BO_FLAG_READ | DRM_BO_FLAG_WRITE, 0, &dstBuf))
+	return 1;
+
+    printf("%u fills, %u usec CPU each, %u per batch, "
+	   "engine %u usec per batch, %u every fourth.\n", ops, cpuUsec,
+	   BENCH_BATCH_OPS, BENCH_FAST_USEC, slowUsec);
+
+    for (i = 0; i < sizeof(slots) / sizeof(slots[0]); ++i)
+	ret |= benchRun(slots[i], ops, cpuUsec, slowUsec);
+
+    drmBOUnreference(0, &dstBuf);
+    return ret;
+}
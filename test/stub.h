@@ -0,0 +1,151 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Stand-ins for the X server and the DRM, so that driver code can be
+ * exercised and timed without either. The stub DRM keeps buffer objects
+ * in malloced memory and models the 2D engine as a single queue that
+ * takes a fixed time per submission, per command dword and per byte it
+ * moves. Fills and copies are really carried out, so tests can check the
+ * pixels. Buffer objects on a submission's validate list stay busy until
+ * the engine gets there.
+ */
+
+#ifndef _PSB_STUB_H_
+#define _PSB_STUB_H_
+
+#include <stdint.h>
+
+typedef struct _StubDrmStats
+{
+    unsigned long submits;
+    unsigned long long dwords;
+    unsigned long long relocs;
+    unsigned long relocErrors;
+    unsigned long validateErrors;
+    unsigned long waits;		/* command submissions that had to wait */
+    unsigned long long waitUsec;
+    unsigned long long ioctlUsec;	/* in the ioctl, not counting waits */
+    unsigned long numBuffers;
+    unsigned long unhandled;		/* 2D commands not executed */
+    unsigned long boundsErrors;		/* blits outside their buffer */
+    unsigned long patternBlits;
+    unsigned long hazards;		/* unfenced reads of blit writes, or
+					 * surface changes under them */
+} StubDrmStats;
+
+extern StubDrmStats stubDrmStats;
+
+/*
+ * Messages at or below this verbosity are printed. Default -1: none.
+ */
+
+extern int stubVerbose;
+
+/*
+ * stub_server.c
+ */
+
+extern void stubTimeAdvance(unsigned ms);
+extern uint64_t stubUsec(void);
+extern void stubTimeHide(uint64_t usec);
+extern void stubSpin(unsigned usec);
+
+/*
+ * stub_drm.c
+ */
+
+extern void stubDrmSetEngine(unsigned submitUsec, unsigned dwordNsec);
+extern void stubDrmSetBandwidth(unsigned mBytesPerSec);
+extern void stubDrmSetExecute(int execute);
+extern unsigned stub2DLength(const uint32_t * dwords, unsigned numDwords);
+extern void stubDrmIdle(void);
+extern void stubDrmBusyUntil(unsigned handle, uint64_t usec);
+extern void stubDrmFailWaits(int num);
+extern void stubDrmFailMap(int skip);
+extern void *stubDrmVirtual(unsigned handle);
+extern unsigned long stubDrmSize(unsigned handle);
+extern void stubDrmResetStats(void);
+
+/*
+ * stub_exa.c
+ */
+
+struct _ScrnInfoRec;
+struct _Pixmap;
+struct _ExtensionEntry;
+
+extern struct _ExtensionEntry *stubExtension;
+extern int stubDRILocked;
+extern unsigned long stubExaAuxErrors;
+extern struct _ScrnInfoRec *stubScreenCreate(void);
+extern int stubExaInit(struct _ScrnInfoRec *pScrn);
+extern void stubScreenDestroy(struct _ScrnInfoRec *pScrn);
+extern void stubScreenBlock(struct _ScrnInfoRec *pScrn);
+extern struct _Pixmap *stubPixmapCreate(struct _ScrnInfoRec *pScrn, int w,
+					int h, int depth, int bpp);
+extern void stubPixmapDestroy(struct _Pixmap *pPix);
+extern void *stubPixmapMap(struct _Pixmap *pPix, int index);
+extern void stubPixmapUnmap(struct _Pixmap *pPix, int index);
+
+/*
+ * stub_xv.c
+ */
+
+/*
+ * What the stub libXpsb was asked to draw, oldest first. It runs one
+ * call at a time on a 3D engine of its own, and keeps the textures of a
+ * call busy until the engine is through with it.
+ */
+
+typedef struct _StubXpsbBlit
+{
+    unsigned texture;		/* DRM handle of the first texture */
+    int numTextures;
+    unsigned offset[3], stride[3];	/* of each texture */
+    int x, y, w, h;		/* destination rectangle */
+    int detear;			/* through psbBlitYUVDetear */
+} StubXpsbBlit;
+
+#define STUB_XPSB_LOG 256
+
+extern StubXpsbBlit stubXpsbLog[STUB_XPSB_LOG];
+extern unsigned long stubXpsbBlits;
+extern unsigned long stubXpsbComposites;
+extern unsigned long stubXpsbUnlocked;	/* 3D calls without the DRI lock */
+extern unsigned long stubDamageCount;
+extern void stubXpsbSetEngine(unsigned blitUsec);
+#ifdef REGION_NUM_RECTS
+extern void stubRegionInit(RegionPtr pReg, const BoxRec * boxes, int num);
+#endif
+extern void stubTimersRun(void);
+extern int stubTimersPending(void);
+
+#endif
@@ -0,0 +1,1173 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * A DRM without a device: buffer objects live in malloced memory, and
+ * DRM_PSB_CMDBUF checks and applies the relocations of a 2D submission,
+ * executes its fills and copies, then fences its buffers on a simulated
+ * engine.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <xf86mm.h>
+#include <psb_drm.h>
+#include <psb_reg.h>
+#include "stub.h"
+
+#define STUB_MAX_BOS 4096
+#define STUB_PAGE_SIZE 4096
+
+typedef struct _StubBO
+{
+    int used;
+    void *virtual;
+    int userMem;
+    unsigned long size;
+    unsigned long offset;
+    uint64_t flags;
+    uint64_t busyUntil;
+} StubBO;
+
+StubDrmStats stubDrmStats;
+
+static StubBO stubBOs[STUB_MAX_BOS];
+static unsigned long stubNextOffset = 0x00100000;
+static uint64_t stubEngineFree;
+static unsigned stubSubmitUsec;
+static unsigned stubDwordNsec;
+static unsigned stubMBytesPerSec;
+static int stubExecuteBlits = 1;
+static int stubFailWaits;
+static int stubFailMap = -1;
+
+#define STUB_FENCES 1024
+static uint32_t stubFenceSeq;
+static uint64_t stubFenceTime[STUB_FENCES];
+
+/*
+ * Set the simulated engine cost of a submission.
+ */
+
+void
+stubDrmSetEngine(unsigned submitUsec, unsigned dwordNsec)
+{
+    stubSubmitUsec = submitUsec;
+    stubDwordNsec = dwordNsec;
+}
+
+/*
+ * Set the simulated memory bandwidth of the 2D engine. Zero means
+ * blits take no time beyond their command cost.
+ */
+
+void
+stubDrmSetBandwidth(unsigned mBytesPerSec)
+{
+    stubMBytesPerSec = mBytesPerSec;
+}
+
+/*
+ * Whether submitted blits are carried out. Replaying a trace turns this
+ * off, since it doesn't know how large the traced buffers were.
+ */
+
+void
+stubDrmSetExecute(int execute)
+{
+    stubExecuteBlits = execute;
+}
+
+void
+stubDrmResetStats(void)
+{
+    unsigned long numBuffers = stubDrmStats.numBuffers;
+
+    memset(&stubDrmStats, 0, sizeof(stubDrmStats));
+    stubDrmStats.numBuffers = numBuffers;
+}
+
+static StubBO *
+stubLookup(unsigned handle)
+{
+    if (handle == 0 || handle > STUB_MAX_BOS || !stubBOs[handle - 1].used)
+	return NULL;
+
+    return &stubBOs[handle - 1];
+}
+
+static uint64_t
+stubWait(StubBO * bo)
+{
+    uint64_t now = stubUsec();
+
+    if (now >= bo->busyUntil)
+	return 0;
+
+    while (stubUsec() < bo->busyUntil) ;
+    return bo->busyUntil - now;
+}
+
+/*
+ * Keep a buffer object busy until the given time, for stand-ins of
+ * other engines.
+ */
+
+void
+stubDrmBusyUntil(unsigned handle, uint64_t usec)
+{
+    StubBO *bo = stubLookup(handle);
+
+    if (bo && bo->busyUntil < usec)
+	bo->busyUntil = usec;
+}
+
+/*
+ * Make the next waits for buffer objects fail, as if interrupted.
+ */
+
+void
+stubDrmFailWaits(int num)
+{
+    stubFailWaits = num;
+}
+
+/*
+ * Make the map after the next skip ones fail. A negative skip cancels
+ * a pending failure.
+ */
+
+void
+stubDrmFailMap(int skip)
+{
+    stubFailMap = skip;
+}
+
+/*
+ * The memory of a buffer object, for checking what was put there.
+ */
+
+void *
+stubDrmVirtual(unsigned handle)
+{
+    StubBO *bo = stubLookup(handle);
+
+    return bo ? bo->virtual : NULL;
+}
+
+unsigned long
+stubDrmSize(unsigned handle)
+{
+    StubBO *bo = stubLookup(handle);
+
+    return bo ? bo->size : 0;
+}
+
+/*
+ * Wait for everything submitted so far.
+ */
+
+void
+stubDrmIdle(void)
+{
+    while (stubUsec() < stubEngineFree) ;
+}
+
+int
+drmBOCreate(int fd, unsigned long size, unsigned pageAlignment,
+	    void *user_buffer, uint64_t mask, unsigned hint, drmBO * buf)
+{
+    StubBO *bo = NULL;
+    unsigned i;
+
+    for (i = 0; i < STUB_MAX_BOS; ++i) {
+	if (!stubBOs[i].used) {
+	    bo = &stubBOs[i];
+	    break;
+	}
+    }
+    if (!bo || !size)
+	return -ENOMEM;
+
+    size = (size + STUB_PAGE_SIZE - 1) & ~(STUB_PAGE_SIZE - 1);
+    memset(bo, 0, sizeof(*bo));
+    if (user_buffer) {
+	bo->virtual = user_buffer;
+	bo->userMem = 1;
+    } else if (posix_memalign(&bo->virtual, STUB_PAGE_SIZE, size)) {
+	return -ENOMEM;
+    } else {
+	memset(bo->virtual, 0, size);
+    }
+
+    /*
+     * Offsets are handed out linearly, and wrap within the 28 bits
+     * the 2D engine can address.
+     */
+
+    if (stubNextOffset + size > 0x10000000)
+	stubNextOffset = 0x00100000;
+    bo->offset = stubNextOffset;
+    stubNextOffset += size;
+
+    bo->used = 1;
+    bo->size = size;
+    bo->flags = mask;
+    stubDrmStats.numBuffers++;
+
+    memset(buf, 0, sizeof(*buf));
+    buf->handle = (bo - stubBOs) + 1;
+    buf->size = size;
+    buf->offset = bo->offset;
+    buf->flags = mask;
+    buf->mask = mask;
+    buf->pageAlignment = pageAlignment;
+
+    return 0;
+}
+
+int
+drmBOUnreference(int fd, drmBO * buf)
+{
+    StubBO *bo = stubLookup(buf->handle);
+
+    if (!bo)
+	return -EINVAL;
+
+    if (!bo->userMem)
+	free(bo->virtual);
+    bo->used = 0;
+    stubDrmStats.numBuffers--;
+    buf->handle = 0;
+
+    return 0;
+}
+
+int
+drmBOMap(int fd, drmBO * buf, unsigned mapFlags, unsigned mapHint,
+	 void **address)
+{
+    StubBO *bo = stubLookup(buf->handle);
+
+    if (!bo)
+	return -EINVAL;
+
+    if (stubFailMap >= 0 && stubFailMap-- == 0)
+	return -EAGAIN;
+
+    if (mapHint & DRM_BO_HINT_DONT_BLOCK) {
+	if (stubUsec() < bo->busyUntil)
+	    return -EBUSY;
+    } else {
+	stubWait(bo);
+    }
+
+    buf->virtual = bo->virtual;
+    buf->mapCount++;
+    *address = bo->virtual;
+
+    return 0;
+}
+
+int
+drmBOUnmap(int fd, drmBO * buf)
+{
+    if (!stubLookup(buf->handle))
+	return -EINVAL;
+
+    buf->mapCount--;
+    return 0;
+}
+
+int
+drmBOBusy(int fd, drmBO * buf, int *busy)
+{
+    StubBO *bo = stubLookup(buf->handle);
+
+    if (!bo)
+	return -EINVAL;
+
+    *busy = (stubUsec() < bo->busyUntil);
+    return 0;
+}
+
+int
+drmBOWaitIdle(int fd, drmBO * buf, unsigned hint)
+{
+    StubBO *bo = stubLookup(buf->handle);
+
+    if (!bo)
+	return -EINVAL;
+
+    if (stubFailWaits) {
+	stubFailWaits--;
+	return -EAGAIN;
+    }
+
+    stubWait(bo);
+    return 0;
+}
+
+int
+drmBOSetStatus(int fd, drmBO * buf, uint64_t flags, uint64_t mask,
+	       unsigned int hint, unsigned int desired_tile_stride,
+	       unsigned int tile_info)
+{
+    StubBO *bo = stubLookup(buf->handle);
+
+    if (!bo)
+	return -EINVAL;
+
+    bo->flags = (bo->flags & ~mask) | (flags & mask);
+    buf->flags = bo->flags;
+    return 0;
+}
+
+/*
+ * Fences signal when the engine gets to the point where they were
+ * emitted.
+ */
+
+int
+drmFenceEmit(int fd, unsigned flags, drmFence * fence, unsigned emit_type)
+{
+    memset(fence, 0, sizeof(*fence));
+    fence->handle = 1;
+    fence->type = emit_type;
+    fence->flags = flags;
+    fence->sequence = ++stubFenceSeq;
+    stubFenceTime[fence->sequence % STUB_FENCES] = stubEngineFree;
+
+    return 0;
+}
+
+int
+drmFenceFlush(int fd, drmFence * fence, unsigned flush_type)
+{
+    return 0;
+}
+
+int
+drmFenceSignaled(int fd, drmFence * fence, unsigned fenceType,
+		 int *signaled)
+{
+    *signaled = (stubUsec() >= stubFenceTime[fence->sequence % STUB_FENCES]);
+    if (*signaled)
+	fence->signaled = fence->type;
+
+    return 0;
+}
+
+int
+drmFenceWait(int fd, unsigned flags, drmFence * fence, unsigned flush_type)
+{
+    while (stubUsec() < stubFenceTime[fence->sequence % STUB_FENCES]) ;
+    fence->signaled = fence->type;
+
+    return 0;
+}
+
+int
+drmMMInit(int fd, unsigned long pOffset, unsigned long pSize,
+	  unsigned memType)
+{
+    return 0;
+}
+
+int
+drmMMTakedown(int fd, unsigned memType)
+{
+    return 0;
+}
+
+int
+drmMMLock(int fd, unsigned memType, int lockBM, int ignoreNoEvict)
+{
+    return 0;
+}
+
+int
+drmMMUnlock(int fd, unsigned memType, int unlockBM)
+{
+    return 0;
+}
+
+/*
+ * The 2D engine. Solid fills, pattern fills and copies between surfaces
+ * of the same format are executed with any ROP3, and plain copies
+ * convert between formats and may blend with the alpha control set by
+ * PSB_2D_CTRL_BH; everything else (rotation, clipping, colour keys) is
+ * skipped and counted in stubDrmStats.unhandled, so that a test can
+ * tell it is not checking what it thinks it is.
+ */
+
+typedef struct _StubFormat
+{
+    uint32_t format;
+    int cpp;
+    int a, r, g, b;			/* channel bits, packed ARGB */
+} StubFormat;
+
+typedef struct _StubSurf
+{
+    StubBO *bo;
+    const StubFormat *format;
+    unsigned long offset;
+    unsigned stride;
+    int cpp;
+} StubSurf;
+
+typedef struct _StubArea
+{
+    StubSurf surf;
+    unsigned x, y, w, h;
+} StubArea;
+
+#define STUB_WRITES 256
+
+typedef struct _StubEngine
+{
+    StubSurf dst;
+    StubSurf src;
+    StubSurf pat;
+    unsigned srcX, srcY;
+    unsigned patX, patY, patW, patH;
+    uint32_t alpha1;
+    uint64_t bytes;
+
+    /*
+     * Areas written since the last fence. Older ones are forgotten
+     * when there are too many.
+     */
+
+    StubArea writes[STUB_WRITES];
+    unsigned numWrites;
+} StubEngine;
+
+static const StubFormat stubFormats[] = {
+    {PSB_2D_SRC_8_ALPHA, 1, 8, 0, 0, 0},
+    {PSB_2D_SRC_332RGB, 1, 0, 3, 3, 2},
+    {PSB_2D_SRC_4444ARGB, 2, 4, 4, 4, 4},
+    {PSB_2D_SRC_555RGB, 2, 0, 5, 5, 5},
+    {PSB_2D_SRC_1555ARGB, 2, 1, 5, 5, 5},
+    {PSB_2D_SRC_565RGB, 2, 0, 5, 6, 5},
+    {PSB_2D_SRC_0888ARGB, 4, 0, 8, 8, 8},
+    {PSB_2D_SRC_8888ARGB, 4, 8, 8, 8, 8},
+    {PSB_2D_DST_8888AYUV, 4, 8, 8, 8, 8}
+};
+
+static const StubFormat stubARGB = { 0, 4, 8, 8, 8, 8 };
+
+static const StubFormat *
+stubFormat(uint32_t format)
+{
+    int i;
+
+    for (i = 0; i < sizeof(stubFormats) / sizeof(stubFormats[0]); ++i)
+	if (stubFormats[i].format == format)
+	    return &stubFormats[i];
+
+    return NULL;
+}
+
+/*
+ * Widen a channel to 8 bits by replicating its bits.
+ */
+
+static uint32_t
+stubExpand(uint32_t value, int shift, int bits)
+{
+    uint32_t c;
+
+    if (!bits)
+	return 0;
+
+    c = ((value >> shift) & ((1 << bits) - 1)) << (8 - bits);
+    for (; bits < 8; bits *= 2)
+	c |= c >> bits;
+
+    return c & 0xFF;
+}
+
+/*
+ * Convert a pixel by widening its channels to 8 bits and truncating
+ * them to the destination's. A source without alpha leaves the
+ * destination alpha bits clear.
+ */
+
+static uint32_t
+stubConvert(const StubFormat * from, const StubFormat * to, uint32_t value)
+{
+    int fg = from->b, fr = fg + from->g, fa = fr + from->r;
+    int tg = to->b, tr = tg + to->g, ta = tr + to->r;
+
+    return ((stubExpand(value, fa, from->a) >> (8 - to->a)) << ta) |
+	((stubExpand(value, fr, from->r) >> (8 - to->r)) << tr) |
+	((stubExpand(value, fg, from->g) >> (8 - to->g)) << tg) |
+	(stubExpand(value, 0, from->b) >> (8 - to->b));
+}
+
+/*
+ * The surface formats share their encoding between the source,
+ * destination and pattern headers.
+ */
+
+static void
+stubSurface(StubSurf * surf, const uint32_t * dwords, unsigned where,
+	    StubBO ** at)
+{
+    surf->bo = at[where + 1];
+    surf->format = stubFormat(dwords[where] & PSB_2D_DST_FORMAT_MASK);
+    surf->cpp = surf->format ? surf->format->cpp : 0;
+    surf->stride = dwords[where] & PSB_2D_DST_STRIDE_MASK;
+    surf->offset = surf->bo ?
+	(dwords[where + 1] & 0x0FFFFFFF) - surf->bo->offset : 0;
+}
+
+static int
+stubInside(const StubSurf * surf, unsigned x, unsigned y,
+	   unsigned w, unsigned h)
+{
+    if (!surf->bo || !surf->cpp)
+	return 0;
+
+    return surf->offset + (unsigned long)(y + h - 1) * surf->stride +
+	(unsigned long)(x + w) * surf->cpp <= surf->bo->size;
+}
+
+static uint32_t *
+stubPixelAddr(const StubSurf * surf, unsigned x, unsigned y)
+{
+    return (uint32_t *) ((char *)surf->bo->virtual + surf->offset +
+			 (unsigned long)y * surf->stride +
+			 (unsigned long)x * surf->cpp);
+}
+
+static uint32_t
+stubRead(const StubSurf * surf, unsigned x, unsigned y)
+{
+    void *addr = stubPixelAddr(surf, x, y);
+
+    switch (surf->cpp) {
+    case 1:
+	return *(uint8_t *) addr;
+    case 2:
+	return *(uint16_t *) addr;
+    default:
+	return *(uint32_t *) addr;
+    }
+}
+
+static void
+stubWrite(const StubSurf * surf, unsigned x, unsigned y, uint32_t value)
+{
+    void *addr = stubPixelAddr(surf, x, y);
+
+    switch (surf->cpp) {
+    case 1:
+	*(uint8_t *) addr = value;
+	break;
+    case 2:
+	*(uint16_t *) addr = value;
+	break;
+    default:
+	*(uint32_t *) addr = value;
+	break;
+    }
+}
+
+/*
+ * Alpha blending of ARGB8888 pixels. Each factor is one of the alpha
+ * operations of PSB_2D_CTRL_BH, inverted if asked to. A source or
+ * destination without alpha is opaque. Only the first alpha control
+ * word is interpreted; the driver leaves the second one zero.
+ */
+
+static uint32_t
+stubMul(uint32_t a, uint32_t b)
+{
+    uint32_t t = a * b + 0x80;
+
+    return (t + (t >> 8)) >> 8;
+}
+
+static uint32_t
+stubAlphaFactor(uint32_t op, int invert, uint32_t srcA, uint32_t dstA,
+		uint32_t gbl)
+{
+    uint32_t f;
+
+    switch (op) {
+    case 0:
+	f = 0xFF;
+	break;
+    case 1:
+	f = srcA;
+	break;
+    case 2:
+	f = dstA;
+	break;
+    case 3:
+	f = stubMul(srcA, gbl);
+	break;
+    case 4:
+	f = stubMul(dstA, gbl);
+	break;
+    case 5:
+	f = gbl;
+	break;
+    default:
+	f = 0;
+	break;
+    }
+
+    return invert ? 0xFF - f : f;
+}
+
+static uint32_t
+stubBlend(uint32_t alpha1, uint32_t s, uint32_t d, int srcHasA,
+	  int dstHasA)
+{
+    uint32_t gbl = (alpha1 & PSB_2D_GBLALPHA_MASK) >> PSB_2D_GBLALPHA_SHIFT;
+    uint32_t srcA = srcHasA ? s >> 24 : 0xFF;
+    uint32_t dstA = dstHasA ? d >> 24 : 0xFF;
+    uint32_t fs = stubAlphaFactor((alpha1 & PSB_2D_SRCALPHA_OP_MASK) >>
+				  PSB_2D_SRCALPHA_OP_SHIFT,
+				  (alpha1 & PSB_2D_SRCALPHA_INVERT) != 0,
+				  srcA, dstA, gbl);
+    uint32_t fd = stubAlphaFactor((alpha1 & PSB_2D_DSTALPHA_OP_MASK) >>
+				  PSB_2D_DSTALPHA_OP_SHIFT,
+				  (alpha1 & PSB_2D_DSTALPHA_INVERT) != 0,
+				  srcA, dstA, gbl);
+    uint32_t result = 0, c;
+    int shift;
+
+    s = (s & 0x00FFFFFF) | (srcA << 24);
+    d = (d & 0x00FFFFFF) | (dstA << 24);
+    for (shift = 0; shift < 32; shift += 8) {
+	c = stubMul((s >> shift) & 0xFF, fs) + stubMul((d >> shift) & 0xFF, fd);
+	result |= (c > 0xFF ? 0xFF : c) << shift;
+    }
+
+    return result;
+}
+
+/*
+ * Bit i of a ROP3 gives the result for pattern bit (i >> 2) & 1,
+ * source bit (i >> 1) & 1 and destination bit i & 1.
+ */
+
+static uint32_t
+stubRop3(unsigned rop, uint32_t p, uint32_t s, uint32_t d)
+{
+    uint32_t result = 0;
+    int i;
+
+    for (i = 0; i < 8; ++i) {
+	if (rop & (1 << i))
+	    result |= ((i & 4) ? p : ~p) & ((i & 2) ? s : ~s) &
+		((i & 1) ? d : ~d);
+    }
+
+    return result;
+}
+
+/*
+ * Whether two areas may share bytes: as boxes on the same surface,
+ * otherwise as the byte ranges they span. Rotated blits cover their
+ * whole buffer.
+ */
+
+static int
+stubOverlap(const StubArea * a, const StubArea * b, int rotated)
+{
+    unsigned long aStart, aEnd, bStart, bEnd;
+
+    if (!a->surf.bo || a->surf.bo != b->surf.bo || !a->w || !b->w)
+	return 0;
+    if (rotated)
+	return 1;
+
+    if (a->surf.offset == b->surf.offset && a->surf.stride == b->surf.stride)
+	return (a->x < b->x + b->w && b->x < a->x + a->w &&
+		a->y < b->y + b->h && b->y < a->y + a->h);
+
+    aStart = a->surf.offset + (unsigned long)a->y * a->surf.stride +
+	(unsigned long)a->x * a->surf.cpp;
+    aEnd = a->surf.offset + (unsigned long)(a->y + a->h - 1) *
+	a->surf.stride + (unsigned long)(a->x + a->w) * a->surf.cpp;
+    bStart = b->surf.offset + (unsigned long)b->y * b->surf.stride +
+	(unsigned long)b->x * b->surf.cpp;
+    bEnd = b->surf.offset + (unsigned long)(b->y + b->h - 1) *
+	b->surf.stride + (unsigned long)(b->x + b->w) * b->surf.cpp;
+
+    return aStart < bEnd && bStart < aEnd;
+}
+
+/*
+ * Count a hazard if a blit reads what blits since the last fence
+ * wrote, then record what it writes.
+ */
+
+static void
+stubHazards(StubEngine * eng, uint32_t cmd, int usesPat, int usesSrc,
+	    int usesDst, unsigned x, unsigned y, unsigned srcX,
+	    unsigned srcY, unsigned w, unsigned h)
+{
+    int rotated = (cmd & PSB_2D_ROT_MASK) != PSB_2D_ROT_NONE;
+    StubArea reads[3];
+    int numReads = 0;
+    unsigned i, j;
+
+    if (usesSrc) {
+	reads[numReads].surf = eng->src;
+	reads[numReads].x = srcX;
+	reads[numReads].y = srcY;
+	reads[numReads].w = w;
+	reads[numReads++].h = h;
+    }
+    if (usesPat && (cmd & PSB_2D_USE_PAT)) {
+	reads[numReads].surf = eng->pat;
+	reads[numReads].x = 0;
+	reads[numReads].y = 0;
+	reads[numReads].w = eng->patW;
+	reads[numReads++].h = eng->patH;
+    }
+    if (usesDst || (cmd & PSB_2D_ALPHA_ENABLE)) {
+	reads[numReads].surf = eng->dst;
+	reads[numReads].x = x;
+	reads[numReads].y = y;
+	reads[numReads].w = w;
+	reads[numReads++].h = h;
+    }
+
+    for (i = 0; i < numReads; ++i)
+	for (j = 0; j < eng->numWrites && j < STUB_WRITES; ++j)
+	    if (stubOverlap(&reads[i], &eng->writes[j], rotated)) {
+		stubDrmStats.hazards++;
+		i = numReads;
+		break;
+	    }
+
+    j = eng->numWrites++ % STUB_WRITES;
+    eng->writes[j].surf = eng->dst;
+    eng->writes[j].x = x;
+    eng->writes[j].y = y;
+    eng->writes[j].w = w;
+    eng->writes[j].h = h;
+}
+
+static void
+stubBlit(StubEngine * eng, uint32_t cmd, uint32_t fill, uint32_t xy,
+	 uint32_t size)
+{
+    unsigned rop = cmd & PSB_2D_ROP3A_MASK;
+    int usesPat = ((rop >> 4) ^ rop) & 0x0F;
+    int usesSrc = ((rop >> 2) ^ rop) & 0x33;
+    int usesDst = ((rop >> 1) ^ rop) & 0x55;
+    unsigned x = (xy & PSB_2D_DST_XSTART_MASK) >> PSB_2D_DST_XSTART_SHIFT;
+    unsigned y = (xy & PSB_2D_DST_YSTART_MASK) >> PSB_2D_DST_YSTART_SHIFT;
+    unsigned w = (size & PSB_2D_DST_XSIZE_MASK) >> PSB_2D_DST_XSIZE_SHIFT;
+    unsigned h = (size & PSB_2D_DST_YSIZE_MASK) >> PSB_2D_DST_YSIZE_SHIFT;
+    unsigned srcX = eng->srcX;
+    unsigned srcY = eng->srcY;
+    uint32_t order = cmd & ~PSB_2D_COPYORDER_CLRMASK;
+    uint32_t *srcCopy = NULL;
+    uint32_t p, s;
+    unsigned i, j;
+
+    if (!w || !h)
+	return;
+
+    /*
+     * With a reversed copy order, the blit starts at the far corner.
+     */
+
+    if (order == PSB_2D_COPYORDER_BR2TL || order == PSB_2D_COPYORDER_TR2BL) {
+	x -= w - 1;
+	srcX -= w - 1;
+    }
+    if (order == PSB_2D_COPYORDER_BR2TL || order == PSB_2D_COPYORDER_BL2TR) {
+	y -= h - 1;
+	srcY -= h - 1;
+    }
+
+    stubHazards(eng, cmd, usesPat, usesSrc, usesDst, x, y, srcX, srcY, w, h);
+
+    if ((cmd & (PSB_2D_ROT_MASK | PSB_2D_CLIP_ENABLE |
+		PSB_2D_SRCCK_REJECT | PSB_2D_SRCCK_PASS |
+		PSB_2D_DSTCK_REJECT | PSB_2D_DSTCK_PASS)) ||
+	(usesPat && (cmd & PSB_2D_USE_PAT) &&
+	 (!eng->patW || !eng->patH || !stubInside(&eng->pat, 0, 0,
+						  eng->patW, eng->patH) ||
+	  eng->pat.cpp != eng->dst.cpp)) ||
+	(usesSrc && (!stubInside(&eng->src, srcX, srcY, w, h) ||
+		     (eng->src.format != eng->dst.format &&
+		      rop != (PSB_2D_ROP3_SRCCOPY & PSB_2D_ROP3A_MASK)))) ||
+	((cmd & PSB_2D_ALPHA_ENABLE) &&
+	 (rop != (PSB_2D_ROP3_SRCCOPY & PSB_2D_ROP3A_MASK) ||
+	  !eng->src.format || !eng->dst.format))) {
+	stubDrmStats.unhandled++;
+	return;
+    }
+    if (!stubInside(&eng->dst, x, y, w, h)) {
+	stubDrmStats.boundsErrors++;
+	return;
+    }
+
+    /*
+     * Read the whole source first, so that overlapping copies come out
+     * right whatever copy order the command asked for.
+     */
+
+    if (usesSrc) {
+	srcCopy = malloc(sizeof(*srcCopy) * w * h);
+	if (!srcCopy) {
+	    stubDrmStats.unhandled++;
+	    return;
+	}
+	for (j = 0; j < h; ++j)
+	    for (i = 0; i < w; ++i)
+		srcCopy[j * w + i] = stubRead(&eng->src, srcX + i, srcY + j);
+	if (cmd & PSB_2D_ALPHA_ENABLE)
+	    for (i = 0; i < w * h; ++i)
+		srcCopy[i] = stubConvert(eng->src.format, &stubARGB,
+					 srcCopy[i]);
+	else if (eng->src.format != eng->dst.format)
+	    for (i = 0; i < w * h; ++i)
+		srcCopy[i] = stubConvert(eng->src.format, eng->dst.format,
+					 srcCopy[i]);
+    }
+
+    if (cmd & PSB_2D_ALPHA_ENABLE) {
+	for (j = 0; j < h; ++j) {
+	    for (i = 0; i < w; ++i) {
+		s = stubBlend(eng->alpha1, srcCopy[j * w + i],
+			      stubConvert(eng->dst.format, &stubARGB,
+					  stubRead(&eng->dst, x + i, y + j)),
+			      eng->src.format->a != 0,
+			      eng->dst.format->a != 0);
+		stubWrite(&eng->dst, x + i, y + j,
+			  stubConvert(&stubARGB, eng->dst.format, s));
+	    }
+	}
+	eng->bytes += (uint64_t) w *h * eng->dst.cpp * 3;
+	free(srcCopy);
+	return;
+    }
+
+    p = (cmd & PSB_2D_USE_PAT) ? 0 : fill;
+    s = 0;
+    for (j = 0; j < h; ++j) {
+	for (i = 0; i < w; ++i) {
+	    if (usesPat && (cmd & PSB_2D_USE_PAT))
+		p = stubRead(&eng->pat, (eng->patX + i) % eng->patW,
+			     (eng->patY + j) % eng->patH);
+	    if (srcCopy)
+		s = srcCopy[j * w + i];
+	    stubWrite(&eng->dst, x + i, y + j,
+		      stubRop3(rop, p, s,
+			       usesDst ? stubRead(&eng->dst, x + i,
+						  y + j) : 0));
+	}
+    }
+
+    eng->bytes += (uint64_t) w *h * eng->dst.cpp *
+	(1 + (usesSrc != 0) + (usesDst != 0));
+    free(srcCopy);
+}
+
+/*
+ * The number of dwords of the 2D command at the start of dwords, or 0 if
+ * the command is unknown or runs past the end of the stream.
+ */
+
+unsigned
+stub2DLength(const uint32_t * dwords, unsigned numDwords)
+{
+    uint32_t cmd;
+    unsigned len;
+
+    if (!numDwords)
+	return 0;
+
+    cmd = dwords[0];
+    switch (cmd & 0xF0000000) {
+    case PSB_2D_PAT_BH:
+    case PSB_2D_SRC_OFF_BH:
+    case PSB_2D_MASK_OFF_BH:
+    case PSB_2D_FENCE_BH:
+    case PSB_2D_FLUSH_BH:
+	len = 1;
+	break;
+    case PSB_2D_CTRL_BH:
+	len = 1 + ((cmd & PSB_2D_SRCCK_CTRL) ? 2 : 0) +
+	    ((cmd & PSB_2D_DSTCK_CTRL) ? 2 : 0) +
+	    ((cmd & PSB_2D_ALPHA_CTRL) ? 2 : 0);
+	break;
+    case PSB_2D_SRC_SURF_BH:
+    case PSB_2D_DST_SURF_BH:
+    case PSB_2D_PAT_SURF_BH:
+    case PSB_2D_MASK_SURF_BH:
+	len = 2;
+	break;
+    case PSB_2D_BLIT_BH:
+	len = (cmd & PSB_2D_USE_PAT) ? 3 : 4;
+	break;
+    default:
+	return 0;
+    }
+
+    return (len <= numDwords) ? len : 0;
+}
+
+/*
+ * Run a command stream. at[i] is the buffer object dword i was
+ * relocated against, if any.
+ */
+
+static uint64_t
+stubExecute(const uint32_t * dwords, unsigned numDwords, StubBO ** at)
+{
+    StubEngine eng;
+    unsigned i = 0;
+    unsigned len;
+    uint32_t cmd, fill;
+
+    memset(&eng, 0, sizeof(eng));
+    while (i < numDwords) {
+	cmd = dwords[i];
+	len = stub2DLength(dwords + i, numDwords - i);
+	if (!len) {
+
+	    /*
+	     * We can't tell how long an unknown command is, so the rest
+	     * of the stream is lost.
+	     */
+
+	    stubDrmStats.unhandled++;
+	    break;
+	}
+
+	switch (cmd & 0xF0000000) {
+	case PSB_2D_PAT_BH:
+	    eng.patW = (cmd & PSB_2D_PAT_WIDTH_MASK) >> PSB_2D_PAT_WIDTH_SHIFT;
+	    eng.patH = (cmd & PSB_2D_PAT_HEIGHT_MASK) >>
+		PSB_2D_PAT_HEIGHT_SHIFT;
+	    eng.patX = (cmd & PSB_2D_PAT_XSTART_MASK) >>
+		PSB_2D_PAT_XSTART_SHIFT;
+	    eng.patY = (cmd & PSB_2D_PAT_YSTART_MASK) >>
+		PSB_2D_PAT_YSTART_SHIFT;
+	    break;
+	case PSB_2D_SRC_OFF_BH:
+	    eng.srcX = (cmd & PSB_2D_SRCOFF_XSTART_MASK) >>
+		PSB_2D_SRCOFF_XSTART_SHIFT;
+	    eng.srcY = (cmd & PSB_2D_SRCOFF_YSTART_MASK) >>
+		PSB_2D_SRCOFF_YSTART_SHIFT;
+	    break;
+	case PSB_2D_FENCE_BH:
+	    eng.numWrites = 0;
+	    break;
+	case PSB_2D_CTRL_BH:
+	    if (cmd & PSB_2D_ALPHA_CTRL)
+		eng.alpha1 = dwords[i + len - 2];
+	    break;
+	case PSB_2D_SRC_SURF_BH:
+	case PSB_2D_DST_SURF_BH:
+	case PSB_2D_PAT_SURF_BH:
+	    if (eng.numWrites)
+		stubDrmStats.hazards++;
+	    if ((cmd & 0xF0000000) == PSB_2D_SRC_SURF_BH)
+		stubSurface(&eng.src, dwords, i, at);
+	    else if ((cmd & 0xF0000000) == PSB_2D_DST_SURF_BH)
+		stubSurface(&eng.dst, dwords, i, at);
+	    else
+		stubSurface(&eng.pat, dwords, i, at);
+	    break;
+	case PSB_2D_BLIT_BH:
+	    if (cmd & PSB_2D_USE_PAT)
+		stubDrmStats.patternBlits++;
+	    fill = (cmd & PSB_2D_USE_PAT) ? 0 : dwords[i + 1];
+	    stubBlit(&eng, cmd, fill, dwords[i + len - 2], dwords[i + len - 1]);
+	    break;
+	default:
+	    break;
+	}
+	i += len;
+    }
+
+    return eng.bytes;
+}
+
+/*
+ * DRM_PSB_CMDBUF. Like the kernel, wait for the command buffer to be
+ * idle before patching it, validate the buffer list, and apply the
+ * relocations. Relocations whose presumed value was wrong are counted
+ * as errors, since the 2D code always knows the current offsets.
+ */
+
+static int
+stubCmdBuf(struct drm_psb_cmdbuf_arg *ca)
+{
+    struct drm_bo_op_arg *arg;
+    struct drm_psb_reloc *reloc;
+    StubBO *list[STUB_MAX_BOS];
+    StubBO *cmd, *relocBuf, *bo;
+    StubBO **at;
+    uint32_t *dwords;
+    uint32_t value;
+    unsigned numBuffers = 0;
+    unsigned i;
+    uint64_t cost;
+    uint64_t waited;
+    uint64_t bytes;
+    uint64_t start;
+
+    cmd = stubLookup(ca->cmdbuf_handle);
+    relocBuf = stubLookup(ca->reloc_handle);
+    if (!cmd || !relocBuf ||
+	ca->cmdbuf_offset + ca->cmdbuf_size * 4 > cmd->size ||
+	ca->reloc_offset + ca->num_relocs * sizeof(*reloc) > relocBuf->size)
+	return -EINVAL;
+
+    for (arg = (struct drm_bo_op_arg *)(unsigned long)ca->buffer_list;
+	 arg; arg = (struct drm_bo_op_arg *)(unsigned long)arg->next) {
+	bo = stubLookup(arg->d.req.bo_req.handle);
+	if (!bo || numBuffers == STUB_MAX_BOS) {
+	    stubDrmStats.validateErrors++;
+	    return -EINVAL;
+	}
+	list[numBuffers++] = bo;
+    }
+
+    /*
+     * Only the ioctl's own wait on the command buffer is counted; waits
+     * the driver does itself are its business.
+     */
+
+    waited = stubWait(cmd);
+    if (waited) {
+	stubDrmStats.waits++;
+	stubDrmStats.waitUsec += waited;
+    }
+
+    at = calloc(ca->cmdbuf_size + 1, sizeof(*at));
+    if (!at)
+	return -ENOMEM;
+
+    dwords = (uint32_t *) ((char *)cmd->virtual + ca->cmdbuf_offset);
+    reloc = (struct drm_psb_reloc *)
+	((char *)relocBuf->virtual + ca->reloc_offset);
+    for (i = 0; i < ca->num_relocs; ++i, ++reloc) {
+	if (reloc->where >= ca->cmdbuf_size || reloc->buffer >= numBuffers) {
+	    stubDrmStats.relocErrors++;
+	    continue;
+	}
+	value = ((list[reloc->buffer]->offset + reloc->pre_add) >>
+		 reloc->shift) & reloc->mask;
+	if ((dwords[reloc->where] & reloc->mask) != value)
+	    stubDrmStats.relocErrors++;
+	dwords[reloc->where] = (dwords[reloc->where] & ~reloc->mask) | value;
+	at[reloc->where] = list[reloc->buffer];
+    }
+
+    /*
+     * The engine cost below is what the blits take; the time we spend
+     * carrying them out on the CPU is taken off the clock.
+     */
+
+    bytes = 0;
+    if (stubExecuteBlits) {
+	start = stubUsec();
+	bytes = stubExecute(dwords, ca->cmdbuf_size, at);
+	stubTimeHide(stubUsec() - start);
+    }
+    free(at);
+
+    cost = stubSubmitUsec +
+	((uint64_t) ca->cmdbuf_size * stubDwordNsec) / 1000;
+    if (stubMBytesPerSec)
+	cost += bytes / stubMBytesPerSec;
+    if (stubEngineFree < stubUsec())
+	stubEngineFree = stubUsec();
+    stubEngineFree += cost;
+
+    i = 0;
+    for (arg = (struct drm_bo_op_arg *)(unsigned long)ca->buffer_list;
+	 arg; arg = (struct drm_bo_op_arg *)(unsigned long)arg->next) {
+	struct drm_bo_info_req req = arg->d.req.bo_req;
+	struct drm_bo_info_rep *rep = &arg->d.rep.bo_info;
+
+	bo = list[i++];
+	bo->busyUntil = stubEngineFree;
+	if (req.mask & DRM_BO_MASK_MEM)
+	    bo->flags = (bo->flags & ~req.mask) | (req.flags & req.mask);
+
+	memset(&arg->d.rep, 0, sizeof(arg->d.rep));
+	rep->handle = req.handle;
+	rep->flags = bo->flags;
+	rep->mask = bo->flags;
+	rep->size = bo->size;
+	rep->offset = bo->offset;
+	rep->page_alignment = 0;
+	arg->handled = 1;
+    }
+
+    stubDrmStats.submits++;
+    stubDrmStats.dwords += ca->cmdbuf_size;
+    stubDrmStats.relocs += ca->num_relocs;
+
+    return 0;
+}
+
+int
+drmCommandWriteRead(int fd, unsigned long drmCommandIndex, void *data,
+		    unsigned long size)
+{
+    if (drmCommandIndex == DRM_PSB_CMDBUF &&
+	size == sizeof(struct drm_psb_cmdbuf_arg)) {
+	uint64_t start = stubUsec();
+	unsigned long long waitUsec = stubDrmStats.waitUsec;
+	int ret = stubCmdBuf((struct drm_psb_cmdbuf_arg *)data);
+
+	stubDrmStats.ioctlUsec += stubUsec() - start -
+	    (stubDrmStats.waitUsec - waitUsec);
+	return ret;
+    }
+
+    return -EINVAL;
+}
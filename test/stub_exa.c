@@ -0,0 +1,445 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * A screen running the driver's EXA acceleration on top of the stub DRM,
+ * with the EXA and dix entry points the acceleration code calls. EXA
+ * itself is not there: tests create pixmaps and call the driver hooks
+ * the way EXA would.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <xf86.h>
+#include <dixstruct.h>
+#include <extnsionst.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+typedef struct _StubPixmap
+{
+    PixmapRec pixmap;
+    void *driverPriv;
+    CARD8 *sysPtr;
+    int sysIndex;
+} StubPixmapRec, *StubPixmapPtr;
+
+static ScrnInfoPtr stubScrns[1];
+ScrnInfoPtr *xf86Screens = stubScrns;
+ScreenInfo screenInfo;
+
+CallbackListPtr ClientStateCallback;
+int (*ProcVector[256]) (ClientPtr);
+int (*SwappedProcVector[256]) (ClientPtr);
+
+/*
+ * What CheckExtension returns for every name. NULL: no extensions.
+ */
+
+ExtensionEntry *stubExtension;
+
+ExtensionEntry *
+CheckExtension(const char *name)
+{
+    return stubExtension;
+}
+
+Bool
+AddCallback(CallbackListPtr * list, CallbackProcPtr callback, pointer data)
+{
+    return TRUE;
+}
+
+Bool
+DeleteCallback(CallbackListPtr * list, CallbackProcPtr callback,
+	       pointer data)
+{
+    return TRUE;
+}
+
+Bool
+PictureTransformPoint(PictTransformPtr transform, PictVectorPtr vector)
+{
+    return TRUE;
+}
+
+ExaDriverPtr
+exaDriverAlloc(void)
+{
+    return xcalloc(1, sizeof(ExaDriverRec));
+}
+
+Bool
+exaDriverInit(ScreenPtr pScreen, ExaDriverPtr pExa)
+{
+    return TRUE;
+}
+
+void
+exaDriverFini(ScreenPtr pScreen)
+{
+}
+
+void *
+exaGetPixmapDriverPrivate(PixmapPtr pPix)
+{
+    return ((StubPixmapPtr) pPix)->driverPriv;
+}
+
+unsigned long
+exaGetPixmapPitch(PixmapPtr pPix)
+{
+    return pPix->devKind;
+}
+
+Bool
+exaPixmapIsOffscreen(PixmapPtr pPix)
+{
+    return ((StubPixmapPtr) pPix)->driverPriv != NULL;
+}
+
+void
+exaMoveInPixmap(PixmapPtr pPix)
+{
+}
+
+void
+ExaOffscreenMarkUsed(PixmapPtr pPix)
+{
+}
+
+/*
+ * No DRI and no 3D engine. The lock only counts, so that the stub
+ * libXpsb can tell whether it is held.
+ */
+
+int stubDRILocked;
+
+void
+psbDRILock(ScrnInfoPtr pScrn, int flags)
+{
+    stubDRILocked++;
+}
+
+void
+psbDRIUnlock(ScrnInfoPtr pScrn)
+{
+    stubDRILocked--;
+}
+
+void
+psbDRIUpdateScanouts(ScrnInfoPtr pScrn)
+{
+}
+
+Bool
+psbExaPrepareComposite3D(int op, PicturePtr pSrcPicture,
+			 PicturePtr pMaskPicture, PicturePtr pDstPicture,
+			 PixmapPtr pSrc, PixmapPtr pMask, PixmapPtr pDst)
+{
+    return FALSE;
+}
+
+void
+psbExaComposite3D(PixmapPtr pDst, int srcX, int srcY, int maskX, int maskY,
+		  int dstX, int dstY, int width, int height)
+{
+}
+
+void
+psbExaDoneComposite3D(PixmapPtr pPixmap)
+{
+}
+
+static void
+stubBlockHandler(int i, pointer blockData, pointer pTimeout,
+		 pointer pReadmask)
+{
+}
+
+/*
+ * Set up a screen with the driver defaults, without acceleration.
+ * Tests may change the PsbRec before calling stubExaInit.
+ */
+
+ScrnInfoPtr
+stubScreenCreate(void)
+{
+    ScrnInfoPtr pScrn = xcalloc(1, sizeof(*pScrn));
+    ScreenPtr pScreen = xcalloc(1, sizeof(*pScreen));
+    PsbPtr pPsb = xcalloc(1, sizeof(*pPsb));
+    PsbDevicePtr pDevice = xcalloc(1, sizeof(*pDevice));
+
+    if (!pScrn || !pScreen || !pPsb || !pDevice)
+	FatalError("Out of memory.\n");
+
+    pScreen->myNum = 0;
+    pScreen->BlockHandler = stubBlockHandler;
+    pScrn->scrnIndex = 0;
+    pScrn->pScreen = pScreen;
+    pScrn->driverPrivate = pPsb;
+    pScrn->vtSema = TRUE;
+    stubScrns[0] = pScrn;
+    screenInfo.numScreens = 1;
+    screenInfo.screens[0] = pScreen;
+
+    pPsb->pScrn = pScrn;
+    pPsb->pDevice = pDevice;
+    pPsb->exaSize = 32 * 1024 * 1024;
+    pPsb->exaMaxSize = 128 * 1024 * 1024;
+    pPsb->exaScratchSize = 512 * 1024;
+    pPsb->exaCmdBuffers = 3;
+    pPsb->exaLazyFlush = TRUE;
+    pPsb->exaUserUpload = 128 * 1024;
+    pPsb->exaCalibrate = PSB_CAL_MODE_OFF;
+    pPsb->exaCalibrationFile = "/nonexistent/psb_exa_calibration";
+    pPsb->pDRIInfo = xcalloc(1, sizeof(*pPsb->pDRIInfo));
+    psbBufIndexInit(&pPsb->buffers);
+
+    pDevice->drmFD = 0;
+    pDevice->man = mmCreateDRM(pDevice->drmFD);
+    if (!pDevice->man || !pPsb->pDRIInfo)
+	FatalError("Could not set up the stub screen.\n");
+
+    return pScrn;
+}
+
+int
+stubExaInit(ScrnInfoPtr pScrn)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+
+    pPsb->has2DBuffer = psbInit2DBuffer(pPsb->pDevice->drmFD, &pPsb->superC,
+					pPsb->exaCmdBuffers);
+    if (!pPsb->has2DBuffer)
+	return FALSE;
+
+    pPsb->pPsbExa = psbExaInit(pScrn);
+    return pPsb->pPsbExa != NULL;
+}
+
+void
+stubScreenDestroy(ScrnInfoPtr pScrn)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    PsbDevicePtr pDevice = pPsb->pDevice;
+    ScreenPtr pScreen = pScrn->pScreen;
+
+    if (pPsb->pPsbExa) {
+	psbAccelFlush(pScrn);
+	psbExaClose(pPsb->pPsbExa, pScreen);
+    }
+    if (pPsb->has2DBuffer)
+	psbTakedown2DBuffer(pDevice->drmFD, &pPsb->superC);
+    pDevice->man->destroy(pDevice->man);
+    stubDrmIdle();
+
+    xfree(pPsb->pDRIInfo);
+    xfree(pDevice);
+    xfree(pPsb);
+    xfree(pScreen);
+    xfree(pScrn);
+    stubScrns[0] = NULL;
+    screenInfo.numScreens = 0;
+}
+
+/*
+ * One pass through the server's block handlers.
+ */
+
+void
+stubScreenBlock(ScrnInfoPtr pScrn)
+{
+    ScreenPtr pScreen = pScrn->pScreen;
+
+    (*pScreen->BlockHandler) (pScreen->myNum, NULL, NULL, NULL);
+}
+
+/*
+ * Create a pixmap the way EXA does with EXA_HANDLES_PIXMAPS.
+ */
+
+PixmapPtr
+stubPixmapCreate(ScrnInfoPtr pScrn, int w, int h, int depth, int bpp)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    ExaDriverPtr pExa = pPsb->pPsbExa->pExa;
+    void *(*createPixmap) (ScreenPtr, int, int, int, int, int, int *) =
+	pExa->CreatePixmap2;
+    Bool (*modifyPixmapHeader) (PixmapPtr, int, int, int, int, int,
+				pointer) = pExa->ModifyPixmapHeader;
+    StubPixmapPtr pStub = xcalloc(1, sizeof(*pStub));
+    PixmapPtr pPix = &pStub->pixmap;
+    int pitch = 0;
+
+    if (!pStub)
+	return NULL;
+
+    pPix->drawable.type = DRAWABLE_PIXMAP;
+    pPix->drawable.pScreen = pScrn->pScreen;
+    pPix->drawable.depth = depth;
+    pPix->drawable.bitsPerPixel = bpp;
+    pPix->drawable.width = w;
+    pPix->drawable.height = h;
+    pPix->refcnt = 1;
+
+    pStub->driverPriv = createPixmap(pScrn->pScreen, w, h, depth, 0, bpp,
+				     &pitch);
+    if (!pStub->driverPriv) {
+	xfree(pStub);
+	return NULL;
+    }
+    pPix->devKind = pitch;
+    modifyPixmapHeader(pPix, w, h, depth, bpp, pitch, NULL);
+
+    return pPix;
+}
+
+void
+stubPixmapDestroy(PixmapPtr pPix)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    void (*destroyPixmap) (ScreenPtr, void *) = pExa->DestroyPixmap;
+
+    destroyPixmap(pPix->drawable.pScreen, ((StubPixmapPtr) pPix)->driverPriv);
+    xfree(pPix);
+}
+
+/*
+ * Prepare access the way ExaDoPrepareAccess does: auxiliary indices
+ * only reach drivers that set EXA_SUPPORTS_PREPARE_AUX. For others EXA
+ * moves the pixmap out and fails, which with mixed pixmaps leaves it
+ * copying from memory that doesn't hold the pixmap. Tests see that as
+ * a failed map and a count in stubExaAuxErrors.
+ */
+
+unsigned long stubExaAuxErrors;
+
+static Bool
+stubPrepareAccess(PixmapPtr pPix, int index)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    Bool (*prepareAccess) (PixmapPtr, int) = pExa->PrepareAccess;
+
+    if (index > EXA_PREPARE_MASK &&
+	!(pExa->flags & EXA_SUPPORTS_PREPARE_AUX)) {
+	stubExaAuxErrors++;
+	return FALSE;
+    }
+
+    return prepareAccess(pPix, index);
+}
+
+/*
+ * Map a pixmap for the CPU, as EXA does around software fallbacks. If
+ * the driver refuses, the CPU gets a system memory copy, filled with
+ * DownloadFromScreen or, where that declines, by mapping the pixmap
+ * with EXA_PREPARE_AUX_SRC and copying, as exaCopyDirty does. EXA keeps
+ * the copy around and only transfers damaged regions; here it lives
+ * for one access.
+ */
+
+void *
+stubPixmapMap(PixmapPtr pPix, int index)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    StubPixmapPtr pStub = (StubPixmapPtr) pPix;
+    void (*finishAccess) (PixmapPtr, int) = pExa->FinishAccess;
+    Bool (*download) (PixmapPtr, int, int, int, int, char *, int) =
+	pExa->DownloadFromScreen;
+
+    if (stubPrepareAccess(pPix, index))
+	return pPix->devPrivate.ptr;
+
+    if (index > EXA_PREPARE_MASK || pStub->sysPtr)
+	return NULL;
+
+    pStub->sysPtr = xalloc(pPix->devKind * pPix->drawable.height);
+    if (!pStub->sysPtr)
+	return NULL;
+
+    if (!download(pPix, 0, 0, pPix->drawable.width, pPix->drawable.height,
+		  (char *)pStub->sysPtr, pPix->devKind)) {
+	if (!stubPrepareAccess(pPix, EXA_PREPARE_AUX_SRC)) {
+	    xfree(pStub->sysPtr);
+	    pStub->sysPtr = NULL;
+	    return NULL;
+	}
+	memcpy(pStub->sysPtr, pPix->devPrivate.ptr,
+	       pPix->devKind * pPix->drawable.height);
+	finishAccess(pPix, EXA_PREPARE_AUX_SRC);
+    }
+
+    pStub->sysIndex = index;
+    pPix->devPrivate.ptr = pStub->sysPtr;
+    return pStub->sysPtr;
+}
+
+/*
+ * Finish a CPU access. What the CPU wrote to a copy goes back with
+ * UploadToScreen or, where that declines, through EXA_PREPARE_AUX_DEST,
+ * as EXA migrates it back before the next accelerated operation.
+ */
+
+void
+stubPixmapUnmap(PixmapPtr pPix, int index)
+{
+    ScrnInfoPtr pScrn = xf86Screens[pPix->drawable.pScreen->myNum];
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    StubPixmapPtr pStub = (StubPixmapPtr) pPix;
+    void (*finishAccess) (PixmapPtr, int) = pExa->FinishAccess;
+    Bool (*upload) (PixmapPtr, int, int, int, int, char *, int) =
+	pExa->UploadToScreen;
+
+    finishAccess(pPix, index);
+    if (index > EXA_PREPARE_MASK || !pStub->sysPtr ||
+	pStub->sysIndex != index)
+	return;
+
+    if (index == EXA_PREPARE_DEST &&
+	!upload(pPix, 0, 0, pPix->drawable.width, pPix->drawable.height,
+		(char *)pStub->sysPtr, pPix->devKind)) {
+	if (stubPrepareAccess(pPix, EXA_PREPARE_AUX_DEST)) {
+	    memcpy(pPix->devPrivate.ptr, pStub->sysPtr,
+		   pPix->devKind * pPix->drawable.height);
+	    finishAccess(pPix, EXA_PREPARE_AUX_DEST);
+	}
+    }
+
+    xfree(pStub->sysPtr);
+    pStub->sysPtr = NULL;
+}
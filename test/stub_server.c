@@ -0,0 +1,183 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * The few X server entry points the tested driver code calls.
+ * Deliberately includes no server headers, so that it doesn't depend
+ * on the server version it is built against.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include "stub.h"
+
+int stubVerbose = -1;
+
+static unsigned stubTimeOffset;
+static uint64_t stubTimeHidden;
+
+void *
+Xalloc(unsigned long size)
+{
+    return malloc(size);
+}
+
+void *
+Xcalloc(unsigned long size)
+{
+    return calloc(1, size);
+}
+
+void *
+Xrealloc(void *ptr, unsigned long size)
+{
+    return realloc(ptr, size);
+}
+
+void
+Xfree(void *ptr)
+{
+    free(ptr);
+}
+
+static void
+stubVMsg(int verb, const char *format, va_list args)
+{
+    if (verb > stubVerbose)
+	return;
+
+    vfprintf(stderr, format, args);
+}
+
+void
+ErrorF(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    stubVMsg(0, format, args);
+    va_end(args);
+}
+
+void
+FatalError(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(1);
+}
+
+void
+LogMessageVerb(int type, int verb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    stubVMsg(verb, format, args);
+    va_end(args);
+}
+
+void
+xf86DrvMsgVerb(int scrnIndex, int type, int verb, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    stubVMsg(verb, format, args);
+    va_end(args);
+}
+
+void
+xf86DrvMsg(int scrnIndex, int type, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    stubVMsg(1, format, args);
+    va_end(args);
+}
+
+uint64_t
+stubUsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000 -
+	stubTimeHidden;
+}
+
+/*
+ * Take time the stubs spent doing work that stands in for the hardware
+ * off the clock, so that it isn't charged to the code under test.
+ */
+
+void
+stubTimeHide(uint64_t usec)
+{
+    stubTimeHidden += usec;
+}
+
+/*
+ * Busy-wait, to stand in for CPU work of a given length.
+ */
+
+void
+stubSpin(unsigned usec)
+{
+    uint64_t end = stubUsec() + usec;
+
+    while (stubUsec() < end) ;
+}
+
+/*
+ * Let the server clock jump ahead, for testing timeouts.
+ */
+
+void
+stubTimeAdvance(unsigned ms)
+{
+    stubTimeOffset += ms;
+}
+
+unsigned int
+GetTimeInMillis(void)
+{
+    return (unsigned int)(stubUsec() / 1000) + stubTimeOffset;
+}
@@ -0,0 +1,382 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * The X server, Xv and libXpsb entry points of the textured video code:
+ * enough of regions for clip lists, server timers that tests fire by
+ * hand, and a libXpsb that records what it is asked to draw instead of
+ * drawing it, while keeping its textures busy for as long as the 3D
+ * engine would.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <xf86.h>
+#include <xf86xv.h>
+#include <regionstr.h>
+#include "psb_driver.h"
+#include "Xpsb.h"
+#include "stub.h"
+
+StubXpsbBlit stubXpsbLog[STUB_XPSB_LOG];
+unsigned long stubXpsbBlits;
+unsigned long stubXpsbComposites;
+unsigned long stubXpsbUnlocked;
+unsigned long stubDamageCount;
+
+static unsigned stubXpsbBlitUsec;
+static uint64_t stubXpsbEngineFree;
+
+/*
+ * Regions. Only what the driver does with clip lists: they are built by
+ * the tests, moved, and emptied.
+ */
+
+static RegDataRec stubEmptyData = { 0, 0 };
+
+void
+miRegionInit(RegionPtr pReg, BoxPtr rect, int size)
+{
+    if (rect) {
+	pReg->extents = *rect;
+	pReg->data = NULL;
+    } else {
+	memset(&pReg->extents, 0, sizeof(pReg->extents));
+	pReg->data = &stubEmptyData;
+    }
+}
+
+void
+miRegionUninit(RegionPtr pReg)
+{
+    if (pReg->data && pReg->data->size)
+	free(pReg->data);
+    pReg->data = NULL;
+}
+
+void
+miRegionEmpty(RegionPtr pReg)
+{
+    miRegionUninit(pReg);
+    miRegionInit(pReg, NULL, 1);
+}
+
+void
+miTranslateRegion(RegionPtr pReg, int x, int y)
+{
+    BoxPtr pBox = REGION_RECTS(pReg);
+    int n = REGION_NUM_RECTS(pReg);
+
+    pReg->extents.x1 += x;
+    pReg->extents.x2 += x;
+    pReg->extents.y1 += y;
+    pReg->extents.y2 += y;
+    if (!pReg->data)
+	return;
+
+    while (n--) {
+	pBox->x1 += x;
+	pBox->x2 += x;
+	pBox->y1 += y;
+	pBox->y2 += y;
+	pBox++;
+    }
+}
+
+/*
+ * A region of the given boxes, which must be y-x banded the way the
+ * server keeps them.
+ */
+
+void
+stubRegionInit(RegionPtr pReg, const BoxRec * boxes, int num)
+{
+    int i;
+
+    if (num <= 1) {
+	miRegionInit(pReg, (BoxPtr) boxes, 1);
+	return;
+    }
+
+    pReg->data = malloc(sizeof(RegDataRec) + num * sizeof(BoxRec));
+    if (!pReg->data)
+	FatalError("Out of memory.\n");
+    pReg->data->size = num;
+    pReg->data->numRects = num;
+    memcpy(REGION_RECTS(pReg), boxes, num * sizeof(BoxRec));
+
+    pReg->extents = boxes[0];
+    for (i = 1; i < num; ++i) {
+	if (boxes[i].x1 < pReg->extents.x1)
+	    pReg->extents.x1 = boxes[i].x1;
+	if (boxes[i].y1 < pReg->extents.y1)
+	    pReg->extents.y1 = boxes[i].y1;
+	if (boxes[i].x2 > pReg->extents.x2)
+	    pReg->extents.x2 = boxes[i].x2;
+	if (boxes[i].y2 > pReg->extents.y2)
+	    pReg->extents.y2 = boxes[i].y2;
+    }
+}
+
+/*
+ * Timers. Nothing runs them behind the tests' back: stubTimersRun fires
+ * the ones that are due by GetTimeInMillis, which tests move on with
+ * stubTimeAdvance.
+ */
+
+struct _OsTimerRec
+{
+    OsTimerPtr next;
+    CARD32 expires;
+    OsTimerCallback callback;
+    pointer arg;
+    Bool armed;
+};
+
+static OsTimerPtr stubTimers;
+
+OsTimerPtr
+TimerSet(OsTimerPtr timer, int flags, CARD32 millis,
+	 OsTimerCallback func, pointer arg)
+{
+    if (!timer) {
+	timer = calloc(1, sizeof(*timer));
+	if (!timer)
+	    return NULL;
+	timer->next = stubTimers;
+	stubTimers = timer;
+    }
+
+    timer->callback = func;
+    timer->arg = arg;
+    timer->armed = (millis != 0);
+    timer->expires = (flags & TimerAbsolute) ? millis :
+	GetTimeInMillis() + millis;
+
+    return timer;
+}
+
+void
+TimerCancel(OsTimerPtr timer)
+{
+    if (timer)
+	timer->armed = FALSE;
+}
+
+void
+TimerFree(OsTimerPtr timer)
+{
+    OsTimerPtr *prev;
+
+    if (!timer)
+	return;
+
+    for (prev = &stubTimers; *prev; prev = &(*prev)->next) {
+	if (*prev == timer) {
+	    *prev = timer->next;
+	    break;
+	}
+    }
+    free(timer);
+}
+
+void
+stubTimersRun(void)
+{
+    CARD32 now = GetTimeInMillis();
+    OsTimerPtr timer;
+    CARD32 next;
+
+    for (timer = stubTimers; timer; timer = timer->next) {
+	if (!timer->armed || (int)(now - timer->expires) < 0)
+	    continue;
+
+	timer->armed = FALSE;
+	next = timer->callback(timer, now, timer->arg);
+	if (next) {
+	    timer->expires = now + next;
+	    timer->armed = TRUE;
+	}
+    }
+}
+
+int
+stubTimersPending(void)
+{
+    OsTimerPtr timer;
+    int num = 0;
+
+    for (timer = stubTimers; timer; timer = timer->next)
+	num += timer->armed;
+
+    return num;
+}
+
+/*
+ * Xv and dix.
+ */
+
+Atom
+MakeAtom(const char *string, unsigned len, Bool makeit)
+{
+    static Atom last;
+
+    return ++last;
+}
+
+/*
+ * Clips nothing. The tests only put video into destinations that their
+ * clip lists cover.
+ */
+
+Bool
+xf86XVClipVideoHelper(BoxPtr dst, INT32 * xa, INT32 * xb, INT32 * ya,
+		      INT32 * yb, RegionPtr reg, INT32 width, INT32 height)
+{
+    BoxPtr ext = REGION_EXTENTS(NULL, reg);
+
+    return REGION_NUM_RECTS(reg) > 0 &&
+	dst->x1 < ext->x2 && dst->x2 > ext->x1 &&
+	dst->y1 < ext->y2 && dst->y2 > ext->y1;
+}
+
+int
+xf86XVListGenericAdaptors(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr ** adaptors)
+{
+    *adaptors = NULL;
+    return 0;
+}
+
+Bool
+xf86XVScreenInit(ScreenPtr pScreen, XF86VideoAdaptorPtr * adaptors, int num)
+{
+    return TRUE;
+}
+
+void
+DamageDamageRegion(DrawablePtr pDrawable, RegionPtr pRegion)
+{
+    stubDamageCount++;
+}
+
+/*
+ * libXpsb. The YUV blits take the DRI lock themselves, the 3D composite
+ * calls expect their caller to hold it.
+ */
+
+/*
+ * Set the simulated 3D engine time of a YUV blit.
+ */
+
+void
+stubXpsbSetEngine(unsigned blitUsec)
+{
+    stubXpsbBlitUsec = blitUsec;
+}
+
+static void
+stubXpsbBlit(XpsbSurfacePtr dst, XpsbSurfacePtr textures[], int num,
+	     int detear)
+{
+    StubXpsbBlit *blit = &stubXpsbLog[stubXpsbBlits++ % STUB_XPSB_LOG];
+    uint64_t now = stubUsec();
+    int i;
+
+    blit->texture = textures[0]->buffer->handle;
+    blit->numTextures = num;
+    for (i = 0; i < num && i < 3; ++i) {
+	blit->offset[i] = textures[i]->offset;
+	blit->stride[i] = textures[i]->stride;
+    }
+    blit->x = dst->x;
+    blit->y = dst->y;
+    blit->w = dst->w;
+    blit->h = dst->h;
+    blit->detear = detear;
+
+    if (stubXpsbEngineFree < now)
+	stubXpsbEngineFree = now;
+    stubXpsbEngineFree += stubXpsbBlitUsec;
+    for (i = 0; i < num; ++i)
+	stubDrmBusyUntil(textures[i]->buffer->handle, stubXpsbEngineFree);
+}
+
+int
+psbBlitYUV(ScrnInfoPtr pScrn, XpsbSurfacePtr dst,
+	   XpsbSurfacePtr backTextures[], int numBackTextures,
+	   Bool isPlanar, unsigned int planarID, float texCoord0[],
+	   float texCoord1[], float texCoord2[], int numCoord,
+	   float conversion_data[])
+{
+    stubXpsbBlit(dst, backTextures, numBackTextures, FALSE);
+    return 0;
+}
+
+int
+psbBlitYUVDetear(ScrnInfoPtr pScrn, XpsbSurfacePtr dst,
+		 XpsbSurfacePtr backTextures[], int numBackTextures,
+		 Bool isPlanar, unsigned int planarID, float texCoord0[],
+		 float texCoord1[], float texCoord2[], int numCoord,
+		 float conversion_data[])
+{
+    stubXpsbBlit(dst, backTextures, numBackTextures, TRUE);
+    return 0;
+}
+
+int
+psb3DPrepareComposite(ScrnInfoPtr pScrn, XpsbSurfacePtr dst,
+		      XpsbSurfacePtr opTextures[], int numOpTextures,
+		      int compOp, unsigned int scalar, Bool scalarSrc,
+		      Bool scalarMask)
+{
+    stubXpsbComposites++;
+    if (!stubDRILocked)
+	stubXpsbUnlocked++;
+    return TRUE;
+}
+
+void
+psb3DCompositeQuad(ScrnInfoPtr pScrn, float vertices[])
+{
+    if (!stubDRILocked)
+	stubXpsbUnlocked++;
+}
+
+int
+psb3DCompositeFinish(ScrnInfoPtr pScrn)
+{
+    if (!stubDRILocked)
+	stubXpsbUnlocked++;
+    return 0;
+}
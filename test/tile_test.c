@@ -0,0 +1,328 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Tiled fills: EXA fills with a tile by copying it once per tile
+ * instance. Copies from a small power-of-two tile must come out right
+ * whatever the tile origin and ROP, and must be merged into far fewer
+ * pattern blits than there are tile instances. Other tiles take the
+ * plain copy path, and so do copies from a small tile that don't
+ * repeat it.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "stub.h"
+
+#define TEST_W 200
+#define TEST_H 100
+
+typedef Bool (*TestPrepareCopyProc) (PixmapPtr, PixmapPtr, int, int, int,
+				     Pixel);
+typedef void (*TestCopyProc) (PixmapPtr, int, int, int, int, int, int);
+typedef void (*TestDoneProc) (PixmapPtr);
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static CARD32
+testTilePixel(int x, int y)
+{
+    return 0x00100000 + (y << 8) + x;
+}
+
+static CARD32
+testDstPixel(int x, int y)
+{
+    return 0x00A00000 ^ ((y << 10) + x);
+}
+
+static void
+testFill(PixmapPtr pPix, CARD32(*pixel) (int, int))
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_DEST);
+    int x, y;
+
+    CHECK(base != NULL);
+    if (!base)
+	return;
+
+    for (y = 0; y < pPix->drawable.height; ++y)
+	for (x = 0; x < pPix->drawable.width; ++x)
+	    ((CARD32 *) (base + y * pPix->devKind))[x] = pixel(x, y);
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_DEST);
+}
+
+/*
+ * Fill a box of pDst with pTile the way exaFillRegionTiled does: row by
+ * row of tile instances, each clipped to the box, with the tile origin
+ * at (xOrg, yOrg).
+ */
+
+static Bool
+testTileBox(ScrnInfoPtr pScrn, PixmapPtr pTile, PixmapPtr pDst, int alu,
+	    BoxPtr box, int xOrg, int yOrg)
+{
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCopyProc prepareCopy = pExa->PrepareCopy;
+    TestCopyProc copy = pExa->Copy;
+    TestDoneProc doneCopy = pExa->DoneCopy;
+    int tileW = pTile->drawable.width;
+    int tileH = pTile->drawable.height;
+    int dstX, dstY, tileX, tileY, w, h;
+
+    if (!prepareCopy(pTile, pDst, 1, 1, alu, ~0))
+	return FALSE;
+
+    for (dstY = box->y1; dstY < box->y2; dstY += h) {
+	tileY = ((dstY - yOrg) % tileH + tileH) % tileH;
+	h = tileH - tileY;
+	if (h > box->y2 - dstY)
+	    h = box->y2 - dstY;
+	for (dstX = box->x1; dstX < box->x2; dstX += w) {
+	    tileX = ((dstX - xOrg) % tileW + tileW) % tileW;
+	    w = tileW - tileX;
+	    if (w > box->x2 - dstX)
+		w = box->x2 - dstX;
+	    copy(pDst, tileX, tileY, dstX, dstY, w, h);
+	}
+    }
+
+    doneCopy(pDst);
+    return TRUE;
+}
+
+static CARD32
+testApply(int alu, CARD32 src, CARD32 dst)
+{
+    switch (alu) {
+    case GXxor:
+	return src ^ dst;
+    case GXand:
+	return src & dst;
+    default:
+	return src;
+    }
+}
+
+static void
+testTile(ScrnInfoPtr pScrn, int tileW, int tileH, int alu, Bool pattern)
+{
+    static const BoxRec boxes[] = {
+	{0, 0, TEST_W, TEST_H},
+	{3, 5, 77, 61},
+	{101, 13, 199, 14},
+    };
+    static const int origins[][2] = {
+	{0, 0}, {5, 3}, {-7, 11},
+    };
+    PixmapPtr pTile, pDst;
+    CARD8 *base;
+    int b, x, y, tx, ty, bad = 0, instances = 0;
+    CARD32 expect;
+
+    pTile = stubPixmapCreate(pScrn, tileW, tileH, 24, 32);
+    pDst = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+    CHECK(pTile && pDst);
+    if (!pTile || !pDst)
+	return;
+
+    testFill(pTile, testTilePixel);
+    testFill(pDst, testDstPixel);
+
+    stubDrmResetStats();
+    for (b = 0; b < sizeof(boxes) / sizeof(boxes[0]); ++b) {
+	CHECK(testTileBox(pScrn, pTile, pDst, alu, (BoxPtr) & boxes[b],
+			  origins[b][0], origins[b][1]));
+	instances += ((boxes[b].x2 - boxes[b].x1) / tileW + 1) *
+	    ((boxes[b].y2 - boxes[b].y1) / tileH + 1);
+    }
+    psbAccelFlush(pScrn);
+
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+    CHECK(stubDrmStats.hazards == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+    if (pattern)
+	CHECK(stubDrmStats.dwords < instances);
+    else
+	CHECK(stubDrmStats.dwords > instances);
+    CHECK((stubDrmStats.patternBlits != 0) == pattern);
+
+    base = stubPixmapMap(pDst, EXA_PREPARE_SRC);
+    CHECK(base != NULL);
+    if (!base)
+	goto out;
+
+    for (y = 0; y < TEST_H; ++y) {
+	for (x = 0; x < TEST_W; ++x) {
+	    expect = testDstPixel(x, y);
+	    for (b = 0; b < sizeof(boxes) / sizeof(boxes[0]); ++b) {
+		if (x < boxes[b].x1 || x >= boxes[b].x2 ||
+		    y < boxes[b].y1 || y >= boxes[b].y2)
+		    continue;
+		tx = ((x - origins[b][0]) % tileW + tileW) % tileW;
+		ty = ((y - origins[b][1]) % tileH + tileH) % tileH;
+		expect = testApply(alu, testTilePixel(tx, ty), expect);
+	    }
+	    if (((CARD32 *) (base + y * pDst->devKind))[x] != expect)
+		bad++;
+	}
+    }
+    stubPixmapUnmap(pDst, EXA_PREPARE_SRC);
+
+    if (bad)
+	fprintf(stderr, "%dx%d tile, alu %d: %d wrong pixels.\n", tileW,
+		tileH, alu, bad);
+    CHECK(bad == 0);
+  out:
+    stubPixmapDestroy(pTile);
+    stubPixmapDestroy(pDst);
+}
+
+/*
+ * Copies of a whole tile, of part of it, and of two boxes next to each
+ * other that don't continue a tiling.
+ */
+
+static void
+testNoRepeat(ScrnInfoPtr pScrn)
+{
+    static const int copies[][6] = {
+	{0, 0, 10, 10, 8, 8},
+	{2, 1, 50, 40, 3, 5},
+	{0, 0, 100, 60, 4, 8},
+	{0, 0, 104, 60, 4, 8},
+    };
+    ExaDriverPtr pExa = psbPTR(pScrn)->pPsbExa->pExa;
+    TestPrepareCopyProc prepareCopy = pExa->PrepareCopy;
+    TestCopyProc copy = pExa->Copy;
+    TestDoneProc doneCopy = pExa->DoneCopy;
+    PixmapPtr pTile, pDst;
+    CARD8 *base;
+    int c, x, y, bad = 0;
+    const int *cp;
+    CARD32 expect;
+
+    pTile = stubPixmapCreate(pScrn, 8, 8, 24, 32);
+    pDst = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+    CHECK(pTile && pDst);
+    if (!pTile || !pDst)
+	return;
+
+    testFill(pTile, testTilePixel);
+    testFill(pDst, testDstPixel);
+
+    stubDrmResetStats();
+    CHECK(prepareCopy(pTile, pDst, 1, 1, GXcopy, ~0));
+    for (c = 0; c < sizeof(copies) / sizeof(copies[0]); ++c) {
+	cp = copies[c];
+	copy(pDst, cp[0], cp[1], cp[2], cp[3], cp[4], cp[5]);
+    }
+    doneCopy(pDst);
+    psbAccelFlush(pScrn);
+
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+    CHECK(stubDrmStats.hazards == 0);
+    CHECK(stubDrmStats.patternBlits == 0);
+
+    base = stubPixmapMap(pDst, EXA_PREPARE_SRC);
+    CHECK(base != NULL);
+    if (!base)
+	goto out;
+
+    for (y = 0; y < TEST_H; ++y) {
+	for (x = 0; x < TEST_W; ++x) {
+	    expect = testDstPixel(x, y);
+	    for (c = 0; c < sizeof(copies) / sizeof(copies[0]); ++c) {
+		cp = copies[c];
+		if (x >= cp[2] && x < cp[2] + cp[4] &&
+		    y >= cp[3] && y < cp[3] + cp[5])
+		    expect = testTilePixel(x - cp[2] + cp[0],
+					   y - cp[3] + cp[1]);
+	    }
+	    if (((CARD32 *) (base + y * pDst->devKind))[x] != expect)
+		bad++;
+	}
+    }
+    stubPixmapUnmap(pDst, EXA_PREPARE_SRC);
+    CHECK(bad == 0);
+  out:
+    stubPixmapDestroy(pTile);
+    stubPixmapDestroy(pDst);
+}
+
+int
+main(int argc, char **argv)
+{
+    ScrnInfoPtr pScrn;
+    PsbExaPtr pPsbExa;
+    int b;
+
+    pScrn = stubScreenCreate();
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    pPsbExa = psbPTR(pScrn)->pPsbExa;
+    for (b = 0; b < PSB_CAL_NUM_BPP; ++b) {
+	pPsbExa->minPixels[PSB_CAL_SOLID][b] = 0;
+	pPsbExa->minPixels[PSB_CAL_COPY][b] = 0;
+    }
+
+    testTile(pScrn, 8, 8, GXcopy, TRUE);
+    testTile(pScrn, 16, 4, GXcopy, TRUE);
+    testTile(pScrn, 1, 2, GXxor, TRUE);
+    testTile(pScrn, 4, 16, GXand, TRUE);
+    testTile(pScrn, 6, 6, GXcopy, FALSE);
+    testTile(pScrn, 32, 8, GXxor, FALSE);
+    testNoRepeat(pScrn);
+
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}
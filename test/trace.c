@@ -0,0 +1,398 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Reading, decoding and replaying 2D command stream traces.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <psb_reg.h>
+#include "trace.h"
+#include "stub.h"
+
+static const char *traceOpNames[16] = {
+    "CLIP", "PAT", "CTRL", "SRC_OFF", "MASK_OFF", "RESERVED1", "RESERVED2",
+    "FENCE", "BLIT", "SRC_SURF", "DST_SURF", "PAT_SURF", "SRC_PAL",
+    "PAT_PAL", "MASK_SURF", "FLUSH"
+};
+
+static const char *traceBlitNames[TRACE_BLIT_KINDS] = {
+    "fill", "copy", "pattern", "alpha"
+};
+
+int
+traceOpen(TraceFilePtr tf, const char *name)
+{
+    PsbTraceHeaderRec header;
+
+    memset(tf, 0, sizeof(*tf));
+    tf->name = name;
+    tf->f = fopen(name, "r");
+    if (!tf->f) {
+	perror(name);
+	return -1;
+    }
+
+    if (fread(&header, sizeof(header), 1, tf->f) != 1 ||
+	header.magic != PSB_TRACE_MAGIC) {
+	fprintf(stderr, "%s: Not a 2D trace.\n", name);
+	goto out_err;
+    }
+    if (header.version != PSB_TRACE_VERSION ||
+	header.relocSize != sizeof(struct drm_psb_reloc)) {
+	fprintf(stderr, "%s: Unsupported trace version %u, relocation "
+		"size %u.\n", name, header.version, header.relocSize);
+	goto out_err;
+    }
+
+    return 0;
+
+  out_err:
+    fclose(tf->f);
+    tf->f = NULL;
+    return -1;
+}
+
+static int
+traceGrow(void **ptr, unsigned *max, unsigned num, size_t size)
+{
+    void *tmp;
+
+    if (num <= *max)
+	return 0;
+
+    tmp = realloc(*ptr, (size_t) num * size);
+    if (!tmp)
+	return -1;
+
+    *ptr = tmp;
+    *max = num;
+    return 0;
+}
+
+/*
+ * Read the next submission. Returns 1 and points sub at it, 0 at the
+ * end of the trace, -1 on a read error or a damaged record. The
+ * submission stays valid until the next call.
+ */
+
+int
+traceNext(TraceFilePtr tf, TraceSubmissionPtr * sub)
+{
+    TraceSubmissionRec *cur = &tf->cur;
+    PsbTraceSubmissionRec *s = &cur->sub;
+    unsigned i;
+
+    if (fread(s, sizeof(*s), 1, tf->f) != 1) {
+	if (feof(tf->f))
+	    return 0;
+	goto out_err;
+    }
+
+    if (traceGrow((void **)&cur->dwords, &tf->maxDwords, s->numDwords,
+		  sizeof(*cur->dwords)) ||
+	traceGrow((void **)&cur->relocs, &tf->maxRelocs, s->numRelocs,
+		  sizeof(*cur->relocs)) ||
+	traceGrow((void **)&cur->buffers, &tf->maxBuffers, s->numBuffers,
+		  sizeof(*cur->buffers)) ||
+	traceGrow((void **)&cur->relocAt, &tf->maxRelocAt, s->numDwords,
+		  sizeof(*cur->relocAt))) {
+	fprintf(stderr, "%s: Out of memory.\n", tf->name);
+	return -1;
+    }
+
+    if (fread(cur->dwords, sizeof(*cur->dwords), s->numDwords,
+	      tf->f) != s->numDwords ||
+	fread(cur->relocs, sizeof(*cur->relocs), s->numRelocs,
+	      tf->f) != s->numRelocs ||
+	fread(cur->buffers, sizeof(*cur->buffers), s->numBuffers,
+	      tf->f) != s->numBuffers ||
+	fseek(tf->f, (long)s->numClipRects * sizeof(drm_clip_rect_t),
+	      SEEK_CUR))
+	goto out_err;
+
+    for (i = 0; i < s->numDwords; ++i)
+	cur->relocAt[i] = -1;
+    for (i = 0; i < s->numRelocs; ++i) {
+	if (cur->relocs[i].where >= s->numDwords)
+	    goto out_err;
+	cur->relocAt[cur->relocs[i].where] = i;
+    }
+
+    *sub = cur;
+    return 1;
+
+  out_err:
+    fprintf(stderr, "%s: Truncated or damaged trace.\n", tf->name);
+    return -1;
+}
+
+void
+traceClose(TraceFilePtr tf)
+{
+    if (tf->f)
+	fclose(tf->f);
+    free(tf->cur.dwords);
+    free(tf->cur.relocs);
+    free(tf->cur.buffers);
+    free(tf->cur.relocAt);
+    memset(tf, 0, sizeof(*tf));
+}
+
+static const struct drm_psb_reloc *
+traceRelocAt(const TraceSubmissionRec * sub, unsigned where)
+{
+    int index = sub->relocAt[where];
+
+    return (index < 0) ? NULL : &sub->relocs[index];
+}
+
+/*
+ * Gather statistics for a submission and, if dump is not NULL, print it
+ * one command per line. Relocated dwords are printed as the buffer and
+ * offset they refer to rather than as addresses, so dumps of different
+ * runs can be compared with diff.
+ */
+
+void
+traceDecode(const TraceSubmissionRec * sub, TraceStatsPtr stats, FILE * dump)
+{
+    const uint32_t *dwords = sub->dwords;
+    const struct drm_psb_reloc *reloc;
+    unsigned numDwords = sub->sub.numDwords;
+    unsigned i, j, len, op, w, h;
+    TraceBlitKind kind;
+    uint32_t cmd, xy, size, rop;
+
+    if (dump) {
+	fprintf(dump, "submission %lu: %u dwords, %u relocs, %u buffers, "
+		"fence flags 0x%x\n", stats->submissions, numDwords,
+		sub->sub.numRelocs, sub->sub.numBuffers, sub->sub.fenceFlags);
+	for (i = 0; i < sub->sub.numBuffers; ++i)
+	    fprintf(dump, "  buffer %u: flags 0x%08llx mask 0x%08llx\n", i,
+		    (unsigned long long)sub->buffers[i].flags,
+		    (unsigned long long)sub->buffers[i].mask);
+    }
+
+    stats->submissions++;
+    stats->dwords += numDwords;
+    stats->relocs += sub->sub.numRelocs;
+    stats->buffers += sub->sub.numBuffers;
+
+    for (i = 0; i < numDwords; i += len) {
+	cmd = dwords[i];
+	op = TRACE_OP(cmd);
+	len = stub2DLength(dwords + i, numDwords - i);
+	if (!len) {
+	    if (dump)
+		fprintf(dump, "  %04x: %08x %s: can't decode the rest\n", i,
+			cmd, traceOpNames[op]);
+	    stats->badStreams++;
+	    break;
+	}
+
+	stats->opCount[op]++;
+	stats->opDwords[op] += len;
+
+	if (op == TRACE_OP(PSB_2D_BLIT_BH)) {
+	    /*
+	     * The driver sets USE_FILL on copies too, so tell them apart
+	     * by whether the ROP depends on the source.
+	     */
+
+	    rop = (cmd & PSB_2D_ROP3A_MASK) >> PSB_2D_ROP3A_SHIFT;
+	    if (cmd & PSB_2D_ALPHA_ENABLE)
+		kind = TRACE_BLIT_ALPHA;
+	    else if (((rop >> 2) ^ rop) & 0x33)
+		kind = TRACE_BLIT_COPY;
+	    else if (cmd & PSB_2D_USE_PAT)
+		kind = TRACE_BLIT_PATTERN;
+	    else
+		kind = TRACE_BLIT_FILL;
+
+	    xy = dwords[i + len - 2];
+	    size = dwords[i + len - 1];
+	    w = (size & PSB_2D_DST_XSIZE_MASK) >> PSB_2D_DST_XSIZE_SHIFT;
+	    h = (size & PSB_2D_DST_YSIZE_MASK) >> PSB_2D_DST_YSIZE_SHIFT;
+	    stats->blits[kind]++;
+	    stats->blitPixels[kind] += w * h;
+
+	    if (dump)
+		fprintf(dump, "  %04x: %08x BLIT %s %u,%u %ux%u\n", i, cmd,
+			traceBlitNames[kind],
+			(xy & PSB_2D_DST_XSTART_MASK) >>
+			PSB_2D_DST_XSTART_SHIFT,
+			(xy & PSB_2D_DST_YSTART_MASK) >>
+			PSB_2D_DST_YSTART_SHIFT, w, h);
+	    continue;
+	}
+
+	if (!dump)
+	    continue;
+
+	fprintf(dump, "  %04x: %08x %s\n", i, cmd, traceOpNames[op]);
+	for (j = 1; j < len; ++j) {
+	    reloc = traceRelocAt(sub, i + j);
+	    if (reloc)
+		fprintf(dump, "  %04x: reloc buffer %u + 0x%x\n", i + j,
+			reloc->buffer, reloc->pre_add);
+	    else
+		fprintf(dump, "  %04x: %08x\n", i + j, dwords[i + j]);
+	}
+    }
+}
+
+void
+tracePrintStats(const TraceStatsRec * stats, FILE * out)
+{
+    unsigned i;
+
+    fprintf(out, "%lu submissions, %llu dwords, %llu relocations, "
+	    "%llu validate list entries.\n", stats->submissions,
+	    stats->dwords, stats->relocs, stats->buffers);
+    if (stats->submissions)
+	fprintf(out, "Per submission: %.1f dwords, %.1f relocations, "
+		"%.1f buffers.\n",
+		(double)stats->dwords / stats->submissions,
+		(double)stats->relocs / stats->submissions,
+		(double)stats->buffers / stats->submissions);
+    if (stats->badStreams)
+	fprintf(out, "%lu submissions with commands that could not be "
+		"decoded.\n", stats->badStreams);
+
+    fprintf(out, "\n%-10s %12s %12s\n", "command", "count", "dwords");
+    for (i = 0; i < 16; ++i)
+	if (stats->opCount[i])
+	    fprintf(out, "%-10s %12llu %12llu\n", traceOpNames[i],
+		    stats->opCount[i], stats->opDwords[i]);
+
+    fprintf(out, "\n%-10s %12s %12s\n", "blit", "count", "pixels");
+    for (i = 0; i < TRACE_BLIT_KINDS; ++i)
+	if (stats->blits[i])
+	    fprintf(out, "%-10s %12llu %12llu\n", traceBlitNames[i],
+		    stats->blits[i], stats->blitPixels[i]);
+}
+
+/*
+ * Replay. Every buffer handle in the trace gets a buffer object of its
+ * own, and each submission is rebuilt with the driver's own relocation
+ * and validate list code and flushed with psbFlush2D.
+ */
+
+#define TRACE_BO_SIZE 4096
+
+void
+traceReplayInit(TraceReplayPtr rp, int fd)
+{
+    memset(rp, 0, sizeof(*rp));
+    rp->fd = fd;
+}
+
+static drmBO *
+traceReplayBO(TraceReplayPtr rp, uint32_t handle)
+{
+    unsigned i;
+
+    for (i = 0; i < rp->numBOs; ++i)
+	if (rp->handles[i] == handle)
+	    return &rp->bos[i];
+
+    if (rp->numBOs == TRACE_MAX_BOS ||
+	drmBOCreate(rp->fd, TRACE_BO_SIZE, 0, NULL, DRM_BO_FLAG_MEM_TT |
+		    DRM_BO_FLAG_READ | DRM_BO_FLAG_WRITE, 0,
+		    &rp->bos[rp->numBOs]))
+	return NULL;
+
+    rp->handles[rp->numBOs] = handle;
+    return &rp->bos[rp->numBOs++];
+}
+
+int
+traceReplay(TraceReplayPtr rp, Psb2DBufferPtr cb,
+	    const TraceSubmissionRec * sub)
+{
+    const struct drm_psb_reloc *reloc;
+    const PsbTraceBufferRec *tb;
+    unsigned numDwords = sub->sub.numDwords;
+    unsigned i;
+    drmBO *bo;
+    int ret;
+
+    if (PSB_2D_PENDING(cb) ||
+	cb->startCmd + numDwords >= (unsigned *)cb->startReloc ||
+	sub->sub.numRelocs >= cb->maxRelocs) {
+	fprintf(stderr, "Submission of %u dwords, %u relocations doesn't "
+		"fit a command buffer.\n", numDwords, sub->sub.numRelocs);
+	return -EINVAL;
+    }
+
+    for (i = 0; i < numDwords; ++i) {
+	reloc = traceRelocAt(sub, i);
+	if (!reloc) {
+	    *cb->curCmd++ = sub->dwords[i];
+	    continue;
+	}
+
+	if (reloc->buffer >= sub->sub.numBuffers) {
+	    fprintf(stderr, "Relocation against buffer %u of %u.\n",
+		    reloc->buffer, sub->sub.numBuffers);
+	    return -EINVAL;
+	}
+	tb = &sub->buffers[reloc->buffer];
+	bo = traceReplayBO(rp, tb->handle);
+	if (!bo)
+	    return -ENOMEM;
+
+	ret = psbRelocOffset2D(cb, reloc->pre_add, bo, tb->flags, tb->mask);
+	if (ret)
+	    return ret;
+    }
+
+    if (cb->bufferList.numOnList != sub->sub.numBuffers)
+	rp->mismatches++;
+
+    return psbFlush2D(cb, sub->sub.fenceFlags, NULL);
+}
+
+void
+traceReplayFini(TraceReplayPtr rp)
+{
+    unsigned i;
+
+    for (i = 0; i < rp->numBOs; ++i)
+	drmBOUnreference(rp->fd, &rp->bos[i]);
+    rp->numBOs = 0;
+}
@@ -0,0 +1,114 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Reading, decoding and replaying the 2D command stream traces written
+ * with the Exa2DTrace option. See psb_ioctl.h for the file format.
+ */
+
+#ifndef _PSB_TRACE_H_
+#define _PSB_TRACE_H_
+
+#include <stdio.h>
+#include "psb_driver.h"
+
+typedef struct _TraceSubmission
+{
+    PsbTraceSubmissionRec sub;
+    uint32_t *dwords;
+    struct drm_psb_reloc *relocs;
+    PsbTraceBufferRec *buffers;
+    int *relocAt;		       /* reloc index for each dword, or -1 */
+} TraceSubmissionRec, *TraceSubmissionPtr;
+
+typedef struct _TraceFile
+{
+    FILE *f;
+    const char *name;
+    TraceSubmissionRec cur;
+    unsigned maxDwords;
+    unsigned maxRelocAt;
+    unsigned maxRelocs;
+    unsigned maxBuffers;
+} TraceFileRec, *TraceFilePtr;
+
+/*
+ * Command opcode, the index into TraceStatsRec::opCount.
+ */
+
+#define TRACE_OP(_bh) ((uint32_t) (_bh) >> 28)
+
+typedef enum
+{
+    TRACE_BLIT_FILL = 0,
+    TRACE_BLIT_COPY,
+    TRACE_BLIT_PATTERN,
+    TRACE_BLIT_ALPHA,
+    TRACE_BLIT_KINDS
+} TraceBlitKind;
+
+typedef struct _TraceStats
+{
+    unsigned long submissions;
+    unsigned long long dwords;
+    unsigned long long relocs;
+    unsigned long long buffers;
+    unsigned long long opCount[16];
+    unsigned long long opDwords[16];
+    unsigned long long blits[TRACE_BLIT_KINDS];
+    unsigned long long blitPixels[TRACE_BLIT_KINDS];
+    unsigned long badStreams;	       /* submissions with unknown commands */
+} TraceStatsRec, *TraceStatsPtr;
+
+#define TRACE_MAX_BOS 256
+
+typedef struct _TraceReplay
+{
+    int fd;
+    unsigned numBOs;
+    uint32_t handles[TRACE_MAX_BOS];
+    drmBO bos[TRACE_MAX_BOS];
+    unsigned long mismatches;	       /* validate lists that came out different */
+} TraceReplayRec, *TraceReplayPtr;
+
+extern int traceOpen(TraceFilePtr tf, const char *name);
+extern int traceNext(TraceFilePtr tf, TraceSubmissionPtr * sub);
+extern void traceClose(TraceFilePtr tf);
+
+extern void traceDecode(const TraceSubmissionRec * sub, TraceStatsPtr stats,
+			FILE * dump);
+extern void tracePrintStats(const TraceStatsRec * stats, FILE * out);
+
+extern void traceReplayInit(TraceReplayPtr rp, int fd);
+extern int traceReplay(TraceReplayPtr rp, Psb2DBufferPtr cb,
+		       const TraceSubmissionRec * sub);
+extern void traceReplayFini(TraceReplayPtr rp);
+
+#endif
@@ -0,0 +1,293 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * 2D command stream traces: what psbFlush2D writes with tracing on must
+ * decode to the commands that were emitted, and replaying it must
+ * rebuild the same submissions.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <psb_reg.h>
+#include "trace.h"
+#include "stub.h"
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+#define TEST_STRIDE 1024
+
+static drmBO srcBuf, dstBuf;
+
+static int
+testSurface(Psb2DBufferPtr ptrCb, uint32_t bh, drmBO * bo, unsigned offset)
+{
+    int ret;
+
+    PSB_SUPER_2D_VARS(ptrCb);
+    PSB_SUPER_2D_OUT(bh | PSB_2D_DST_8888ARGB |
+		     ((TEST_STRIDE << PSB_2D_DST_STRIDE_SHIFT) &
+		      PSB_2D_DST_STRIDE_MASK));
+    PSB_SUPER_2D_RELOC_OFFSET(offset, bo, DRM_BO_FLAG_MEM_TT,
+			      DRM_BO_MASK_MEM);
+    PSB_SUPER_2D_DONE(ret);
+
+    return ret;
+}
+
+static void
+testBlit(Psb2DBufferPtr cb, uint32_t rop, int x, int y, int w, int h)
+{
+    *cb->curCmd++ = PSB_2D_BLIT_BH | PSB_2D_ROT_NONE |
+	PSB_2D_COPYORDER_TL2BR | PSB_2D_DSTCK_DISABLE |
+	PSB_2D_SRCCK_DISABLE | PSB_2D_USE_FILL | rop;
+    *cb->curCmd++ = 0xFF00FF00;
+    *cb->curCmd++ = ((x << PSB_2D_DST_XSTART_SHIFT) & PSB_2D_DST_XSTART_MASK)
+	| ((y << PSB_2D_DST_YSTART_SHIFT) & PSB_2D_DST_YSTART_MASK);
+    *cb->curCmd++ = ((w << PSB_2D_DST_XSIZE_SHIFT) & PSB_2D_DST_XSIZE_MASK) |
+	((h << PSB_2D_DST_YSIZE_SHIFT) & PSB_2D_DST_YSIZE_MASK);
+}
+
+/*
+ * Three submissions: two fills, a copy between buffers, and a copy
+ * within one buffer.
+ */
+
+static void
+testRecord(const char *name)
+{
+    Psb2DBufferRec cb;
+
+    memset(&cb, 0, sizeof(cb));
+    CHECK(psbInit2DBuffer(0, &cb, 2));
+    CHECK(psbTrace2DOpen(&cb, name));
+
+    CHECK(!testSurface(&cb, PSB_2D_DST_SURF_BH, &dstBuf, 0));
+    testBlit(&cb, PSB_2D_ROP3_PATCOPY, 0, 0, 16, 16);
+    testBlit(&cb, PSB_2D_ROP3_PATCOPY, 16, 0, 8, 4);
+    CHECK(!psbFlush2D(&cb, 0, NULL));
+
+    CHECK(!testSurface(&cb, PSB_2D_SRC_SURF_BH, &srcBuf, 4096));
+    CHECK(!testSurface(&cb, PSB_2D_DST_SURF_BH, &dstBuf, 0));
+    testBlit(&cb, PSB_2D_ROP3_SRCCOPY, 0, 16, 32, 2);
+    CHECK(!psbFlush2D(&cb, DRM_FENCE_FLAG_NO_USER, NULL));
+
+    CHECK(!testSurface(&cb, PSB_2D_SRC_SURF_BH, &dstBuf, 0));
+    CHECK(!testSurface(&cb, PSB_2D_DST_SURF_BH, &dstBuf, 0));
+    testBlit(&cb, PSB_2D_ROP3_SRCCOPY, 4, 4, 4, 4);
+    CHECK(!psbFlush2D(&cb, 0, NULL));
+
+    psbTakedown2DBuffer(0, &cb);
+}
+
+static void
+testDecode(const char *name)
+{
+    TraceFileRec tf;
+    TraceSubmissionPtr sub;
+    TraceStatsRec stats;
+
+    memset(&stats, 0, sizeof(stats));
+    CHECK(!traceOpen(&tf, name));
+    while (traceNext(&tf, &sub) > 0)
+	traceDecode(sub, &stats, NULL);
+    traceClose(&tf);
+
+    CHECK(stats.submissions == 3);
+    CHECK(stats.dwords == 2 + 8 + 4 + 4 + 4 + 4);
+    CHECK(stats.relocs == 5);
+    CHECK(stats.buffers == 2 + 3 + 2);
+    CHECK(stats.badStreams == 0);
+    CHECK(stats.opCount[TRACE_OP(PSB_2D_BLIT_BH)] == 4);
+    CHECK(stats.opCount[TRACE_OP(PSB_2D_DST_SURF_BH)] == 3);
+    CHECK(stats.opCount[TRACE_OP(PSB_2D_SRC_SURF_BH)] == 2);
+    CHECK(stats.blits[TRACE_BLIT_FILL] == 2);
+    CHECK(stats.blitPixels[TRACE_BLIT_FILL] == 16 * 16 + 8 * 4);
+    CHECK(stats.blits[TRACE_BLIT_COPY] == 2);
+    CHECK(stats.blitPixels[TRACE_BLIT_COPY] == 32 * 2 + 4 * 4);
+}
+
+/*
+ * Replay with tracing on, and compare the two traces. Buffer handles and
+ * the relocated addresses differ; everything else must match.
+ */
+
+static void
+testReplay(const char *name, const char *replayName)
+{
+    TraceFileRec tf, rf;
+    TraceSubmissionPtr sub, rsub;
+    TraceReplayRec rp;
+    Psb2DBufferRec cb;
+    unsigned i, count = 0;
+    int ret;
+
+    memset(&cb, 0, sizeof(cb));
+    CHECK(psbInit2DBuffer(0, &cb, 1));
+    CHECK(psbTrace2DOpen(&cb, replayName));
+    traceReplayInit(&rp, 0);
+    stubDrmResetStats();
+
+    CHECK(!traceOpen(&tf, name));
+    while ((ret = traceNext(&tf, &sub)) > 0)
+	CHECK(!traceReplay(&rp, &cb, sub));
+    CHECK(ret == 0);
+    traceClose(&tf);
+
+    CHECK(rp.numBOs == 2);
+    CHECK(rp.mismatches == 0);
+    CHECK(stubDrmStats.submits == 3);
+    CHECK(stubDrmStats.relocErrors == 0);
+    CHECK(stubDrmStats.validateErrors == 0);
+    CHECK(stubDrmStats.unhandled == 0);
+    psbTakedown2DBuffer(0, &cb);
+    traceReplayFini(&rp);
+
+    CHECK(!traceOpen(&tf, name));
+    CHECK(!traceOpen(&rf, replayName));
+    while (traceNext(&tf, &sub) > 0) {
+	if (traceNext(&rf, &rsub) <= 0) {
+	    CHECK(!"replay trace too short");
+	    break;
+	}
+	count++;
+	CHECK(sub->sub.numDwords == rsub->sub.numDwords);
+	CHECK(sub->sub.numRelocs == rsub->sub.numRelocs);
+	CHECK(sub->sub.numBuffers == rsub->sub.numBuffers);
+	CHECK(sub->sub.fenceFlags == rsub->sub.fenceFlags);
+	if (sub->sub.numDwords != rsub->sub.numDwords ||
+	    sub->sub.numRelocs != rsub->sub.numRelocs ||
+	    sub->sub.numBuffers != rsub->sub.numBuffers)
+	    continue;
+	for (i = 0; i < sub->sub.numDwords; ++i)
+	    CHECK(sub->relocAt[i] >= 0 || sub->dwords[i] == rsub->dwords[i]);
+	for (i = 0; i < sub->sub.numRelocs; ++i) {
+	    CHECK(sub->relocs[i].where == rsub->relocs[i].where);
+	    CHECK(sub->relocs[i].buffer == rsub->relocs[i].buffer);
+	    CHECK(sub->relocs[i].pre_add == rsub->relocs[i].pre_add);
+	}
+	for (i = 0; i < sub->sub.numBuffers; ++i) {
+	    CHECK(sub->buffers[i].flags == rsub->buffers[i].flags);
+	    CHECK(sub->buffers[i].mask == rsub->buffers[i].mask);
+	}
+    }
+    CHECK(count == 3);
+    CHECK(traceNext(&rf, &rsub) == 0);
+    traceClose(&tf);
+    traceClose(&rf);
+}
+
+/*
+ * A trace cut off in the middle of a record is reported as damaged.
+ */
+
+static void
+testTruncated(const char *name, const char *cutName)
+{
+    TraceFileRec tf;
+    TraceSubmissionPtr sub;
+    char buf[4096];
+    size_t len;
+    FILE *in, *out;
+    int ret, count = 0;
+
+    in = fopen(name, "r");
+    out = fopen(cutName, "w");
+    CHECK(in && out);
+    if (!in || !out)
+	return;
+    len = fread(buf, 1, sizeof(buf), in);
+    CHECK(len > 8);
+    CHECK(fwrite(buf, 1, len - 8, out) == len - 8);
+    fclose(in);
+    fclose(out);
+
+    CHECK(!traceOpen(&tf, cutName));
+    while ((ret = traceNext(&tf, &sub)) > 0)
+	count++;
+    CHECK(ret < 0);
+    CHECK(count == 2);
+    traceClose(&tf);
+
+    CHECK(traceOpen(&tf, "/dev/null") < 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    char dir[] = "/tmp/trace_testXXXXXX";
+    char name[sizeof(dir) + 16];
+    char replayName[sizeof(dir) + 16];
+    char cutName[sizeof(dir) + 16];
+
+    if (!mkdtemp(dir)) {
+	perror("mkdtemp");
+	return 1;
+    }
+    sprintf(name, "%s/trace", dir);
+    sprintf(replayName, "%s/replay", dir);
+    sprintf(cutName, "%s/cut", dir);
+
+    if (drmBOCreate(0, 64 * TEST_STRIDE, 0, NULL, DRM_BO_FLAG_MEM_TT |
+		    DRM_BO_FLAG_READ | DRM_BO_FLAG_WRITE, 0, &dstBuf) ||
+	drmBOCreate(0, 64 * TEST_STRIDE, 0, NULL, DRM_BO_FLAG_MEM_TT |
+		    DRM_BO_FLAG_READ | DRM_BO_FLAG_WRITE, 0, &srcBuf))
+	return 1;
+
+    testRecord(name);
+    testDecode(name);
+    stubDrmSetExecute(0);
+    testReplay(name, replayName);
+    testTruncated(name, cutName);
+
+    drmBOUnreference(0, &srcBuf);
+    drmBOUnreference(0, &dstBuf);
+    unlink(name);
+    unlink(replayName);
+    unlink(cutName);
+    rmdir(dir);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,279 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Zero-copy uploads: the MIT-SHM dispatch functions must only be wrapped
+ * with ExaShmCache, once the extension exists, which is after the
+ * screens are set up, and must be put back when the screen goes away
+ * unless someone wrapped them after us. Uploads from a segment must
+ * reuse its wrapped buffer until the segment is detached, other memory
+ * uploaded during a ShmPutImage must not be kept, and the blitted
+ * pixels must arrive, by the CPU if waiting for the blit fails.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "psb_driver.h"
+#include "dixstruct.h"
+#include "extnsionst.h"
+#include <X11/extensions/shmstr.h>
+#include "stub.h"
+
+#define TEST_SHM_MAJOR 130
+#define TEST_W 256
+#define TEST_H 256
+
+typedef Bool (*TestUploadProc) (PixmapPtr, int, int, int, int, char *,
+				int);
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+static PixmapPtr testPixmap;
+static CARD32 *testSegment;
+static CARD32 *testSource;
+static TestUploadProc testUpload;
+static int testShmCalls;
+
+/*
+ * Stands in for the MIT-SHM dispatcher: a ShmPutImage uploads the
+ * whole source, normally the segment, into the test pixmap.
+ */
+
+static int
+testShmProc(ClientPtr client)
+{
+    REQUEST(xReq);
+
+    testShmCalls++;
+    if (stuff->data == X_ShmPutImage)
+	CHECK(testUpload(testPixmap, 0, 0, TEST_W, TEST_H,
+			 (char *)testSource, TEST_W * 4));
+
+    return Success;
+}
+
+/*
+ * Another module wrapping MIT-SHM after us.
+ */
+
+static int
+testOtherProc(ClientPtr client)
+{
+    return Success;
+}
+
+static void
+testRequest(ClientPtr client, xShmPutImageReq * req, int minor)
+{
+    memset(req, 0, sizeof(*req));
+    req->reqType = TEST_SHM_MAJOR;
+    req->shmReqType = minor;
+    req->length = sizeof(*req) >> 2;
+    req->shmseg = 0x200001;
+
+    memset(client, 0, sizeof(*client));
+    client->requestBuffer = req;
+    client->req_len = req->length;
+}
+
+static int
+testCheckPixels(PixmapPtr pPix, CARD32 seed)
+{
+    CARD8 *base = stubPixmapMap(pPix, EXA_PREPARE_SRC);
+    int x, y, bad = 0;
+
+    if (!base)
+	return 1;
+
+    for (y = 0; y < TEST_H; ++y)
+	for (x = 0; x < TEST_W; ++x)
+	    if (((CARD32 *) (base + y * pPix->devKind))[x] !=
+		seed + y * TEST_W + x)
+		bad = 1;
+
+    stubPixmapUnmap(pPix, EXA_PREPARE_SRC);
+    return bad;
+}
+
+static void
+testFill(CARD32 *dst, CARD32 seed)
+{
+    int i;
+
+    for (i = 0; i < TEST_W * TEST_H; ++i)
+	dst[i] = seed + i;
+}
+
+int
+main(int argc, char **argv)
+{
+    ExtensionEntry shm;
+    ScrnInfoPtr pScrn;
+    ClientRec client;
+    xShmPutImageReq req;
+    unsigned long numBuffers;
+    CARD32 *heap;
+    int shmid;
+
+    memset(&shm, 0, sizeof(shm));
+    shm.name = SHMNAME;
+    shm.base = TEST_SHM_MAJOR;
+    ProcVector[TEST_SHM_MAJOR] = testShmProc;
+    SwappedProcVector[TEST_SHM_MAJOR] = testShmProc;
+
+    shmid = shmget(IPC_PRIVATE, TEST_W * TEST_H * 4, IPC_CREAT | 0600);
+    if (shmid < 0)
+	return 1;
+    testSegment = shmat(shmid, NULL, 0);
+    shmctl(shmid, IPC_RMID, NULL);
+    if (testSegment == (void *)-1)
+	return 1;
+    if (posix_memalign((void **)&heap, 4096, TEST_W * TEST_H * 4))
+	return 1;
+    testSource = testSegment;
+
+    /*
+     * Without ExaShmCache, MIT-SHM is left alone.
+     */
+
+    stubExtension = &shm;
+    pScrn = stubScreenCreate();
+    CHECK(stubExaInit(pScrn));
+    stubScreenBlock(pScrn);
+    CHECK(ProcVector[TEST_SHM_MAJOR] == testShmProc);
+    stubScreenDestroy(pScrn);
+
+    /*
+     * No MIT-SHM while the screen is set up.
+     */
+
+    stubExtension = NULL;
+    pScrn = stubScreenCreate();
+    psbPTR(pScrn)->exaShmCache = TRUE;
+    CHECK(stubExaInit(pScrn));
+    CHECK(ProcVector[TEST_SHM_MAJOR] == testShmProc);
+
+    testUpload = psbPTR(pScrn)->pPsbExa->pExa->UploadToScreen;
+    testPixmap = stubPixmapCreate(pScrn, TEST_W, TEST_H, 24, 32);
+    CHECK(testPixmap != NULL);
+
+    stubExtension = &shm;
+    stubScreenBlock(pScrn);
+    CHECK(ProcVector[TEST_SHM_MAJOR] != testShmProc);
+    CHECK(SwappedProcVector[TEST_SHM_MAJOR] != testShmProc);
+
+    /*
+     * The first ShmPutImage wraps the segment and keeps it, the second
+     * one reuses it.
+     */
+
+    testFill(testSegment, 1000);
+    testRequest(&client, &req, X_ShmPutImage);
+    numBuffers = stubDrmStats.numBuffers;
+    ProcVector[TEST_SHM_MAJOR] (&client);
+    CHECK(testShmCalls == 1);
+    CHECK(stubDrmStats.numBuffers == numBuffers + 1);
+    CHECK(!testCheckPixels(testPixmap, 1000));
+
+    testFill(testSegment, 5000);
+    ProcVector[TEST_SHM_MAJOR] (&client);
+    CHECK(testShmCalls == 2);
+    CHECK(stubDrmStats.numBuffers == numBuffers + 1);
+    CHECK(!testCheckPixels(testPixmap, 5000));
+
+    /*
+     * Memory outside the segment isn't kept.
+     */
+
+    testSource = heap;
+    testFill(heap, 7000);
+    ProcVector[TEST_SHM_MAJOR] (&client);
+    CHECK(stubDrmStats.numBuffers == numBuffers + 1);
+    CHECK(!testCheckPixels(testPixmap, 7000));
+    testSource = testSegment;
+
+    /*
+     * A detach unpins it at the next block handler.
+     */
+
+    testRequest(&client, &req, X_ShmDetach);
+    ProcVector[TEST_SHM_MAJOR] (&client);
+    CHECK(testShmCalls == 4);
+    stubScreenBlock(pScrn);
+    CHECK(stubDrmStats.numBuffers == numBuffers);
+
+    /*
+     * If waiting for the blit fails, the CPU copies the image and the
+     * segment isn't kept.
+     */
+
+    testFill(testSegment, 9000);
+    testRequest(&client, &req, X_ShmPutImage);
+    stubDrmFailWaits(1);
+    ProcVector[TEST_SHM_MAJOR] (&client);
+    stubDrmFailWaits(0);
+    CHECK(stubDrmStats.numBuffers == numBuffers);
+    CHECK(!testCheckPixels(testPixmap, 9000));
+
+    CHECK(stubDrmStats.unhandled == 0);
+    CHECK(stubDrmStats.boundsErrors == 0);
+    CHECK(stubDrmStats.hazards == 0);
+    CHECK(stubDrmStats.relocErrors == 0);
+
+    /*
+     * What another module wrapped stays wrapped.
+     */
+
+    ProcVector[TEST_SHM_MAJOR] = testOtherProc;
+    stubPixmapDestroy(testPixmap);
+    stubScreenDestroy(pScrn);
+    CHECK(ProcVector[TEST_SHM_MAJOR] == testOtherProc);
+    CHECK(SwappedProcVector[TEST_SHM_MAJOR] == testShmProc);
+
+    shmdt(testSegment);
+    free(heap);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,420 @@
+/**************************************************************************
+ *
+ * Copyright 2006 Thomas Hellstrom.
+ * Copyright (c) Intel Corp. 2007.
+ * All Rights Reserved.
+ *
+ * Intel funded Tungsten Graphics (http://www.tungstengraphics.com) to
+ * develop this driver.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+/*
+ * Textured video: the Xv frame buffer pool gives the memory of stopped
+ * ports back on its own, without further Xv requests, a port that finds
+ * all its buffers busy waits for the one the 3D engine gets done with
+ * first, frames are only taken for repeats when asked to, and clip
+ * regions are drawn box by box.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "psb_driver.h"
+#include "fourcc.h"
+#include "regionstr.h"
+#include "stub.h"
+
+#define TEST_IDLE_MS 5000	/* PSB_VIDEO_IDLE_MS */
+
+static int failures;
+
+#define CHECK(_cond)							\
+    do {								\
+	if (!(_cond)) {							\
+	    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,	\
+		    __LINE__, #_cond);					\
+	    failures++;							\
+	}								\
+    } while (0)
+
+/*
+ * Put a YV12 frame of the given size on a port, unscaled at the origin
+ * of the pixmap, clipped to the given boxes.
+ */
+
+static int
+testPutClipped(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, int port,
+	       PixmapPtr pPix, unsigned char *buf, int w, int h,
+	       const BoxRec * boxes, int numBoxes)
+{
+    RegionRec clip;
+    int ret;
+
+    stubRegionInit(&clip, boxes, numBoxes);
+    ret = adapt->PutImage(pScrn, 0, 0, 0, 0, w, h, w, h, FOURCC_YV12, buf,
+			  w, h, TRUE, &clip,
+			  adapt->pPortPrivates[port].ptr, &pPix->drawable);
+    REGION_UNINIT(pScrn->pScreen, &clip);
+
+    return ret;
+}
+
+static int
+testPutFrame(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, int port,
+	     PixmapPtr pPix, unsigned char *buf, int w, int h)
+{
+    BoxRec box = { 0, 0, w, h };
+
+    return testPutClipped(pScrn, adapt, port, pPix, buf, w, h, &box, 1);
+}
+
+/*
+ * The same with a new frame every time.
+ */
+
+static int
+testPut(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, int port,
+	PixmapPtr pPix, int w, int h)
+{
+    static unsigned char frame;
+    unsigned char *buf = malloc(w * h * 3 / 2);
+    int ret;
+
+    if (!buf)
+	FatalError("Out of memory.\n");
+    memset(buf, ++frame, w * h * 3 / 2);
+    ret = testPutFrame(pScrn, adapt, port, pPix, buf, w, h);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * The luma pixel at (x, y) of the texture the last blit was done from.
+ * Frames of the test sizes are uploaded with the luma pitch equal to
+ * their width.
+ */
+
+static unsigned char
+testShownLuma(int w, int x, int y)
+{
+    StubXpsbBlit *blit = &stubXpsbLog[(stubXpsbBlits - 1) % STUB_XPSB_LOG];
+    unsigned char *luma = stubDrmVirtual(blit->texture);
+
+    return luma ? luma[y * w + x] : 0;
+}
+
+static void
+testStop(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, int port)
+{
+    adapt->StopVideo(pScrn, adapt->pPortPrivates[port].ptr, TRUE);
+}
+
+/*
+ * Buffers of stopped ports are freed once they have been idle for
+ * PSB_VIDEO_IDLE_MS, each on its own schedule, by the pool's timer
+ * alone.
+ */
+
+static void
+testIdleTrim(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, PixmapPtr pPix)
+{
+    unsigned long base = stubDrmStats.numBuffers;
+    int numBufs = psbPTR(pScrn)->xvBuffers;
+
+    CHECK(testPut(pScrn, adapt, 0, pPix, 320, 240) == Success);
+    CHECK(stubDrmStats.numBuffers == base + numBufs);
+    CHECK(stubTimersPending() == 0);
+
+    testStop(pScrn, adapt, 0);
+    CHECK(stubDrmStats.numBuffers == base + numBufs);
+    CHECK(stubTimersPending() == 1);
+
+    stubTimeAdvance(TEST_IDLE_MS / 2);
+
+    CHECK(testPut(pScrn, adapt, 1, pPix, 176, 144) == Success);
+    testStop(pScrn, adapt, 1);
+    CHECK(stubDrmStats.numBuffers == base + 2 * numBufs);
+
+    stubTimeAdvance(TEST_IDLE_MS / 2 - 100);
+    stubTimersRun();
+    CHECK(stubDrmStats.numBuffers == base + 2 * numBufs);
+
+    stubTimeAdvance(200);
+    stubTimersRun();
+    CHECK(stubDrmStats.numBuffers == base + numBufs);
+    CHECK(stubTimersPending() == 1);
+
+    stubTimeAdvance(TEST_IDLE_MS / 2);
+    stubTimersRun();
+    CHECK(stubDrmStats.numBuffers == base);
+    CHECK(stubTimersPending() == 0);
+
+    /*
+     * Playing again sets the timer up again.
+     */
+
+    CHECK(testPut(pScrn, adapt, 0, pPix, 320, 240) == Success);
+    testStop(pScrn, adapt, 0);
+    CHECK(stubTimersPending() == 1);
+    stubTimeAdvance(TEST_IDLE_MS + 100);
+    stubTimersRun();
+    CHECK(stubDrmStats.numBuffers == base);
+    CHECK(stubTimersPending() == 0);
+}
+
+/*
+ * Port 0 puts four frames into its three buffers: the fourth has to wait
+ * and goes into the buffer the first frame used, so the buffers were
+ * last displayed in the order of the second, third and fourth frame.
+ * Port 1 then gets the same buffers from the pool while they are all
+ * still busy, in an order of its own, and must wait for the one of the
+ * second frame.
+ */
+
+static void
+testOldestBusy(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, PixmapPtr pPix)
+{
+    unsigned long first = stubXpsbBlits;
+    unsigned texture;
+    uint64_t start;
+    int i;
+
+    stubXpsbSetEngine(50000);
+
+    for (i = 0; i < 4; ++i)
+	CHECK(testPut(pScrn, adapt, 0, pPix, 320, 240) == Success);
+    CHECK(stubXpsbBlits == first + 4);
+    texture = stubXpsbLog[(first + 1) % STUB_XPSB_LOG].texture;
+    CHECK(stubXpsbLog[(first + 3) % STUB_XPSB_LOG].texture ==
+	  stubXpsbLog[first % STUB_XPSB_LOG].texture);
+
+    testStop(pScrn, adapt, 0);
+
+    start = stubUsec();
+    CHECK(testPut(pScrn, adapt, 1, pPix, 320, 240) == Success);
+    CHECK(stubXpsbBlits == first + 5);
+    CHECK(stubXpsbLog[(first + 4) % STUB_XPSB_LOG].texture == texture);
+    CHECK(stubUsec() - start < 100000);
+
+    testStop(pScrn, adapt, 1);
+    stubXpsbSetEngine(0);
+    stubTimeAdvance(TEST_IDLE_MS);
+    stubTimersRun();
+}
+
+/*
+ * Every frame is uploaded unless XvSkipRepeats is on, including one that
+ * differs from the last one only where the repeat hash doesn't look.
+ * With the option on, a frame put again is displayed from the buffer
+ * that already holds it.
+ */
+
+static void
+testRepeats(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, PixmapPtr pPix)
+{
+    PsbPtr pPsb = psbPTR(pScrn);
+    int w = 320, h = 240;
+    unsigned char *buf = calloc(1, w * h * 3 / 2);
+    unsigned long first = stubXpsbBlits;
+    unsigned texture;
+
+    if (!buf)
+	FatalError("Out of memory.\n");
+
+    CHECK(!pPsb->xvSkipRepeats);
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    texture = stubXpsbLog[first % STUB_XPSB_LOG].texture;
+    CHECK(testShownLuma(w, 5, 0) == 0);
+
+    buf[5] = 0xEB;		/* between the hash samples */
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbLog[(first + 1) % STUB_XPSB_LOG].texture != texture);
+    CHECK(testShownLuma(w, 5, 0) == 0xEB);
+
+    texture = stubXpsbLog[(first + 1) % STUB_XPSB_LOG].texture;
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbLog[(first + 2) % STUB_XPSB_LOG].texture != texture);
+    CHECK(testShownLuma(w, 5, 0) == 0xEB);
+
+    pPsb->xvSkipRepeats = TRUE;
+    texture = stubXpsbLog[(first + 2) % STUB_XPSB_LOG].texture;
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbLog[(first + 3) % STUB_XPSB_LOG].texture != texture);
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbBlits == first + 5);
+    CHECK(stubXpsbLog[(first + 4) % STUB_XPSB_LOG].texture ==
+	  stubXpsbLog[(first + 3) % STUB_XPSB_LOG].texture);
+    CHECK(testShownLuma(w, 5, 0) == 0xEB);
+
+    buf[w * h] = 0x40;		/* sampled */
+    CHECK(testPutFrame(pScrn, adapt, 2, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbLog[(first + 5) % STUB_XPSB_LOG].texture !=
+	  stubXpsbLog[(first + 4) % STUB_XPSB_LOG].texture);
+    pPsb->xvSkipRepeats = FALSE;
+
+    testStop(pScrn, adapt, 2);
+    free(buf);
+}
+
+/*
+ * Video in a window that another window partly covers is converted box
+ * by box, straight to the destination. Single boxes go through the
+ * de-tearing blit when Vsync is on; clip regions of several boxes don't.
+ */
+
+static void
+testClipBoxes(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, PixmapPtr pPix)
+{
+    static const BoxRec boxes[] = {
+	{0, 0, 320, 80},
+	{0, 80, 100, 160}, {200, 80, 320, 160},
+	{0, 160, 320, 240}
+    };
+    int numBoxes = sizeof(boxes) / sizeof(boxes[0]);
+    PsbPtr pPsb = psbPTR(pScrn);
+    int w = 320, h = 240;
+    unsigned char *buf = calloc(1, w * h * 3 / 2);
+    unsigned long first, damage;
+    StubXpsbBlit *blit;
+    int i;
+
+    if (!buf)
+	FatalError("Out of memory.\n");
+
+    pPsb->vsync = TRUE;
+    stubXpsbComposites = 0;
+    stubXpsbUnlocked = 0;
+
+    first = stubXpsbBlits;
+    damage = stubDamageCount;
+    CHECK(testPutClipped(pScrn, adapt, 3, pPix, buf, w, h, boxes,
+			 numBoxes) == Success);
+    CHECK(stubXpsbBlits == first + numBoxes);
+    CHECK(stubDamageCount == damage + 1);
+    for (i = 0; i < numBoxes && stubXpsbBlits == first + numBoxes; ++i) {
+	blit = &stubXpsbLog[(first + i) % STUB_XPSB_LOG];
+	CHECK(blit->x == boxes[i].x1 && blit->y == boxes[i].y1);
+	CHECK(blit->w == boxes[i].x2 - boxes[i].x1);
+	CHECK(blit->h == boxes[i].y2 - boxes[i].y1);
+	CHECK(!blit->detear);
+    }
+
+    first = stubXpsbBlits;
+    CHECK(testPutFrame(pScrn, adapt, 3, pPix, buf, w, h) == Success);
+    CHECK(stubXpsbBlits == first + 1);
+    CHECK(stubXpsbLog[first % STUB_XPSB_LOG].detear);
+
+    CHECK(stubXpsbComposites == 0);
+    CHECK(stubXpsbUnlocked == 0);
+    CHECK(stubDRILocked == 0);
+
+    pPsb->vsync = FALSE;
+    testStop(pScrn, adapt, 3);
+    free(buf);
+}
+
+/*
+ * Planar frames are uploaded as NV12. The chroma plane the blit is
+ * programmed with must be where the copy put it, at the copy's pitch,
+ * and fit in the buffer, also for odd widths whose luma pitch is more
+ * than twice the pitch of a separate U or V plane.
+ */
+
+static void
+testNV12Layout(ScrnInfoPtr pScrn, XF86VideoAdaptorPtr adapt, PixmapPtr pPix)
+{
+    const int w = 129, h = 256, cw = w >> 1, ch = h >> 1;
+    unsigned char *buf = malloc(w * h + 2 * cw * ch);
+    StubXpsbBlit *blit;
+    unsigned char *uv;
+    int x, y, bad = 0;
+
+    if (!buf)
+	FatalError("Out of memory.\n");
+    memset(buf, 0x10, w * h);
+    memset(buf + w * h, 0x40, cw * ch);
+    memset(buf + w * h + cw * ch, 0xC0, cw * ch);
+
+    CHECK(testPutFrame(pScrn, adapt, 0, pPix, buf, w, h) == Success);
+    free(buf);
+    testStop(pScrn, adapt, 0);
+
+    blit = &stubXpsbLog[(stubXpsbBlits - 1) % STUB_XPSB_LOG];
+    CHECK(blit->numTextures == 2);
+    CHECK(blit->stride[0] >= w);
+    CHECK(blit->stride[1] == blit->stride[0]);
+    CHECK(blit->offset[1] == blit->offset[0] + blit->stride[0] * h);
+    CHECK(blit->offset[1] + blit->stride[1] * ((h + 1) >> 1) <=
+	  stubDrmSize(blit->texture));
+
+    uv = (unsigned char *)stubDrmVirtual(blit->texture) + blit->offset[1];
+    for (y = 0; y < ch; ++y)
+	for (x = 0; x < cw; ++x)
+	    if (uv[y * blit->stride[1] + 2 * x] != 0x40 ||
+		uv[y * blit->stride[1] + 2 * x + 1] != 0xC0)
+		bad = 1;
+    CHECK(!bad);
+}
+
+int
+main(int argc, char **argv)
+{
+    XF86VideoAdaptorPtr adapt;
+    ScrnInfoPtr pScrn;
+    PixmapPtr pPix;
+    PsbPtr pPsb;
+
+    pScrn = stubScreenCreate();
+    pPsb = psbPTR(pScrn);
+    pPsb->xvBuffers = 3;
+    pPsb->xvMemMax = 16384 * 1024;
+    if (!stubExaInit(pScrn)) {
+	fprintf(stderr, "Failed to set up EXA.\n");
+	return 1;
+    }
+
+    adapt = psbInitVideo(pScrn->pScreen);
+    if (!adapt) {
+	fprintf(stderr, "Failed to set up textured video.\n");
+	return 1;
+    }
+    pPix = stubPixmapCreate(pScrn, 640, 480, 24, 32);
+
+    testIdleTrim(pScrn, adapt, pPix);
+    testOldestBusy(pScrn, adapt, pPix);
+    testRepeats(pScrn, adapt, pPix);
+    testClipBoxes(pScrn, adapt, pPix);
+    testNV12Layout(pScrn, adapt, pPix);
+
+    stubPixmapDestroy(pPix);
+    psbFreeAdaptor(pScrn, adapt);
+    CHECK(stubTimersPending() == 0);
+    stubScreenDestroy(pScrn);
+
+    return failures ? 1 : 0;
+}